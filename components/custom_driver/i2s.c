@@ -29,6 +29,7 @@
 #include "soc/lldesc.h"
 
 #include "soc/rtc.h"
+#include "soc/soc_memory_layout.h"
 
 #include "esp_attr.h"
 #include "soc/chip_revision.h"
@@ -38,6 +39,7 @@
 #include "esp_log.h"
 #include "esp_pm.h"
 #include "esp_rom_gpio.h"
+#include "esp_timer.h"
 
 #include "sdkconfig.h"
 
@@ -63,6 +65,16 @@ static const char *I2S_TAG = "c_I2S";
 #define I2S_PDM_BCK_FACTOR (64)
 #define I2S_BASE_CLK (2 * APB_CLK_FREQ)
 
+/**
+ * @brief Buffer of i2s_custom_write_zero_copy() a descriptor points to
+ *
+ */
+typedef struct {
+  const void *src;                 /*!< NULL if the descriptor has its own*/
+  i2s_custom_release_cb_t release; /*!< set on the last piece of src only*/
+  void *arg;
+} i2s_lent_t;
+
 /**
  * @brief DMA buffer object
  *
@@ -75,6 +87,9 @@ typedef struct {
   SemaphoreHandle_t mux;
   xQueueHandle queue;
   lldesc_t **desc;
+  lldesc_t *eof_desc; /*!< last descriptor sent, NULL until the first EOF*/
+  int64_t eof_time;   /*!< esp_timer time of that EOF*/
+  i2s_lent_t *lent;   /*!< per descriptor*/
 } i2s_dma_t;
 
 /**
@@ -323,6 +338,7 @@ esp_err_t i2s_custom_init_dma_tx_queues(i2s_port_t i2s_num, uint8_t *data,
 
   p_i2s_obj[i2s_num]->tx->curr_ptr = NULL;
   p_i2s_obj[i2s_num]->tx->rw_pos = 0;
+  p_i2s_obj[i2s_num]->tx->eof_desc = NULL;
 
   // fill DMA buffers
   if ((data != NULL) && (written != NULL) && (size != 0)) {
@@ -578,6 +594,42 @@ esp_err_t i2s_custom_set_clk(i2s_port_t i2s_num, uint32_t rate,
   return i2s_custom_init_dma_tx_queues(i2s_num, NULL, 0, NULL, NULL, NULL);
 }
 
+static int IRAM_ATTR i2s_dma_desc_index(i2s_obj_t *p_i2s,
+                                         const lldesc_t *desc) {
+  int i;
+
+  for (i = 0; i < p_i2s->dma_buf_count; i++) {
+    if (p_i2s->tx->desc[i] == desc) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * Give descriptor idx its own buffer back.
+ *
+ * @return callback to call for the buffer it pointed to, NULL if none
+ */
+static i2s_custom_release_cb_t IRAM_ATTR i2s_dma_return_lent(i2s_obj_t *p_i2s,
+                                                             int idx,
+                                                             void **arg) {
+  i2s_dma_t *tx = p_i2s->tx;
+  i2s_custom_release_cb_t release = tx->lent[idx].release;
+
+  tx->desc[idx]->buf = (uint8_t *)tx->buf[idx];
+  tx->desc[idx]->length = tx->buf_size;
+  tx->desc[idx]->size = tx->buf_size;
+
+  *arg = tx->lent[idx].arg;
+  tx->lent[idx].src = NULL;
+  tx->lent[idx].release = NULL;
+  tx->lent[idx].arg = NULL;
+
+  return release;
+}
+
 static void IRAM_ATTR i2s_intr_handler_default(void *arg) {
   i2s_obj_t *p_i2s = (i2s_obj_t *)arg;
   uint32_t status;
@@ -609,6 +661,23 @@ static void IRAM_ATTR i2s_intr_handler_default(void *arg) {
 
   if ((status & I2S_INTR_OUT_EOF) && p_i2s->tx) {
     i2s_hal_get_out_eof_des_addr(&(p_i2s->hal), (uint32_t *)&finish_desc);
+    // the next descriptor starts playing now, see i2s_custom_get_play_time()
+    portENTER_CRITICAL_ISR(&i2s_spinlock[p_i2s->i2s_num]);
+    p_i2s->tx->eof_time = esp_timer_get_time();
+    p_i2s->tx->eof_desc = finish_desc;
+    portEXIT_CRITICAL_ISR(&i2s_spinlock[p_i2s->i2s_num]);
+    // a buffer of i2s_custom_write_zero_copy() was sent, the descriptor gets
+    // its own back before it goes to the queue
+    int idx = i2s_dma_desc_index(p_i2s, finish_desc);
+    if ((idx >= 0) && (p_i2s->tx->lent[idx].src != NULL)) {
+      void *release_arg;
+      i2s_custom_release_cb_t release =
+          i2s_dma_return_lent(p_i2s, idx, &release_arg);
+
+      if (release != NULL) {
+        release(release_arg);
+      }
+    }
     // All buffers are empty. This means we have an underflow on our hands.
     if (xQueueIsQueueFullFromISR(p_i2s->tx->queue)) {
       xQueueReceiveFromISR(p_i2s->tx->queue, &dummy,
@@ -683,6 +752,9 @@ static esp_err_t i2s_destroy_dma_queue(i2s_port_t i2s_num, i2s_dma_t *dma) {
   if (dma->desc) {
     free(dma->desc);
   }
+  if (dma->lent) {
+    free(dma->lent);
+  }
   vQueueDelete(dma->queue);
   vSemaphoreDelete(dma->mux);
   free(dma);
@@ -736,6 +808,13 @@ static i2s_dma_t *i2s_create_dma_queue(i2s_port_t i2s_num, int dma_buf_count,
     }
   }
 
+  dma->lent = (i2s_lent_t *)calloc(dma_buf_count, sizeof(i2s_lent_t));
+  if (dma->lent == NULL) {
+    ESP_LOGE(I2S_TAG, "Error malloc dma lent buffers");
+    i2s_destroy_dma_queue(i2s_num, dma);
+    return NULL;
+  }
+
   for (bux_idx = 0; bux_idx < dma_buf_count; bux_idx++) {
     dma->desc[bux_idx]->owner = 1;
     dma->desc[bux_idx]->eof = 1;
@@ -762,6 +841,9 @@ esp_err_t i2s_custom_start(i2s_port_t i2s_num) {
   // start DMA link
   I2S_ENTER_CRITICAL();
   i2s_hal_reset(&(p_i2s_obj[i2s_num]->hal));
+  if (p_i2s_obj[i2s_num]->tx) {
+    p_i2s_obj[i2s_num]->tx->eof_desc = NULL;
+  }
 
   esp_intr_disable(p_i2s_obj[i2s_num]->i2s_isr_handle);
   i2s_hal_clear_intr_status(&(p_i2s_obj[i2s_num]->hal), I2S_INTR_MAX);
@@ -794,6 +876,21 @@ esp_err_t i2s_custom_stop(i2s_port_t i2s_num) {
   i2s_hal_get_intr_status(&(p_i2s_obj[i2s_num]->hal), &mask);
   i2s_hal_clear_intr_status(&(p_i2s_obj[i2s_num]->hal), mask);
   I2S_EXIT_CRITICAL();
+
+  // the DMA and its interrupt are off, nothing reads lent buffers any more
+  if (p_i2s_obj[i2s_num]->tx && p_i2s_obj[i2s_num]->tx->lent) {
+    for (int i = 0; i < p_i2s_obj[i2s_num]->dma_buf_count; i++) {
+      if (p_i2s_obj[i2s_num]->tx->lent[i].src != NULL) {
+        void *release_arg;
+        i2s_custom_release_cb_t release =
+            i2s_dma_return_lent(p_i2s_obj[i2s_num], i, &release_arg);
+
+        if (release != NULL) {
+          release(release_arg);
+        }
+      }
+    }
+  }
   return ESP_OK;
 }
 
@@ -1107,6 +1204,93 @@ esp_err_t i2s_custom_driver_uninstall(i2s_port_t i2s_num) {
   return ESP_OK;
 }
 
+static int i2s_dma_buf_index(i2s_port_t i2s_num, const void *buf) {
+  int i;
+
+  for (i = 0; i < p_i2s_obj[i2s_num]->dma_buf_count; i++) {
+    if (p_i2s_obj[i2s_num]->tx->buf[i] == buf) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+esp_err_t i2s_custom_get_play_time(i2s_port_t i2s_num, size_t offset,
+                                   int64_t *play_time) {
+  i2s_dma_t *tx;
+  lldesc_t *eof_desc;
+  int64_t eof_time;
+  double rate;
+  int count, playing, target, ahead, i;
+  size_t pos, bytes;
+
+  I2S_CHECK((i2s_num < I2S_NUM_MAX), "i2s_num error", ESP_ERR_INVALID_ARG);
+  I2S_CHECK((p_i2s_obj[i2s_num]->tx), "tx NULL", ESP_ERR_INVALID_ARG);
+  I2S_CHECK((play_time != NULL), "play_time NULL", ESP_ERR_INVALID_ARG);
+
+  tx = p_i2s_obj[i2s_num]->tx;
+  count = p_i2s_obj[i2s_num]->dma_buf_count;
+
+  I2S_ENTER_CRITICAL();
+  eof_desc = tx->eof_desc;
+  eof_time = tx->eof_time;
+  I2S_EXIT_CRITICAL();
+
+  if (eof_desc == NULL) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  // descriptor started at the last EOF
+  playing = i2s_dma_desc_index(p_i2s_obj[i2s_num], eof_desc);
+  if (playing < 0) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  playing = (playing + 1) % count;
+
+  // descriptor the next write goes to, the oldest free one if the current is
+  // full. With none free it is the one playing, once it is sent.
+  if ((tx->curr_ptr != NULL) && (tx->rw_pos < tx->buf_size)) {
+    target = i2s_dma_buf_index(i2s_num, tx->curr_ptr);
+    pos = tx->rw_pos;
+  } else {
+    char *next;
+
+    if (xQueuePeek(tx->queue, &next, 0) == pdTRUE) {
+      target = i2s_dma_buf_index(i2s_num, next);
+    } else {
+      target = playing;
+    }
+    pos = 0;
+  }
+  if (target < 0) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  ahead = (target - playing + count) % count;
+  if (ahead == 0) {
+    ahead = count;
+  }
+  // lent descriptors may be shorter than a DMA buffer
+  bytes = pos + offset;
+  I2S_ENTER_CRITICAL();
+  for (i = 0; i < ahead; i++) {
+    bytes += tx->desc[(playing + i) % count]->length;
+  }
+  I2S_EXIT_CRITICAL();
+
+  rate = p_i2s_obj[i2s_num]->real_rate;
+  if (rate <= 0) {
+    rate = p_i2s_obj[i2s_num]->sample_rate;
+  }
+
+  *play_time = eof_time + (int64_t)((double)bytes * 1e6 /
+                                    (rate * p_i2s_obj[i2s_num]->channel_num *
+                                     p_i2s_obj[i2s_num]->bytes_per_sample));
+
+  return ESP_OK;
+}
+
 esp_err_t i2s_custom_write(i2s_port_t i2s_num, const void *src, size_t size,
                            size_t *bytes_written, TickType_t ticks_to_wait) {
   char *data_ptr, *src_byte;
@@ -1160,6 +1344,142 @@ esp_err_t i2s_custom_write(i2s_port_t i2s_num, const void *src, size_t size,
   return ESP_OK;
 }
 
+esp_err_t i2s_custom_write_cb(i2s_port_t i2s_num, i2s_custom_fill_cb_t fill,
+                              void *arg, size_t size, size_t *bytes_written,
+                              TickType_t ticks_to_wait) {
+  char *data_ptr;
+  size_t bytes_can_write, filled;
+  *bytes_written = 0;
+  I2S_CHECK((i2s_num < I2S_NUM_MAX), "i2s_num error", ESP_ERR_INVALID_ARG);
+  I2S_CHECK((fill != NULL), "fill NULL", ESP_ERR_INVALID_ARG);
+  I2S_CHECK((size < SOC_I2S_MAX_BUFFER_SIZE), "size is too large",
+            ESP_ERR_INVALID_ARG);
+  I2S_CHECK((p_i2s_obj[i2s_num]->tx), "tx NULL", ESP_ERR_INVALID_ARG);
+  xSemaphoreTake(p_i2s_obj[i2s_num]->tx->mux, (portTickType)portMAX_DELAY);
+#ifdef CONFIG_PM_ENABLE
+  esp_pm_lock_acquire(p_i2s_obj[i2s_num]->pm_lock);
+#endif
+  while (size > 0) {
+    if (p_i2s_obj[i2s_num]->tx->rw_pos == p_i2s_obj[i2s_num]->tx->buf_size ||
+        p_i2s_obj[i2s_num]->tx->curr_ptr == NULL) {
+      if (xQueueReceive(p_i2s_obj[i2s_num]->tx->queue,
+                        &p_i2s_obj[i2s_num]->tx->curr_ptr,
+                        ticks_to_wait) == pdFALSE) {
+        break;
+      }
+      p_i2s_obj[i2s_num]->tx->rw_pos = 0;
+    }
+    data_ptr = (char *)p_i2s_obj[i2s_num]->tx->curr_ptr;
+    data_ptr += p_i2s_obj[i2s_num]->tx->rw_pos;
+    bytes_can_write =
+        p_i2s_obj[i2s_num]->tx->buf_size - p_i2s_obj[i2s_num]->tx->rw_pos;
+    if (bytes_can_write > size) {
+      bytes_can_write = size;
+    }
+    filled = fill(data_ptr, bytes_can_write, arg);
+    if ((filled == 0) || (filled > bytes_can_write)) {
+      break;
+    }
+    size -= filled;
+    p_i2s_obj[i2s_num]->tx->rw_pos += filled;
+    (*bytes_written) += filled;
+  }
+#ifdef CONFIG_PM_ENABLE
+  esp_pm_lock_release(p_i2s_obj[i2s_num]->pm_lock);
+#endif
+
+  xSemaphoreGive(p_i2s_obj[i2s_num]->tx->mux);
+  return ESP_OK;
+}
+
+esp_err_t i2s_custom_write_zero_copy(i2s_port_t i2s_num, const void *src,
+                                     size_t size,
+                                     i2s_custom_release_cb_t release,
+                                     void *arg, size_t *bytes_written,
+                                     TickType_t ticks_to_wait) {
+  i2s_dma_t *tx;
+  const char *src_byte = (const char *)src;
+  size_t bytes_can_write;
+  int idx, last = -1;
+  bool release_now = false;
+  *bytes_written = 0;
+  I2S_CHECK((i2s_num < I2S_NUM_MAX), "i2s_num error", ESP_ERR_INVALID_ARG);
+  I2S_CHECK((release != NULL), "release NULL", ESP_ERR_INVALID_ARG);
+  I2S_CHECK((p_i2s_obj[i2s_num]->tx), "tx NULL", ESP_ERR_INVALID_ARG);
+  // no log, callers fall back to i2s_custom_write()
+  if ((src == NULL) || !esp_ptr_dma_capable(src) || ((uint32_t)src & 3) ||
+      (size & 3)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  tx = p_i2s_obj[i2s_num]->tx;
+  xSemaphoreTake(tx->mux, (portTickType)portMAX_DELAY);
+#ifdef CONFIG_PM_ENABLE
+  esp_pm_lock_acquire(p_i2s_obj[i2s_num]->pm_lock);
+#endif
+  // the DMA sends a buffer written to before as a whole, fill it up
+  if ((tx->curr_ptr != NULL) && (tx->rw_pos > 0) &&
+      (tx->rw_pos < tx->buf_size)) {
+    bytes_can_write = tx->buf_size - tx->rw_pos;
+    if (bytes_can_write > size) {
+      bytes_can_write = size;
+    }
+    memcpy((char *)tx->curr_ptr + tx->rw_pos, src_byte, bytes_can_write);
+    size -= bytes_can_write;
+    src_byte += bytes_can_write;
+    tx->rw_pos += bytes_can_write;
+    (*bytes_written) += bytes_can_write;
+  }
+  while (size > 0) {
+    if (xQueueReceive(tx->queue, &tx->curr_ptr, ticks_to_wait) == pdFALSE) {
+      break;
+    }
+    idx = i2s_dma_buf_index(i2s_num, tx->curr_ptr);
+    if (idx < 0) {
+      break;
+    }
+    bytes_can_write = tx->buf_size;
+    if (bytes_can_write > size) {
+      bytes_can_write = size;
+    }
+    // the descriptor was sent and is not reached again before all others
+    I2S_ENTER_CRITICAL();
+    tx->lent[idx].src = src_byte;
+    tx->lent[idx].release = (bytes_can_write == size) ? release : NULL;
+    tx->lent[idx].arg = arg;
+    tx->desc[idx]->buf = (uint8_t *)src_byte;
+    tx->desc[idx]->length = bytes_can_write;
+    tx->desc[idx]->size = bytes_can_write;
+    I2S_EXIT_CRITICAL();
+    // taken as full, the next write gets a new buffer
+    tx->rw_pos = tx->buf_size;
+    last = idx;
+    size -= bytes_can_write;
+    src_byte += bytes_can_write;
+    (*bytes_written) += bytes_can_write;
+  }
+  if ((size > 0) || (last < 0)) {
+    // timeout or all copied, release with the last piece queued unless it
+    // was sent already
+    I2S_ENTER_CRITICAL();
+    if ((last >= 0) && (tx->lent[last].src != NULL)) {
+      tx->lent[last].release = release;
+    } else {
+      release_now = true;
+    }
+    I2S_EXIT_CRITICAL();
+  }
+#ifdef CONFIG_PM_ENABLE
+  esp_pm_lock_release(p_i2s_obj[i2s_num]->pm_lock);
+#endif
+
+  xSemaphoreGive(tx->mux);
+
+  if (release_now) {
+    release(arg);
+  }
+  return ESP_OK;
+}
+
 esp_err_t i2s_custom_write_expand(i2s_port_t i2s_num, const void *src,
                                   size_t size, size_t src_bits, size_t aim_bits,
                                   size_t *bytes_written,
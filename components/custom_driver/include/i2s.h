@@ -164,6 +164,104 @@ esp_err_t i2s_custom_driver_uninstall(i2s_port_t i2s_num);
 esp_err_t i2s_custom_write(i2s_port_t i2s_num, const void *src, size_t size,
                            size_t *bytes_written, TickType_t ticks_to_wait);
 
+/**
+ * @brief Fills up to size bytes of DMA buffer at dst, see
+ * i2s_custom_write_cb().
+ *
+ * @return number of bytes filled, 0 to stop
+ */
+typedef size_t (*i2s_custom_fill_cb_t)(void *dst, size_t size, void *arg);
+
+/**
+ * @brief Write data to I2S DMA transmit buffer produced by a callback, which
+ * writes straight into the DMA buffers instead of a copy being made from a
+ * source buffer.
+ *
+ * @param i2s_num             I2S_NUM_0, I2S_NUM_1
+ *
+ * @param fill                Called with the free part of the current DMA
+ * buffer, at most the bytes still to write. Filling less continues with the
+ * rest of that buffer.
+ *
+ * @param arg                 Passed to fill
+ *
+ * @param size                Size of data in bytes
+ *
+ * @param[out] bytes_written  Number of bytes written, if timeout or fill
+ * returned 0, the result will be less than the size passed in.
+ *
+ * @param ticks_to_wait       TX buffer wait timeout in RTOS ticks, see
+ * i2s_custom_write()
+ *
+ * @return
+ *     - ESP_OK               Success
+ *     - ESP_ERR_INVALID_ARG  Parameter error
+ */
+esp_err_t i2s_custom_write_cb(i2s_port_t i2s_num, i2s_custom_fill_cb_t fill,
+                              void *arg, size_t size, size_t *bytes_written,
+                              TickType_t ticks_to_wait);
+
+/**
+ * @brief Hands a buffer passed to i2s_custom_write_zero_copy() back once the
+ * DMA is done with it. Called from the I2S interrupt, or from
+ * i2s_custom_stop() for buffers that were not sent.
+ */
+typedef void (*i2s_custom_release_cb_t)(void *arg);
+
+/**
+ * @brief Queue a buffer to be sent by the DMA in place instead of copying it
+ * to the DMA buffers. Free DMA descriptors are pointed to pieces of src of
+ * up to one DMA buffer, their own buffers are put back once sent.
+ *
+ * @param i2s_num             I2S_NUM_0, I2S_NUM_1
+ *
+ * @param src                 DMA capable, 32 bit aligned, must stay valid
+ * until release is called
+ *
+ * @param size                Size of data in bytes, multiple of 4
+ *
+ * @param release             Called with arg once the last byte queued is
+ * sent, or right away if none was. Not called if an error is returned.
+ *
+ * @param[out] bytes_written  Number of bytes queued, if timeout, the result
+ * will be less than the size passed in. A part of the current DMA buffer
+ * that was written to already is filled up by copying.
+ *
+ * @param ticks_to_wait       TX buffer wait timeout in RTOS ticks, see
+ * i2s_custom_write()
+ *
+ * @return
+ *     - ESP_OK               Success, release will be called
+ *     - ESP_ERR_INVALID_ARG  Parameter error or src not usable by the DMA,
+ * write it with i2s_custom_write() instead
+ */
+esp_err_t i2s_custom_write_zero_copy(i2s_port_t i2s_num, const void *src,
+                                     size_t size,
+                                     i2s_custom_release_cb_t release,
+                                     void *arg, size_t *bytes_written,
+                                     TickType_t ticks_to_wait);
+
+/**
+ * @brief Get when a byte written next goes out, from the time of the last
+ * DMA EOF interrupt, the descriptor playing since and the bytes queued in
+ * front of the write position. The I2S FIFO and the DAC add a constant
+ * delay on top.
+ *
+ * @param i2s_num             I2S_NUM_0, I2S_NUM_1
+ *
+ * @param offset              Bytes past the current write position
+ *
+ * @param[out] play_time      esp_timer_get_time() at which that byte starts
+ * playing
+ *
+ * @return
+ *     - ESP_OK                 Success
+ *     - ESP_ERR_INVALID_ARG    Parameter error
+ *     - ESP_ERR_INVALID_STATE  No DMA EOF since the last start
+ */
+esp_err_t i2s_custom_get_play_time(i2s_port_t i2s_num, size_t offset,
+                                   int64_t *play_time);
+
 /**
  * @brief Write data to I2S DMA transmit buffer while expanding the number of
  * bits per sample. For example, expanding 16-bit PCM to 32-bit PCM.
@@ -295,6 +393,8 @@ esp_err_t i2s_custom_set_sample_rates(i2s_port_t i2s_num, uint32_t rate);
  * There is no need to call i2s_stop() before calling i2s_driver_uninstall().
  *
  * Disables I2S TX/RX, until i2s_start() is called.
+ * Buffers queued by i2s_custom_write_zero_copy() are released, their
+ * descriptors get their own buffers back.
  *
  * @param i2s_num  I2S_NUM_0, I2S_NUM_1
  *
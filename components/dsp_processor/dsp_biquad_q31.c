@@ -0,0 +1,226 @@
+/* Fixed point stereo biquads and volume
+
+   Samples are Q31, a 16 bit sample shifted up by 16, so the filters keep
+   15 bits below the output LSB. Coefficients are Q3.28 since shelves and
+   peaks with gain exceed 2. Products are summed in 64 bit. The bits a
+   biquad's output drops are added to its next accumulator (fraction
+   saving), which keeps the noise of low cut offs at the output LSB. The
+   final requantization to 16 bit is rounded with TPDF dither, so low level
+   signals don't turn into harmonics of the truncation.
+*/
+
+#include "dsp_biquad_q31.h"
+
+#include <math.h>
+#include <string.h>
+
+#define FRACTION_MASK ((1 << DSP_Q31_COEF_SHIFT) - 1)
+
+/**
+ *
+ */
+static inline int32_t dsp_q31_sat(int64_t v) {
+  if (v > INT32_MAX) {
+    return INT32_MAX;
+  }
+  if (v < INT32_MIN) {
+    return INT32_MIN;
+  }
+
+  return (int32_t)v;
+}
+
+/**
+ * One direct form I step, s is x1 x2 y1 y2 fraction.
+ */
+static inline int32_t dsp_biquad_q31_step(int32_t x, const int32_t *c,
+                                          int32_t *s) {
+  int64_t acc = (int64_t)s[4] + (int64_t)c[0] * x + (int64_t)c[1] * s[0] +
+                (int64_t)c[2] * s[1] - (int64_t)c[3] * s[2] -
+                (int64_t)c[4] * s[3];
+  int32_t y = dsp_q31_sat(acc >> DSP_Q31_COEF_SHIFT);
+
+  s[4] = (int32_t)(acc & FRACTION_MASK);
+  s[1] = s[0];
+  s[0] = x;
+  s[3] = s[2];
+  s[2] = y;
+
+  return y;
+}
+
+/**
+ * xorshift32, plenty for dither.
+ */
+static inline uint32_t dsp_q31_random(uint32_t *seed) {
+  uint32_t x = *seed;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *seed = x;
+
+  return x;
+}
+
+/**
+ * Q31 to 16 bit with TPDF dither, the sum of two uniform values of one LSB
+ * each taken from the two halves of one random number.
+ */
+static inline uint16_t dsp_q31_dither(int32_t v, uint32_t *seed) {
+  uint32_t r = dsp_q31_random(seed);
+  int32_t d = (int32_t)((r & 0xFFFF) + (r >> 16)) - 0xFFFF;
+  int64_t t = ((int64_t)v + d + 0x8000) >> 16;
+
+  if (t > INT16_MAX) {
+    return (uint16_t)INT16_MAX;
+  }
+  if (t < INT16_MIN) {
+    return (uint16_t)INT16_MIN;
+  }
+
+  return (uint16_t)(int16_t)t;
+}
+
+/**
+ *
+ */
+int32_t dsp_biquad_q31_coeffs(int32_t *q, const float *coeffs) {
+  const float one = (float)(1 << DSP_Q31_COEF_SHIFT);
+  float sum = 0;
+  uint32_t n;
+
+  // |x|, |y| <= 2^31, so the accumulator stays below 2^63 if the
+  // coefficients add up to less than 16
+  for (n = 0; n < 5; n++) {
+    sum += fabsf(coeffs[n]);
+  }
+  if (!(sum < 15.9f)) {
+    return -1;
+  }
+
+  for (n = 0; n < 5; n++) {
+    q[n] = (int32_t)lrintf(coeffs[n] * one);
+  }
+
+  return 0;
+}
+
+/**
+ *
+ */
+int32_t dsp_q31_gain(float gain) {
+  float q = gain * (float)(1 << DSP_Q31_COEF_SHIFT);
+
+  if (!(q < 2147483520.0f)) {
+    return INT32_MAX;
+  }
+  if (q < -2147483520.0f) {
+    return INT32_MIN + 1;
+  }
+
+  return (int32_t)lrintf(q);
+}
+
+/**
+ *
+ */
+void dsp_q31_from_s16(const volatile uint32_t *in, int32_t *out, int frames,
+                      int32_t gain) {
+  // Q15 sample times Q3.28 gain to Q31
+  const int shift = DSP_Q31_COEF_SHIFT + 15 - 31;
+  int i;
+
+  for (i = 0; i < frames; i++) {
+    uint32_t s = in[i];
+
+    out[2 * i] = dsp_q31_sat(((int64_t)(int16_t)(s & 0xFFFF) * gain) >> shift);
+    out[2 * i + 1] = dsp_q31_sat(((int64_t)(int16_t)(s >> 16) * gain) >> shift);
+  }
+}
+
+/**
+ *
+ */
+void dsp_q31_from_s32(const volatile uint32_t *in, int32_t *out, int frames,
+                      int32_t gain) {
+  int i;
+
+  for (i = 0; i < 2 * frames; i++) {
+    out[i] = dsp_q31_sat(((int64_t)(int32_t)in[i] * gain) >>
+                         DSP_Q31_COEF_SHIFT);
+  }
+}
+
+/**
+ *
+ */
+void dsp_biquad_stereo_q31(int32_t *buf, int frames,
+                           dsp_biquad_stereo_q31_t *bq) {
+  const int32_t *cl = &bq->coeffs[0];
+  const int32_t *cr = &bq->coeffs[5];
+  int32_t sl[5], sr[5];
+  int i;
+
+  // locals, so the states can live in registers
+  memcpy(sl, &bq->s[0], sizeof(sl));
+  memcpy(sr, &bq->s[5], sizeof(sr));
+
+  for (i = 0; i < frames; i++) {
+    buf[2 * i] = dsp_biquad_q31_step(buf[2 * i], cl, sl);
+    buf[2 * i + 1] = dsp_biquad_q31_step(buf[2 * i + 1], cr, sr);
+  }
+
+  memcpy(&bq->s[0], sl, sizeof(sl));
+  memcpy(&bq->s[5], sr, sizeof(sr));
+}
+
+/**
+ *
+ */
+void dsp_q31_to_s16(const int32_t *in, volatile uint32_t *out, int frames,
+                    uint32_t *seed) {
+  uint32_t x = *seed;
+  int i;
+
+  for (i = 0; i < frames; i++) {
+    uint16_t l = dsp_q31_dither(in[2 * i], &x);
+    uint16_t r = dsp_q31_dither(in[2 * i + 1], &x);
+
+    out[i] = ((uint32_t)r << 16) | l;
+  }
+
+  *seed = x;
+}
+
+/**
+ *
+ */
+void dsp_q31_volume_s16(volatile uint32_t *audio, int frames, int32_t gain,
+                        uint32_t *seed) {
+  const int shift = DSP_Q31_COEF_SHIFT + 15 - 31;
+  uint32_t x = *seed;
+  int i;
+
+  for (i = 0; i < frames; i++) {
+    uint32_t s = audio[i];
+    int32_t l = dsp_q31_sat(((int64_t)(int16_t)(s & 0xFFFF) * gain) >> shift);
+    int32_t r = dsp_q31_sat(((int64_t)(int16_t)(s >> 16) * gain) >> shift);
+
+    audio[i] = ((uint32_t)dsp_q31_dither(r, &x) << 16) | dsp_q31_dither(l, &x);
+  }
+
+  *seed = x;
+}
+
+/**
+ *
+ */
+void dsp_q31_volume_s32(volatile uint32_t *audio, int frames, int32_t gain) {
+  int i;
+
+  for (i = 0; i < 2 * frames; i++) {
+    audio[i] = (uint32_t)dsp_q31_sat(((int64_t)(int32_t)audio[i] * gain) >>
+                                     DSP_Q31_COEF_SHIFT);
+  }
+}
@@ -0,0 +1,239 @@
+/* Stereo biquads, portable C
+
+   The recursion of one channel is a chain of dependent multiply adds, so
+   running left and right in the same loop gives the FPU two chains to
+   overlap. Coefficients and states are copied to locals, which the
+   compiler keeps in registers, and the conversions to and from 16 bit are
+   fused into the first and last biquad of a cascade.
+*/
+
+#include "dsp_biquad_stereo.h"
+
+/**
+ * One step of direct form II, same order of operations as esp-dsp.
+ */
+#define DSP_BIQUAD_STEP(x, y, c, w0, w1)                \
+  do {                                                  \
+    float d = (x) - (c)[3] * (w0) - (c)[4] * (w1);      \
+    (y) = (c)[0] * d + (c)[1] * (w0) + (c)[2] * (w1);   \
+    (w1) = (w0);                                        \
+    (w0) = d;                                           \
+  } while (0)
+
+/**
+ *
+ */
+void dsp_biquad_stereo_s16(volatile uint32_t *audio, int frames, float gain,
+                           dsp_biquad_stereo_t *bq) {
+  const float *cl = &bq->coeffs[0];
+  const float *cr = &bq->coeffs[5];
+  float l0 = bq->w[0], l1 = bq->w[1], r0 = bq->w[2], r1 = bq->w[3];
+  float yl, yr;
+  int i;
+
+  for (i = 0; i < frames; i++) {
+    uint32_t s = audio[i];
+
+    DSP_BIQUAD_STEP(gain * (float)(int16_t)(s & 0xFFFF), yl, cl, l0, l1);
+    DSP_BIQUAD_STEP(gain * (float)(int16_t)(s >> 16), yr, cr, r0, r1);
+
+    audio[i] =
+        ((uint32_t)dsp_biquad_to_s16(yr) << 16) | dsp_biquad_to_s16(yl);
+  }
+
+  bq->w[0] = l0;
+  bq->w[1] = l1;
+  bq->w[2] = r0;
+  bq->w[3] = r1;
+}
+
+/**
+ *
+ */
+void dsp_biquad_stereo2_s16(volatile uint32_t *audio, int frames, float gain,
+                            dsp_biquad_stereo_t *bq) {
+  const float *cl = &bq[0].coeffs[0];
+  const float *cr = &bq[0].coeffs[5];
+  const float *dl = &bq[1].coeffs[0];
+  const float *dr = &bq[1].coeffs[5];
+  float l0 = bq[0].w[0], l1 = bq[0].w[1], r0 = bq[0].w[2], r1 = bq[0].w[3];
+  float m0 = bq[1].w[0], m1 = bq[1].w[1], s0 = bq[1].w[2], s1 = bq[1].w[3];
+  float yl, yr;
+  int i;
+
+  for (i = 0; i < frames; i++) {
+    uint32_t s = audio[i];
+
+    DSP_BIQUAD_STEP(gain * (float)(int16_t)(s & 0xFFFF), yl, cl, l0, l1);
+    DSP_BIQUAD_STEP(gain * (float)(int16_t)(s >> 16), yr, cr, r0, r1);
+    DSP_BIQUAD_STEP(yl, yl, dl, m0, m1);
+    DSP_BIQUAD_STEP(yr, yr, dr, s0, s1);
+
+    audio[i] =
+        ((uint32_t)dsp_biquad_to_s16(yr) << 16) | dsp_biquad_to_s16(yl);
+  }
+
+  bq[0].w[0] = l0;
+  bq[0].w[1] = l1;
+  bq[0].w[2] = r0;
+  bq[0].w[3] = r1;
+  bq[1].w[0] = m0;
+  bq[1].w[1] = m1;
+  bq[1].w[2] = s0;
+  bq[1].w[3] = s1;
+}
+
+/**
+ *
+ */
+void dsp_biquad_stereo_s16_f32(const volatile uint32_t *in, float *out,
+                               int frames, float gain,
+                               dsp_biquad_stereo_t *bq) {
+  const float *cl = &bq->coeffs[0];
+  const float *cr = &bq->coeffs[5];
+  float l0 = bq->w[0], l1 = bq->w[1], r0 = bq->w[2], r1 = bq->w[3];
+  int i;
+
+  for (i = 0; i < frames; i++) {
+    uint32_t s = in[i];
+
+    DSP_BIQUAD_STEP(gain * (float)(int16_t)(s & 0xFFFF), out[2 * i], cl, l0,
+                    l1);
+    DSP_BIQUAD_STEP(gain * (float)(int16_t)(s >> 16), out[2 * i + 1], cr, r0,
+                    r1);
+  }
+
+  bq->w[0] = l0;
+  bq->w[1] = l1;
+  bq->w[2] = r0;
+  bq->w[3] = r1;
+}
+
+/**
+ *
+ */
+void dsp_biquad_stereo_f32_ansi(const float *in, float *out, int frames,
+                                dsp_biquad_stereo_t *bq) {
+  const float *cl = &bq->coeffs[0];
+  const float *cr = &bq->coeffs[5];
+  float l0 = bq->w[0], l1 = bq->w[1], r0 = bq->w[2], r1 = bq->w[3];
+  int i;
+
+  for (i = 0; i < frames; i++) {
+    float xl = in[2 * i];
+    float xr = in[2 * i + 1];
+
+    DSP_BIQUAD_STEP(xl, out[2 * i], cl, l0, l1);
+    DSP_BIQUAD_STEP(xr, out[2 * i + 1], cr, r0, r1);
+  }
+
+  bq->w[0] = l0;
+  bq->w[1] = l1;
+  bq->w[2] = r0;
+  bq->w[3] = r1;
+}
+
+/**
+ *
+ */
+void dsp_biquad_stereo_f32_s16(const float *in, volatile uint32_t *out,
+                               int frames, dsp_biquad_stereo_t *bq) {
+  const float *cl = &bq->coeffs[0];
+  const float *cr = &bq->coeffs[5];
+  float l0 = bq->w[0], l1 = bq->w[1], r0 = bq->w[2], r1 = bq->w[3];
+  float yl, yr;
+  int i;
+
+  for (i = 0; i < frames; i++) {
+    DSP_BIQUAD_STEP(in[2 * i], yl, cl, l0, l1);
+    DSP_BIQUAD_STEP(in[2 * i + 1], yr, cr, r0, r1);
+
+    out[i] = ((uint32_t)dsp_biquad_to_s16(yr) << 16) | dsp_biquad_to_s16(yl);
+  }
+
+  bq->w[0] = l0;
+  bq->w[1] = l1;
+  bq->w[2] = r0;
+  bq->w[3] = r1;
+}
+
+/**
+ *
+ */
+void dsp_biquad_split_s16_f32(const volatile uint32_t *in, float *hi,
+                              float *lo, int frames, float gain,
+                              const float *split, dsp_biquad_stereo_t *hiBq,
+                              dsp_biquad_stereo_t *loBq) {
+  const float *cl = &hiBq->coeffs[0];
+  const float *cr = &hiBq->coeffs[5];
+  const float *dl = &loBq->coeffs[0];
+  const float *dr = &loBq->coeffs[5];
+  const float ll = split[0], lr = split[1], rl = split[2], rr = split[3];
+  float l0 = hiBq->w[0], l1 = hiBq->w[1], r0 = hiBq->w[2], r1 = hiBq->w[3];
+  float m0 = loBq->w[0], m1 = loBq->w[1], s0 = loBq->w[2], s1 = loBq->w[3];
+  int i;
+
+  for (i = 0; i < frames; i++) {
+    uint32_t s = in[i];
+    float xl = gain * (float)(int16_t)(s & 0xFFFF);
+    float xr = gain * (float)(int16_t)(s >> 16);
+
+    DSP_BIQUAD_STEP(xl, hi[2 * i], cl, l0, l1);
+    DSP_BIQUAD_STEP(xr, hi[2 * i + 1], cr, r0, r1);
+    DSP_BIQUAD_STEP(ll * xl + lr * xr, lo[2 * i], dl, m0, m1);
+    DSP_BIQUAD_STEP(rl * xl + rr * xr, lo[2 * i + 1], dr, s0, s1);
+  }
+
+  hiBq->w[0] = l0;
+  hiBq->w[1] = l1;
+  hiBq->w[2] = r0;
+  hiBq->w[3] = r1;
+  loBq->w[0] = m0;
+  loBq->w[1] = m1;
+  loBq->w[2] = s0;
+  loBq->w[3] = s1;
+}
+
+/**
+ *
+ */
+void dsp_biquad_xover2_s16(volatile uint32_t *audio, volatile uint32_t *aux,
+                           int frames, float gain, const float *split,
+                           dsp_biquad_stereo_t *hi, dsp_biquad_stereo_t *lo) {
+  const float *cl = &lo[0].coeffs[0];
+  const float *cr = &lo[0].coeffs[5];
+  const float *dl = &lo[1].coeffs[0];
+  const float *dr = &lo[1].coeffs[5];
+  const float ll = split[0], lr = split[1], rl = split[2], rr = split[3];
+  float l0 = lo[0].w[0], l1 = lo[0].w[1], r0 = lo[0].w[2], r1 = lo[0].w[3];
+  float m0 = lo[1].w[0], m1 = lo[1].w[1], s0 = lo[1].w[2], s1 = lo[1].w[3];
+  float yl, yr;
+  int i;
+
+  // the lows first, while the input is intact, then the highs in place.
+  // Two passes of four biquads, like dsp_biquad_stereo2_s16(), keep the
+  // states in registers.
+  for (i = 0; i < frames; i++) {
+    uint32_t s = audio[i];
+    float xl = gain * (float)(int16_t)(s & 0xFFFF);
+    float xr = gain * (float)(int16_t)(s >> 16);
+
+    DSP_BIQUAD_STEP(ll * xl + lr * xr, yl, cl, l0, l1);
+    DSP_BIQUAD_STEP(rl * xl + rr * xr, yr, cr, r0, r1);
+    DSP_BIQUAD_STEP(yl, yl, dl, m0, m1);
+    DSP_BIQUAD_STEP(yr, yr, dr, s0, s1);
+
+    aux[i] = ((uint32_t)dsp_biquad_to_s16(yr) << 16) | dsp_biquad_to_s16(yl);
+  }
+
+  lo[0].w[0] = l0;
+  lo[0].w[1] = l1;
+  lo[0].w[2] = r0;
+  lo[0].w[3] = r1;
+  lo[1].w[0] = m0;
+  lo[1].w[1] = m1;
+  lo[1].w[2] = s0;
+  lo[1].w[3] = s1;
+
+  dsp_biquad_stereo2_s16(audio, frames, gain, hi);
+}
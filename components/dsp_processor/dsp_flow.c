@@ -0,0 +1,1206 @@
+/* DSP graphs on a preallocated processing context
+
+   Every flow is a graph: a list of nodes run in order, each over a whole
+   block of one channel, so there is a switch per node and block but none
+   per sample. A chunk is processed in blocks of ctx->frames: both channels
+   are converted to float into ctx->buf, the nodes filter, scale, mix and
+   route them in place and channels 0 and 1 are written back. Nothing is
+   allocated per chunk, only when the stream format grows the blocks.
+
+   Graphs of biquads only, the same number on both channels like all the
+   fixed flows, skip the conversion passes: left and right biquads are
+   paired and run interleaved, the first pair reads the 16 bit frames and
+   the last one writes them back. Cascades of one or two pairs take a
+   single pass over the chunk. A crossover splitting the input into
+   channels 2 and 3 first, for a second output, pairs their biquads too
+   and fuses the split into the first pass of both sides.
+
+   In fixed point, which only dsp_fixed_bench turns on, the pairs run on
+   Q31 samples instead, converted from and to 16 bit once per block with
+   the final rounding dithered.
+
+   Streams of more than 16 bits come in 32 bit slots, a word per sample.
+   They take the same graphs, pairs and fixed point pairs with their own
+   conversions, without the single pass kernels of the 16 bit path.
+*/
+
+#include "dsp_flow.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+
+#include "dsps_biquad.h"
+#include "dsps_biquad_gen.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#ifdef CONFIG_USE_BIQUAD_ASM
+#define BIQUAD dsps_biquad_f32_ae32
+#define BIQUAD_STEREO dsp_biquad_stereo_f32_ae32
+#else
+#define BIQUAD dsps_biquad_f32
+#define BIQUAD_STEREO dsp_biquad_stereo_f32_ansi
+#endif
+
+static const char *TAG = "dspFlow";
+
+// names of enum filtertypes in graph descriptions
+static const char *filterNames[] = {
+    "lpf",   "hpf",   "bpf",  "bpf0db",   "notch",
+    "ap360", "ap180", "peak", "lowshelf", "highshelf",
+};
+
+#define FILTER_TYPES (sizeof(filterNames) / sizeof(filterNames[0]))
+
+/**
+ *
+ */
+static void dsp_flow_biquad(dspGraph_t *g, uint8_t ch, int filtertype,
+                            float freq, float gain, float q) {
+  dspNode_t *n = &g->node[g->nodeCnt++];
+
+  memset(n, 0, sizeof(dspNode_t));
+  n->type = DSP_NODE_BIQUAD;
+  n->ch = ch;
+  n->filtertype = filtertype;
+  n->freq = freq;
+  n->gain = gain;
+  n->q = q;
+}
+
+/**
+ * Linkwitz-Riley of 4th order, two Butterworth biquads.
+ */
+static void dsp_flow_lr4(dspGraph_t *g, uint8_t ch, int filtertype,
+                         float freq) {
+  dsp_flow_biquad(g, ch, filtertype, freq, 0, 0.7071f);
+  dsp_flow_biquad(g, ch, filtertype, freq, 0, 0.7071f);
+}
+
+/**
+ * A MIX or ROUTE node.
+ */
+static void dsp_flow_connect(dspGraph_t *g, dspNodeType_t type, uint8_t ch,
+                             uint8_t src, float gain) {
+  dspNode_t *n = &g->node[g->nodeCnt++];
+
+  memset(n, 0, sizeof(dspNode_t));
+  n->type = type;
+  n->ch = ch;
+  n->src = src;
+  n->gain = gain;
+}
+
+/**
+ * The fixed flows as graphs.
+ */
+static void dsp_flow_graph(dspFlows_t flow, const filterParams_t *p,
+                           dspGraph_t *g) {
+  uint8_t ch;
+
+  g->inGain = 1.0f;
+  g->nodeCnt = 0;
+
+  switch (flow) {
+    case dspfEQBassTreble: {
+      // simple EQ control of low and high frequencies (bass, treble)
+      for (ch = 0; ch < 2; ch++) {
+        dsp_flow_biquad(g, ch, LOWSHELF, p->fc_1, p->gain_1, 0.707f);
+        dsp_flow_biquad(g, ch, HIGHSHELF, p->fc_3, p->gain_3, 0.707f);
+      }
+
+      break;
+    }
+
+    case dspfBassBoost: {
+      // 6dB of headroom for the boost
+      g->inGain = 0.5f;
+      for (ch = 0; ch < 2; ch++) {
+        dsp_flow_biquad(g, ch, LOWSHELF, p->fc_1, 6.0f, 0.707f);
+      }
+
+      break;
+    }
+
+    case dspfBiamp: {
+      // LR4 crossover at fc_1, the highs of left and right on channels 0
+      // and 1, their lows on 2 and 3. The two sum up flat in magnitude.
+      dsp_flow_connect(g, DSP_NODE_ROUTE, 2, 0, 1.0f);
+      dsp_flow_connect(g, DSP_NODE_ROUTE, 3, 1, 1.0f);
+      for (ch = 0; ch < 4; ch++) {
+        dsp_flow_lr4(g, ch, (ch < 2) ? HPF : LPF, p->fc_1);
+      }
+
+      break;
+    }
+
+    case dspf2DOT1: {
+      // LR4 crossover at fc_1, the highs of left and right on channels 0
+      // and 1, the lows of their mono sum on 2 and 3 for the subwoofer
+      dsp_flow_connect(g, DSP_NODE_ROUTE, 2, 0, 0.5f);
+      dsp_flow_connect(g, DSP_NODE_MIX, 2, 1, 0.5f);
+      dsp_flow_connect(g, DSP_NODE_ROUTE, 3, 2, 1.0f);
+      for (ch = 0; ch < 4; ch++) {
+        dsp_flow_lr4(g, ch, (ch < 2) ? HPF : LPF, p->fc_1);
+      }
+
+      break;
+    }
+
+    case dspfGraph: {
+      *g = p->graph;
+
+      break;
+    }
+
+    default: {
+      break;
+    }
+  }
+}
+
+/**
+ * Peaking EQ of the audio EQ cookbook, the esp-dsp one is a band pass.
+ */
+static void dsp_flow_gen_peaking(float *coeffs, float f, float gain, float q) {
+  float A = powf(10.0f, gain / 40.0f);
+  float w0 = 2.0f * (float)M_PI * f;
+  float c = cosf(w0);
+  float alpha = sinf(w0) / (2.0f * q);
+  float a0 = 1.0f + alpha / A;
+
+  coeffs[0] = (1.0f + alpha * A) / a0;
+  coeffs[1] = -2.0f * c / a0;
+  coeffs[2] = (1.0f - alpha * A) / a0;
+  coeffs[3] = -2.0f * c / a0;
+  coeffs[4] = (1.0f - alpha / A) / a0;
+}
+
+/**
+ * First order all pass, 180 degrees at f. esp-dsp generates the same second
+ * order one as for 360 degrees.
+ */
+static void dsp_flow_gen_allpass180(float *coeffs, float f) {
+  float t = tanf((float)M_PI * f);
+  float c = (t - 1.0f) / (t + 1.0f);
+
+  coeffs[0] = c;
+  coeffs[1] = 1.0f;
+  coeffs[2] = 0.0f;
+  coeffs[3] = c;
+  coeffs[4] = 0.0f;
+}
+
+/**
+ * Coefficients of a biquad node for samplerate, a frequency at or above
+ * Nyquist passes the channel unchanged.
+ */
+static void dsp_flow_gen_biquad(ptype_t *f, float freq, uint32_t samplerate) {
+  if (freq >= 0.5f) {
+    ESP_LOGW(TAG, "%.0fHz is above Nyquist, filter bypassed",
+             freq * samplerate);
+
+    f->coeffs[0] = 1.0f;
+    f->coeffs[1] = f->coeffs[2] = f->coeffs[3] = f->coeffs[4] = 0.0f;
+
+    return;
+  }
+
+  switch (f->filtertype) {
+    case LPF:
+      dsps_biquad_gen_lpf_f32(f->coeffs, freq, f->q);
+      break;
+
+    case HPF:
+      dsps_biquad_gen_hpf_f32(f->coeffs, freq, f->q);
+      break;
+
+    case BPF:
+      dsps_biquad_gen_bpf_f32(f->coeffs, freq, f->q);
+      break;
+
+    case BPF0DB:
+      dsps_biquad_gen_bpf0db_f32(f->coeffs, freq, f->q);
+      break;
+
+    case NOTCH:
+      // esp-dsp cuts the center by half the gain
+      dsps_biquad_gen_notch_f32(f->coeffs, freq, 2.0f * f->gain, f->q);
+      break;
+
+    case ALLPASS360:
+      dsps_biquad_gen_allpass360_f32(f->coeffs, freq, f->q);
+      break;
+
+    case ALLPASS180:
+      dsp_flow_gen_allpass180(f->coeffs, freq);
+      break;
+
+    case PEAKINGEQ:
+      dsp_flow_gen_peaking(f->coeffs, freq, f->gain, f->q);
+      break;
+
+    case LOWSHELF:
+      dsps_biquad_gen_lowShelf_f32(f->coeffs, freq, f->gain, f->q);
+      break;
+
+    case HIGHSHELF:
+      dsps_biquad_gen_highShelf_f32(f->coeffs, freq, f->gain, f->q);
+      break;
+
+    default:
+      break;
+  }
+}
+
+/**
+ * Fixed point pairs of cnt pairNode, false if a biquad doesn't fit.
+ */
+static bool dsp_flow_pair_q31(dsp_flow_ctx_t *ctx, uint32_t cnt) {
+  uint32_t k, ch;
+
+  for (k = 0; k < cnt; k++) {
+    for (ch = 0; ch < 2; ch++) {
+      uint32_t n = ctx->pairNode[k][ch];
+
+      if (dsp_biquad_q31_coeffs(&ctx->pairQ31[k].coeffs[5 * ch],
+                                ctx->filter[n].coeffs) < 0) {
+        ESP_LOGW(TAG, "node %u too steep for fixed point, using float", n);
+
+        return false;
+      }
+      memcpy(&ctx->pairQ31[k].s[5 * ch], ctx->q31State[n],
+             sizeof(ctx->q31State[0]));
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Channels 2 and 3 as a mix of the input if the leading nodes are ROUTE
+ * and MIX writing only those, the number of such nodes or -1.
+ */
+static int32_t dsp_flow_split(const dspGraph_t *g, float *split) {
+  uint32_t n;
+
+  memset(split, 0, 4 * sizeof(float));
+
+  for (n = 0; n < g->nodeCnt; n++) {
+    const dspNode_t *node = &g->node[n];
+    float *row, from[2];
+
+    if ((node->type != DSP_NODE_ROUTE) && (node->type != DSP_NODE_MIX)) {
+      break;
+    }
+    if ((node->ch < 2) || (node->ch > 3) || (node->src > 3)) {
+      return -1;
+    }
+    row = &split[2 * (node->ch - 2)];
+
+    if (node->src < 2) {
+      from[0] = (node->src == 0) ? 1.0f : 0.0f;
+      from[1] = (node->src == 1) ? 1.0f : 0.0f;
+    } else {
+      from[0] = split[2 * (node->src - 2)];
+      from[1] = split[2 * (node->src - 2) + 1];
+    }
+
+    if (node->type == DSP_NODE_ROUTE) {
+      row[0] = 0;
+      row[1] = 0;
+    }
+    row[0] += node->gain * from[0];
+    row[1] += node->gain * from[1];
+  }
+
+  return n;
+}
+
+/**
+ * Pair the biquads of left and right if the graph is nothing else, or a
+ * split of the input into channels 2 and 3 followed by biquads on 0 to 3
+ * pairing those of 2 and 3 as well. Copies coefficients and states into
+ * the pairs, those of 2 and 3 follow the ones of 0 and 1.
+ */
+static void dsp_flow_pair(dsp_flow_ctx_t *ctx) {
+  const dspGraph_t *g = &ctx->graph;
+  uint32_t cnt[4] = {0, 0, 0, 0};
+  uint8_t auxNode[DSP_GRAPH_MAX_NODES / 2][2];
+  int32_t first;
+  uint32_t n, k, ch;
+
+  ctx->fused = false;
+  ctx->q31 = false;
+  ctx->pairCnt = 0;
+  ctx->auxPairCnt = 0;
+
+  first = dsp_flow_split(g, ctx->split);
+  if (first < 0) {
+    return;
+  }
+
+  for (n = first; n < g->nodeCnt; n++) {
+    const dspNode_t *node = &g->node[n];
+
+    if ((node->type != DSP_NODE_BIQUAD) || (node->ch > 3) ||
+        (cnt[node->ch] >= DSP_GRAPH_MAX_NODES / 2)) {
+      return;
+    }
+
+    if (node->ch < 2) {
+      ctx->pairNode[cnt[node->ch]++][node->ch] = n;
+    } else {
+      auxNode[cnt[node->ch]++][node->ch - 2] = n;
+    }
+  }
+
+  // a split needs biquads on its channels, plain pairs none there
+  if ((cnt[0] == 0) || (cnt[0] != cnt[1]) || (cnt[2] != cnt[3]) ||
+      ((first > 0) != (cnt[2] > 0)) ||
+      (cnt[0] + cnt[2] > DSP_GRAPH_MAX_NODES / 2)) {
+    return;
+  }
+
+  ctx->pairCnt = cnt[0];
+  ctx->auxPairCnt = cnt[2];
+  memcpy(&ctx->pairNode[cnt[0]], auxNode, cnt[2] * sizeof(auxNode[0]));
+  ctx->fused = true;
+
+  if (ctx->fixed && (cnt[2] == 0) && dsp_flow_pair_q31(ctx, cnt[0])) {
+    ctx->q31 = true;
+
+    return;
+  }
+
+  for (k = 0; k < cnt[0] + cnt[2]; k++) {
+    for (ch = 0; ch < 2; ch++) {
+      const ptype_t *f = &ctx->filter[ctx->pairNode[k][ch]];
+
+      memcpy(&ctx->pair[k].coeffs[5 * ch], f->coeffs, sizeof(f->coeffs));
+      memcpy(&ctx->pair[k].w[2 * ch], f->w, sizeof(f->w));
+    }
+  }
+}
+
+/**
+ * States of the pairs back to their nodes.
+ */
+static void dsp_flow_unpair(dsp_flow_ctx_t *ctx) {
+  uint32_t k, ch;
+
+  if (ctx->fused == false) {
+    return;
+  }
+
+  for (k = 0; k < ctx->pairCnt + ctx->auxPairCnt; k++) {
+    for (ch = 0; ch < 2; ch++) {
+      uint32_t n = ctx->pairNode[k][ch];
+
+      if (ctx->q31) {
+        memcpy(ctx->q31State[n], &ctx->pairQ31[k].s[5 * ch],
+               sizeof(ctx->q31State[0]));
+      } else {
+        memcpy(ctx->filter[n].w, &ctx->pair[k].w[2 * ch],
+               sizeof(ctx->filter[0].w));
+      }
+    }
+  }
+}
+
+/**
+ * Node parameters into ctx->filter with coefficients for ctx->samplerate,
+ * states are kept.
+ */
+static void dsp_flow_gen_filters(dsp_flow_ctx_t *ctx) {
+  const dspGraph_t *g = &ctx->graph;
+  uint32_t n;
+
+  ctx->chCnt = 2;
+  ctx->outputs = 2;
+
+  for (n = 0; n < g->nodeCnt; n++) {
+    const dspNode_t *node = &g->node[n];
+    ptype_t *f = &ctx->filter[n];
+
+    f->filtertype = node->filtertype;
+    f->freq = node->freq;
+    f->gain = node->gain;
+    f->q = node->q;
+
+    if (node->ch >= ctx->chCnt) {
+      ctx->chCnt = node->ch + 1;
+    }
+    if (((node->type == DSP_NODE_MIX) || (node->type == DSP_NODE_ROUTE)) &&
+        (node->src >= ctx->chCnt)) {
+      ctx->chCnt = node->src + 1;
+    }
+    if ((node->ch == 2) || (node->ch == 3)) {
+      ctx->outputs = 4;
+    }
+
+    if ((node->type == DSP_NODE_BIQUAD) && (ctx->samplerate != 0)) {
+      dsp_flow_gen_biquad(f, node->freq / ctx->samplerate, ctx->samplerate);
+    }
+  }
+
+  dsp_flow_pair(ctx);
+}
+
+/**
+ *
+ */
+static uint32_t dsp_flow_node_key(const dspNode_t *node) {
+  return node->type | (node->ch << 8) | (node->filtertype << 16);
+}
+
+/**
+ *
+ */
+void dsp_flow_init(dsp_flow_ctx_t *ctx) {
+  uint32_t ch;
+
+  memset(ctx, 0, sizeof(dsp_flow_ctx_t));
+
+  ctx->flow = dspfStereo;
+  ctx->graph.inGain = 1.0f;
+  for (ch = 0; ch < DSP_GRAPH_CHANNELS; ch++) {
+    ctx->buf[ch] = ctx->minBuf.f[ch];
+  }
+  ctx->qBuf = ctx->minBuf.q;
+  ctx->frames = DSP_FLOW_MIN_FRAMES;
+  ctx->dither = 0x2545F491;
+}
+
+/**
+ *
+ */
+void dsp_flow_deinit(dsp_flow_ctx_t *ctx) {
+  if (ctx->heapBuf != NULL) {
+    heap_caps_free(ctx->heapBuf);
+  }
+
+  dsp_flow_init(ctx);
+}
+
+/**
+ *
+ */
+void dsp_flow_set_fixed(dsp_flow_ctx_t *ctx, bool fixed) {
+  uint32_t n;
+
+  if (fixed == ctx->fixed) {
+    return;
+  }
+
+  // the states of one don't fit the other
+  for (n = 0; n < DSP_GRAPH_MAX_NODES; n++) {
+    memset(ctx->filter[n].w, 0, sizeof(ctx->filter[n].w));
+  }
+  memset(ctx->q31State, 0, sizeof(ctx->q31State));
+
+  ctx->fixed = fixed;
+  dsp_flow_pair(ctx);
+}
+
+/**
+ *
+ */
+int32_t dsp_flow_set_format(dsp_flow_ctx_t *ctx, uint32_t samplerate,
+                            uint8_t channels, uint32_t chunkFrames) {
+  bool newFormat =
+      (samplerate != ctx->samplerate) || (channels != ctx->channels);
+  uint32_t frames = chunkFrames;
+  uint32_t ch;
+  float *buf;
+
+  if (frames > DSP_FLOW_MAX_FRAMES) {
+    frames = DSP_FLOW_MAX_FRAMES;
+  }
+
+  if (newFormat) {
+    ctx->samplerate = samplerate;
+    ctx->channels = channels;
+
+    ctx->sized = 0;
+
+    memset(ctx->filter, 0, sizeof(ctx->filter));
+    memset(ctx->q31State, 0, sizeof(ctx->q31State));
+    dsp_flow_gen_filters(ctx);
+  }
+
+  // tried already, also if it failed
+  if (frames <= ctx->sized) {
+    return 0;
+  }
+  ctx->sized = frames;
+
+  if (frames <= ctx->frames) {
+    return 0;
+  }
+
+  // once per format, unless a longer chunk comes
+  buf = (float *)heap_caps_malloc(DSP_GRAPH_CHANNELS * frames * sizeof(float),
+                                  MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  if (buf == NULL) {
+    buf = (float *)heap_caps_malloc(
+        DSP_GRAPH_CHANNELS * frames * sizeof(float), MALLOC_CAP_8BIT);
+  }
+
+  if (buf == NULL) {
+    ESP_LOGW(TAG, "no memory for %u frame blocks, using %u", frames,
+             ctx->frames);
+
+    return -1;
+  }
+
+  if (ctx->heapBuf != NULL) {
+    heap_caps_free(ctx->heapBuf);
+  }
+
+  ctx->heapBuf = buf;
+  for (ch = 0; ch < DSP_GRAPH_CHANNELS; ch++) {
+    ctx->buf[ch] = buf + ch * frames;
+  }
+  ctx->qBuf = (int32_t *)buf;
+  ctx->frames = frames;
+
+  return 0;
+}
+
+/**
+ *
+ */
+int32_t dsp_flow_check_graph(const dspGraph_t *graph) {
+  uint32_t n;
+
+  if ((graph->nodeCnt > DSP_GRAPH_MAX_NODES) || !isfinite(graph->inGain)) {
+    return -1;
+  }
+
+  for (n = 0; n < graph->nodeCnt; n++) {
+    const dspNode_t *node = &graph->node[n];
+
+    if ((node->type > DSP_NODE_ROUTE) || (node->ch >= DSP_GRAPH_CHANNELS) ||
+        (node->src >= DSP_GRAPH_CHANNELS) || !isfinite(node->gain)) {
+      return -1;
+    }
+
+    if ((node->type == DSP_NODE_BIQUAD) &&
+        ((node->filtertype >= FILTER_TYPES) || !(node->freq > 0.0f) ||
+         !(node->q > 0.0f) || !isfinite(node->freq) || !isfinite(node->q))) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ *
+ */
+int32_t dsp_flow_set_params(dsp_flow_ctx_t *ctx, const filterParams_t *params) {
+  dspFlows_t flow = params->dspFlow;
+  uint32_t key[DSP_GRAPH_MAX_NODES];
+  uint32_t n, oldCnt = ctx->graph.nodeCnt;
+
+  if (flow == dspfFunkyHonda) {
+    ESP_LOGW(TAG, "flow %d not implemented yet, using stereo instead", flow);
+
+    flow = dspfStereo;
+  }
+
+  if ((flow == dspfGraph) && (dsp_flow_check_graph(&params->graph) < 0)) {
+    ESP_LOGE(TAG, "invalid graph, keeping the current one");
+
+    return -1;
+  }
+
+  dsp_flow_unpair(ctx);
+
+  for (n = 0; n < oldCnt; n++) {
+    key[n] = dsp_flow_node_key(&ctx->graph.node[n]);
+  }
+
+  ctx->flow = flow;
+  dsp_flow_graph(flow, params, &ctx->graph);
+
+  // a node that is something else now starts from silence
+  for (n = 0; n < ctx->graph.nodeCnt; n++) {
+    if ((n >= oldCnt) || (key[n] != dsp_flow_node_key(&ctx->graph.node[n]))) {
+      memset(&ctx->filter[n], 0, sizeof(ptype_t));
+      memset(ctx->q31State[n], 0, sizeof(ctx->q31State[0]));
+    }
+  }
+
+  dsp_flow_gen_filters(ctx);
+
+  return 0;
+}
+
+/**
+ * Append the node described by one line of a graph description to graph.
+ *
+ * @return the nodes appended, 0 for an empty line, -1 on a syntax error
+ */
+static int32_t dsp_flow_parse_node(const char *line, dspGraph_t *graph) {
+  char word[12], type[12];
+  unsigned int ch = 0, src = 0;
+  float freq, gain, q;
+  dspNode_t *node;
+  uint32_t t;
+  int n;
+
+  if (sscanf(line, "%11s", word) != 1) {
+    return 0;
+  }
+
+  if (strcmp(word, "in") == 0) {
+    if (sscanf(line, "%*s %f", &gain) != 1) {
+      return -1;
+    }
+    graph->inGain = powf(10.0f, gain / 20.0f);
+
+    return 0;
+  }
+
+  if (strcmp(word, "lr4") == 0) {
+    if ((sscanf(line, "%*s %u %11s %f", &ch, type, &freq) != 3) ||
+        (ch >= DSP_GRAPH_CHANNELS) ||
+        (graph->nodeCnt + 2 > DSP_GRAPH_MAX_NODES)) {
+      return -1;
+    }
+    if (strcmp(type, "lpf") == 0) {
+      dsp_flow_lr4(graph, ch, LPF, freq);
+    } else if (strcmp(type, "hpf") == 0) {
+      dsp_flow_lr4(graph, ch, HPF, freq);
+    } else {
+      return -1;
+    }
+
+    return 2;
+  }
+
+  if (graph->nodeCnt >= DSP_GRAPH_MAX_NODES) {
+    return -1;
+  }
+  node = &graph->node[graph->nodeCnt];
+  memset(node, 0, sizeof(dspNode_t));
+
+  if (strcmp(word, "bq") == 0) {
+    if (sscanf(line, "%*s %u %11s %f %f %f", &ch, type, &freq, &gain, &q) !=
+        5) {
+      return -1;
+    }
+    for (t = 0; t < FILTER_TYPES; t++) {
+      if (strcmp(type, filterNames[t]) == 0) {
+        break;
+      }
+    }
+    if (t == FILTER_TYPES) {
+      return -1;
+    }
+
+    node->type = DSP_NODE_BIQUAD;
+    node->filtertype = t;
+    node->freq = freq;
+    node->gain = gain;
+    node->q = q;
+  } else if (strcmp(word, "gain") == 0) {
+    if (sscanf(line, "%*s %u %f", &ch, &gain) != 2) {
+      return -1;
+    }
+
+    node->type = DSP_NODE_GAIN;
+    node->gain = powf(10.0f, gain / 20.0f);
+  } else if (strcmp(word, "mix") == 0) {
+    if (sscanf(line, "%*s %u %u %f", &ch, &src, &gain) != 3) {
+      return -1;
+    }
+
+    node->type = DSP_NODE_MIX;
+    node->src = src;
+    node->gain = gain;
+  } else if (strcmp(word, "route") == 0) {
+    n = sscanf(line, "%*s %u %u %f", &ch, &src, &gain);
+    if (n < 2) {
+      return -1;
+    }
+
+    node->type = DSP_NODE_ROUTE;
+    node->src = src;
+    node->gain = (n == 3) ? gain : 1.0f;
+  } else {
+    return -1;
+  }
+
+  if ((ch >= DSP_GRAPH_CHANNELS) ||
+      ((node->type != DSP_NODE_BIQUAD) && (node->type != DSP_NODE_GAIN) &&
+       (src >= DSP_GRAPH_CHANNELS))) {
+    return -1;
+  }
+  node->ch = ch;
+  graph->nodeCnt++;
+
+  return 1;
+}
+
+/**
+ *
+ */
+int32_t dsp_flow_parse_graph(const char *text, dspGraph_t *graph) {
+  char line[64];
+  size_t len;
+
+  memset(graph, 0, sizeof(dspGraph_t));
+  graph->inGain = 1.0f;
+
+  while (*text != 0) {
+    len = strcspn(text, ";\n");
+    if (len >= sizeof(line)) {
+      return -1;
+    }
+    memcpy(line, text, len);
+    line[len] = 0;
+
+    if (dsp_flow_parse_node(line, graph) < 0) {
+      ESP_LOGW(TAG, "can't parse node \"%s\"", line);
+
+      return -1;
+    }
+
+    text += len;
+    if (*text != 0) {
+      text++;
+    }
+  }
+
+  if (dsp_flow_check_graph(graph) < 0) {
+    return -1;
+  }
+
+  return graph->nodeCnt;
+}
+
+/**
+ * Frames times volume in place. Only an input gain above 1 can clip, that
+ * one is saturated, the usual attenuation stays a plain multiply.
+ */
+static void dsp_flow_volume(volatile uint32_t *audio, uint32_t frames,
+                            float volume) {
+  const float gain = volume / INT16_MAX;
+  uint32_t i;
+
+  if (volume <= 1.0f) {
+    for (i = 0; i < frames; i++) {
+      uint32_t s = audio[i];
+      int16_t l = (int16_t)(volume * (float)(int16_t)(s & 0xFFFF));
+      int16_t r = (int16_t)(volume * (float)(int16_t)(s >> 16));
+
+      audio[i] = ((uint32_t)(uint16_t)r << 16) | (uint16_t)l;
+    }
+
+    return;
+  }
+
+  for (i = 0; i < frames; i++) {
+    uint32_t s = audio[i];
+    uint16_t l = dsp_biquad_to_s16(gain * (float)(int16_t)(s & 0xFFFF));
+    uint16_t r = dsp_biquad_to_s16(gain * (float)(int16_t)(s >> 16));
+
+    audio[i] = ((uint32_t)r << 16) | l;
+  }
+}
+
+/**
+ * Run node n over a block of frames.
+ */
+static void dsp_flow_node(dsp_flow_ctx_t *ctx, uint32_t n, uint32_t frames) {
+  const dspNode_t *node = &ctx->graph.node[n];
+  ptype_t *f = &ctx->filter[n];
+  float *dst = ctx->buf[node->ch];
+  const float *src = ctx->buf[node->src];
+  const float gain = f->gain;
+  uint32_t i;
+
+  switch (node->type) {
+    case DSP_NODE_BIQUAD:
+      BIQUAD(dst, dst, frames, f->coeffs, f->w);
+      break;
+
+    case DSP_NODE_GAIN:
+      for (i = 0; i < frames; i++) {
+        dst[i] *= gain;
+      }
+      break;
+
+    case DSP_NODE_MIX:
+      for (i = 0; i < frames; i++) {
+        dst[i] += gain * src[i];
+      }
+      break;
+
+    case DSP_NODE_ROUTE:
+      for (i = 0; i < frames; i++) {
+        dst[i] = gain * src[i];
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+/**
+ * A block of interleaved float after its first pair through the cnt - 1
+ * pairs that follow into 16 bit frames, the last pass converting.
+ */
+static void dsp_flow_cascade_s16(float *buf, volatile uint32_t *out,
+                                 uint32_t frames, dsp_biquad_stereo_t *pair,
+                                 uint32_t cnt) {
+  uint32_t i, p;
+
+  for (p = 1; p + 1 < cnt; p++) {
+    BIQUAD_STEREO(buf, buf, frames, &pair[p]);
+  }
+
+  if (cnt > 1) {
+    dsp_biquad_stereo_f32_s16(buf, out, frames, &pair[cnt - 1]);
+
+    return;
+  }
+
+  for (i = 0; i < frames; i++) {
+    out[i] = ((uint32_t)dsp_biquad_to_s16(buf[2 * i + 1]) << 16) |
+             dsp_biquad_to_s16(buf[2 * i]);
+  }
+}
+
+/**
+ * A chunk through the stereo pairs, one pass per pair.
+ */
+static void dsp_flow_pairs(dsp_flow_ctx_t *ctx, volatile uint32_t *audio,
+                           uint32_t frames, float gain) {
+  dsp_biquad_stereo_t *pair = ctx->pair;
+  float *buf = ctx->buf[0];  // interleaved over buf[0] and buf[1]
+  uint32_t k, n;
+
+  if (ctx->pairCnt == 1) {
+    dsp_biquad_stereo_s16(audio, frames, gain, pair);
+
+    return;
+  }
+
+  if (ctx->pairCnt == 2) {
+    dsp_biquad_stereo2_s16(audio, frames, gain, pair);
+
+    return;
+  }
+
+  for (k = 0; k < frames; k += n) {
+    n = frames - k;
+    if (n > ctx->frames) {
+      n = ctx->frames;
+    }
+
+    dsp_biquad_stereo_s16_f32(&audio[k], buf, n, gain, &pair[0]);
+    dsp_flow_cascade_s16(buf, &audio[k], n, pair, ctx->pairCnt);
+  }
+}
+
+/**
+ * A chunk through a crossover, the split into channels 2 and 3 fused into
+ * the first pairs. An LR4 on both sides takes no float buffers.
+ */
+static void dsp_flow_xover(dsp_flow_ctx_t *ctx, volatile uint32_t *audio,
+                           volatile uint32_t *aux, uint32_t frames,
+                           float gain) {
+  dsp_biquad_stereo_t *hi = ctx->pair;
+  dsp_biquad_stereo_t *lo = &ctx->pair[ctx->pairCnt];
+  float *hiBuf = ctx->buf[0];  // interleaved over buf[0] and buf[1]
+  float *loBuf = ctx->buf[2];  // and over buf[2] and buf[3]
+  uint32_t k, n;
+
+  if ((ctx->pairCnt == 2) && (ctx->auxPairCnt == 2)) {
+    dsp_biquad_xover2_s16(audio, aux, frames, gain, ctx->split, hi, lo);
+
+    return;
+  }
+
+  for (k = 0; k < frames; k += n) {
+    n = frames - k;
+    if (n > ctx->frames) {
+      n = ctx->frames;
+    }
+
+    dsp_biquad_split_s16_f32(&audio[k], hiBuf, loBuf, n, gain, ctx->split, hi,
+                             lo);
+    dsp_flow_cascade_s16(loBuf, &aux[k], n, lo, ctx->auxPairCnt);
+    dsp_flow_cascade_s16(hiBuf, &audio[k], n, hi, ctx->pairCnt);
+  }
+}
+
+/**
+ * dsp_flow_pairs() in fixed point, gain in Q3.28.
+ */
+static void dsp_flow_pairs_q31(dsp_flow_ctx_t *ctx, volatile uint32_t *audio,
+                               uint32_t frames, int32_t gain) {
+  int32_t *buf = ctx->qBuf;
+  uint32_t k, n, p;
+
+  for (k = 0; k < frames; k += n) {
+    n = frames - k;
+    if (n > ctx->frames) {
+      n = ctx->frames;
+    }
+
+    dsp_q31_from_s16(&audio[k], buf, n, gain);
+    for (p = 0; p < ctx->pairCnt; p++) {
+      dsp_biquad_stereo_q31(buf, n, &ctx->pairQ31[p]);
+    }
+    dsp_q31_to_s16(buf, &audio[k], n, &ctx->dither);
+  }
+}
+
+/**
+ *
+ */
+void dsp_flow_process(dsp_flow_ctx_t *ctx, volatile uint32_t *audio,
+                      volatile uint32_t *aux, uint32_t frames, float volume) {
+  const dspGraph_t *g = &ctx->graph;
+  float *l = ctx->buf[0];
+  float *r = ctx->buf[1];
+  uint32_t i, k, n, node;
+  float gain;
+
+  if ((g->nodeCnt == 0) || (ctx->samplerate == 0)) {
+    gain = volume * g->inGain;
+    if (gain == 1.0f) {
+      return;
+    }
+
+    if (ctx->fixed) {
+      dsp_q31_volume_s16(audio, frames, dsp_q31_gain(gain), &ctx->dither);
+    } else {
+      dsp_flow_volume(audio, frames, gain);
+    }
+
+    return;
+  }
+
+  if (ctx->q31) {
+    dsp_flow_pairs_q31(ctx, audio, frames, dsp_q31_gain(volume * g->inGain));
+
+    return;
+  }
+
+  gain = volume * g->inGain / INT16_MAX;
+
+  if (ctx->fused) {
+    if ((ctx->auxPairCnt > 0) && (aux != NULL)) {
+      dsp_flow_xover(ctx, audio, aux, frames, gain);
+    } else {
+      dsp_flow_pairs(ctx, audio, frames, gain);
+    }
+
+    return;
+  }
+
+  for (k = 0; k < frames; k += n) {
+    volatile uint32_t *block = &audio[k];
+
+    n = frames - k;
+    if (n > ctx->frames) {
+      n = ctx->frames;
+    }
+
+    for (i = 0; i < n; i++) {
+      uint32_t s = block[i];
+
+      l[i] = gain * (float)(int16_t)(s & 0xFFFF);
+      r[i] = gain * (float)(int16_t)(s >> 16);
+    }
+    for (i = 2; i < ctx->chCnt; i++) {
+      memset(ctx->buf[i], 0, n * sizeof(float));
+    }
+
+    for (node = 0; node < g->nodeCnt; node++) {
+      dsp_flow_node(ctx, node, n);
+    }
+
+    for (i = 0; i < n; i++) {
+      // boosting graphs may exceed full scale
+      block[i] = ((uint32_t)dsp_biquad_to_s16(r[i]) << 16) |
+                 dsp_biquad_to_s16(l[i]);
+    }
+    if ((ctx->outputs == 4) && (aux != NULL)) {
+      for (i = 0; i < n; i++) {
+        aux[k + i] = ((uint32_t)dsp_biquad_to_s16(ctx->buf[3][i]) << 16) |
+                     dsp_biquad_to_s16(ctx->buf[2][i]);
+      }
+    }
+  }
+}
+
+/**
+ * A block of interleaved float to stereo frames of 32 bit slots.
+ */
+static void dsp_flow_to_s32(const float *buf, volatile uint32_t *out,
+                            uint32_t frames) {
+  uint32_t i;
+
+  for (i = 0; i < 2 * frames; i++) {
+    out[i] = dsp_biquad_to_s32(buf[i]);
+  }
+}
+
+/**
+ * dsp_flow_pairs() and dsp_flow_xover() for 32 bit slots, one pass per pair
+ * over interleaved float blocks.
+ */
+static void dsp_flow_pairs_s32(dsp_flow_ctx_t *ctx, volatile uint32_t *audio,
+                               volatile uint32_t *aux, uint32_t frames,
+                               float gain) {
+  const bool xover = (ctx->auxPairCnt > 0) && (aux != NULL);
+  const float *split = ctx->split;
+  float *hi = ctx->buf[0];  // interleaved over buf[0] and buf[1]
+  float *lo = ctx->buf[2];  // and over buf[2] and buf[3]
+  uint32_t i, k, n, p;
+
+  for (k = 0; k < frames; k += n) {
+    n = frames - k;
+    if (n > ctx->frames) {
+      n = ctx->frames;
+    }
+
+    for (i = 0; i < n; i++) {
+      float l = gain * (float)(int32_t)audio[2 * (k + i)];
+      float r = gain * (float)(int32_t)audio[2 * (k + i) + 1];
+
+      hi[2 * i] = l;
+      hi[2 * i + 1] = r;
+      if (xover) {
+        lo[2 * i] = split[0] * l + split[1] * r;
+        lo[2 * i + 1] = split[2] * l + split[3] * r;
+      }
+    }
+
+    if (xover) {
+      for (p = 0; p < ctx->auxPairCnt; p++) {
+        BIQUAD_STEREO(lo, lo, n, &ctx->pair[ctx->pairCnt + p]);
+      }
+      dsp_flow_to_s32(lo, &aux[2 * k], n);
+    }
+
+    for (p = 0; p < ctx->pairCnt; p++) {
+      BIQUAD_STEREO(hi, hi, n, &ctx->pair[p]);
+    }
+    dsp_flow_to_s32(hi, &audio[2 * k], n);
+  }
+}
+
+/**
+ * dsp_flow_pairs_q31() for 32 bit slots, which are Q31 already.
+ */
+static void dsp_flow_pairs_q31_s32(dsp_flow_ctx_t *ctx,
+                                   volatile uint32_t *audio, uint32_t frames,
+                                   int32_t gain) {
+  int32_t *buf = ctx->qBuf;
+  uint32_t i, k, n, p;
+
+  for (k = 0; k < frames; k += n) {
+    n = frames - k;
+    if (n > ctx->frames) {
+      n = ctx->frames;
+    }
+
+    dsp_q31_from_s32(&audio[2 * k], buf, n, gain);
+    for (p = 0; p < ctx->pairCnt; p++) {
+      dsp_biquad_stereo_q31(buf, n, &ctx->pairQ31[p]);
+    }
+    for (i = 0; i < 2 * n; i++) {
+      audio[2 * k + i] = (uint32_t)buf[i];
+    }
+  }
+}
+
+/**
+ *
+ */
+void dsp_flow_process_s32(dsp_flow_ctx_t *ctx, volatile uint32_t *audio,
+                          volatile uint32_t *aux, uint32_t frames,
+                          float volume) {
+  const dspGraph_t *g = &ctx->graph;
+  float *l = ctx->buf[0];
+  float *r = ctx->buf[1];
+  uint32_t i, k, n, node;
+  float gain = volume * g->inGain;
+
+  if ((g->nodeCnt == 0) || (ctx->samplerate == 0)) {
+    if (gain == 1.0f) {
+      return;
+    }
+
+    if (ctx->fixed) {
+      dsp_q31_volume_s32(audio, frames, dsp_q31_gain(gain));
+    } else {
+      for (i = 0; i < 2 * frames; i++) {
+        audio[i] = dsp_biquad_to_s32(gain / 2147483648.0f *
+                                     (float)(int32_t)audio[i]);
+      }
+    }
+
+    return;
+  }
+
+  if (ctx->q31) {
+    dsp_flow_pairs_q31_s32(ctx, audio, frames, dsp_q31_gain(gain));
+
+    return;
+  }
+
+  gain /= 2147483648.0f;
+
+  if (ctx->fused) {
+    dsp_flow_pairs_s32(ctx, audio, aux, frames, gain);
+
+    return;
+  }
+
+  for (k = 0; k < frames; k += n) {
+    volatile uint32_t *block = &audio[2 * k];
+
+    n = frames - k;
+    if (n > ctx->frames) {
+      n = ctx->frames;
+    }
+
+    for (i = 0; i < n; i++) {
+      l[i] = gain * (float)(int32_t)block[2 * i];
+      r[i] = gain * (float)(int32_t)block[2 * i + 1];
+    }
+    for (i = 2; i < ctx->chCnt; i++) {
+      memset(ctx->buf[i], 0, n * sizeof(float));
+    }
+
+    for (node = 0; node < g->nodeCnt; node++) {
+      dsp_flow_node(ctx, node, n);
+    }
+
+    for (i = 0; i < n; i++) {
+      block[2 * i] = dsp_biquad_to_s32(l[i]);
+      block[2 * i + 1] = dsp_biquad_to_s32(r[i]);
+    }
+    if ((ctx->outputs == 4) && (aux != NULL)) {
+      for (i = 0; i < n; i++) {
+        aux[2 * (k + i)] = dsp_biquad_to_s32(ctx->buf[2][i]);
+        aux[2 * (k + i) + 1] = dsp_biquad_to_s32(ctx->buf[3][i]);
+      }
+    }
+  }
+}
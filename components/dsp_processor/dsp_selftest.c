@@ -0,0 +1,255 @@
+/* DSP self test on the target
+
+   The host tools build the C kernels only, the assembly ones run on the
+   ESP32 alone. This checks them against the C kernels on noise, in and out
+   of place and at frame counts the zero overhead loop could get wrong, and
+   counts the cycles of the bass and treble EQ against the former worker,
+   which the host benchmarks can only estimate.
+*/
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "xtensa/hal.h"
+
+#include "dsp_biquad_stereo.h"
+#include "dsp_selftest.h"
+#include "dsps_biquad.h"
+#include "dsps_biquad_gen.h"
+
+static const char *TAG = "dspTest";
+
+#define DSP_SELFTEST_FRAMES 257
+#define DSP_SELFTEST_CHUNK 1152  //!< frames of a 24ms chunk at 48kHz
+#define DSP_SELFTEST_RUNS 8
+#define DSP_SELFTEST_REF_LEN 16  //!< frames the former worker took at once
+
+#if (dsps_biquad_f32_ae32_enabled == 1)
+#define DSP_SELFTEST_BIQUAD dsps_biquad_f32_ae32
+#else
+#define DSP_SELFTEST_BIQUAD dsps_biquad_f32_ansi
+#endif
+
+/**
+ * Noise at about -6dBFS on both channels.
+ */
+static void dsp_selftest_noise(float *buf, int frames, uint32_t seed) {
+  int i;
+
+  for (i = 0; i < 2 * frames; i++) {
+    seed = seed * 1664525u + 1013904223u;
+    buf[i] = (float)(int32_t)seed / 4294967296.0f;
+  }
+}
+
+#if (dsps_biquad_f32_ae32_enabled == 1)
+/**
+ * The bass and treble shelves, a different one per channel.
+ */
+static void dsp_selftest_bq(dsp_biquad_stereo_t *bq) {
+  memset(bq, 0, sizeof(*bq));
+  dsps_biquad_gen_lowShelf_f32(&bq->coeffs[0], 300.0f / 48000, 6.0f, 0.707f);
+  dsps_biquad_gen_highShelf_f32(&bq->coeffs[5], 4000.0f / 48000, -6.0f,
+                                0.707f);
+}
+
+/**
+ * @return largest difference of two float buffers
+ */
+static float dsp_selftest_diff(const float *a, const float *b, int len) {
+  float max = 0;
+  int i;
+
+  for (i = 0; i < len; i++) {
+    float d = fabsf(a[i] - b[i]);
+
+    if (d > max) {
+      max = d;
+    }
+  }
+
+  return max;
+}
+
+/**
+ * dsp_biquad_stereo_f32_ae32() against dsp_biquad_stereo_f32_ansi() in
+ * passes of frames, out of place or in place.
+ *
+ * @return 0 if they agree, -1 otherwise
+ */
+static int32_t dsp_selftest_stereo_ae32(float *in, float *ref, float *out,
+                                        int frames, bool inPlace) {
+  dsp_biquad_stereo_t bqRef, bqAsm;
+  float diff = 0, d;
+  int pass;
+
+  dsp_selftest_bq(&bqRef);
+  bqAsm = bqRef;
+
+  // a few passes, a state stored wrong shows in the output of the next
+  for (pass = 0; pass < 4; pass++) {
+    dsp_selftest_noise(in, frames, pass + frames);
+    dsp_biquad_stereo_f32_ansi(in, ref, frames, &bqRef);
+
+    if (inPlace) {
+      memcpy(out, in, 2 * frames * sizeof(float));
+      dsp_biquad_stereo_f32_ae32(out, out, frames, &bqAsm);
+    } else {
+      dsp_biquad_stereo_f32_ae32(in, out, frames, &bqAsm);
+    }
+
+    d = dsp_selftest_diff(ref, out, 2 * frames);
+    if (d > diff) {
+      diff = d;
+    }
+  }
+
+  if (diff > DSP_SELFTEST_TOLERANCE) {
+    ESP_LOGE(TAG,
+             "dsp_biquad_stereo_f32_ae32 %d frames%s off by %e, disable "
+             "USE_BIQUAD_ASM",
+             frames, inPlace ? " in place" : "", diff);
+
+    return -1;
+  }
+
+  ESP_LOGI(TAG, "dsp_biquad_stereo_f32_ae32 %d frames%s: max diff %e",
+           frames, inPlace ? " in place" : "", diff);
+
+  return 0;
+}
+#endif
+
+/**
+ * The former dsp_processor_worker() on the bass and treble EQ: 16 frames
+ * at a time deinterleaved to float, each channel through the two shelves
+ * with esp-dsp and back.
+ */
+static void dsp_selftest_former(volatile uint32_t *audio, int frames,
+                                dsp_biquad_stereo_t *bq) {
+  float a[DSP_SELFTEST_REF_LEN], b[DSP_SELFTEST_REF_LEN];
+  int k, i, ch;
+
+  for (k = 0; k < frames; k += DSP_SELFTEST_REF_LEN) {
+    volatile uint32_t *tmp = &audio[k];
+    int max = (frames - k < DSP_SELFTEST_REF_LEN) ? frames - k
+                                                  : DSP_SELFTEST_REF_LEN;
+
+    for (ch = 0; ch < 2; ch++) {
+      int shift = 16 * ch;
+
+      for (i = 0; i < max; i++) {
+        a[i] = (float)((int16_t)(tmp[i] >> shift)) / INT16_MAX;
+      }
+
+      DSP_SELFTEST_BIQUAD(a, b, max, &bq[0].coeffs[5 * ch], &bq[0].w[2 * ch]);
+      DSP_SELFTEST_BIQUAD(b, a, max, &bq[1].coeffs[5 * ch], &bq[1].w[2 * ch]);
+
+      for (i = 0; i < max; i++) {
+        uint16_t v = (uint16_t)(int16_t)(a[i] * INT16_MAX);
+
+        tmp[i] = (tmp[i] & ~(0xFFFFu << shift)) | ((uint32_t)v << shift);
+      }
+    }
+  }
+}
+
+/**
+ * Cycles per frame of the bass and treble EQ, dsp_biquad_stereo2_s16()
+ * against the former worker, the fastest of a few chunks each.
+ */
+static void dsp_selftest_cycles(void) {
+  dsp_biquad_stereo_t bq[2];
+  uint32_t *audio = (uint32_t *)malloc(DSP_SELFTEST_CHUNK * sizeof(uint32_t));
+  uint32_t cycles, best = UINT32_MAX, former = UINT32_MAX, seed = 1;
+  int run, i, ch;
+
+  if (audio == NULL) {
+    ESP_LOGE(TAG, "%s: no memory", __func__);
+    return;
+  }
+
+  memset(bq, 0, sizeof(bq));
+  for (ch = 0; ch < 2; ch++) {
+    dsps_biquad_gen_lowShelf_f32(&bq[0].coeffs[5 * ch], 300.0f / 48000, 6.0f,
+                                 0.707f);
+    dsps_biquad_gen_highShelf_f32(&bq[1].coeffs[5 * ch], 4000.0f / 48000,
+                                  -6.0f, 0.707f);
+  }
+
+  for (run = 0; run < 2 * DSP_SELFTEST_RUNS; run++) {
+    // noise at about -6dBFS on both channels
+    for (i = 0; i < DSP_SELFTEST_CHUNK; i++) {
+      int16_t l, r;
+
+      seed = seed * 1664525u + 1013904223u;
+      l = (int16_t)(seed >> 16) / 2;
+      seed = seed * 1664525u + 1013904223u;
+      r = (int16_t)(seed >> 16) / 2;
+      audio[i] = ((uint32_t)(uint16_t)r << 16) | (uint16_t)l;
+    }
+
+    cycles = xthal_get_ccount();
+    if (run & 1) {
+      dsp_selftest_former(audio, DSP_SELFTEST_CHUNK, bq);
+    } else {
+      dsp_biquad_stereo2_s16(audio, DSP_SELFTEST_CHUNK, 1.0f / INT16_MAX, bq);
+    }
+    cycles = xthal_get_ccount() - cycles;
+
+    if (run & 1) {
+      former = (cycles < former) ? cycles : former;
+    } else {
+      best = (cycles < best) ? cycles : best;
+    }
+  }
+
+  free(audio);
+
+  ESP_LOGI(TAG,
+           "bass/treble: %u cycles per frame, former worker %u, %.2fx",
+           best / DSP_SELFTEST_CHUNK, former / DSP_SELFTEST_CHUNK,
+           (float)former / best);
+}
+
+/**
+ *
+ */
+int32_t dsp_selftest_run(void) {
+  int32_t ret = 0;
+  float *in = (float *)malloc(3 * 2 * DSP_SELFTEST_FRAMES * sizeof(float));
+  float *ref = &in[2 * DSP_SELFTEST_FRAMES];
+  float *out = &ref[2 * DSP_SELFTEST_FRAMES];
+
+  if (in == NULL) {
+    ESP_LOGE(TAG, "%s: no memory", __func__);
+
+    return -1;
+  }
+
+#if (dsps_biquad_f32_ae32_enabled == 1)
+  {
+    static const int frames[] = {1, 2, 3, DSP_SELFTEST_FRAMES};
+    int n;
+
+    for (n = 0; n < (int)(sizeof(frames) / sizeof(frames[0])); n++) {
+      if ((dsp_selftest_stereo_ae32(in, ref, out, frames[n], false) < 0) ||
+          (dsp_selftest_stereo_ae32(in, ref, out, frames[n], true) < 0)) {
+        ret = -1;
+      }
+    }
+  }
+#else
+  ESP_LOGI(TAG, "no ae32 kernels on this target");
+#endif
+
+  dsp_selftest_cycles();
+
+  free(in);
+
+  return ret;
+}
@@ -0,0 +1,71 @@
+#ifndef _DSP_BIQUAD_Q31_H_
+#define _DSP_BIQUAD_Q31_H_
+
+#include <stdint.h>
+
+// coefficients and gains are Q3.28, up to +-8
+#define DSP_Q31_COEF_SHIFT 28
+
+/**
+ * Fixed point counterpart of dsp_biquad_stereo_t. Samples are Q31 with 1.0
+ * the 16 bit full scale. Direct form I with 64 bit accumulators and the
+ * truncated fraction fed into the next sample, so low cut offs don't
+ * suffer from the precision loss of direct form II.
+ */
+typedef struct dsp_biquad_stereo_q31 {
+  int32_t coeffs[10];  // left b0 b1 b2 a1 a2, then right
+  int32_t s[10];       // left x1 x2 y1 y2 fraction, then right
+} dsp_biquad_stereo_q31_t;
+
+/**
+ * Float coefficients b0 b1 b2 a1 a2 of esp-dsp to Q3.28.
+ *
+ * @return 0 on success, -1 if they are too large for the accumulator
+ */
+int32_t dsp_biquad_q31_coeffs(int32_t *q, const float *coeffs);
+
+/**
+ * Linear gain to Q3.28, saturated.
+ */
+int32_t dsp_q31_gain(float gain);
+
+/**
+ * 16 bit stereo frames times gain into interleaved Q31.
+ */
+void dsp_q31_from_s16(const volatile uint32_t *in, int32_t *out, int frames,
+                      int32_t gain);
+
+/**
+ * Stereo frames of 32 bit slots, left then right word, times gain into
+ * interleaved Q31. The slots are Q31 already, full scale 1.0.
+ */
+void dsp_q31_from_s32(const volatile uint32_t *in, int32_t *out, int frames,
+                      int32_t gain);
+
+/**
+ * Interleaved Q31 through bq in place.
+ */
+void dsp_biquad_stereo_q31(int32_t *buf, int frames,
+                           dsp_biquad_stereo_q31_t *bq);
+
+/**
+ * Interleaved Q31 to 16 bit stereo frames, rounded with TPDF dither of +-1
+ * LSB and saturated. seed is the state of the dither generator, not 0.
+ */
+void dsp_q31_to_s16(const int32_t *in, volatile uint32_t *out, int frames,
+                    uint32_t *seed);
+
+/**
+ * 16 bit stereo frames times gain in place, with dither as
+ * dsp_q31_to_s16().
+ */
+void dsp_q31_volume_s16(volatile uint32_t *audio, int frames, int32_t gain,
+                        uint32_t *seed);
+
+/**
+ * Stereo frames of 32 bit slots times gain in place, saturated. Truncated
+ * without dither, far below the LSB of a 24 bit sample.
+ */
+void dsp_q31_volume_s32(volatile uint32_t *audio, int frames, int32_t gain);
+
+#endif /* _DSP_BIQUAD_Q31_H_ */
@@ -0,0 +1,108 @@
+#ifndef _DSP_BIQUAD_STEREO_H_
+#define _DSP_BIQUAD_STEREO_H_
+
+#include <stdint.h>
+
+/**
+ * A biquad per channel, run on both channels of interleaved stereo in one
+ * pass so the two independent recursions overlap. Direct form II with the
+ * coefficients and states of esp-dsp, states are kept in registers for a
+ * pass and stored at its end.
+ */
+typedef struct dsp_biquad_stereo {
+  float coeffs[10];  // left b0 b1 b2 a1 a2, then right
+  float w[4];        // left w0 w1, then right
+} dsp_biquad_stereo_t;
+
+/**
+ * Float in full scale to 16 bit, saturated.
+ */
+static inline uint16_t dsp_biquad_to_s16(float v) {
+  v *= INT16_MAX;
+
+  if (v >= INT16_MAX) {
+    return (uint16_t)INT16_MAX;
+  }
+  if (v <= INT16_MIN) {
+    return (uint16_t)INT16_MIN;
+  }
+
+  return (uint16_t)(int16_t)v;
+}
+
+/**
+ * Float in full scale to a 32 bit slot, saturated.
+ */
+static inline uint32_t dsp_biquad_to_s32(float v) {
+  v *= 2147483648.0f;
+
+  if (v >= 2147483648.0f) {
+    return (uint32_t)INT32_MAX;
+  }
+  if (v <= -2147483648.0f) {
+    return (uint32_t)INT32_MIN;
+  }
+
+  return (uint32_t)(int32_t)v;
+}
+
+/**
+ * 16 bit stereo frames, left in the low half word, times gain through bq
+ * and back in place.
+ */
+void dsp_biquad_stereo_s16(volatile uint32_t *audio, int frames, float gain,
+                           dsp_biquad_stereo_t *bq);
+
+/**
+ * dsp_biquad_stereo_s16() through the cascade bq[0], bq[1], the bass and
+ * treble EQ and biamp in a single pass.
+ */
+void dsp_biquad_stereo2_s16(volatile uint32_t *audio, int frames, float gain,
+                            dsp_biquad_stereo_t *bq);
+
+/**
+ * 16 bit stereo frames times gain through bq into interleaved float.
+ */
+void dsp_biquad_stereo_s16_f32(const volatile uint32_t *in, float *out,
+                               int frames, float gain,
+                               dsp_biquad_stereo_t *bq);
+
+/**
+ * Interleaved float through bq, in may be out.
+ */
+void dsp_biquad_stereo_f32_ansi(const float *in, float *out, int frames,
+                                dsp_biquad_stereo_t *bq);
+
+/**
+ * dsp_biquad_stereo_f32_ansi() for the ESP32 FPU with zero overhead loops.
+ */
+void dsp_biquad_stereo_f32_ae32(const float *in, float *out, int frames,
+                                dsp_biquad_stereo_t *bq);
+
+/**
+ * Interleaved float through bq into 16 bit stereo frames.
+ */
+void dsp_biquad_stereo_f32_s16(const float *in, volatile uint32_t *out,
+                               int frames, dsp_biquad_stereo_t *bq);
+
+/**
+ * Split 16 bit stereo frames times gain into two interleaved float
+ * streams: hi is the input through hiBq, lo the input mixed by split,
+ * left = split[0] l + split[1] r and right = split[2] l + split[3] r,
+ * through loBq.
+ */
+void dsp_biquad_split_s16_f32(const volatile uint32_t *in, float *hi,
+                              float *lo, int frames, float gain,
+                              const float *split, dsp_biquad_stereo_t *hiBq,
+                              dsp_biquad_stereo_t *loBq);
+
+/**
+ * dsp_biquad_split_s16_f32() through the cascades hi[0], hi[1] back in
+ * place and lo[0], lo[1] into aux, a stereo LR4 crossover without float
+ * buffers.
+ */
+void dsp_biquad_xover2_s16(volatile uint32_t *audio, volatile uint32_t *aux,
+                           int frames, float gain, const float *split,
+                           dsp_biquad_stereo_t *hi, dsp_biquad_stereo_t *lo);
+
+#endif /* _DSP_BIQUAD_STEREO_H_ */
@@ -0,0 +1,142 @@
+#ifndef _DSP_FLOW_H_
+#define _DSP_FLOW_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dsp_biquad_q31.h"
+#include "dsp_biquad_stereo.h"
+#include "dsp_processor.h"
+
+// longest block processed at once, longer chunks take several blocks. Past
+// this the call overhead of the biquads is lost in the noise and internal
+// RAM is better left to the rest.
+#define DSP_FLOW_MAX_FRAMES 256
+
+// block used until work buffers for the stream are allocated
+#define DSP_FLOW_MIN_FRAMES 16
+
+/**
+ * Everything a graph needs to process a chunk, so processing does no heap
+ * operations. Work buffers are sized when the stream format changes, the
+ * fixed flows are translated into graphs and new parameters only recompute
+ * coefficients.
+ */
+typedef struct dsp_flow_ctx {
+  dspFlows_t flow;  // flow processed, dspfStereo for unimplemented ones
+  dspGraph_t graph;
+  uint8_t chCnt;    // channels the graph uses, from 2
+  uint8_t outputs;  // 4 if the graph writes channel 2 or 3, else 2
+  uint32_t samplerate;
+  uint8_t channels;
+  uint32_t frames;  // block length, each buf holds as many floats
+  uint32_t sized;   // chunk frames the buffers were last sized for
+  float *buf[DSP_GRAPH_CHANNELS];  // adjacent, pairs use [0] and [1] or
+                                   // [2] and [3] as one interleaved block
+  int32_t *qBuf;   // interleaved Q31 over buf[0] and buf[1]
+  float *heapBuf;  // buf if allocated, else they are minBuf
+  union {
+    float f[DSP_GRAPH_CHANNELS][DSP_FLOW_MIN_FRAMES];
+    int32_t q[2 * DSP_FLOW_MIN_FRAMES];
+  } minBuf;
+  ptype_t filter[DSP_GRAPH_MAX_NODES];  // one per graph node
+  int32_t q31State[DSP_GRAPH_MAX_NODES][5];  // of the fixed point pairs
+  // graphs of only biquads, as many on left as on right, run as stereo
+  // pairs which own the states then. A crossover may first feed channels
+  // 2 and 3 from the input, their pairs follow those of 0 and 1.
+  bool fused;
+  bool fixed;  // pairs and volume in fixed point if possible
+  bool q31;    // pairs are pairQ31
+  uint32_t dither;  // state of the dither generator
+  uint32_t pairCnt;
+  uint32_t auxPairCnt;  // pairs on channels 2 and 3
+  float split[4];       // channels 2 = [0] l + [1] r, 3 = [2] l + [3] r
+  uint8_t pairNode[DSP_GRAPH_MAX_NODES / 2][2];  // left and right node
+  union {
+    dsp_biquad_stereo_t pair[DSP_GRAPH_MAX_NODES / 2];
+    dsp_biquad_stereo_q31_t pairQ31[DSP_GRAPH_MAX_NODES / 2];
+  };
+} dsp_flow_ctx_t;
+
+/**
+ * Stereo flow until dsp_flow_set_params(), no heap used yet.
+ */
+void dsp_flow_init(dsp_flow_ctx_t *ctx);
+
+/**
+ *
+ */
+void dsp_flow_deinit(dsp_flow_ctx_t *ctx);
+
+/**
+ * Size the work buffers for chunks of chunkFrames and compute the filter
+ * coefficients for samplerate. Does nothing if neither changed, so it can
+ * be called for every chunk; buffers only grow within a format, up to
+ * DSP_FLOW_MAX_FRAMES.
+ *
+ * @return 0 on success, -1 if the buffers couldn't be allocated and the
+ * minimal block is used
+ */
+int32_t dsp_flow_set_format(dsp_flow_ctx_t *ctx, uint32_t samplerate,
+                            uint8_t channels, uint32_t chunkFrames);
+
+/**
+ * Nodes whose type, channel and filter type stay keep their filter states,
+ * so changing a frequency or gain doesn't click.
+ *
+ * @return 0 on success, -1 if the graph is invalid and the current one is
+ * kept
+ */
+int32_t dsp_flow_set_params(dsp_flow_ctx_t *ctx, const filterParams_t *params);
+
+/**
+ * Run stereo pairs of biquads and the volume of graphs without nodes in
+ * fixed point, see dsp_biquad_q31.h. Graphs with other nodes and pairs
+ * whose coefficients don't fit stay in float. Filter states restart from
+ * silence when this changes. The firmware doesn't: dsp_fixed_bench
+ * measures it noisier and slower than float.
+ */
+void dsp_flow_set_fixed(dsp_flow_ctx_t *ctx, bool fixed);
+
+/**
+ * @return 0 if every node of graph has valid channels and filter types
+ */
+int32_t dsp_flow_check_graph(const dspGraph_t *graph);
+
+/**
+ * Parse a graph from text, nodes separated by newlines or ';':
+ *
+ *   in <dB>                                   input gain, default 0
+ *   bq <ch> <type> <Hz> <dB> <q>              biquad
+ *   lr4 <ch> <lpf|hpf> <Hz>                   Linkwitz-Riley, two biquads
+ *   gain <ch> <dB>
+ *   mix <ch> <src> <factor>                   ch += factor * src
+ *   route <ch> <src> [factor]                 ch = factor * src
+ *
+ * where type is one of lpf hpf bpf bpf0db notch ap360 ap180 peak lowshelf
+ * highshelf, e.g. "in -6; bq 0 peak 1000 3 1.4; bq 1 peak 1000 3 1.4".
+ * Channels 0 and 1 are played, 2 and 3 on the second output, 4 is scratch:
+ * "route 2 0; route 3 1; lr4 0 hpf 2000; lr4 1 hpf 2000; lr4 2 lpf 2000;
+ * lr4 3 lpf 2000" splits both channels at 2kHz.
+ *
+ * @return number of nodes, -1 with the graph undefined on a syntax error
+ */
+int32_t dsp_flow_parse_graph(const char *text, dspGraph_t *graph);
+
+/**
+ * Process frames of interleaved 16 bit stereo in place, accessed as 32 bit
+ * words so chunks in IRAM work. Channels 2 and 3 of a graph with 4 outputs
+ * go to aux as as many frames, they are dropped if aux is NULL.
+ */
+void dsp_flow_process(dsp_flow_ctx_t *ctx, volatile uint32_t *audio,
+                      volatile uint32_t *aux, uint32_t frames, float volume);
+
+/**
+ * dsp_flow_process() for frames of two 32 bit slots, left then right, as
+ * 24 and 32 bit streams are played. aux takes as many frames.
+ */
+void dsp_flow_process_s32(dsp_flow_ctx_t *ctx, volatile uint32_t *audio,
+                          volatile uint32_t *aux, uint32_t frames,
+                          float volume);
+
+#endif /* _DSP_FLOW_H_ */
@@ -1,6 +1,9 @@
 #ifndef _DSP_PROCESSOR_H_
 #define _DSP_PROCESSOR_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "esp_err.h"
 
 typedef enum dspFlows {
@@ -10,6 +13,7 @@ typedef enum dspFlows {
   dspfFunkyHonda,
   dspfBassBoost,
   dspfEQBassTreble,
+  dspfGraph,  // filterParams_t.graph
 } dspFlows_t;
 
 enum filtertypes {
@@ -29,7 +33,7 @@ enum filtertypes {
 // required weights and states for processing an automomous processing
 // function. The high level parameters is maintained in the structure
 // as well
-// Process node
+// Process node, a GAIN, MIX or ROUTE node keeps its factor in gain
 typedef struct ptype {
   int filtertype;
   float freq;
@@ -40,6 +44,42 @@ typedef struct ptype {
   float w[2];
 } ptype_t;
 
+// nodes a graph holds at most, a 10 band EQ on both channels plus a
+// crossover fits
+#define DSP_GRAPH_MAX_NODES 32
+
+// left and right, a second pair, e.g. the lows of a crossover, and a
+// scratch channel
+#define DSP_GRAPH_CHANNELS 5
+
+typedef enum dspNodeType {
+  DSP_NODE_BIQUAD,  // ch through a biquad
+  DSP_NODE_GAIN,    // ch *= gain
+  DSP_NODE_MIX,     // ch += gain * src
+  DSP_NODE_ROUTE,   // ch = gain * src
+} dspNodeType_t;
+
+// One step of a processing graph. Steps run in order on whole blocks of a
+// channel.
+typedef struct dspNode_s {
+  uint8_t type;        // dspNodeType_t
+  uint8_t ch;          // channel written
+  uint8_t src;         // MIX and ROUTE: channel read
+  uint8_t filtertype;  // BIQUAD: enum filtertypes
+  float freq;          // BIQUAD: Hz
+  float gain;          // BIQUAD: dB, NOTCH: cut at center, others: linear
+  float q;             // BIQUAD
+} dspNode_t;
+
+// Channels 0 and 1 start as the input times inGain and volume and are
+// played after the last node, the others start silent. If a node writes
+// channel 2 or 3 they are played as a second stereo output.
+typedef struct dspGraph_s {
+  float inGain;  // linear, headroom for boosting filters
+  uint8_t nodeCnt;
+  dspNode_t node[DSP_GRAPH_MAX_NODES];
+} dspGraph_t;
+
 // used to dynamically change used filters and their parameters
 typedef struct filterParams_s {
   dspFlows_t dspFlow;
@@ -49,18 +89,14 @@ typedef struct filterParams_s {
   float gain_2;
   float fc_3;
   float gain_3;
+  dspGraph_t graph;  // dspfGraph only
 } filterParams_t;
 
-// TODO: this is unused, remove???
-// Process flow
-typedef struct pnode {
-  ptype_t process;
-  struct pnode *next;
-} pnode_t;
-
 void dsp_processor_init(void);
 void dsp_processor_uninit(void);
-int dsp_processor_worker(char *audio, size_t chunk_size, uint32_t samplerate);
+int dsp_processor_worker(char *audio, char *aux, size_t chunk_size,
+                         uint32_t samplerate, uint8_t slotBits);
+uint8_t dsp_processor_outputs(void);
 esp_err_t dsp_processor_update_filter_params(filterParams_t *params);
 void dsp_processor_set_volome(double volume);
 
@@ -0,0 +1,20 @@
+#ifndef _DSP_SELFTEST_H_
+#define _DSP_SELFTEST_H_
+
+#include <stdint.h>
+
+// output of the ESP32 kernels may differ from the C ones by this much, the
+// FPU rounds its fused multiply adds once and the states of a low shelf
+// grow to a few hundred. Two 16 bit LSB, a wrong coefficient or state is
+// off by far more.
+#define DSP_SELFTEST_TOLERANCE (1.0f / 16384)
+
+/**
+ * Checks on the target what the host build can't: the assembly kernels
+ * against their C counterparts. Logs the results, takes a few ms.
+ *
+ * @return 0 if all kernels agree, -1 otherwise
+ */
+int32_t dsp_selftest_run(void);
+
+#endif /* _DSP_SELFTEST_H_ */
@@ -15,6 +15,11 @@
 
 #include <stdint.h>
 #include "MedianFilter.h"
+
+// sorted linked list, O(n) per insert. See MedianFilterHeap.c for the
+// O(log n) alternative
+#if !MEDIANFILTER_TWO_HEAPS
+
 /**
  *
  */
@@ -151,6 +156,8 @@ int64_t MEDIANFILTER_get_median(sMedianFilter_t *medianFilter, uint32_t n) {
   return avgMedian;
 }
 
+#endif
+
 /**
  *
  */
@@ -0,0 +1,293 @@
+/*
+ * MedianFilterHeap.c
+ *
+ * Sliding window median with two heaps, O(log n) per insert. The lower half
+ * of the window is kept in a max heap, the upper half in a min heap, the
+ * median is the top of the lower one. Heap slots are stored in the node
+ * buffer, the lower heap from its start and the upper heap from its end, and
+ * every node knows its slot so the oldest sample can be replaced in place.
+ *
+ * Returns the same medians as the linked list in MedianFilter.c, the upper
+ * one of the two middle values while the window isn't full yet.
+ */
+
+/**
+ * This Module expects odd numbers of buffer lengths!!!
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "MedianFilter.h"
+
+#if MEDIANFILTER_TWO_HEAPS
+
+typedef enum { HEAP_LOW = 0, HEAP_HIGH } heap_t;
+
+/**
+ *
+ */
+static inline unsigned int slot_index(const sMedianFilter_t *medianFilter,
+                                      heap_t heap, unsigned int k) {
+  return (heap == HEAP_LOW) ? k : medianFilter->numNodes - 1 - k;
+}
+
+/**
+ *
+ */
+static inline unsigned int heap_index(const sMedianFilter_t *medianFilter,
+                                      heap_t heap, const sMedianNode_t *node) {
+  return (heap == HEAP_LOW) ? node->heapSlot
+                            : medianFilter->numNodes - 1 - node->heapSlot;
+}
+
+/**
+ *
+ */
+static inline sMedianNode_t *heap_get(const sMedianFilter_t *medianFilter,
+                                      heap_t heap, unsigned int k) {
+  return medianFilter->medianBuffer[slot_index(medianFilter, heap, k)]
+      .heapNode;
+}
+
+/**
+ *
+ */
+static inline void heap_set(sMedianFilter_t *medianFilter, heap_t heap,
+                            unsigned int k, sMedianNode_t *node) {
+  unsigned int slot = slot_index(medianFilter, heap, k);
+
+  medianFilter->medianBuffer[slot].heapNode = node;
+  node->heapSlot = slot;
+}
+
+/**
+ * @return true if a belongs above b in the heap
+ */
+static inline int heap_above(heap_t heap, const sMedianNode_t *a,
+                             const sMedianNode_t *b) {
+  return (heap == HEAP_LOW) ? (a->value > b->value) : (a->value < b->value);
+}
+
+/**
+ *
+ */
+static void heap_sift_up(sMedianFilter_t *medianFilter, heap_t heap,
+                         unsigned int k) {
+  sMedianNode_t *node = heap_get(medianFilter, heap, k);
+
+  while (k > 0) {
+    unsigned int parent = (k - 1) / 2;
+    sMedianNode_t *p = heap_get(medianFilter, heap, parent);
+
+    if (!heap_above(heap, node, p)) {
+      break;
+    }
+
+    heap_set(medianFilter, heap, k, p);
+    k = parent;
+  }
+
+  heap_set(medianFilter, heap, k, node);
+}
+
+/**
+ *
+ */
+static void heap_sift_down(sMedianFilter_t *medianFilter, heap_t heap,
+                           unsigned int k, unsigned int cnt) {
+  sMedianNode_t *node = heap_get(medianFilter, heap, k);
+
+  while (2 * k + 1 < cnt) {
+    unsigned int child = 2 * k + 1;
+    sMedianNode_t *c = heap_get(medianFilter, heap, child);
+
+    if (child + 1 < cnt) {
+      sMedianNode_t *c2 = heap_get(medianFilter, heap, child + 1);
+
+      if (heap_above(heap, c2, c)) {
+        child++;
+        c = c2;
+      }
+    }
+
+    if (!heap_above(heap, c, node)) {
+      break;
+    }
+
+    heap_set(medianFilter, heap, k, c);
+    k = child;
+  }
+
+  heap_set(medianFilter, heap, k, node);
+}
+
+/**
+ *
+ */
+static void heap_push(sMedianFilter_t *medianFilter, heap_t heap,
+                      sMedianNode_t *node) {
+  unsigned int *cnt = (heap == HEAP_LOW) ? &medianFilter->lowCnt
+                                         : &medianFilter->highCnt;
+
+  heap_set(medianFilter, heap, *cnt, node);
+  (*cnt)++;
+  heap_sift_up(medianFilter, heap, *cnt - 1);
+}
+
+/**
+ * Remove the top, it is left in the slot behind the heap.
+ */
+static sMedianNode_t *heap_pop(sMedianFilter_t *medianFilter, heap_t heap,
+                               unsigned int *cnt) {
+  sMedianNode_t *top = heap_get(medianFilter, heap, 0);
+
+  (*cnt)--;
+  heap_set(medianFilter, heap, 0, heap_get(medianFilter, heap, *cnt));
+  heap_set(medianFilter, heap, *cnt, top);
+  heap_sift_down(medianFilter, heap, 0, *cnt);
+
+  return top;
+}
+
+/**
+ * Sum of the top n values, the heap is restored afterwards.
+ */
+static int64_t heap_sum_top(sMedianFilter_t *medianFilter, heap_t heap,
+                            unsigned int n) {
+  unsigned int cnt = (heap == HEAP_LOW) ? medianFilter->lowCnt
+                                        : medianFilter->highCnt;
+  unsigned int full = cnt;
+  int64_t sum = 0;
+  unsigned int i;
+
+  for (i = 0; (i < n) && (cnt > 0); i++) {
+    sum += heap_pop(medianFilter, heap, &cnt)->value;
+  }
+
+  // popped nodes are behind the heap, push them back
+  while (cnt < full) {
+    heap_sift_up(medianFilter, heap, cnt++);
+  }
+
+  return sum;
+}
+
+/**
+ *
+ */
+int MEDIANFILTER_Init(sMedianFilter_t *medianFilter) {
+  if (medianFilter && medianFilter->medianBuffer &&
+      (medianFilter->numNodes % 2) && (medianFilter->numNodes > 1)) {
+    for (unsigned int i = 0; i < medianFilter->numNodes; i++) {
+      medianFilter->medianBuffer[i].value = INT64_MAX;
+      medianFilter->medianBuffer[i].heapNode = NULL;
+      medianFilter->medianBuffer[i].heapSlot = 0;
+    }
+
+    medianFilter->ageHead = 0;
+    medianFilter->lowCnt = 0;
+    medianFilter->highCnt = 0;
+    medianFilter->bufferCnt = 0;
+
+    return 0;
+  }
+
+  return -1;
+}
+
+/**
+ *
+ */
+int64_t MEDIANFILTER_Insert(sMedianFilter_t *medianFilter, int64_t sample) {
+  sMedianNode_t *node = &medianFilter->medianBuffer[medianFilter->ageHead];
+
+  medianFilter->ageHead = (medianFilter->ageHead + 1) % medianFilter->numNodes;
+
+  if (medianFilter->bufferCnt < medianFilter->numNodes) {
+    unsigned int lowWanted;
+
+    medianFilter->bufferCnt++;
+    node->value = sample;
+
+    if ((medianFilter->lowCnt == 0) ||
+        (sample <= heap_get(medianFilter, HEAP_LOW, 0)->value)) {
+      heap_push(medianFilter, HEAP_LOW, node);
+    } else {
+      heap_push(medianFilter, HEAP_HIGH, node);
+    }
+
+    // median is the value at index bufferCnt / 2 of the sorted window
+    lowWanted = medianFilter->bufferCnt / 2 + 1;
+    while (medianFilter->lowCnt > lowWanted) {
+      heap_push(medianFilter, HEAP_HIGH,
+                heap_pop(medianFilter, HEAP_LOW, &medianFilter->lowCnt));
+    }
+
+    while (medianFilter->lowCnt < lowWanted) {
+      heap_push(medianFilter, HEAP_LOW,
+                heap_pop(medianFilter, HEAP_HIGH, &medianFilter->highCnt));
+    }
+  } else {
+    // replace oldest sample in place
+    sMedianNode_t *lowTop, *highTop;
+    heap_t heap;
+    unsigned int cnt;
+
+    if (node->heapSlot < medianFilter->lowCnt) {
+      heap = HEAP_LOW;
+      cnt = medianFilter->lowCnt;
+    } else {
+      heap = HEAP_HIGH;
+      cnt = medianFilter->highCnt;
+    }
+
+    node->value = sample;
+    heap_sift_up(medianFilter, heap, heap_index(medianFilter, heap, node));
+    heap_sift_down(medianFilter, heap, heap_index(medianFilter, heap, node),
+                   cnt);
+
+    // at most one value ended up in the wrong half
+    if (medianFilter->highCnt > 0) {
+      lowTop = heap_get(medianFilter, HEAP_LOW, 0);
+      highTop = heap_get(medianFilter, HEAP_HIGH, 0);
+
+      if (lowTop->value > highTop->value) {
+        heap_set(medianFilter, HEAP_LOW, 0, highTop);
+        heap_set(medianFilter, HEAP_HIGH, 0, lowTop);
+        heap_sift_down(medianFilter, HEAP_LOW, 0, medianFilter->lowCnt);
+        heap_sift_down(medianFilter, HEAP_HIGH, 0, medianFilter->highCnt);
+      }
+    }
+  }
+
+  return heap_get(medianFilter, HEAP_LOW, 0)->value;
+}
+
+/**
+ *
+ */
+int64_t MEDIANFILTER_get_median(sMedianFilter_t *medianFilter, uint32_t n) {
+  int64_t avgMedian;
+
+  if (medianFilter->bufferCnt == 0) {
+    return INT64_MAX;
+  }
+
+  if (n >= medianFilter->bufferCnt) {
+    n = medianFilter->bufferCnt - 1;
+  }
+
+  // n should not include the center value
+  if ((n % 2) != 0) {
+    n--;
+  }
+
+  // median and the n / 2 values below are the top of the lower heap
+  avgMedian = heap_sum_top(medianFilter, HEAP_LOW, n / 2 + 1);
+  avgMedian += heap_sum_top(medianFilter, HEAP_HIGH, n / 2);
+  avgMedian /= (n + 1);
+
+  return avgMedian;
+}
+
+#endif
@@ -18,6 +18,39 @@ extern "C" {
 
 #include <stdint.h>
 
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+
+// select the implementation, see Kconfig.projbuild. Both keep the samples in
+// the node buffer provided by the caller.
+#ifndef MEDIANFILTER_TWO_HEAPS
+#ifdef CONFIG_MEDIANFILTER_TWO_HEAPS
+#define MEDIANFILTER_TWO_HEAPS 1
+#else
+#define MEDIANFILTER_TWO_HEAPS 0
+#endif
+#endif
+
+#if MEDIANFILTER_TWO_HEAPS
+
+typedef struct sMedianNode {
+  int64_t value;                 // sample value
+  struct sMedianNode *heapNode;  // node in the heap slot of this index
+  unsigned int heapSlot;         // heap slot holding this node
+} sMedianNode_t;
+
+typedef struct {
+  unsigned int numNodes;        // median node buffer length
+  sMedianNode_t *medianBuffer;  // median node buffer
+  unsigned int ageHead;         // index of oldest value
+  unsigned int lowCnt;   // max heap of the lower half, slots from the start
+  unsigned int highCnt;  // min heap of the upper half, slots from the end
+  unsigned int bufferCnt;
+} sMedianFilter_t;
+
+#else
+
 typedef struct sMedianNode {
   int64_t value;                  // sample value
   struct sMedianNode *nextAge;    // pointer to next oldest value
@@ -34,6 +67,8 @@ typedef struct {
   unsigned int bufferCnt;
 } sMedianFilter_t;
 
+#endif
+
 int MEDIANFILTER_Init(sMedianFilter_t *medianFilter);
 int64_t MEDIANFILTER_Insert(sMedianFilter_t *medianFilter, int64_t sample);
 int64_t MEDIANFILTER_get_median(sMedianFilter_t *medianFilter, uint32_t n);
@@ -0,0 +1,98 @@
+/* Wire chunk latency statistics
+
+   How early chunks arrive before they are played only depends on the server
+   buffer and their latency. The latency distribution tells how much of the
+   buffer the network really needs and how long chunks wait locally.
+*/
+
+#include "chunk_lead.h"
+
+#include <string.h>
+
+/**
+ *
+ */
+void chunk_lead_init(chunk_lead_t *lead) {
+  memset(lead, 0, sizeof(chunk_lead_t));
+}
+
+/**
+ *
+ */
+int32_t chunk_lead_insert(chunk_lead_t *lead, int64_t latency, int64_t now) {
+  int32_t done = 0;
+  int64_t bin;
+
+  if (lead->count[0] + lead->count[1] == 0) {
+    lead->windowStart = now;
+  } else if (now - lead->windowStart >= CHUNK_LEAD_WINDOW_US) {
+    lead->current ^= 1;
+    memset(lead->bins[lead->current], 0, sizeof(lead->bins[0]));
+    lead->count[lead->current] = 0;
+    lead->windowStart = now;
+    done = 1;
+  }
+
+  if (latency > lead->max) {
+    lead->max = latency;
+  }
+
+  // early chunks count as 0, late ones in the last bin
+  bin = latency / (CHUNK_LEAD_BIN_MS * 1000);
+  if (bin < 0) {
+    bin = 0;
+  } else if (bin >= CHUNK_LEAD_BINS) {
+    bin = CHUNK_LEAD_BINS - 1;
+  }
+
+  if (lead->bins[lead->current][bin] < UINT16_MAX) {
+    lead->bins[lead->current][bin]++;
+    lead->count[lead->current]++;
+  }
+
+  return done;
+}
+
+/**
+ *
+ */
+int32_t chunk_lead_quantile_ms(const chunk_lead_t *lead, uint32_t permille) {
+  uint32_t total = lead->count[0] + lead->count[1];
+  uint32_t want, sum = 0;
+  int32_t i;
+
+  if (total < CHUNK_LEAD_MIN_SAMPLES) {
+    return -1;
+  }
+
+  want = (uint32_t)(((uint64_t)total * permille + 999) / 1000);
+  if (want == 0) {
+    want = 1;
+  }
+
+  for (i = 0; i < CHUNK_LEAD_BINS; i++) {
+    sum += lead->bins[0][i] + lead->bins[1][i];
+    if (sum >= want) {
+      break;
+    }
+  }
+
+  if (i == CHUNK_LEAD_BINS) {
+    i--;
+  }
+
+  return (i + 1) * CHUNK_LEAD_BIN_MS;
+}
+
+/**
+ *
+ */
+int32_t chunk_lead_recommended_ms(const chunk_lead_t *lead, int32_t dmaLeadMs) {
+  int32_t latency = chunk_lead_quantile_ms(lead, CHUNK_LEAD_SAFE_PERMILLE);
+
+  if (latency < 0) {
+    return -1;
+  }
+
+  return (latency + dmaLeadMs + CHUNK_LEAD_MARGIN_MS + 9) / 10 * 10;
+}
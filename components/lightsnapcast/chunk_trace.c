@@ -0,0 +1,185 @@
+/* Per chunk pipeline trace
+
+   Fixed size records in a ring, the writer claims a slot with an atomic
+   increment and marks it complete with its sequence number last, so any
+   task can record without a lock. The exporter checks the sequence before
+   and after copying a record and skips it if it was overwritten meanwhile.
+*/
+
+#include "chunk_trace.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *stageNames[CHUNK_TRACE_STAGES] = {
+    "receive", "decode_in", "decoded", "dsp", "queued", "dequeued", "play",
+};
+
+static chunk_trace_record_t *ring = NULL;
+static uint32_t ringMask = 0;
+static uint32_t ringHead = 0;
+
+/**
+ *
+ */
+int32_t chunk_trace_init(uint32_t records) {
+  uint32_t n = 1;
+
+  if (ring != NULL) {
+    return 0;
+  }
+
+  while ((n << 1) <= records) {
+    n <<= 1;
+  }
+
+  ring = (chunk_trace_record_t *)calloc(n, sizeof(chunk_trace_record_t));
+  if (ring == NULL) {
+    return -1;
+  }
+
+  ringMask = n - 1;
+
+  return 0;
+}
+
+/**
+ *
+ */
+void chunk_trace_record(chunk_trace_stage_t stage, int64_t chunk, uint32_t aux,
+                        int64_t now) {
+  chunk_trace_record_t *r;
+  uint32_t idx;
+
+  if (ring == NULL) {
+    return;
+  }
+
+  idx = __atomic_fetch_add(&ringHead, 1, __ATOMIC_RELAXED);
+  r = &ring[idx & ringMask];
+
+  __atomic_store_n(&r->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  r->time = now;
+  r->chunk = chunk;
+  r->stage = (uint16_t)stage;
+  r->aux = (aux > UINT16_MAX) ? UINT16_MAX : (uint16_t)aux;
+  __atomic_store_n(&r->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ *
+ */
+const char *chunk_trace_stage_name(chunk_trace_stage_t stage) {
+  if ((uint32_t)stage >= CHUNK_TRACE_STAGES) {
+    return "unknown";
+  }
+
+  return stageNames[stage];
+}
+
+/**
+ * Copy record idx if it is still in the ring and complete.
+ */
+static bool chunk_trace_read(uint32_t idx, chunk_trace_record_t *out) {
+  const chunk_trace_record_t *r = &ring[idx & ringMask];
+
+  if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != idx + 1) {
+    return false;
+  }
+
+  out->time = r->time;
+  out->chunk = r->chunk;
+  out->stage = r->stage;
+  out->aux = r->aux;
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+  return __atomic_load_n(&r->seq, __ATOMIC_RELAXED) == idx + 1;
+}
+
+/**
+ *
+ */
+int32_t chunk_trace_export(chunk_trace_write_t write, void *arg) {
+  char line[256];
+  uint32_t head, first, idx, j;
+  int32_t events = 0;
+  int len, s;
+
+  len = snprintf(line, sizeof(line),
+                 "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  if (write(arg, line, len) < 0) {
+    return -1;
+  }
+
+  for (s = 0; s < CHUNK_TRACE_STAGES; s++) {
+    len = snprintf(line, sizeof(line),
+                   "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                   "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                   (s == 0) ? "" : ",", s, stageNames[s]);
+    if (write(arg, line, len) < 0) {
+      return -1;
+    }
+  }
+
+  if (ring != NULL) {
+    head = __atomic_load_n(&ringHead, __ATOMIC_ACQUIRE);
+
+    // leave the oldest quarter, it is overwritten first while we export
+    first = 0;
+    if (head > ringMask + 1) {
+      first = head - (ringMask + 1) + (ringMask + 1) / 4;
+    }
+
+    for (idx = first; idx != head; idx++) {
+      chunk_trace_record_t r, p;
+      bool found = false;
+
+      if (chunk_trace_read(idx, &r) == false) {
+        continue;
+      }
+
+      // the same chunk at the stage before
+      for (j = idx; (j != first) && (idx - j < CHUNK_TRACE_LOOKBACK);) {
+        j--;
+        if (chunk_trace_read(j, &p) && (p.chunk == r.chunk) &&
+            (p.stage < r.stage)) {
+          found = (r.time >= p.time);
+          break;
+        }
+      }
+
+      if (found) {
+        len = snprintf(line, sizeof(line),
+                       ",{\"name\":\"%s\",\"cat\":\"chunk\",\"ph\":\"X\","
+                       "\"ts\":%lld,\"dur\":%lld,\"pid\":1,\"tid\":%u,"
+                       "\"args\":{\"chunk\":%lld,\"aux\":%u,\"from\":\"%s\"}}",
+                       chunk_trace_stage_name(r.stage), (long long)p.time,
+                       (long long)(r.time - p.time), r.stage,
+                       (long long)r.chunk, r.aux,
+                       chunk_trace_stage_name(p.stage));
+      } else {
+        len = snprintf(line, sizeof(line),
+                       ",{\"name\":\"%s\",\"cat\":\"chunk\",\"ph\":\"i\","
+                       "\"s\":\"t\",\"ts\":%lld,\"pid\":1,\"tid\":%u,"
+                       "\"args\":{\"chunk\":%lld,\"aux\":%u}}",
+                       chunk_trace_stage_name(r.stage), (long long)r.time,
+                       r.stage, (long long)r.chunk, r.aux);
+      }
+
+      if (write(arg, line, len) < 0) {
+        return -1;
+      }
+
+      events++;
+    }
+  }
+
+  if (write(arg, "]}", 2) < 0) {
+    return -1;
+  }
+
+  return events;
+}
@@ -1,2 +1,4 @@
 COMPONENT_SRCDIRS := .
+# POSIX transport is only used by the host build
+COMPONENT_OBJEXCLUDE := snapcast_transport_posix.o
 # CFLAGS +=
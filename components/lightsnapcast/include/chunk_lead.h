@@ -0,0 +1,64 @@
+#ifndef __CHUNK_LEAD_H__
+#define __CHUNK_LEAD_H__
+
+#include <stdint.h>
+
+// histogram resolution and range of chunk latency
+#define CHUNK_LEAD_BIN_MS 4
+#define CHUNK_LEAD_BINS 512
+
+// statistics cover the last one to two windows
+#define CHUNK_LEAD_WINDOW_US 60000000LL
+
+// chunks needed before quantiles are given
+#define CHUNK_LEAD_MIN_SAMPLES 500
+
+// quantile of latency the recommended buffer covers, in 1/1000
+#define CHUNK_LEAD_SAFE_PERMILLE 999
+
+// added to the recommended buffer for decoding and scheduling
+#define CHUNK_LEAD_MARGIN_MS 20
+
+/**
+ * Latency of wire chunks: server time when a chunk is complete on the
+ * client minus its timestamp. A chunk has to be here at least the DMA lead
+ * before its play time, the timestamp plus the server buffer, so a buffer
+ * covering a high quantile of latency plus that lead is enough. Chunks wait
+ * in the local queue for the buffer minus their latency.
+ *
+ * Kept as histograms of the current and the last window, so the figures
+ * follow changes of the network within CHUNK_LEAD_WINDOW_US.
+ */
+typedef struct chunk_lead {
+  uint16_t bins[2][CHUNK_LEAD_BINS];
+  uint32_t count[2];
+  uint8_t current;
+  int64_t windowStart;
+  int64_t max;  // µs, since init
+} chunk_lead_t;
+
+void chunk_lead_init(chunk_lead_t *lead);
+
+/**
+ * Add the latency in µs of a chunk received at local time now.
+ *
+ * @return 1 if a window was completed, 0 otherwise
+ */
+int32_t chunk_lead_insert(chunk_lead_t *lead, int64_t latency, int64_t now);
+
+/**
+ * @return latency in ms not exceeded by permille / 1000 of the chunks, upper
+ * edge of its bin, or -1 if there are less than CHUNK_LEAD_MIN_SAMPLES
+ */
+int32_t chunk_lead_quantile_ms(const chunk_lead_t *lead, uint32_t permille);
+
+/**
+ * Server buffer that would play CHUNK_LEAD_SAFE_PERMILLE of chunks in time
+ * with dmaLeadMs of audio between the queue and the DAC, rounded up to
+ * 10ms.
+ *
+ * @return ms or -1 if not known yet
+ */
+int32_t chunk_lead_recommended_ms(const chunk_lead_t *lead, int32_t dmaLeadMs);
+
+#endif  // __CHUNK_LEAD_H__
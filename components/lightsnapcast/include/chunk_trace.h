@@ -0,0 +1,81 @@
+#ifndef __CHUNK_TRACE_H__
+#define __CHUNK_TRACE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#endif
+
+// stages a chunk passes from the socket to the DAC
+typedef enum chunk_trace_stage {
+  CHUNK_TRACE_RECEIVE = 0,  // wire chunk starts coming in, aux bytes
+  CHUNK_TRACE_DECODE_IN,    // decoder takes the chunk, aux bytes
+  CHUNK_TRACE_DECODED,      // decoded, aux bytes of pcm
+  CHUNK_TRACE_DSP,          // dsp_processor_worker() done
+  CHUNK_TRACE_QUEUED,       // insert_pcm_chunk(), aux chunks queued
+  CHUNK_TRACE_DEQUEUED,     // player_task took it, aux chunks queued
+  CHUNK_TRACE_PLAY,         // starts playing, from the last DMA EOF
+  CHUNK_TRACE_STAGES
+} chunk_trace_stage_t;
+
+// records looked back for the previous stage of a chunk on export
+#define CHUNK_TRACE_LOOKBACK 64
+
+typedef struct chunk_trace_record {
+  int64_t time;   // µs, local
+  int64_t chunk;  // µs, server timestamp of the chunk
+  uint32_t seq;   // index + 1 of the record, 0 while it is written
+  uint16_t stage;
+  uint16_t aux;
+} chunk_trace_record_t;
+
+/**
+ * @return number of bytes written or negative to stop the export
+ */
+typedef int (*chunk_trace_write_t)(void *arg, const char *data, size_t len);
+
+#if CONFIG_SNAPCLIENT_CHUNK_TRACE
+#define CHUNK_TRACE(stage, tv, aux)                                     \
+  chunk_trace_record((stage), (int64_t)(tv).sec * 1000000LL + (tv).usec, \
+                     (aux), esp_timer_get_time())
+#else
+#define CHUNK_TRACE(stage, tv, aux) \
+  do {                              \
+  } while (0)
+#endif
+
+/**
+ * Allocate the ring, records is rounded down to a power of 2. Until then
+ * chunk_trace_record() does nothing.
+ *
+ * @return 0 on success, -1 out of memory
+ */
+int32_t chunk_trace_init(uint32_t records);
+
+/**
+ * Lock free, from any task, overwrites the oldest record.
+ *
+ * @param aux clamped to 65535
+ */
+void chunk_trace_record(chunk_trace_stage_t stage, int64_t chunk, uint32_t aux,
+                        int64_t now);
+
+/**
+ * @return name of a stage as used in the export
+ */
+const char *chunk_trace_stage_name(chunk_trace_stage_t stage);
+
+/**
+ * Write the ring as Chrome trace event JSON, one thread per stage. A record
+ * whose chunk passed an earlier stage within CHUNK_TRACE_LOOKBACK records is
+ * a complete event lasting from there, others are instant events. Records
+ * overwritten while exporting are skipped.
+ *
+ * @return events written or negative if write failed
+ */
+int32_t chunk_trace_export(chunk_trace_write_t write, void *arg);
+
+#endif  // __CHUNK_TRACE_H__
@@ -0,0 +1,106 @@
+#ifndef __JITTER_BUFFER_H__
+#define __JITTER_BUFFER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// insert results
+#define JITTER_BUFFER_OK 0
+#define JITTER_BUFFER_STALE -1  // before the next chunk to play
+#define JITTER_BUFFER_FULL -2   // too far ahead, try again later
+
+// pop results
+#define JITTER_BUFFER_CHUNK 1
+#define JITTER_BUFFER_GAP 0
+#define JITTER_BUFFER_EMPTY -1
+
+typedef void (*jitter_buffer_free_t)(void *entry);
+
+/**
+ * Chunks indexed by timestamp instead of a FIFO of pointers. Slot n holds
+ * the chunk starting n chunk durations after the origin, modulo capacity,
+ * so finding the chunk due at a time, noticing a missing one and dropping
+ * everything before a time need no search.
+ *
+ * Chunks arrive in order over TCP, a timestamp more than half a chunk past
+ * the last one means chunks were lost on the way, e.g. for lack of memory.
+ * The player gets a gap for them to fill with silence instead of playing
+ * the next chunk early. Chunks with the same timestamp as the one before,
+ * as decoders may produce, go after it. A timestamp far off the buffered
+ * ones is taken as a new stream once the old one is played.
+ *
+ * Not thread safe.
+ */
+typedef struct jitter_buffer {
+  void **slots;
+  uint32_t capacity;
+  double chunkUs;  // chunk duration
+  int64_t origin;  // timestamp of sequence 0
+  int64_t head;    // sequence of the next chunk to play
+  int64_t tail;    // one past the last sequence inserted
+  uint32_t count;  // chunks held
+  bool anchored;   // origin is valid
+  jitter_buffer_free_t freeEntry;
+} jitter_buffer_t;
+
+/**
+ * @param capacity chunks held at most
+ * @param chunkUs duration of a chunk in µs
+ * @param freeEntry called for chunks dropped by the buffer
+ *
+ * @return 0 on success, -1 out of memory
+ */
+int32_t jitter_buffer_init(jitter_buffer_t *jb, uint32_t capacity,
+                           double chunkUs, jitter_buffer_free_t freeEntry);
+
+/**
+ * Free all chunks and the slots.
+ */
+void jitter_buffer_deinit(jitter_buffer_t *jb);
+
+/**
+ * Free all chunks, the next insert sets a new origin.
+ */
+void jitter_buffer_flush(jitter_buffer_t *jb);
+
+/**
+ * @param timestamp server time the chunk starts in µs
+ *
+ * @return JITTER_BUFFER_OK if the buffer took entry, JITTER_BUFFER_STALE or
+ * JITTER_BUFFER_FULL if not
+ */
+int32_t jitter_buffer_insert(jitter_buffer_t *jb, int64_t timestamp,
+                             void *entry);
+
+/**
+ * Take the next chunk to play.
+ *
+ * @param[out] entry the chunk, NULL on a gap
+ * @param[out] timestamp of the chunk or the missing one, may be NULL
+ *
+ * @return JITTER_BUFFER_CHUNK, JITTER_BUFFER_GAP if it is missing but later
+ * ones are here, JITTER_BUFFER_EMPTY if there is nothing to play
+ */
+int32_t jitter_buffer_pop(jitter_buffer_t *jb, void **entry,
+                          int64_t *timestamp);
+
+/**
+ * Free all chunks starting before timestamp, also skips the gaps there.
+ *
+ * @return chunks dropped
+ */
+uint32_t jitter_buffer_drop_before(jitter_buffer_t *jb, int64_t timestamp);
+
+/**
+ * O(1) lookup.
+ *
+ * @return the chunk playing at timestamp or NULL if not held
+ */
+void *jitter_buffer_at(const jitter_buffer_t *jb, int64_t timestamp);
+
+/**
+ * @return chunks held
+ */
+uint32_t jitter_buffer_count(const jitter_buffer_t *jb);
+
+#endif  // __JITTER_BUFFER_H__
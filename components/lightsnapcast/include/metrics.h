@@ -0,0 +1,93 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum metric_type {
+  METRIC_COUNTER = 0,
+  METRIC_GAUGE,
+  METRIC_HISTOGRAM,
+} metric_type_t;
+
+/**
+ * One time series, defined statically by the module updating it with the
+ * METRIC_*_INIT() macros and registered once. Metrics sharing a name, but
+ * with different labels, are one family and are registered one after the
+ * other.
+ */
+typedef struct metric {
+  const char *name;    // snake case, with the unit as suffix
+  const char *labels;  // e.g. kind="hard", or NULL
+  const char *help;
+  metric_type_t type;
+  bool (*read)(int32_t *value);  // gauge read on export, false to omit it
+  const int32_t *bounds;         // histogram bucket upper bounds, ascending
+  uint32_t buckets;              // number of bounds
+  uint32_t *counts;              // buckets + 1 counts, the last above all
+  int32_t value;                 // counter or gauge
+  int64_t sum;                   // histogram, sum of observed values
+  bool registered;
+  struct metric *next;
+} metric_t;
+
+#define METRIC_COUNTER_INIT(n, l, h) \
+  { .name = (n), .labels = (l), .help = (h), .type = METRIC_COUNTER }
+
+#define METRIC_GAUGE_INIT(n, l, h, r)                                  \
+  {                                                                    \
+    .name = (n), .labels = (l), .help = (h), .type = METRIC_GAUGE,     \
+    .read = (r)                                                        \
+  }
+
+// counts is an array of one more than bounds
+#define METRIC_HISTOGRAM_INIT(n, h, b, c)                                 \
+  {                                                                       \
+    .name = (n), .help = (h), .type = METRIC_HISTOGRAM, .bounds = (b),    \
+    .buckets = sizeof(b) / sizeof((b)[0]), .counts = (c)                  \
+  }
+
+/**
+ * @return number of bytes written or negative to stop the export
+ */
+typedef int (*metrics_write_t)(void *arg, const char *data, size_t len);
+
+/**
+ * Add a metric to the export, a second call is ignored. Not thread safe
+ * against itself, register from init code.
+ */
+void metrics_register(metric_t *m);
+
+/**
+ * Counter, gauge and histogram updates are atomic and take no lock, from
+ * any task. The 64 bit histogram sum is a short critical section inside
+ * the atomic on the ESP32.
+ */
+void metric_add(metric_t *m, int32_t n);
+
+/**
+ *
+ */
+static inline void metric_inc(metric_t *m) { metric_add(m, 1); }
+
+/**
+ *
+ */
+void metric_set(metric_t *m, int32_t value);
+
+/**
+ * Count value in the first bucket whose bound is at least value.
+ */
+void metric_observe(metric_t *m, int32_t value);
+
+/**
+ * Write all registered metrics in the Prometheus text format 0.0.4.
+ * Histogram buckets are read one by one, _count is their total so the
+ * buckets always add up.
+ *
+ * @return bytes written or negative if write failed
+ */
+int32_t metrics_export(metrics_write_t write, void *arg);
+
+#endif  // __METRICS_H__
@@ -0,0 +1,84 @@
+#ifndef __PCM_CHUNK_POOL_H__
+#define __PCM_CHUNK_POOL_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "player.h"
+
+// chunks besides the queue entries: one being decoded, one waiting for room
+// in the queue and one the player holds. Allocation doesn't fall back to the
+// heap, the player cuts its queue to the blocks the pool got beyond these so
+// it never misses mid-stream.
+#if CONFIG_SNAPCLIENT_I2S_ZERO_COPY
+// plus the chunks the DMA plays in place, returned once they were sent
+#define PCM_CHUNK_POOL_EXTRA (3 + CHNK_CTRL_CNT)
+#else
+#define PCM_CHUNK_POOL_EXTRA 3
+#endif
+
+// internal DRAM left to wifi, lwip and the decoders
+#define PCM_CHUNK_POOL_DRAM_RESERVE (48 * 1024)
+
+// chunks from a pool being destroyed get this long to be returned before
+// the pool is retired and freed with the last of them
+#define PCM_CHUNK_POOL_DESTROY_WAIT_MS 100
+
+#define PCM_CHUNK_POOL_MAX_REGIONS 8
+
+typedef struct pcm_chunk_pool_stats {
+  uint32_t blocks;     // blocks in the pool
+  size_t blockSize;    // bytes
+  uint32_t inUse;      // blocks currently allocated
+  uint32_t highWater;  // max blocks allocated at once
+  uint32_t hits;       // allocations served by the pool
+  uint32_t misses;     // allocations too large or with the pool exhausted
+} pcm_chunk_pool_stats_t;
+
+/**
+ * Build the pool for chunks of up to blockSize bytes. Payload blocks are
+ * carved from a few large allocations in IRAM (32 bit access only), PSRAM
+ * if available and internal DRAM, in this order. With byteAccess IRAM comes
+ * last, for decoders that write 16 bit samples straight into the chunk. Any
+ * pool left over is destroyed first.
+ *
+ * @return number of blocks, may be less than count if memory is short, or
+ * negative on error
+ */
+int32_t pcm_chunk_pool_create(size_t blockSize, uint32_t count,
+                              bool byteAccess);
+
+/**
+ * Stop allocating from the pool and free it once all chunks are returned.
+ */
+void pcm_chunk_pool_destroy(void);
+
+/**
+ * O(1), never blocks.
+ *
+ * @return chunk with a single fragment of bytes or NULL on a miss
+ */
+pcm_chunk_message_t *pcm_chunk_pool_alloc(size_t bytes);
+
+/**
+ * Return a chunk with pcmChunk->pool set, O(1).
+ */
+void pcm_chunk_pool_free(pcm_chunk_message_t *pcmChunk);
+
+/**
+ * pcm_chunk_pool_free() for the I2S interrupt, also safe from tasks. In IRAM
+ * and touching internal memory only, so it may run with the flash cache
+ * disabled like the IRAM_ATTR DMA callback that calls it. Memory can't be
+ * freed there, so the last chunk of a destroyed pool must not come back this
+ * way: stop I2S, which returns the chunks it holds, before
+ * pcm_chunk_pool_destroy().
+ */
+void pcm_chunk_pool_free_from_isr(pcm_chunk_message_t *pcmChunk);
+
+/**
+ * Counters of the current pool, all 0 if there is none.
+ */
+void pcm_chunk_pool_get_stats(pcm_chunk_pool_stats_t *stats);
+
+#endif  // __PCM_CHUNK_POOL_H__
@@ -0,0 +1,49 @@
+#ifndef __PCM_PACK_H__
+#define __PCM_PACK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PCM_PACK_MAX_CHANNELS 8
+
+/**
+ * Interleave planar decoder output into the I2S DMA layout.
+ *
+ * src[c] holds frames samples of channel c, sign extended from the input
+ * bit depth like FLAC__int32. The output is written as 32 bit words only,
+ * so dst may be in IRAM:
+ *   - 32 bit slots: one word per sample, left aligned, channel order
+ *   - 16 bit slots: two samples per word, the earlier one in the upper half,
+ *     24 and 32 bit input is truncated. An odd sample count leaves the lower
+ *     half of the last word 0.
+ */
+typedef void (*pcm_pack_fn_t)(void *dst, const int32_t *const src[],
+                              uint32_t frames);
+
+/**
+ * Kernel for input of bits (16, 24 or 32) with ch (1 - 8) channels and
+ * slotBits (16 or 32) output, chosen once per stream.
+ *
+ * @return NULL if the format is not supported
+ */
+pcm_pack_fn_t pcm_pack_select(uint8_t bits, uint8_t ch, uint8_t slotBits);
+
+/**
+ * Interleaved native 16 bit samples, as opus_decode() writes them, to the
+ * 16 bit slot layout. dst may be src for in place conversion. Both are
+ * accessed as 32 bit words only and must be 4 byte aligned, src is read up
+ * to the next word boundary.
+ */
+void pcm_pack_int16(void *dst, const void *src, uint32_t samples);
+
+/**
+ * I2S slot width the player uses for a stream of bits per sample.
+ */
+uint8_t pcm_pack_slot_bits(uint8_t bits);
+
+/**
+ * Size of frames packed by pcm_pack_select(bits, ch, slotBits).
+ */
+size_t pcm_pack_bytes(uint32_t frames, uint8_t ch, uint8_t slotBits);
+
+#endif  // __PCM_PACK_H__
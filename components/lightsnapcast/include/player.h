@@ -13,15 +13,12 @@
 // size?!
 #define CHNK_CTRL_CNT 2
 
-#define LATENCY_MEDIAN_FILTER_LEN 199
-#define LATENCY_MEDIAN_FILTER_FULL 19
-
-// set to 0 if you do not wish to be the median an average around actual
-// median average will be (LATENCY_MEDIAN_FILTER_LEN /
-// LATENCY_MEDIAN_AVG_DIVISOR) + 1 samples around median. e.g. if n=4 then
-// 2 samples above and below will be added plus the actual median. So in
-// reality n+1 samples will be averaged
-#define LATENCY_MEDIAN_AVG_DIVISOR 0
+// decoded chunks queued in front of the player if the stream buffer is kept
+// encoded (CONFIG_SNAPCLIENT_COMPRESSED_BUFFER), the ones going to DMA on
+// start plus a margin for decode time jitter
+#define PLAYER_DECODE_LEAD (CHNK_CTRL_CNT + 2)
+// longest a decoded chunk waits for room in the queue before it is dropped
+#define PLAYER_DECODE_AHEAD_WAIT_MS 2000
 
 #define SHORT_BUFFER_LEN 99
 #define MINI_BUFFER_LEN 19
@@ -33,10 +30,14 @@ struct pcm_chunk_fragment {
   pcm_chunk_fragment_t *nextFragment;
 };
 
+typedef struct pcm_chunk_pool pcm_chunk_pool_t;
+
 typedef struct pcmData {
   tv_t timestamp;
   uint32_t totalSize;
   pcm_chunk_fragment_t *fragment;
+  pcm_chunk_pool_t *pool;  // owning pool, NULL if allocated from heap
+  struct pcmData *aux;     // second DSP output as large, freed with it
 } pcm_chunk_message_t;
 
 typedef enum codec_type_e { NONE = 0, PCM, FLAC, OGG, OPUS } codec_type_t;
@@ -67,7 +68,7 @@ int32_t insert_pcm_chunk(pcm_chunk_message_t *pcmChunk);
 // int8_t insert_pcm_chunk (wire_chunk_message_t *decodedWireChunk);
 int8_t free_pcm_chunk(pcm_chunk_message_t *pcmChunk);
 
-int32_t player_latency_insert(int64_t newValue);
+int32_t player_latency_insert(int64_t diff, int64_t rtt, int64_t now);
 int32_t player_send_snapcast_setting(snapcastSetting_t *setting);
 int8_t player_get_snapcast_settings(snapcastSetting_t *setting);
 
@@ -78,4 +79,20 @@ int32_t server_now(int64_t *sNow, int64_t *diff2Server);
 
 int32_t pcm_chunk_queue_msg_waiting(void);
 
+/**
+ * Add a received wire chunk to the latency statistics. Lock free and never
+ * blocks, the player task adds it to them and logs the recommended buffer
+ * once a minute.
+ *
+ * @param chunkStart server time of the chunk's timestamp in µs
+ */
+int32_t player_chunk_received(int64_t chunkStart);
+
+/**
+ * @param[out] bufMs server buffer covering the measured chunk latency
+ *
+ * @return 0 on success, -1 if not measured yet
+ */
+int32_t player_get_recommended_buffer(int32_t *bufMs);
+
 #endif  // __PLAYER_H__
@@ -0,0 +1,89 @@
+#ifndef __RESAMPLER_H__
+#define __RESAMPLER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// windowed sinc taps per output sample, even
+#define RESAMPLER_TAPS 16
+
+// filter phases between two input frames, log2. output positions between
+// phases interpolate the coefficients linearly.
+#define RESAMPLER_PHASE_BITS 7
+#define RESAMPLER_PHASES (1 << RESAMPLER_PHASE_BITS)
+
+// Kaiser window beta and cutoff in fractions of the input sample rate. a
+// cutoff of 0.5 makes phase 0 a pass through, -0.3dB at 18kHz worst case
+#define RESAMPLER_KAISER_BETA 10.0
+#define RESAMPLER_CUTOFF 0.5
+
+// largest speed correction
+#define RESAMPLER_MAX_PPM 1000
+
+// input frames before the one an output position is centred on
+#define RESAMPLER_LEFT_TAPS (RESAMPLER_TAPS / 2 - 1)
+
+/**
+ * Drift correction by resampling with a continuously variable ratio close to
+ * 1. Input and output are in the I2S slot layout of pcm_pack.h, 16 bit slots
+ * with 16 bit samples or 32 bit slots with left aligned samples, which are
+ * resampled at 24 bit. Input is read 32 bit wise only so it may be in IRAM.
+ *
+ * Every output frame is a polyphase windowed sinc interpolation of
+ * RESAMPLER_TAPS input frames. Positions are kept in 32.32 fixed point, the
+ * step between output frames is 1 + ppm / 1e6 input frames. The last
+ * RESAMPLER_TAPS / 2 input frames of a chunk are needed as lookahead and
+ * come out with the next chunk.
+ */
+typedef struct resampler {
+  uint8_t ch;
+  uint8_t slotBits;
+  uint32_t maxFrames;  // largest input chunk
+
+  float *hist;      // interleaved input frames, history and current chunk
+  uint32_t filled;  // frames in hist
+
+  uint64_t pos;   // position of the next output frame in hist, 32.32
+  uint64_t step;  // input frames per output frame, 32.32
+  float ppm;
+
+  void *out;  // output of the last resampler_process()
+  uint32_t outMaxFrames;
+} resampler_t;
+
+/**
+ * Allocate buffers for chunks of up to maxFrames frames of ch channels in
+ * slotBits (16 or 32) slots. 16 bit slots need an even channel count.
+ *
+ * @return 0 on success, negative on error
+ */
+int32_t resampler_init(resampler_t *rs, uint32_t maxFrames, uint8_t ch,
+                       uint8_t slotBits);
+
+void resampler_free(resampler_t *rs);
+
+/**
+ * Start over after src was sent to the output unresampled, its last frames
+ * become the history of the next chunk. The speed is set back to nominal.
+ */
+void resampler_prime(resampler_t *rs, const void *src, uint32_t frames);
+
+/**
+ * Play faster (ppm > 0) or slower, clamped to +-RESAMPLER_MAX_PPM.
+ */
+void resampler_set_ppm(resampler_t *rs, float ppm);
+
+/**
+ * Resample a chunk, the output is in rs->out.
+ *
+ * @return number of output frames
+ */
+uint32_t resampler_process(resampler_t *rs, const void *src, uint32_t frames);
+
+/**
+ * Input frames given to resampler_process() that are not output yet, they
+ * go to the output ahead of the next chunk.
+ */
+float resampler_delay_frames(const resampler_t *rs);
+
+#endif  // __RESAMPLER_H__
@@ -0,0 +1,72 @@
+#ifndef __SAMPLE_SLIP_H__
+#define __SAMPLE_SLIP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// frames over which playback glides by one frame, 0.7ms at 48kHz
+#define SAMPLE_SLIP_FADE_FRAMES 32
+
+// positions per chunk the quietest fade is picked from
+#define SAMPLE_SLIP_CANDIDATES 8
+
+// largest speed correction, one frame per 2000 frame chunk
+#define SAMPLE_SLIP_MAX_PPM 500
+
+#define SAMPLE_SLIP_MAX_CH 8
+
+/**
+ * Drift correction by dropping or repeating single frames, independent of
+ * the clock hardware. Nothing is cut: within SAMPLE_SLIP_FADE_FRAMES the
+ * output moves from one input frame to its neighbour along a raised cosine
+ * ramp, so the discontinuity is a fractional delay glide instead of a
+ * click. The fade goes where the signal changes least between frames.
+ *
+ * Works on the I2S slot layout of pcm_pack.h at any channel count, 16 bit
+ * slots need an even one. The input is read 32 bit wise only so it may be
+ * in IRAM. sample_slip_fill() writes the output straight into the DMA
+ * buffers, see i2s_custom_write_cb(), no pass of its own over the chunk.
+ */
+typedef struct sample_slip {
+  uint8_t ch;
+  uint8_t slotBits;
+  uint32_t frameWords;  // 32 bit words per frame
+
+  // chunk being copied
+  const uint32_t *src;
+  uint32_t frames;     // input frames
+  uint32_t outFrames;  // frames + delta
+  uint32_t outPos;     // next output frame
+  int8_t delta;        // 1 repeats a frame, -1 drops one
+  uint32_t fadeAt;     // first output frame of the fade
+
+  // frame split at the end of a DMA buffer, its last carryBytes go first
+  uint32_t carry[SAMPLE_SLIP_MAX_CH];
+  uint32_t carryBytes;
+} sample_slip_t;
+
+/**
+ * @return 0 on success, negative on unsupported layout
+ */
+int32_t sample_slip_init(sample_slip_t *slip, uint8_t ch, uint8_t slotBits);
+
+/**
+ * Start copying a chunk of frames at src, with one frame more (delta 1),
+ * less (-1) or as is (0). Chunks shorter than the fade are copied as is.
+ *
+ * @return output frames
+ */
+uint32_t sample_slip_start(sample_slip_t *slip, const void *src,
+                           uint32_t frames, int8_t delta);
+
+/**
+ * Copy the next output frames to dst. A frame that doesn't fit whole is
+ * split, its rest starts the next call, so DMA buffers need not end on a
+ * frame. size is a multiple of 4. arg is the sample_slip_t, matches
+ * i2s_custom_fill_cb_t.
+ *
+ * @return bytes written to dst, 0 if the chunk is done
+ */
+size_t sample_slip_fill(void *dst, size_t size, void *arg);
+
+#endif  // __SAMPLE_SLIP_H__
@@ -0,0 +1,82 @@
+/* Capture format of received snapcast streams
+
+   A capture is a sequence of sessions, each starting with a session header
+   followed by records of raw received bytes:
+
+     session header: "SNAPCAP\0", u32 version, u32 reserved
+     record:         i64 local receive time in µs, u32 length, bytes
+
+   All values are little endian. Sessions start on every (re)connect so a
+   capture streamed out over the websocket can simply be concatenated.
+*/
+
+#ifndef __SNAPCAST_CAPTURE_H__
+#define __SNAPCAST_CAPTURE_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#define SNAPCAST_CAPTURE_MAGIC "SNAPCAP"
+#define SNAPCAST_CAPTURE_VERSION 1
+
+#define SNAPCAST_CAPTURE_SESSION_HEADER_SIZE 16
+#define SNAPCAST_CAPTURE_RECORD_HEADER_SIZE 12
+
+/**
+ *
+ */
+static inline void snapcast_capture_session_header(char *buf) {
+  memset(buf, 0, SNAPCAST_CAPTURE_SESSION_HEADER_SIZE);
+  memcpy(buf, SNAPCAST_CAPTURE_MAGIC, sizeof(SNAPCAST_CAPTURE_MAGIC));
+  buf[8] = SNAPCAST_CAPTURE_VERSION;
+}
+
+/**
+ * @return 1 if buf starts a session with a supported version, else 0
+ */
+static inline int snapcast_capture_is_session_header(const char *buf) {
+  return (memcmp(buf, SNAPCAST_CAPTURE_MAGIC, sizeof(SNAPCAST_CAPTURE_MAGIC)) ==
+          0) &&
+         (buf[8] == SNAPCAST_CAPTURE_VERSION);
+}
+
+/**
+ *
+ */
+static inline void snapcast_capture_record_header(char *buf, int64_t now,
+                                                  uint32_t len) {
+  uint64_t t = (uint64_t)now;
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    buf[i] = (char)(t >> (8 * i));
+  }
+
+  for (i = 0; i < 4; i++) {
+    buf[8 + i] = (char)(len >> (8 * i));
+  }
+}
+
+/**
+ *
+ */
+static inline void snapcast_capture_record_parse(const char *buf, int64_t *now,
+                                                 uint32_t *len) {
+  const uint8_t *b = (const uint8_t *)buf;
+  uint64_t t = 0;
+  uint32_t l = 0;
+  int i;
+
+  for (i = 7; i >= 0; i--) {
+    t = (t << 8) | b[i];
+  }
+
+  for (i = 3; i >= 0; i--) {
+    l = (l << 8) | b[8 + i];
+  }
+
+  *now = (int64_t)t;
+  *len = l;
+}
+
+#endif  // __SNAPCAST_CAPTURE_H__
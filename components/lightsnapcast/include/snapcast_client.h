@@ -0,0 +1,106 @@
+#ifndef __SNAPCAST_CLIENT_H__
+#define __SNAPCAST_CLIENT_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "snapcast.h"
+#include "snapcast_framer.h"
+
+/**
+ * Byte stream to the snapserver. The same client engine runs on lwIP netconn
+ * on target and on POSIX sockets on a linux host.
+ */
+typedef struct snapcast_transport {
+  void *ctx;
+
+  /** resolve and connect to the server, 0 on success */
+  int (*connect)(void *ctx);
+
+  /** send all of data, 0 on success. Called from time sync timer too */
+  int (*send)(void *ctx, const char *data, size_t len);
+
+  /**
+   * get the next received segment, it stays valid until the next call.
+   * >0 on success, 0 if nothing was received, <0 if connection is lost
+   */
+  int (*recv)(void *ctx, const char **data, size_t *len);
+
+  void (*close)(void *ctx);
+} snapcast_transport_t;
+
+/**
+ * Client events, a negative return value drops the connection.
+ */
+typedef struct snapcast_client_callbacks {
+  void *arg;
+
+  /** connected and hello sent, reset stream state */
+  int (*connected)(void *arg);
+
+  /** codec header, payload points into receive buffer */
+  int (*codec_header)(void *arg, const codec_header_message_t *msg);
+
+  int (*server_settings)(void *arg, const server_settings_message_t *msg);
+
+  /** SNAPCAST_FRAMER_MESSAGE and SNAPCAST_FRAMER_PAYLOAD of wire chunks */
+  int (*wire_chunk)(void *arg, const snapcast_frame_t *frame);
+
+  /** time message answer, diff to server and round trip time in µs and local
+   * receive time */
+  int (*time)(void *arg, int64_t diffToServer, int64_t rtt, int64_t now);
+
+  void (*disconnected)(void *arg);
+
+  /** every received segment and its local receive time, e.g. for capture */
+  void (*received)(void *arg, const char *data, size_t len, int64_t now);
+} snapcast_client_callbacks_t;
+
+typedef struct snapcast_client {
+  snapcast_transport_t *transport;
+  snapcast_client_callbacks_t cb;
+  int64_t (*now)(void);  // µs time base used for time sync
+  snapcast_framer_t framer;
+  char *msgBuf;  // codec header or server settings split between segments
+  uint16_t idCounter;
+  bool connected;
+
+  // statistics
+  uint64_t rxBytes;
+  uint32_t messages;
+  uint32_t wireChunks;
+} snapcast_client_t;
+
+int snapcast_client_init(snapcast_client_t *client,
+                         snapcast_transport_t *transport,
+                         const snapcast_client_callbacks_t *cb,
+                         int64_t (*now)(void));
+
+/**
+ * Connect to the server and send the hello message.
+ *
+ * @return 0 on success, -1 on error
+ */
+int snapcast_client_connect(snapcast_client_t *client, hello_message_t *hello);
+
+/**
+ * Receive one segment and dispatch all events found in it.
+ *
+ * @return 0 on success, -1 if the connection should be closed
+ */
+int snapcast_client_process(snapcast_client_t *client);
+
+void snapcast_client_disconnect(snapcast_client_t *client);
+
+/**
+ * Connect, process until the connection is lost and disconnect.
+ */
+int snapcast_client_run(snapcast_client_t *client, hello_message_t *hello);
+
+/**
+ * Send a time message, answer will be reported by the time callback.
+ */
+int snapcast_client_send_time_request(snapcast_client_t *client);
+
+#endif  // __SNAPCAST_CLIENT_H__
@@ -0,0 +1,69 @@
+#ifndef __SNAPCAST_CLOCK_H__
+#define __SNAPCAST_CLOCK_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// time sync samples used for the estimate
+#define SNAPCAST_CLOCK_WINDOW 64
+
+// samples needed before server time is trusted
+#define SNAPCAST_CLOCK_MIN_SAMPLES 5
+
+// samples must span this long before drift is estimated
+#define SNAPCAST_CLOCK_DRIFT_SPAN_US 10000000LL
+
+// crystal tolerance of server and client, larger drift estimates are clamped
+#define SNAPCAST_CLOCK_MAX_DRIFT_PPM 500
+
+// round trip time above the minimum at which a sample's weight halves
+#define SNAPCAST_CLOCK_RTT_SCALE_US 200
+
+typedef struct snapcast_clock_sample {
+  int64_t local;   // local receive time of the answer
+  int64_t offset;  // server time - local time
+  int64_t rtt;     // round trip time
+} snapcast_clock_sample_t;
+
+/**
+ * Model of the server clock as seen from the local clock:
+ *
+ *   server(t) = t + offset + drift * (t - ref)
+ *
+ * fitted by weighted linear regression over the last time sync samples.
+ * Samples are weighted by their round trip time relative to the fastest one,
+ * delayed answers carry an offset error up to half their extra delay.
+ */
+typedef struct snapcast_clock {
+  snapcast_clock_sample_t samples[SNAPCAST_CLOCK_WINDOW];
+  uint32_t count;  // valid samples
+  uint32_t head;   // next sample is written here
+
+  int64_t ref;     // local time the offset refers to
+  int64_t offset;  // µs
+  double drift;    // server µs per local µs - 1
+} snapcast_clock_t;
+
+void snapcast_clock_init(snapcast_clock_t *clock);
+
+/**
+ * Add a time sync sample and update the model.
+ *
+ * @param[in] local Local receive time of the time message answer.
+ * @param[in] offset Server time - local time calculated from the answer.
+ * @param[in] rtt Round trip time of the time message.
+ */
+void snapcast_clock_insert(snapcast_clock_t *clock, int64_t local,
+                           int64_t offset, int64_t rtt);
+
+/**
+ * @return true if enough samples were collected to predict server time
+ */
+bool snapcast_clock_ready(const snapcast_clock_t *clock);
+
+/**
+ * Predict server time - local time at local time now.
+ */
+int64_t snapcast_clock_offset(const snapcast_clock_t *clock, int64_t now);
+
+#endif  // __SNAPCAST_CLOCK_H__
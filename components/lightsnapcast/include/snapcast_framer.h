@@ -0,0 +1,65 @@
+#ifndef __SNAPCAST_FRAMER_H__
+#define __SNAPCAST_FRAMER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "snapcast.h"
+
+#define WIRE_CHUNK_HEADER_SIZE 12
+
+typedef enum snapcast_framer_event {
+  SNAPCAST_FRAMER_NEED_DATA = 0,  //!< input exhausted, partial state is kept
+  SNAPCAST_FRAMER_MESSAGE,  //!< base message and typed header are complete
+  SNAPCAST_FRAMER_PAYLOAD,  //!< a contiguous piece of the message payload
+  SNAPCAST_FRAMER_ERROR,    //!< malformed stream, framer must be reset
+} snapcast_framer_event_t;
+
+/**
+ * A frame describes what snapcast_framer_parse() found in the input. Payload
+ * pieces are views into the caller's segment and are only valid as long as
+ * the segment (e.g. netbuf) isn't released.
+ */
+typedef struct snapcast_frame {
+  snapcast_framer_event_t event;
+  base_message_t base;
+  wire_chunk_message_t wire_chunk;  // only valid for wire chunks, no payload
+  time_message_t time;              // only valid for time messages
+  const char *data;                 // payload piece
+  uint32_t len;                     // length of payload piece
+  uint32_t offset;                  // offset of payload piece inside payload
+  uint32_t total;                   // total payload length after typed header
+  bool complete;                    // this is the last event of the message
+} snapcast_frame_t;
+
+typedef struct snapcast_framer {
+  uint32_t state;
+  uint32_t fill;  // bytes already collected in hdr
+  char hdr[BASE_MESSAGE_SIZE];
+  base_message_t base;
+  wire_chunk_message_t wire_chunk;
+  time_message_t time;
+  uint32_t payloadPos;
+  uint32_t payloadLen;
+} snapcast_framer_t;
+
+void snapcast_framer_init(snapcast_framer_t *framer);
+
+/**
+ * Parse as much of data as is needed to produce the next frame event.
+ *
+ * Headers which are completely contained in data are decoded in place, only
+ * headers straddling a segment boundary are collected byte wise. Payload is
+ * never copied, the biggest possible contiguous piece is returned instead.
+ *
+ * @param[in] framer The framer holding the partial state between segments.
+ * @param[in] data The received segment.
+ * @param[in] len The length of the received segment.
+ * @param[out] frame The event found in data.
+ * @return number of consumed bytes
+ */
+size_t snapcast_framer_parse(snapcast_framer_t *framer, const char *data,
+                             size_t len, snapcast_frame_t *frame);
+
+#endif  // __SNAPCAST_FRAMER_H__
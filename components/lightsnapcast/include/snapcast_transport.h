@@ -0,0 +1,25 @@
+#ifndef __SNAPCAST_TRANSPORT_H__
+#define __SNAPCAST_TRANSPORT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "snapcast_client.h"
+
+/**
+ * lwIP netconn transport, used on target. Server is looked up through mDNS
+ * if useMdns is set, host and port are used otherwise.
+ */
+snapcast_transport_t *snapcast_transport_netconn_create(bool useMdns,
+                                                        const char *host,
+                                                        uint16_t port);
+void snapcast_transport_netconn_destroy(snapcast_transport_t *transport);
+
+/**
+ * POSIX socket transport, used for host builds.
+ */
+snapcast_transport_t *snapcast_transport_posix_create(const char *host,
+                                                      uint16_t port);
+void snapcast_transport_posix_destroy(snapcast_transport_t *transport);
+
+#endif  // __SNAPCAST_TRANSPORT_H__
@@ -0,0 +1,89 @@
+#ifndef __SYNC_CTRL_H__
+#define __SYNC_CTRL_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// the age error is corrected within SYNC_CTRL_TC_S, the integral part learns
+// the DAC clock's drift within SYNC_CTRL_TI_S. TI = 4 * TC is critically
+// damped.
+#define SYNC_CTRL_TC_S 1.0f
+#define SYNC_CTRL_TI_S 4.0f
+
+// largest APLL speed correction, the crystal is specified to +-10ppm
+#define SYNC_APLL_MAX_PPM 500
+
+// the APLL multiplier is only changed once the correction is this many 1/256
+// steps past the middle to the next step. Every write recalibrates the APLL,
+// 4 steps halve the writes of a noisy age against rounding alone.
+#define SYNC_APLL_HYSTERESIS 1024
+
+/**
+ * PI controller turning the filtered age error into a playback speed
+ * correction in ppm, used by the APLL and the resampler.
+ */
+typedef struct sync_ctrl {
+  float tc;      // proportional time constant in s
+  float ti;      // integral time constant in s
+  float maxPpm;  // output and integral limit
+  float drift;   // integral part, the learnt DAC clock drift in ppm
+} sync_ctrl_t;
+
+/**
+ *
+ */
+void sync_ctrl_init(sync_ctrl_t *ctrl, float tc, float ti, float maxPpm);
+
+/**
+ * Update from the age error err in µs, positive if we are late, dt µs after
+ * the last update.
+ *
+ * @return speed correction in ppm, positive to play faster
+ */
+float sync_ctrl_update(sync_ctrl_t *ctrl, int64_t err, int64_t dt);
+
+/**
+ * APLL coefficients for a speed correction. The APLL runs at
+ *
+ *   fout = xtal * (4 + sdm2 + sdm1 / 256 + sdm0 / 65536)
+ *
+ * so sdm2, sdm1 and sdm0 are one 16.16 fixed point multiplier and a speed
+ * correction scales it. o_div is left as is, sdm2 too because rev0 silicon
+ * ignores sdm1 and sdm0 and a changed sdm2 would be a jump of several
+ * percent there. One step of the multiplier is 1.2 to 1.8ppm with a 40MHz
+ * crystal, depending on the sample rate.
+ */
+typedef struct sync_apll {
+  int32_t nominal;  // multiplier without correction, 16.16
+  int32_t min;      // multiplier range with the same sdm2
+  int32_t max;
+  int32_t current;  // multiplier last returned by sync_apll_set_ppm()
+  int oDiv;
+} sync_apll_t;
+
+/**
+ * Start from the nominal coefficients, as found by i2s_apll_calculate_fi2s().
+ */
+void sync_apll_init(sync_apll_t *apll, int sdm0, int sdm1, int sdm2, int oDiv);
+
+/**
+ * Multiplier for a speed correction of ppm in 1/256 steps, 24.8 fixed point.
+ * Integer math but for converting ppm.
+ */
+int32_t sync_apll_target(const sync_apll_t *apll, float ppm);
+
+/**
+ * Coefficients for a speed correction of ppm, positive to play faster.
+ *
+ * @return true if they differ from the last call and the APLL needs to be
+ * written
+ */
+bool sync_apll_set_ppm(sync_apll_t *apll, float ppm, int *sdm0, int *sdm1,
+                       int *sdm2, int *oDiv);
+
+/**
+ * Correction the current coefficients actually give.
+ */
+float sync_apll_get_ppm(const sync_apll_t *apll);
+
+#endif  // __SYNC_CTRL_H__
@@ -0,0 +1,202 @@
+/* Timestamp indexed chunk buffer
+
+   Sequence numbers count chunk durations from the first timestamp seen,
+   slot = sequence % capacity. head to tail - 1 are the sequences that can
+   be held, slots of missing chunks in between stay NULL.
+*/
+
+#include "jitter_buffer.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ *
+ */
+static int64_t jitter_buffer_seq(const jitter_buffer_t *jb, int64_t timestamp) {
+  return (int64_t)floor((double)(timestamp - jb->origin) / jb->chunkUs + 0.5);
+}
+
+/**
+ *
+ */
+static int64_t jitter_buffer_ts(const jitter_buffer_t *jb, int64_t seq) {
+  return jb->origin + llround((double)seq * jb->chunkUs);
+}
+
+/**
+ *
+ */
+int32_t jitter_buffer_init(jitter_buffer_t *jb, uint32_t capacity,
+                           double chunkUs, jitter_buffer_free_t freeEntry) {
+  memset(jb, 0, sizeof(jitter_buffer_t));
+
+  jb->slots = (void **)calloc(capacity, sizeof(void *));
+  if (jb->slots == NULL) {
+    return -1;
+  }
+
+  jb->capacity = capacity;
+  jb->chunkUs = chunkUs;
+  jb->freeEntry = freeEntry;
+
+  return 0;
+}
+
+/**
+ *
+ */
+void jitter_buffer_deinit(jitter_buffer_t *jb) {
+  if (jb->slots == NULL) {
+    return;
+  }
+
+  jitter_buffer_flush(jb);
+  free(jb->slots);
+  jb->slots = NULL;
+  jb->capacity = 0;
+}
+
+/**
+ *
+ */
+void jitter_buffer_flush(jitter_buffer_t *jb) {
+  int64_t seq;
+
+  for (seq = jb->head; seq < jb->tail; seq++) {
+    void **slot = &jb->slots[seq % jb->capacity];
+
+    if (*slot != NULL) {
+      jb->freeEntry(*slot);
+      *slot = NULL;
+    }
+  }
+
+  jb->head = 0;
+  jb->tail = 0;
+  jb->count = 0;
+  jb->anchored = false;
+}
+
+/**
+ *
+ */
+int32_t jitter_buffer_insert(jitter_buffer_t *jb, int64_t timestamp,
+                             void *entry) {
+  int64_t seq = 0;
+
+  if (jb->anchored) {
+    seq = jitter_buffer_seq(jb, timestamp);
+
+    // a new stream, once the old one is played
+    if ((jb->count == 0) && ((seq < jb->head - (int64_t)jb->capacity) ||
+                             (seq >= jb->head + (int64_t)jb->capacity))) {
+      jb->anchored = false;
+    }
+  }
+
+  if (jb->anchored == false) {
+    jb->origin = timestamp;
+    jb->head = 0;
+    jb->tail = 0;
+    jb->anchored = true;
+    seq = 0;
+  }
+
+  if (seq < jb->head) {
+    return JITTER_BUFFER_STALE;
+  }
+
+  // same timestamp as the chunk before, keep the order they came in
+  if ((seq < jb->tail) && (jb->slots[seq % jb->capacity] != NULL)) {
+    seq = jb->tail;
+  }
+
+  if (seq >= jb->head + (int64_t)jb->capacity) {
+    return JITTER_BUFFER_FULL;
+  }
+
+  jb->slots[seq % jb->capacity] = entry;
+  jb->count++;
+  if (seq >= jb->tail) {
+    jb->tail = seq + 1;
+  }
+
+  return JITTER_BUFFER_OK;
+}
+
+/**
+ *
+ */
+int32_t jitter_buffer_pop(jitter_buffer_t *jb, void **entry,
+                          int64_t *timestamp) {
+  void **slot;
+
+  *entry = NULL;
+
+  if (jb->count == 0) {
+    return JITTER_BUFFER_EMPTY;
+  }
+
+  slot = &jb->slots[jb->head % jb->capacity];
+  if (timestamp != NULL) {
+    *timestamp = jitter_buffer_ts(jb, jb->head);
+  }
+  jb->head++;
+
+  if (*slot == NULL) {
+    return JITTER_BUFFER_GAP;
+  }
+
+  *entry = *slot;
+  *slot = NULL;
+  jb->count--;
+
+  return JITTER_BUFFER_CHUNK;
+}
+
+/**
+ *
+ */
+uint32_t jitter_buffer_drop_before(jitter_buffer_t *jb, int64_t timestamp) {
+  uint32_t dropped = 0;
+
+  while ((jb->count > 0) && (jitter_buffer_ts(jb, jb->head) < timestamp)) {
+    void **slot = &jb->slots[jb->head % jb->capacity];
+
+    if (*slot != NULL) {
+      jb->freeEntry(*slot);
+      *slot = NULL;
+      jb->count--;
+      dropped++;
+    }
+
+    jb->head++;
+  }
+
+  return dropped;
+}
+
+/**
+ *
+ */
+void *jitter_buffer_at(const jitter_buffer_t *jb, int64_t timestamp) {
+  int64_t seq;
+
+  if ((jb->anchored == false) || (jb->count == 0)) {
+    return NULL;
+  }
+
+  seq = (int64_t)floor((double)(timestamp - jb->origin) / jb->chunkUs);
+  if ((seq < jb->head) || (seq >= jb->tail)) {
+    return NULL;
+  }
+
+  return jb->slots[seq % jb->capacity];
+}
+
+/**
+ *
+ */
+uint32_t jitter_buffer_count(const jitter_buffer_t *jb) { return jb->count; }
@@ -0,0 +1,190 @@
+/* Counters, gauges and histograms for the Prometheus text format
+
+   Metrics are static structs owned by the module updating them and linked
+   into a list on registration. Updates are single atomic operations, the
+   export reads each value once and may mix updates from before and during
+   the scrape, which Prometheus tolerates.
+*/
+
+#include "metrics.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+static metric_t *head = NULL;
+static metric_t *tail = NULL;
+
+/**
+ *
+ */
+void metrics_register(metric_t *m) {
+  if (m->registered) {
+    return;
+  }
+
+  m->registered = true;
+  m->next = NULL;
+
+  if (tail == NULL) {
+    __atomic_store_n(&head, m, __ATOMIC_RELEASE);
+  } else {
+    __atomic_store_n(&tail->next, m, __ATOMIC_RELEASE);
+  }
+  tail = m;
+}
+
+/**
+ *
+ */
+void metric_add(metric_t *m, int32_t n) {
+  __atomic_fetch_add(&m->value, n, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ */
+void metric_set(metric_t *m, int32_t value) {
+  __atomic_store_n(&m->value, value, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ */
+void metric_observe(metric_t *m, int32_t value) {
+  uint32_t i;
+
+  for (i = 0; i < m->buckets; i++) {
+    if (value <= m->bounds[i]) {
+      break;
+    }
+  }
+
+  __atomic_fetch_add(&m->counts[i], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&m->sum, (int64_t)value, __ATOMIC_RELAXED);
+}
+
+/**
+ * snprintf() to write(), longer lines are cut.
+ */
+static int32_t metrics_line(metrics_write_t write, void *arg, char *line,
+                            size_t size, const char *fmt, ...) {
+  va_list ap;
+  int len;
+
+  va_start(ap, fmt);
+  len = vsnprintf(line, size, fmt, ap);
+  va_end(ap);
+
+  if (len < 0) {
+    return -1;
+  }
+  if ((size_t)len >= size) {
+    len = size - 1;
+  }
+
+  return write(arg, line, len) < 0 ? -1 : len;
+}
+
+/**
+ *
+ */
+static int32_t metrics_export_one(metrics_write_t write, void *arg,
+                                  const metric_t *m, char *line,
+                                  size_t size) {
+  const char *labels = (m->labels != NULL) ? m->labels : "";
+  const char *open = (m->labels != NULL) ? "{" : "";
+  const char *close = (m->labels != NULL) ? "}" : "";
+  const char *sep = (m->labels != NULL) ? "," : "";
+  int32_t len, total = 0;
+  uint32_t i, cumulative = 0;
+  int32_t value;
+
+  switch (m->type) {
+    case METRIC_COUNTER:
+      value = __atomic_load_n(&m->value, __ATOMIC_RELAXED);
+      return metrics_line(write, arg, line, size, "%s%s%s%s %u\n", m->name,
+                          open, labels, close, (uint32_t)value);
+
+    case METRIC_GAUGE:
+      if (m->read != NULL) {
+        if (m->read(&value) == false) {
+          return 0;
+        }
+      } else {
+        value = __atomic_load_n(&m->value, __ATOMIC_RELAXED);
+      }
+      return metrics_line(write, arg, line, size, "%s%s%s%s %d\n", m->name,
+                          open, labels, close, value);
+
+    case METRIC_HISTOGRAM:
+      for (i = 0; i <= m->buckets; i++) {
+        cumulative += __atomic_load_n(&m->counts[i], __ATOMIC_RELAXED);
+
+        if (i < m->buckets) {
+          len = metrics_line(write, arg, line, size,
+                             "%s_bucket{%s%sle=\"%d\"} %u\n", m->name, labels,
+                             sep, m->bounds[i], cumulative);
+        } else {
+          len = metrics_line(write, arg, line, size,
+                             "%s_bucket{%s%sle=\"+Inf\"} %u\n", m->name,
+                             labels, sep, cumulative);
+        }
+        if (len < 0) {
+          return -1;
+        }
+        total += len;
+      }
+
+      len = metrics_line(write, arg, line, size, "%s_sum%s%s%s %lld\n",
+                         m->name, open, labels, close,
+                         (long long)__atomic_load_n(&m->sum, __ATOMIC_RELAXED));
+      if (len < 0) {
+        return -1;
+      }
+      total += len;
+
+      len = metrics_line(write, arg, line, size, "%s_count%s%s%s %u\n",
+                         m->name, open, labels, close, cumulative);
+      if (len < 0) {
+        return -1;
+      }
+
+      return total + len;
+  }
+
+  return 0;
+}
+
+/**
+ *
+ */
+int32_t metrics_export(metrics_write_t write, void *arg) {
+  static const char *typeNames[] = {"counter", "gauge", "histogram"};
+  const char *family = NULL;
+  char line[256];
+  int32_t len, total = 0;
+  metric_t *m;
+
+  for (m = __atomic_load_n(&head, __ATOMIC_ACQUIRE); m != NULL;
+       m = __atomic_load_n(&m->next, __ATOMIC_ACQUIRE)) {
+    if ((family == NULL) || (strcmp(family, m->name) != 0)) {
+      len = metrics_line(write, arg, line, sizeof(line),
+                         "# HELP %s %s\n# TYPE %s %s\n", m->name, m->help,
+                         m->name, typeNames[m->type]);
+      if (len < 0) {
+        return -1;
+      }
+      total += len;
+      family = m->name;
+    }
+
+    len = metrics_export_one(write, arg, m, line, sizeof(line));
+    if (len < 0) {
+      return -1;
+    }
+    total += len;
+  }
+
+  return total;
+}
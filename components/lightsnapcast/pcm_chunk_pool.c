@@ -0,0 +1,344 @@
+/* Fixed block pool for decoded PCM chunks
+
+   Once the codec header is known every chunk has the same size, so chunk
+   descriptors and payload blocks are set up front when the player creates
+   its queue. Allocation and free only move a descriptor between the free
+   list and the caller, nothing fragments the heap mid-stream and large
+   contiguous regions waste less memory than one heap block per chunk.
+*/
+
+#include "pcm_chunk_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char *TAG = "PCM_POOL";
+// pcm_chunk_pool_free_from_isr() may run with the flash cache disabled
+static const char DRAM_ATTR isrTag[] = "PCM_POOL";
+
+typedef struct pcm_chunk_pool_entry pcm_chunk_pool_entry_t;
+struct pcm_chunk_pool_entry {
+  pcm_chunk_message_t chunk;  // must be first, see pcm_chunk_pool_free()
+  pcm_chunk_fragment_t fragment;
+  pcm_chunk_pool_entry_t *next;
+};
+
+struct pcm_chunk_pool {
+  pcm_chunk_pool_entry_t *entries;
+  pcm_chunk_pool_entry_t *freeList;
+  void *regions[PCM_CHUNK_POOL_MAX_REGIONS];
+  uint32_t regionCnt;
+  bool retired;  // destroyed, freed when the last chunk is returned
+  pcm_chunk_pool_stats_t stats;
+};
+
+typedef struct pcm_chunk_pool_region {
+  uint32_t caps;
+  size_t reserve;
+  bool wordOnly;  // no 8 and 16 bit access
+} pcm_chunk_pool_region_t;
+
+static const pcm_chunk_pool_region_t poolRegions[] = {
+#if CONFIG_SNAPCLIENT_I2S_ZERO_COPY
+    // played by the DMA in place, see i2s_custom_write_zero_copy()
+    {MALLOC_CAP_DMA, PCM_CHUNK_POOL_DRAM_RESERVE, false},
+#endif
+    {MALLOC_CAP_32BIT | MALLOC_CAP_EXEC, 0, true},
+#if CONFIG_SPIRAM
+    {MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT, 0, false},
+#endif
+    {MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT, PCM_CHUNK_POOL_DRAM_RESERVE,
+     false},
+};
+
+static pcm_chunk_pool_t *currentPool = NULL;
+static portMUX_TYPE poolMux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ *
+ */
+static void pcm_chunk_pool_release(pcm_chunk_pool_t *pool) {
+  uint32_t i;
+
+  for (i = 0; i < pool->regionCnt; i++) {
+    heap_caps_free(pool->regions[i]);
+  }
+
+  heap_caps_free(pool->entries);
+  free(pool);
+}
+
+/**
+ *
+ */
+static void pcm_chunk_pool_log_stats(const char *what,
+                                     const pcm_chunk_pool_stats_t *stats) {
+  ESP_LOGI(TAG,
+           "%s: %u blocks of %u bytes, in use %u, high water %u, hits %u, "
+           "misses %u",
+           what, stats->blocks, stats->blockSize, stats->inUse,
+           stats->highWater, stats->hits, stats->misses);
+}
+
+/**
+ * Carve blocks from region until the pool has count or the region is out of
+ * memory.
+ */
+static void pcm_chunk_pool_fill(pcm_chunk_pool_t *pool,
+                                const pcm_chunk_pool_region_t *region,
+                                size_t blockSize, uint32_t count) {
+  // a region may consist of several heap blocks
+  while ((pool->stats.blocks < count) &&
+         (pool->regionCnt < PCM_CHUNK_POOL_MAX_REGIONS)) {
+    size_t freeMem = heap_caps_get_free_size(region->caps);
+    size_t avail = heap_caps_get_largest_free_block(region->caps);
+    uint32_t n, i;
+    char *mem;
+
+    if (freeMem <= region->reserve) {
+      break;
+    }
+
+    if (avail > freeMem - region->reserve) {
+      avail = freeMem - region->reserve;
+    }
+
+    n = avail / blockSize;
+    if (n > count - pool->stats.blocks) {
+      n = count - pool->stats.blocks;
+    }
+
+    if (n == 0) {
+      break;
+    }
+
+    mem = (char *)heap_caps_malloc(n * blockSize, region->caps);
+    if (mem == NULL) {
+      break;
+    }
+
+    pool->regions[pool->regionCnt++] = mem;
+
+    for (i = 0; i < n; i++) {
+      pcm_chunk_pool_entry_t *entry = &pool->entries[pool->stats.blocks++];
+
+      entry->chunk.fragment = &entry->fragment;
+      entry->chunk.pool = pool;
+      entry->fragment.payload = mem + i * blockSize;
+      entry->next = pool->freeList;
+      pool->freeList = entry;
+    }
+
+    ESP_LOGI(TAG, "%u blocks from caps 0x%x", n, region->caps);
+  }
+}
+
+/**
+ *
+ */
+int32_t pcm_chunk_pool_create(size_t blockSize, uint32_t count,
+                              bool byteAccess) {
+  pcm_chunk_pool_t *pool;
+  uint32_t r;
+
+  if ((blockSize == 0) || (count == 0)) {
+    return -1;
+  }
+
+  pcm_chunk_pool_destroy();
+
+  // payload is accessed 32 bit wise, also needed for IRAM
+  blockSize = (blockSize + 3) & ~3;
+
+  // internal like the descriptors, both are touched from the I2S interrupt
+  pool = (pcm_chunk_pool_t *)heap_caps_calloc(
+      1, sizeof(pcm_chunk_pool_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  if (pool == NULL) {
+    ESP_LOGE(TAG, "Failed to allocate pool");
+
+    return -2;
+  }
+
+  pool->entries = (pcm_chunk_pool_entry_t *)heap_caps_calloc(
+      count, sizeof(pcm_chunk_pool_entry_t),
+      MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  if (pool->entries == NULL) {
+    ESP_LOGE(TAG, "Failed to allocate %u chunk descriptors", count);
+
+    free(pool);
+
+    return -2;
+  }
+
+  pool->stats.blockSize = blockSize;
+
+  for (r = 0; r < sizeof(poolRegions) / sizeof(poolRegions[0]); r++) {
+    if ((byteAccess == false) || (poolRegions[r].wordOnly == false)) {
+      pcm_chunk_pool_fill(pool, &poolRegions[r], blockSize, count);
+    }
+  }
+
+  // IRAM only for what is left
+  if (byteAccess == true) {
+    for (r = 0; r < sizeof(poolRegions) / sizeof(poolRegions[0]); r++) {
+      if (poolRegions[r].wordOnly == true) {
+        pcm_chunk_pool_fill(pool, &poolRegions[r], blockSize, count);
+      }
+    }
+  }
+
+  if (pool->stats.blocks < count) {
+    ESP_LOGW(TAG, "got %u of %u blocks, buffer will be shorter",
+             pool->stats.blocks, count);
+  }
+
+  portENTER_CRITICAL(&poolMux);
+  currentPool = pool;
+  portEXIT_CRITICAL(&poolMux);
+
+  pcm_chunk_pool_log_stats("created", &pool->stats);
+
+  return pool->stats.blocks;
+}
+
+/**
+ *
+ */
+void pcm_chunk_pool_destroy(void) {
+  pcm_chunk_pool_t *pool;
+  pcm_chunk_pool_stats_t stats;
+  bool release;
+  int i;
+
+  portENTER_CRITICAL(&poolMux);
+  pool = currentPool;
+  currentPool = NULL;
+  portEXIT_CRITICAL(&poolMux);
+
+  if (pool == NULL) {
+    return;
+  }
+
+  // chunks in flight from decoder to queue come back soon
+  for (i = 0; i < PCM_CHUNK_POOL_DESTROY_WAIT_MS; i++) {
+    portENTER_CRITICAL(&poolMux);
+    stats = pool->stats;
+    portEXIT_CRITICAL(&poolMux);
+
+    if (stats.inUse == 0) {
+      break;
+    }
+
+    vTaskDelay(pdMS_TO_TICKS(1));
+  }
+
+  portENTER_CRITICAL(&poolMux);
+  stats = pool->stats;
+  pool->retired = true;
+  release = (pool->stats.inUse == 0);
+  portEXIT_CRITICAL(&poolMux);
+
+  pcm_chunk_pool_log_stats("destroyed", &stats);
+
+  if (release) {
+    pcm_chunk_pool_release(pool);
+  } else {
+    ESP_LOGW(TAG, "%u chunks still in use, pool freed with the last one",
+             stats.inUse);
+  }
+}
+
+/**
+ *
+ */
+pcm_chunk_message_t *pcm_chunk_pool_alloc(size_t bytes) {
+  pcm_chunk_pool_entry_t *entry = NULL;
+
+  portENTER_CRITICAL(&poolMux);
+  if (currentPool != NULL) {
+    if ((bytes <= currentPool->stats.blockSize) &&
+        (currentPool->freeList != NULL)) {
+      entry = currentPool->freeList;
+      currentPool->freeList = entry->next;
+      currentPool->stats.hits++;
+      currentPool->stats.inUse++;
+      if (currentPool->stats.inUse > currentPool->stats.highWater) {
+        currentPool->stats.highWater = currentPool->stats.inUse;
+      }
+    } else {
+      currentPool->stats.misses++;
+    }
+  }
+  portEXIT_CRITICAL(&poolMux);
+
+  if (entry == NULL) {
+    return NULL;
+  }
+
+  memset(&entry->chunk.timestamp, 0, sizeof(entry->chunk.timestamp));
+  entry->chunk.totalSize = bytes;
+  entry->fragment.size = bytes;
+  entry->fragment.nextFragment = NULL;
+  entry->chunk.aux = NULL;
+
+  return &entry->chunk;
+}
+
+/**
+ *
+ */
+void pcm_chunk_pool_free(pcm_chunk_message_t *pcmChunk) {
+  pcm_chunk_pool_entry_t *entry = (pcm_chunk_pool_entry_t *)pcmChunk;
+  pcm_chunk_pool_t *pool = pcmChunk->pool;
+  bool release;
+
+  portENTER_CRITICAL(&poolMux);
+  entry->next = pool->freeList;
+  pool->freeList = entry;
+  pool->stats.inUse--;
+  release = pool->retired && (pool->stats.inUse == 0);
+  portEXIT_CRITICAL(&poolMux);
+
+  if (release) {
+    pcm_chunk_pool_release(pool);
+  }
+}
+
+/**
+ *
+ */
+void IRAM_ATTR pcm_chunk_pool_free_from_isr(pcm_chunk_message_t *pcmChunk) {
+  pcm_chunk_pool_entry_t *entry = (pcm_chunk_pool_entry_t *)pcmChunk;
+  pcm_chunk_pool_t *pool = pcmChunk->pool;
+  bool release;
+
+  portENTER_CRITICAL_SAFE(&poolMux);
+  entry->next = pool->freeList;
+  pool->freeList = entry;
+  pool->stats.inUse--;
+  release = pool->retired && (pool->stats.inUse == 0);
+  portEXIT_CRITICAL_SAFE(&poolMux);
+
+  if (release) {
+    ESP_DRAM_LOGE(isrTag, "last chunk of a destroyed pool, pool not freed");
+  }
+}
+
+/**
+ *
+ */
+void pcm_chunk_pool_get_stats(pcm_chunk_pool_stats_t *stats) {
+  portENTER_CRITICAL(&poolMux);
+  if (currentPool != NULL) {
+    *stats = currentPool->stats;
+  } else {
+    memset(stats, 0, sizeof(pcm_chunk_pool_stats_t));
+  }
+  portEXIT_CRITICAL(&poolMux);
+}
@@ -0,0 +1,179 @@
+/* Planar to interleaved packing for the I2S DMA layout
+
+   One kernel per input depth, channel count and slot width, generated from
+   two inline templates. Channel count and shifts are compile time constants
+   in every kernel, so the per channel loops unroll completely and nothing
+   but the frame loop branches.
+*/
+
+#include "pcm_pack.h"
+
+/**
+ * 32 bit slots, one word per sample.
+ */
+static inline __attribute__((always_inline)) void pack_slot32(
+    void *dst, const int32_t *const src[], uint32_t frames, const uint32_t ch,
+    const uint32_t shift) {
+  volatile uint32_t *out = (volatile uint32_t *)dst;
+  uint32_t i, c;
+
+  for (i = 0; i < frames; i++) {
+#pragma GCC unroll 8
+    for (c = 0; c < ch; c++) {
+      out[c] = (uint32_t)src[c][i] << shift;
+    }
+
+    out += ch;
+  }
+}
+
+/**
+ *
+ */
+static inline __attribute__((always_inline)) uint32_t pack_pair(
+    int32_t first, int32_t second, const uint32_t shift) {
+  return ((uint32_t)(first >> shift) << 16) |
+         ((uint32_t)(second >> shift) & 0xFFFF);
+}
+
+/**
+ * 16 bit slots, two samples per word.
+ */
+static inline __attribute__((always_inline)) void pack_slot16(
+    void *dst, const int32_t *const src[], uint32_t frames, const uint32_t ch,
+    const uint32_t shift) {
+  // odd channel counts fill whole words every two frames
+  const uint32_t step = (ch & 1) ? 2 : 1;
+  volatile uint32_t *out = (volatile uint32_t *)dst;
+  uint32_t i, w;
+
+  for (i = 0; i + step <= frames; i += step) {
+#pragma GCC unroll 8
+    for (w = 0; w < step * ch / 2; w++) {
+      // samples 2w and 2w + 1 of this step in frame order
+      out[w] = pack_pair(src[(2 * w) % ch][i + (2 * w) / ch],
+                         src[(2 * w + 1) % ch][i + (2 * w + 1) / ch], shift);
+    }
+
+    out += step * ch / 2;
+  }
+
+  if (i < frames) {
+    // last frame of an odd count with odd channels
+#pragma GCC unroll 8
+    for (w = 0; w < ch / 2; w++) {
+      out[w] = pack_pair(src[2 * w][i], src[2 * w + 1][i], shift);
+    }
+
+    out[ch / 2] = (uint32_t)(src[ch - 1][i] >> shift) << 16;
+  }
+}
+
+#define PCM_PACK_KERNELS(BITS, CH)                                         \
+  static void pack_##BITS##_##CH##_slot16(                                 \
+      void *dst, const int32_t *const src[], uint32_t frames) {            \
+    pack_slot16(dst, src, frames, CH, BITS - 16);                          \
+  }                                                                        \
+  static void pack_##BITS##_##CH##_slot32(                                 \
+      void *dst, const int32_t *const src[], uint32_t frames) {            \
+    pack_slot32(dst, src, frames, CH, 32 - BITS);                          \
+  }
+
+#define PCM_PACK_DEPTH(BITS) \
+  PCM_PACK_KERNELS(BITS, 1)  \
+  PCM_PACK_KERNELS(BITS, 2)  \
+  PCM_PACK_KERNELS(BITS, 3)  \
+  PCM_PACK_KERNELS(BITS, 4)  \
+  PCM_PACK_KERNELS(BITS, 5)  \
+  PCM_PACK_KERNELS(BITS, 6)  \
+  PCM_PACK_KERNELS(BITS, 7)  \
+  PCM_PACK_KERNELS(BITS, 8)
+
+PCM_PACK_DEPTH(16)
+PCM_PACK_DEPTH(24)
+PCM_PACK_DEPTH(32)
+
+#define PCM_PACK_ENTRY(BITS, CH) \
+  { pack_##BITS##_##CH##_slot16, pack_##BITS##_##CH##_slot32 }
+
+#define PCM_PACK_ENTRIES(BITS)                                             \
+  {                                                                        \
+    PCM_PACK_ENTRY(BITS, 1), PCM_PACK_ENTRY(BITS, 2),                      \
+        PCM_PACK_ENTRY(BITS, 3), PCM_PACK_ENTRY(BITS, 4),                  \
+        PCM_PACK_ENTRY(BITS, 5), PCM_PACK_ENTRY(BITS, 6),                  \
+        PCM_PACK_ENTRY(BITS, 7), PCM_PACK_ENTRY(BITS, 8)                   \
+  }
+
+// [16, 24, 32 bit input][channels - 1][16, 32 bit slots]
+static const pcm_pack_fn_t packKernels[3][PCM_PACK_MAX_CHANNELS][2] = {
+    PCM_PACK_ENTRIES(16),
+    PCM_PACK_ENTRIES(24),
+    PCM_PACK_ENTRIES(32),
+};
+
+/**
+ *
+ */
+pcm_pack_fn_t pcm_pack_select(uint8_t bits, uint8_t ch, uint8_t slotBits) {
+  int depth;
+
+  switch (bits) {
+    case 16:
+      depth = 0;
+      break;
+    case 24:
+      depth = 1;
+      break;
+    case 32:
+      depth = 2;
+      break;
+    default:
+      return NULL;
+  }
+
+  if ((ch < 1) || (ch > PCM_PACK_MAX_CHANNELS) ||
+      ((slotBits != 16) && (slotBits != 32))) {
+    return NULL;
+  }
+
+  return packKernels[depth][ch - 1][slotBits / 16 - 1];
+}
+
+/**
+ *
+ */
+void pcm_pack_int16(void *dst, const void *src, uint32_t samples) {
+  volatile uint32_t *out = (volatile uint32_t *)dst;
+  const volatile uint32_t *in = (const volatile uint32_t *)src;
+  uint32_t words = samples / 2;
+  uint32_t i;
+
+  // the earlier sample sits in the lower half of a little endian word
+  for (i = 0; i < words; i++) {
+    uint32_t w = in[i];
+
+    out[i] = (w << 16) | (w >> 16);
+  }
+
+  if (samples & 1) {
+    out[words] = in[words] << 16;
+  }
+}
+
+/**
+ *
+ */
+uint8_t pcm_pack_slot_bits(uint8_t bits) { return (bits <= 16) ? 16 : 32; }
+
+/**
+ *
+ */
+size_t pcm_pack_bytes(uint32_t frames, uint8_t ch, uint8_t slotBits) {
+  size_t samples = (size_t)frames * ch;
+
+  if (slotBits == 16) {
+    return (samples + 1) / 2 * 4;
+  }
+
+  return samples * 4;
+}
@@ -22,18 +22,33 @@
 
 #include "MedianFilter.h"
 #include "board_pins_config.h"
+#include "chunk_lead.h"
+#include "chunk_trace.h"
+#include "jitter_buffer.h"
+#include "metrics.h"
+#include "pcm_chunk_pool.h"
+#include "pcm_pack.h"
 #include "player.h"
+#include "resampler.h"
+#include "sample_slip.h"
 #include "snapcast.h"
+#include "snapcast_clock.h"
+#include "sync_ctrl.h"
 
 #include "i2s.h"  // use custom i2s driver instead of IDF version
 
 #include <math.h>
 
-#define USE_SAMPLE_INSERTION 0  // TODO: doesn't work as intended
-
 #define SYNC_TASK_PRIORITY (configMAX_PRIORITIES - 1)
 #define SYNC_TASK_CORE_ID 1  // tskNO_AFFINITY
 
+// the deepest calls of player_task() are an ESP_LOGx with 64 bit or float
+// arguments, about 1.5k in newlib's vfprintf, and the resampler's taps and
+// unpacking or the sample slip fill called from inside i2s_custom_write*().
+// 2048 + 512 left a few hundred bytes with the resampler, this leaves about
+// 1k. Check snapclient_player_stack_free_bytes on /metrics after a change.
+#define SYNC_TASK_STACK_SIZE 4096
+
 static const char *TAG = "PLAYER";
 
 /**
@@ -44,14 +59,27 @@ static const char *TAG = "PLAYER";
  * I2S bit clock is (apll_freq / 16)
  */
 static int apll_normal_predefine[6] = {0, 0, 0, 0, 0, 0};
-static int apll_corr_predefine[][6] = {{0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0}};
+static sync_apll_t apll;  //!< speed corrections derived from the above
 
 static SemaphoreHandle_t latencyBufSemaphoreHandle = NULL;
 
 static bool latencyBuffFull = 0;
 
-static sMedianFilter_t latencyMedianFilter;
-static sMedianNode_t latencyMedianLong[LATENCY_MEDIAN_FILTER_LEN];
+static snapcast_clock_t serverClock;
+
+static SemaphoreHandle_t chunkLeadMux = NULL;
+static chunk_lead_t chunkLead;  //!< latency of received wire chunks
+
+// wire chunks as received, moved into chunkLead by the player task so the
+// receiving task never waits for it. Single producer, single consumer.
+#define CHUNK_LEAD_RING_LEN 128
+typedef struct chunk_lead_entry {
+  int64_t chunkStart;  // server time
+  int64_t received;    // local time
+} chunk_lead_entry_t;
+static chunk_lead_entry_t chunkLeadRing[CHUNK_LEAD_RING_LEN];
+static uint32_t chunkLeadHead = 0;  //!< written by the receiving task
+static uint32_t chunkLeadTail = 0;  //!< written by the player task
 
 static sMedianFilter_t shortMedianFilter;
 static sMedianNode_t shortMedianBuffer[SHORT_BUFFER_LEN];
@@ -59,14 +87,93 @@ static sMedianNode_t shortMedianBuffer[SHORT_BUFFER_LEN];
 static sMedianFilter_t miniMedianFilter;
 static sMedianNode_t miniMedianBuffer[MINI_BUFFER_LEN];
 
-static int64_t latencyToServer = 0;
+static sync_ctrl_t syncCtrl;  //!< speed correction from the age error
 
-static int8_t currentDir = 0;  //!< current apll direction, see apll_adjust()
+#if CONFIG_SNAPCLIENT_SYNC_RESAMPLER
+static resampler_t resampler;
+#elif CONFIG_SNAPCLIENT_SYNC_SAMPLE_INSERTION
+static sample_slip_t sampleSlip;
+static float slipFrames = 0.0f;  //!< frames to drop, negative to insert
+#endif
 
-static QueueHandle_t pcmChkQHdl = NULL;
+// chunks by timestamp, NULL if not created, guarded by playerPcmQueueMux
+static jitter_buffer_t pcmJitterBuf;
+static jitter_buffer_t *pcmChkBuf = NULL;
+static SemaphoreHandle_t pcmChkAvailable = NULL;  //!< given on every insert
+// stands in for a missing chunk, set up with the queue. The player holds
+// one chunk at a time, so one descriptor is enough.
+static pcm_chunk_fragment_t pcmChkGapFragment;
+static pcm_chunk_message_t pcmChkGap = {.fragment = &pcmChkGapFragment};
+static bool decodeAhead = false;  //!< queue only holds the decoded lead
 
 static TaskHandle_t playerTaskHandle = NULL;
 
+static const int32_t ageErrorBounds[] = {
+    -10000, -5000, -2000, -1000, -500, -200, -100, -50, -20, 0,
+    20,     50,    100,   200,   500,  1000, 2000, 5000, 10000,
+};
+static uint32_t ageErrorCounts[sizeof(ageErrorBounds) /
+                                   sizeof(ageErrorBounds[0]) +
+                               1];
+static metric_t ageErrorMetric = METRIC_HISTOGRAM_INIT(
+    "snapclient_age_error_us",
+    "Age of the chunk played against its timestamp, positive if late",
+    ageErrorBounds, ageErrorCounts);
+
+static const char resyncHelp[] =
+    "Hard resyncs restart playback, soft ones write the APLL or slip a frame";
+static metric_t hardResyncMetric = METRIC_COUNTER_INIT(
+    "snapclient_resyncs_total", "kind=\"hard\"", resyncHelp);
+static metric_t softResyncMetric = METRIC_COUNTER_INIT(
+    "snapclient_resyncs_total", "kind=\"soft\"", resyncHelp);
+
+static const char speedHelp[] =
+    "Chunks played at corrected speed, rate by dir is the duty cycle";
+static metric_t speedFasterMetric = METRIC_COUNTER_INIT(
+    "snapclient_speed_chunks_total", "dir=\"faster\"", speedHelp);
+static metric_t speedSlowerMetric = METRIC_COUNTER_INIT(
+    "snapclient_speed_chunks_total", "dir=\"slower\"", speedHelp);
+static metric_t speedNominalMetric = METRIC_COUNTER_INIT(
+    "snapclient_speed_chunks_total", "dir=\"nominal\"", speedHelp);
+
+static metric_t queueMetric =
+    METRIC_GAUGE_INIT("snapclient_queue_chunks", NULL,
+                      "Decoded chunks waiting to be played", NULL);
+
+static bool read_pool_hits(int32_t *value);
+static bool read_pool_misses(int32_t *value);
+static bool read_pool_high_water(int32_t *value);
+static bool read_pool_blocks(int32_t *value);
+static bool read_recommended_buffer(int32_t *value);
+static bool read_player_stack_free(int32_t *value);
+
+static const char poolAllocsHelp[] =
+    "Chunk allocations from the pcm chunk pool of the current stream, a miss "
+    "drops the chunk";
+static metric_t poolHitsMetric =
+    METRIC_GAUGE_INIT("snapclient_pcm_pool_allocs_chunks", "result=\"hit\"",
+                      poolAllocsHelp, read_pool_hits);
+static metric_t poolMissesMetric =
+    METRIC_GAUGE_INIT("snapclient_pcm_pool_allocs_chunks", "result=\"miss\"",
+                      poolAllocsHelp, read_pool_misses);
+static metric_t poolHighWaterMetric = METRIC_GAUGE_INIT(
+    "snapclient_pcm_pool_high_water_chunks", NULL,
+    "Most pcm chunk pool blocks in use at once in the current stream",
+    read_pool_high_water);
+static metric_t poolBlocksMetric = METRIC_GAUGE_INIT(
+    "snapclient_pcm_pool_blocks_chunks", NULL,
+    "Blocks in the pcm chunk pool of the current stream", read_pool_blocks);
+
+static metric_t recommendedBufferMetric = METRIC_GAUGE_INIT(
+    "snapclient_recommended_buffer_ms", NULL,
+    "Server buffer covering the measured chunk latency, see chunk_lead.h",
+    read_recommended_buffer);
+
+static metric_t playerStackMetric = METRIC_GAUGE_INIT(
+    "snapclient_player_stack_free_bytes", NULL,
+    "Least free stack of the player task since it started",
+    read_player_stack_free);
+
 static QueueHandle_t snapcastSettingQueueHandle = NULL;
 
 static uint32_t i2sDmaBufCnt;
@@ -119,11 +226,6 @@ static esp_err_t player_setup_i2s(i2s_port_t i2sNum,
   i2sDmaBufCnt = __dmaBufCnt * CHNK_CTRL_CNT;
   i2sDmaBufMaxLen = __dmaBufLen;
 
-#if USE_SAMPLE_INSERTION
-  i2sDmaBufCnt = 128;
-  i2sDmaBufMaxLen = 9;
-#endif
-
   fi2s_clk = setting->sr * setting->ch * setting->bits * m_scale;
 
   apll_normal_predefine[0] = setting->bits;
@@ -135,25 +237,9 @@ static esp_err_t player_setup_i2s(i2s_port_t i2sNum,
     ESP_LOGE(TAG, "ERROR, fi2s_clk");
   }
 
-#define UPPER_SR_SCALER 1.0001
-#define LOWER_SR_SCALER 0.9999
-
-  apll_corr_predefine[0][0] = setting->bits;
-  apll_corr_predefine[0][1] = setting->sr * UPPER_SR_SCALER;
-  if (i2s_apll_calculate_fi2s(
-          fi2s_clk * UPPER_SR_SCALER, setting->bits, &apll_corr_predefine[0][2],
-          &apll_corr_predefine[0][3], &apll_corr_predefine[0][4],
-          &apll_corr_predefine[0][5]) != ESP_OK) {
-    ESP_LOGE(TAG, "ERROR, fi2s_clk * %f", UPPER_SR_SCALER);
-  }
-  apll_corr_predefine[1][0] = setting->bits;
-  apll_corr_predefine[1][1] = setting->sr * LOWER_SR_SCALER;
-  if (i2s_apll_calculate_fi2s(
-          fi2s_clk * LOWER_SR_SCALER, setting->bits, &apll_corr_predefine[1][2],
-          &apll_corr_predefine[1][3], &apll_corr_predefine[1][4],
-          &apll_corr_predefine[1][5]) != ESP_OK) {
-    ESP_LOGE(TAG, "ERROR, fi2s_clk * %f", LOWER_SR_SCALER);
-  }
+  // corrections scale these in fixed point, no search per adjustment
+  sync_apll_init(&apll, apll_normal_predefine[2], apll_normal_predefine[3],
+                 apll_normal_predefine[4], apll_normal_predefine[5]);
 
   ESP_LOGI(TAG, "player_setup_i2s: dma_buf_len is %d, dma_buf_count is %d",
            i2sDmaBufMaxLen, i2sDmaBufCnt);
@@ -179,47 +265,291 @@ static esp_err_t player_setup_i2s(i2s_port_t i2sNum,
   i2s_custom_driver_install(i2sNum, &i2s_config0, 0, NULL);
   i2s_custom_set_pin(i2sNum, &pin_config0);
 
+  // the DAC on I2S0 gets the master clock, a second port shares its APLL
+  if (i2sNum == I2S_NUM_0) {
 #if CONFIG_AUDIO_BOARD_CUSTOM
-  i2s_mclk_gpio_select(i2sNum, CONFIG_MASTER_I2S_MCLK_PIN);
+    i2s_mclk_gpio_select(i2sNum, CONFIG_MASTER_I2S_MCLK_PIN);
 #else
-  i2s_mclk_gpio_select(i2sNum, GPIO_NUM_0);
+    i2s_mclk_gpio_select(i2sNum, GPIO_NUM_0);
 #endif
+  }
 
   return 0;
 }
 
 /**
+ * I2S0, and I2S1 for the second DSP output
+ */
+static esp_err_t player_setup_outputs(snapcastSetting_t *setting) {
+  esp_err_t ret = player_setup_i2s(I2S_NUM_0, setting);
+
+#if CONFIG_SNAPCLIENT_DSP_SECOND_I2S
+  if (ret == 0) {
+    ret = player_setup_i2s(I2S_NUM_1, setting);
+  }
+#endif
+
+  return ret;
+}
+
+/**
+ * Both outputs start back to back, so they stay a few bit clocks apart at
+ * most.
+ */
+static void player_outputs_start(void) {
+  i2s_custom_start(I2S_NUM_0);
+#if CONFIG_SNAPCLIENT_DSP_SECOND_I2S
+  i2s_custom_start(I2S_NUM_1);
+#endif
+}
+
+/**
+ *
+ */
+static void player_outputs_stop(void) {
+  i2s_custom_stop(I2S_NUM_0);
+#if CONFIG_SNAPCLIENT_DSP_SECOND_I2S
+  i2s_custom_stop(I2S_NUM_1);
+#endif
+}
+
+/**
+ *
+ */
+static void player_outputs_zero_dma_buffer(void) {
+  i2s_custom_zero_dma_buffer(I2S_NUM_0);
+#if CONFIG_SNAPCLIENT_DSP_SECOND_I2S
+  i2s_custom_zero_dma_buffer(I2S_NUM_1);
+#endif
+}
+
+#if CONFIG_SNAPCLIENT_DSP_SECOND_I2S
+/**
+ * The second DSP output of chnk matching its payload at p_payload, NULL if
+ * there is none. Only kept for chunks of a single fragment.
+ */
+static char *player_aux_payload(pcm_chunk_message_t *chnk,
+                                const char *p_payload) {
+  pcm_chunk_fragment_t *fragment = chnk->fragment;
+
+  if ((chnk->aux == NULL) || (chnk->aux->fragment->payload == NULL) ||
+      (p_payload == NULL) || (fragment->nextFragment != NULL) ||
+      (p_payload < fragment->payload) ||
+      (p_payload >= fragment->payload + fragment->size)) {
+    return NULL;
+  }
+
+  return chnk->aux->fragment->payload + (p_payload - fragment->payload);
+}
+
+/**
+ * The second output of the size bytes of chnk at p_payload just written to
+ * I2S0 into I2S1, zeros if chnk has none.
+ */
+static void player_write_aux(pcm_chunk_message_t *chnk, const char *p_payload,
+                             size_t size) {
+  static const uint32_t zeros[32] = {0};
+  const char *aux = player_aux_payload(chnk, p_payload);
+  size_t written, n;
+
+  while (size > 0) {
+    n = size;
+    if (aux == NULL) {
+      n = (size > sizeof(zeros)) ? sizeof(zeros) : size;
+    }
+
+    written = 0;
+    if (i2s_custom_write(I2S_NUM_1, (aux != NULL) ? aux : (const char *)zeros,
+                         n, &written, portMAX_DELAY) != ESP_OK) {
+      ESP_LOGE(TAG, "i2s_playback_task: I2S1 write error %u", size);
+
+      return;
+    }
+
+    size -= written;
+    if (aux != NULL) {
+      aux += written;
+    }
+  }
+}
+
+/**
+ * I2S1 counterpart of i2s_custom_init_dma_tx_queues() on I2S0 with its
+ * descriptor position before that call. The DMA buffers were zeroed, so
+ * without a second output there is nothing to copy.
+ */
+static void player_init_aux_dma(pcm_chunk_message_t *chnk,
+                                const char *p_payload, size_t size,
+                                uint32_t descriptor,
+                                uint32_t descriptorOffset) {
+  char *aux = player_aux_payload(chnk, p_payload);
+  size_t written = 0;
+
+  i2s_custom_init_dma_tx_queues(I2S_NUM_1, (uint8_t *)aux,
+                                (aux != NULL) ? size : 0, &written,
+                                &descriptor, &descriptorOffset);
+}
+#endif
+
+/**
+ *
+ */
+static void pcm_chunk_free_entry(void *entry) {
+  free_pcm_chunk((pcm_chunk_message_t *)entry);
+}
+
+/**
+ * Pool counters start over with every stream, omitted without a pool.
+ */
+static bool read_pool_hits(int32_t *value) {
+  pcm_chunk_pool_stats_t stats;
+
+  pcm_chunk_pool_get_stats(&stats);
+  *value = stats.hits;
+
+  return (stats.blocks > 0);
+}
+
+/**
+ *
+ */
+static bool read_pool_misses(int32_t *value) {
+  pcm_chunk_pool_stats_t stats;
+
+  pcm_chunk_pool_get_stats(&stats);
+  *value = stats.misses;
+
+  return (stats.blocks > 0);
+}
+
+/**
+ *
+ */
+static bool read_pool_high_water(int32_t *value) {
+  pcm_chunk_pool_stats_t stats;
+
+  pcm_chunk_pool_get_stats(&stats);
+  *value = stats.highWater;
+
+  return (stats.blocks > 0);
+}
+
+/**
+ *
+ */
+static bool read_pool_blocks(int32_t *value) {
+  pcm_chunk_pool_stats_t stats;
+
+  pcm_chunk_pool_get_stats(&stats);
+  *value = stats.blocks;
+
+  return (stats.blocks > 0);
+}
+
+#if CONFIG_SNAPCLIENT_I2S_ZERO_COPY
+/**
+ * Called by the I2S driver once a chunk written with
+ * i2s_custom_write_zero_copy() was sent
+ */
+static void IRAM_ATTR pcm_chunk_dma_release(void *arg) {
+  pcm_chunk_pool_free_from_isr((pcm_chunk_message_t *)arg);
+}
+#endif
+
+/**
+ * The chunk without payload standing in for a missing one, played as
+ * silence. Sized when the queue is built, never freed.
+ */
+static pcm_chunk_message_t *pcm_chunk_gap(int64_t timestamp) {
+  pcmChkGap.timestamp.sec = timestamp / 1000000;
+  pcmChkGap.timestamp.usec = timestamp % 1000000;
+  pcmChkGapFragment.size = pcmChkGap.totalSize;
+
+  return &pcmChkGap;
+}
+
+/**
+ * Fills DMA buffers with silence, see i2s_custom_write_cb().
+ */
+static size_t player_fill_silence(void *dst, size_t size, void *arg) {
+  memset(dst, 0, size);
+
+  return size;
+}
+
+/**
+ * Get the next chunk to play, or one of silence if it went missing while
+ * later ones are here already.
  *
+ * @return pdPASS or pdFAIL if none came within wait
  */
-static int destroy_pcm_queue(QueueHandle_t *queueHandle) {
+static BaseType_t receive_pcm_chunk(pcm_chunk_message_t **chnk,
+                                    TickType_t wait) {
+  void *entry;
+  int64_t timestamp;
+  int32_t ret;
+
+  while (1) {
+    xSemaphoreTake(playerPcmQueueMux, portMAX_DELAY);
+    if (pcmChkBuf != NULL) {
+      ret = jitter_buffer_pop(pcmChkBuf, &entry, &timestamp);
+      if (ret == JITTER_BUFFER_CHUNK) {
+        CHUNK_TRACE(CHUNK_TRACE_DEQUEUED,
+                    ((pcm_chunk_message_t *)entry)->timestamp,
+                    jitter_buffer_count(pcmChkBuf));
+      }
+    } else {
+      ret = JITTER_BUFFER_EMPTY;
+    }
+    xSemaphoreGive(playerPcmQueueMux);
+
+    if (ret == JITTER_BUFFER_CHUNK) {
+      *chnk = (pcm_chunk_message_t *)entry;
+
+      return pdPASS;
+    } else if (ret == JITTER_BUFFER_GAP) {
+      ESP_LOGW(TAG, "pcm chunk missing, play silence");
+
+      *chnk = pcm_chunk_gap(timestamp);
+
+      return pdPASS;
+    }
+
+    // insert_pcm_chunk() gives it for every chunk, so a stale one only
+    // makes us look again
+    if (xSemaphoreTake(pcmChkAvailable, wait) == pdFALSE) {
+      *chnk = NULL;
+
+      return pdFAIL;
+    }
+  }
+}
+
+/**
+ *
+ */
+static int destroy_pcm_queue(void) {
   int ret = pdPASS;
-  pcm_chunk_message_t *chnk = NULL;
 
   xSemaphoreTake(playerPcmQueueMux, portMAX_DELAY);
 
-  if (*queueHandle == NULL) {
+  if (pcmChkBuf == NULL) {
     ESP_LOGW(TAG, "no pcm chunk queue created?");
     ret = pdFAIL;
   } else {
     // free all allocated memory
-    while (uxQueueMessagesWaiting(*queueHandle)) {
-      ret = xQueueReceive(*queueHandle, &chnk, pdMS_TO_TICKS(2000));
-      if (ret != pdFAIL) {
-        if (chnk != NULL) {
-          free_pcm_chunk(chnk);
-        }
-      }
-    }
-
-    // delete the queue
-    vQueueDelete(*queueHandle);
-    *queueHandle = NULL;
+    jitter_buffer_deinit(pcmChkBuf);
+    pcmChkBuf = NULL;
 
     ret = pdPASS;
   }
 
   xSemaphoreGive(playerPcmQueueMux);
 
+  // outside the mutex, chunks still on their way to insert_pcm_chunk() need
+  // it to get back to the pool
+  pcm_chunk_pool_destroy();
+
   return ret;
 }
 
@@ -234,6 +564,7 @@ int deinit_player(void) {
     ESP_LOGW(TAG, "no sync task created?");
   } else {
     vTaskDelete(playerTaskHandle);
+    playerTaskHandle = NULL;
   }
 
   if (snapcastSettingsMux != NULL) {
@@ -241,13 +572,23 @@ int deinit_player(void) {
     snapcastSettingsMux = NULL;
   }
 
-  ret = destroy_pcm_queue(&pcmChkQHdl);
+#if CONFIG_SNAPCLIENT_I2S_ZERO_COPY
+  // returns the chunks the DMA plays from to the pool
+  i2s_custom_stop(I2S_NUM_0);
+#endif
+
+  ret = destroy_pcm_queue();
 
   if (playerPcmQueueMux != NULL) {
     vSemaphoreDelete(playerPcmQueueMux);
     playerPcmQueueMux = NULL;
   }
 
+  if (pcmChkAvailable != NULL) {
+    vSemaphoreDelete(pcmChkAvailable);
+    pcmChkAvailable = NULL;
+  }
+
   if (latencyBufSemaphoreHandle == NULL) {
     ESP_LOGW(TAG, "no latency buffer semaphore created?");
   } else {
@@ -287,7 +628,31 @@ int init_player(void) {
     xSemaphoreGive(playerPcmQueueMux);
   }
 
-  ret = player_setup_i2s(I2S_NUM_0, &currentSnapcastSetting);
+  if (pcmChkAvailable == NULL) {
+    pcmChkAvailable = xSemaphoreCreateBinary();
+  }
+
+  metrics_register(&ageErrorMetric);
+  metrics_register(&hardResyncMetric);
+  metrics_register(&softResyncMetric);
+  metrics_register(&speedFasterMetric);
+  metrics_register(&speedSlowerMetric);
+  metrics_register(&speedNominalMetric);
+  metrics_register(&queueMetric);
+  metrics_register(&poolHitsMetric);
+  metrics_register(&poolMissesMetric);
+  metrics_register(&poolHighWaterMetric);
+  metrics_register(&poolBlocksMetric);
+  metrics_register(&recommendedBufferMetric);
+  metrics_register(&playerStackMetric);
+
+#if CONFIG_SNAPCLIENT_CHUNK_TRACE
+  if (chunk_trace_init(CONFIG_SNAPCLIENT_CHUNK_TRACE_RECORDS) < 0) {
+    ESP_LOGE(TAG, "Failed to allocate chunk trace");
+  }
+#endif
+
+  ret = player_setup_outputs(&currentSnapcastSetting);
   if (ret < 0) {
     ESP_LOGE(TAG, "player_setup_i2s failed: %d", ret);
 
@@ -299,11 +664,13 @@ int init_player(void) {
     latencyBufSemaphoreHandle = xSemaphoreCreateMutex();
   }
 
-  // init diff buff median filter
-  latencyMedianFilter.numNodes = LATENCY_MEDIAN_FILTER_LEN;
-  latencyMedianFilter.medianBuffer = latencyMedianLong;
   reset_latency_buffer();
 
+  if (chunkLeadMux == NULL) {
+    chunkLeadMux = xSemaphoreCreateMutex();
+    chunk_lead_init(&chunkLead);
+  }
+
   shortMedianFilter.numNodes = SHORT_BUFFER_LEN;
   shortMedianFilter.medianBuffer = shortMedianBuffer;
   MEDIANFILTER_Init(&shortMedianFilter);
@@ -317,7 +684,7 @@ int init_player(void) {
   if (playerTaskHandle == NULL) {
     ESP_LOGI(TAG, "Start player_task");
 
-    xTaskCreatePinnedToCore(player_task, "player", 2048 + 512, NULL,
+    xTaskCreatePinnedToCore(player_task, "player", SYNC_TASK_STACK_SIZE, NULL,
                             SYNC_TASK_PRIORITY, &playerTaskHandle,
                             SYNC_TASK_CORE_ID);
   }
@@ -360,34 +727,14 @@ int8_t player_get_snapcast_settings(snapcastSetting_t *setting) {
 /**
  *
  */
-int32_t player_latency_insert(int64_t newValue) {
-  int64_t medianValue;
-
-  medianValue = MEDIANFILTER_Insert(&latencyMedianFilter, newValue);
+int32_t player_latency_insert(int64_t diff, int64_t rtt, int64_t now) {
   if (xSemaphoreTake(latencyBufSemaphoreHandle, pdMS_TO_TICKS(0)) == pdTRUE) {
-    if (MEDIANFILTER_isFull(&latencyMedianFilter, LATENCY_MEDIAN_FILTER_FULL)) {
-      latencyBuffFull = true;
-
-      //      ESP_LOGI(TAG, "(full) latency median: %lldus", medianValue);
-    }
-    //    else {
-    //      ESP_LOGI(TAG, "(not full) latency median: %lldus", medianValue);
-    //    }
-
-#if LATENCY_MEDIAN_AVG_DIVISOR
-    // ESP_LOGI(TAG, "actual latency median: %lldus", medianValue);
-    //    medianValue = MEDIANFILTER_get_median(&latencyMedianFilter,
-    //    ceil((float)LATENCY_MEDIAN_FILTER_LEN /
-    //    (float)LATENCY_MEDIAN_AVG_DIVISOR));
-    medianValue = MEDIANFILTER_get_median(&latencyMedianFilter, 32);
-// ESP_LOGI(TAG, "avg latency median: %lldus", medianValue);
-#endif
-
-    latencyToServer = medianValue;
+    snapcast_clock_insert(&serverClock, now, diff, rtt);
+    latencyBuffFull = snapcast_clock_ready(&serverClock);
 
     xSemaphoreGive(latencyBufSemaphoreHandle);
   } else {
-    ESP_LOGW(TAG, "couldn't set latencyToServer = medianValue");
+    ESP_LOGW(TAG, "couldn't insert time sync into server clock");
   }
 
   return 0;
@@ -445,14 +792,131 @@ int32_t player_send_snapcast_setting(snapcastSetting_t *setting) {
 /**
  *
  */
-int32_t reset_latency_buffer(void) {
-  // init diff buff median filter
-  if (MEDIANFILTER_Init(&latencyMedianFilter) < 0) {
-    ESP_LOGE(TAG, "reset_diff_buffer: couldn't init median filter long. STOP");
+int32_t player_chunk_received(int64_t chunkStart) {
+  uint32_t head = __atomic_load_n(&chunkLeadHead, __ATOMIC_RELAXED);
+  uint32_t tail = __atomic_load_n(&chunkLeadTail, __ATOMIC_ACQUIRE);
+  chunk_lead_entry_t *entry;
+
+  if (head - tail >= CHUNK_LEAD_RING_LEN) {
+    // the player is behind, it's only statistics
+    return -1;
+  }
 
+  entry = &chunkLeadRing[head % CHUNK_LEAD_RING_LEN];
+  entry->chunkStart = chunkStart;
+  entry->received = esp_timer_get_time();
+  __atomic_store_n(&chunkLeadHead, head + 1, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+/**
+ * Move the chunks player_chunk_received() queued into the latency
+ * statistics, logs the recommended buffer once a window is done.
+ */
+static void player_chunk_lead_drain(void) {
+  uint32_t head = __atomic_load_n(&chunkLeadHead, __ATOMIC_ACQUIRE);
+  uint32_t tail = __atomic_load_n(&chunkLeadTail, __ATOMIC_RELAXED);
+  snapcastSetting_t set;
+  int64_t diff = 0;
+  int32_t done = 0;
+
+  if (head == tail) {
+    return;
+  }
+
+  // an old offset is fine, it moves by microseconds per minute
+  get_diff_to_server(&diff);
+
+  if (diff != 0) {
+    xSemaphoreTake(chunkLeadMux, portMAX_DELAY);
+    for (; tail != head; tail++) {
+      const chunk_lead_entry_t *entry =
+          &chunkLeadRing[tail % CHUNK_LEAD_RING_LEN];
+
+      done |= chunk_lead_insert(&chunkLead,
+                                entry->received + diff - entry->chunkStart,
+                                entry->received);
+    }
+    xSemaphoreGive(chunkLeadMux);
+  }
+
+  __atomic_store_n(&chunkLeadTail, head, __ATOMIC_RELEASE);
+
+  if (done) {
+    int32_t median, safe, recommended;
+
+    player_get_snapcast_settings(&set);
+    if (set.sr == 0) {
+      return;
+    }
+
+    xSemaphoreTake(chunkLeadMux, portMAX_DELAY);
+    median = chunk_lead_quantile_ms(&chunkLead, 500);
+    safe = chunk_lead_quantile_ms(&chunkLead, CHUNK_LEAD_SAFE_PERMILLE);
+    recommended = chunk_lead_recommended_ms(
+        &chunkLead, CHNK_CTRL_CNT * set.chkInFrames * 1000 / set.sr);
+    xSemaphoreGive(chunkLeadMux);
+
+    if (recommended >= 0) {
+      ESP_LOGI(TAG,
+               "chunk latency median %dms, %d.%d%% below %dms, buffer %dms, "
+               "recommended %dms",
+               median, CHUNK_LEAD_SAFE_PERMILLE / 10,
+               CHUNK_LEAD_SAFE_PERMILLE % 10, safe, set.buf_ms, recommended);
+    }
+  }
+}
+
+/**
+ *
+ */
+int32_t player_get_recommended_buffer(int32_t *bufMs) {
+  snapcastSetting_t set;
+
+  if ((bufMs == NULL) || (chunkLeadMux == NULL)) {
     return -2;
   }
 
+  player_get_snapcast_settings(&set);
+  if (set.sr == 0) {
+    *bufMs = -1;
+
+    return -1;
+  }
+
+  xSemaphoreTake(chunkLeadMux, portMAX_DELAY);
+  *bufMs = chunk_lead_recommended_ms(
+      &chunkLead, CHNK_CTRL_CNT * set.chkInFrames * 1000 / set.sr);
+  xSemaphoreGive(chunkLeadMux);
+
+  return (*bufMs < 0) ? -1 : 0;
+}
+
+/**
+ * Omitted until enough chunks were measured.
+ */
+static bool read_recommended_buffer(int32_t *value) {
+  return (player_get_recommended_buffer(value) == 0);
+}
+
+/**
+ * High water mark in bytes, StackType_t is a byte on the ESP32.
+ */
+static bool read_player_stack_free(int32_t *value) {
+  if (playerTaskHandle == NULL) {
+    return false;
+  }
+
+  *value = uxTaskGetStackHighWaterMark(playerTaskHandle);
+
+  return true;
+}
+
+/**
+ *
+ */
+int32_t reset_latency_buffer(void) {
   if (latencyBufSemaphoreHandle == NULL) {
     ESP_LOGE(TAG, "reset_diff_buffer: latencyBufSemaphoreHandle == NULL");
 
@@ -461,7 +925,7 @@ int32_t reset_latency_buffer(void) {
 
   if (xSemaphoreTake(latencyBufSemaphoreHandle, portMAX_DELAY) == pdTRUE) {
     latencyBuffFull = false;
-    latencyToServer = 0;
+    snapcast_clock_init(&serverClock);
 
     xSemaphoreGive(latencyBufSemaphoreHandle);
   } else {
@@ -521,9 +985,9 @@ int32_t get_diff_to_server(int64_t *tDiff) {
     return -1;
   }
 
-  *tDiff = latencyToServer;
-  lastDiff = latencyToServer;  // store value, so we can return a value if
-                               // semaphore couldn't be taken
+  *tDiff = snapcast_clock_offset(&serverClock, esp_timer_get_time());
+  lastDiff = *tDiff;  // store value, so we can return a value if
+                      // semaphore couldn't be taken
 
   xSemaphoreGive(latencyBufSemaphoreHandle);
 
@@ -648,39 +1112,19 @@ static void tg0_timer1_start(uint64_t alarm_value) {
 // sdm2, uint32_t o_div); apll_freq = xtal_freq * (4 + sdm2 + sdm1/256 +
 // sdm0/65536)/((o_div + 2) * 2) xtal == 40MHz on lyrat v4.3 I2S bit_clock =
 // rate * (number of channels) * bits_per_sample
-void adjust_apll(int8_t direction) {
+//
+// returns true if the APLL was written
+bool adjust_apll(float ppm) {
   int sdm0, sdm1, sdm2, o_div;
 
-  // only change if necessary
-  if (currentDir == direction) {
-    return;
-  }
-
-  if (direction == 1) {
-    // speed up
-    sdm0 = apll_corr_predefine[0][2];
-    sdm1 = apll_corr_predefine[0][3];
-    sdm2 = apll_corr_predefine[0][4];
-    o_div = apll_corr_predefine[0][5];
-  } else if (direction == -1) {
-    // slow down
-    sdm0 = apll_corr_predefine[1][2];
-    sdm1 = apll_corr_predefine[1][3];
-    sdm2 = apll_corr_predefine[1][4];
-    o_div = apll_corr_predefine[1][5];
-  } else {
-    // reset to normal playback speed
-    sdm0 = apll_normal_predefine[2];
-    sdm1 = apll_normal_predefine[3];
-    sdm2 = apll_normal_predefine[4];
-    o_div = apll_normal_predefine[5];
-
-    direction = 0;
+  // only change if necessary, every write recalibrates the APLL
+  if (sync_apll_set_ppm(&apll, ppm, &sdm0, &sdm1, &sdm2, &o_div) == false) {
+    return false;
   }
 
   rtc_clk_apll_enable(1, sdm0, sdm1, sdm2, o_div);
 
-  currentDir = direction;
+  return true;
 }
 
 /**
@@ -719,253 +1163,54 @@ int8_t free_pcm_chunk(pcm_chunk_message_t *pcmChunk) {
     return -1;
   }
 
-  free_pcm_chunk_fragments(pcmChunk->fragment);
-  pcmChunk->fragment = NULL;  // was freed in free_pcm_chunk_fragments()
-
-  free(pcmChunk);
-  pcmChunk = NULL;
-
-  return 0;
-}
-
-/**
- *
- */
-int32_t allocate_pcm_chunk_memory_caps(pcm_chunk_message_t *pcmChunk,
-                                       size_t bytes, uint32_t caps) {
-  size_t largestFreeBlock, freeMem;
-  int ret = -3;
-
-  // we got valid memory for pcm_chunk_message_t
-  // first we try to allocated 32 bit aligned memory for payload
-  // check available memory first so we can decide if we need to fragment the
-  // data
-  if (caps != 0) {
-    freeMem = heap_caps_get_free_size(caps);
-    largestFreeBlock = heap_caps_get_largest_free_block(caps);
-    if ((freeMem >= bytes) && (largestFreeBlock >= bytes)) {
-      // ESP_LOGI(TAG, "32b f %d b %d", freeMem, largestFreeBlock);
-
-      pcmChunk->fragment->payload = (char *)heap_caps_malloc(bytes, caps);
-      if (pcmChunk->fragment->payload == NULL) {
-        ESP_LOGE(
-            TAG,
-            "Failed to heap_caps_malloc(%d, %d) memory for pcm chunk payload",
-            bytes, caps);
-
-        ret = -2;
-      } else {
-        pcmChunk->totalSize = bytes;
-        pcmChunk->fragment->nextFragment = NULL;
-        pcmChunk->fragment->size = bytes;
-
-        ret = 0;
-      }
-    } else {
-      // ESP_LOGE (TAG, "couldn't get memory to insert chunk of size %d, IRAM
-      // freemem: %d blocksize %d", bytes, freeMem, largestFreeBlock);
-    }
-  } else {
-    pcmChunk->fragment->payload = (char *)malloc(bytes);
-    if (pcmChunk->fragment->payload == NULL) {
-      ESP_LOGE(TAG, "Failed to malloc memory for pcm chunk payload");
-
-      ret = -2;
-    } else {
-      pcmChunk->totalSize = bytes;
-      pcmChunk->fragment->nextFragment = NULL;
-      pcmChunk->fragment->size = bytes;
-
-      ret = 0;
-    }
+  if (pcmChunk == &pcmChkGap) {
+    return 0;
   }
 
-  return ret;
-}
-
-/**
- *
- */
-int32_t allocate_pcm_chunk_memory_caps_fragmented(pcm_chunk_message_t *pcmChunk,
-                                                  size_t bytes, uint32_t caps) {
-  size_t largestFreeBlock, freeMem;
-  int ret = -3;
-
-  // we got valid memory for pcm_chunk_message_t
-  // first we try to allocated 32 bit aligned memory for payload
-  // check available memory first so we can decide if we need to fragment the
-  // data
-  freeMem = heap_caps_get_free_size(caps);
-  largestFreeBlock = heap_caps_get_largest_free_block(caps);
-  if (freeMem >= bytes) {
-    // ESP_LOGI(TAG, "32b f %d b %d", freeMem, largestFreeBlock);
-
-    if (largestFreeBlock >= bytes) {
-      pcmChunk->fragment->payload = (char *)heap_caps_malloc(bytes, caps);
-      if (pcmChunk->fragment->payload == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate IRAM memory for pcm chunk payload");
-
-        ret = -2;
-      } else {
-        pcmChunk->totalSize = bytes;
-        pcmChunk->fragment->nextFragment = NULL;
-        pcmChunk->fragment->size = bytes;
-
-        ret = 0;
-      }
-    } else {
-      size_t remainingBytes = bytes + (largestFreeBlock % 4);
-      size_t needBytes = largestFreeBlock - (largestFreeBlock % 4);
-      pcm_chunk_fragment_t *fragment = pcmChunk->fragment;
-
-      pcmChunk->totalSize = 0;
-
-      while (remainingBytes) {
-        fragment->payload = (char *)heap_caps_malloc(needBytes, caps);
-        if (fragment->payload == NULL) {
-          ESP_LOGE(TAG,
-                   "Failed to allocate fragmented IRAM memory for "
-                   "pcm chunk payload %d %d %d %d",
-                   needBytes, remainingBytes, heap_caps_get_free_size(caps),
-                   heap_caps_get_largest_free_block(caps));
-
-          ret = -2;
+  if (pcmChunk->aux != NULL) {
+    free_pcm_chunk(pcmChunk->aux);
+    pcmChunk->aux = NULL;
+  }
 
-          break;
-        } else {
-          fragment->size = needBytes;
-          remainingBytes -= needBytes;
-          pcmChunk->totalSize += needBytes;
+  if (pcmChunk->pool != NULL) {
+    pcm_chunk_pool_free(pcmChunk);
 
-          if (remainingBytes > 0) {
-            fragment->nextFragment =
-                (pcm_chunk_fragment_t *)calloc(1, sizeof(pcm_chunk_fragment_t));
-            if (fragment->nextFragment == NULL) {
-              ESP_LOGE(TAG,
-                       "Failed to fragmented IRAM memory "
-                       "for pcm chunk fragment");
+    return 0;
+  }
 
-              ret = -2;
+  free_pcm_chunk_fragments(pcmChunk->fragment);
+  pcmChunk->fragment = NULL;  // was freed in free_pcm_chunk_fragments()
 
-              break;
-            } else {
-              fragment = fragment->nextFragment;
-              largestFreeBlock = heap_caps_get_largest_free_block(caps);
-              if (largestFreeBlock >= remainingBytes) {
-                needBytes = remainingBytes;
-              } else {
-                needBytes = largestFreeBlock - (largestFreeBlock % 4);
-              }
-            }
-          } else {
-            ret = 0;
-          }
-        }
-      }
-    }
-  } else {
-    // ESP_LOGE (TAG, "couldn't get memory to insert chunk of size %d, IRAM
-    // freemem: %d blocksize %d", decodedWireChunk->size, freeMem,
-    // largestFreeBlock);
-  }
+  free(pcmChunk);
+  pcmChunk = NULL;
 
-  return ret;
+  return 0;
 }
 
 /**
- *
+ * Chunks only come from the pool. The queue is cut to the blocks the pool
+ * got, so with the chunks in flight counted in PCM_CHUNK_POOL_EXTRA it
+ * can't run dry. A miss is a sizing bug and logged as an error, or a
+ * decoder that is ahead of the player rebuilding the pool for a new format.
  */
 int32_t allocate_pcm_chunk_memory(pcm_chunk_message_t **pcmChunk,
                                   size_t bytes) {
-  int ret = -3;
-
-  *pcmChunk = (pcm_chunk_message_t *)calloc(1, sizeof(pcm_chunk_message_t));
-  if (*pcmChunk == NULL) {
-    ESP_LOGE(TAG, "Failed to allocate memory for pcm chunk message");
-
-    return -2;
-  }
-
-  (*pcmChunk)->fragment =
-      (pcm_chunk_fragment_t *)calloc(1, sizeof(pcm_chunk_fragment_t));
-  if ((*pcmChunk)->fragment == NULL) {
-    ESP_LOGE(TAG, "Failed to allocate memory for pcm chunk fragment");
-
-    free_pcm_chunk(*pcmChunk);
-
-    return -2;
-  }
-
-#if CONFIG_SPIRAM && CONFIG_SPIRAM_BOOT_INIT
-  ret = allocate_pcm_chunk_memory_caps(*pcmChunk, bytes,
-                                       MALLOC_CAP_8BIT | MALLOC_CAP_SPIRAM);
-#elif CONFIG_SPIRAM
-  ret = allocate_pcm_chunk_memory_caps(*pcmChunk, bytes, 0);
-#else
-  // TODO: x should probably be dynamically calculated as a fraction of buffer
-  // size if allocation fails we try again every 1ms for max. x ms waiting for
-  // chunks to finish playback
-  uint32_t x = 50;
-  for (int i = 0; i < x; i++) {
-    ret = allocate_pcm_chunk_memory_caps(*pcmChunk, bytes,
-                                         MALLOC_CAP_32BIT | MALLOC_CAP_EXEC);
-    if (ret < 0) {
-      ret = allocate_pcm_chunk_memory_caps(*pcmChunk, bytes, MALLOC_CAP_8BIT);
-      //      if (ret < 0) {
-      //        //      ret = allocate_pcm_chunk_memory_caps_fragmented
-      //        //(*pcmChunk, bytes, MALLOC_CAP_32BIT | MALLOC_CAP_EXEC);
-      //        if (ret < 0) {
-      //          // allocate_pcm_chunk_memory_caps_fragmented (*pcmChunk,
-      //          bytes,
-      //          // MALLOC_CAP_8BIT);
-      //        }
-      //      }
-    }
+  pcm_chunk_pool_stats_t stats;
 
-    if (ret < 0) {
-      vTaskDelay(pdMS_TO_TICKS(1));
-    } else {
-      break;
-    }
+  *pcmChunk = pcm_chunk_pool_alloc(bytes);
+  if (*pcmChunk != NULL) {
+    return 0;
   }
-#endif
 
-  if (ret < 0) {
-    ESP_LOGW(TAG,
-             "couldn't get memory to insert chunk, inserting an chunk "
-             "containing just 0");
-
-    //    xSemaphoreTake(playerPcmQueueMux, portMAX_DELAY);
-    //    ESP_LOGW(
-    //        TAG, "%d, %d, %d, %d, %d",
-    //        heap_caps_get_free_size(MALLOC_CAP_8BIT),
-    //        heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
-    //        uxQueueMessagesWaiting(pcmChkQHdl),
-    //        heap_caps_get_free_size(MALLOC_CAP_32BIT | MALLOC_CAP_EXEC),
-    //        heap_caps_get_largest_free_block(MALLOC_CAP_32BIT |
-    //        MALLOC_CAP_EXEC));
-    //    xSemaphoreGive(playerPcmQueueMux);
-
-    ESP_LOGW(
-        TAG, "%d, %d, %d, %d", heap_caps_get_free_size(MALLOC_CAP_8BIT),
-        heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
-        heap_caps_get_free_size(MALLOC_CAP_32BIT | MALLOC_CAP_EXEC),
-        heap_caps_get_largest_free_block(MALLOC_CAP_32BIT | MALLOC_CAP_EXEC));
-
-    // simulate a chunk of all samples 0,
-    // player_task() will know what to do with this
-    (*pcmChunk)->fragment->payload = NULL;
-    (*pcmChunk)->totalSize = bytes;
-    (*pcmChunk)->fragment->nextFragment = NULL;
-    (*pcmChunk)->fragment->size = bytes;
-
-    ret = 0;
+  pcm_chunk_pool_get_stats(&stats);
+  if ((stats.blocks > 0) && (bytes <= stats.blockSize)) {
+    ESP_LOGE(TAG, "pcm chunk pool exhausted, %u of %u blocks in use, chunk "
+             "dropped", stats.inUse, stats.blocks);
   } else {
-    // ESP_LOGI (TAG, "got memory for pcm chunk %p %p %d", *pcmChunk,
-    // (*pcmChunk)->fragment->payload, bytes);
+    ESP_LOGW(TAG, "no pool block for %u bytes yet, chunk dropped", bytes);
   }
 
-  return ret;
+  return -1;
 }
 
 /**
@@ -979,6 +1224,9 @@ int32_t insert_pcm_chunk(pcm_chunk_message_t *pcmChunk) {
   }
 
   bool isFull = false;
+  int64_t timestamp;
+  int32_t ret;
+
   latency_buffer_full(&isFull, portMAX_DELAY);
   if (isFull == false) {
     free_pcm_chunk(pcmChunk);
@@ -989,8 +1237,11 @@ int32_t insert_pcm_chunk(pcm_chunk_message_t *pcmChunk) {
     return -3;
   }
 
+  timestamp = (int64_t)pcmChunk->timestamp.sec * 1000000LL +
+              (int64_t)pcmChunk->timestamp.usec;
+
   xSemaphoreTake(playerPcmQueueMux, portMAX_DELAY);
-  if (pcmChkQHdl == NULL) {
+  if (pcmChkBuf == NULL) {
     ESP_LOGW(TAG, "pcm chunk queue not created");
 
     free_pcm_chunk(pcmChunk);
@@ -1000,20 +1251,46 @@ int32_t insert_pcm_chunk(pcm_chunk_message_t *pcmChunk) {
     return -2;
   }
 
-  //  if (uxQueueSpacesAvailable(pcmChkQHdl) == 0) {
-  //    pcm_chunk_message_t *element;
-  //
-  //    xQueueReceive(pcmChkQHdl, &element, portMAX_DELAY);
-  //
-  //    free_pcm_chunk(element);
-  //  }
+  ret = jitter_buffer_insert(pcmChkBuf, timestamp, pcmChunk);
+
+  if ((ret == JITTER_BUFFER_FULL) && (decodeAhead == true)) {
+    uint32_t i;
+
+    // wait for the player to make room instead of dropping, in short steps
+    // so destroy_pcm_queue() can get in between
+    for (i = 0; i < PLAYER_DECODE_AHEAD_WAIT_MS / 10; i++) {
+      xSemaphoreGive(playerPcmQueueMux);
+      vTaskDelay(pdMS_TO_TICKS(10));
+      xSemaphoreTake(playerPcmQueueMux, portMAX_DELAY);
+
+      if (pcmChkBuf == NULL) {
+        free_pcm_chunk(pcmChunk);
+
+        xSemaphoreGive(playerPcmQueueMux);
+
+        return -2;
+      }
+
+      ret = jitter_buffer_insert(pcmChkBuf, timestamp, pcmChunk);
+      if (ret != JITTER_BUFFER_FULL) {
+        break;
+      }
+    }
+  }
+
+  if (ret == JITTER_BUFFER_OK) {
+    CHUNK_TRACE(CHUNK_TRACE_QUEUED, pcmChunk->timestamp,
+                jitter_buffer_count(pcmChkBuf));
 
-  // if (xQueueSend(pcmChkQHdl, &pcmChunk, pdMS_TO_TICKS(10)) != pdTRUE) {
-  if (xQueueSend(pcmChkQHdl, &pcmChunk, pdMS_TO_TICKS(1)) != pdTRUE) {
+    xSemaphoreGive(pcmChkAvailable);
+  } else if (ret == JITTER_BUFFER_FULL) {
     ESP_LOGW(TAG, "send: pcmChunkQueue full, messages waiting %d",
-             uxQueueMessagesWaiting(pcmChkQHdl));
+             jitter_buffer_count(pcmChkBuf));
 
     free_pcm_chunk(pcmChunk);
+  } else {
+    // its play time has passed already
+    free_pcm_chunk(pcmChunk);
   }
 
   xSemaphoreGive(playerPcmQueueMux);
@@ -1026,8 +1303,8 @@ int32_t pcm_chunk_queue_msg_waiting(void) {
 
   xSemaphoreTake(playerPcmQueueMux, portMAX_DELAY);
 
-  if (pcmChkQHdl) {
-    ret = uxQueueMessagesWaiting(pcmChkQHdl);
+  if (pcmChkBuf) {
+    ret = jitter_buffer_count(pcmChkBuf);
   }
 
   xSemaphoreGive(playerPcmQueueMux);
@@ -1052,8 +1329,6 @@ static void player_task(void *pvParameters) {
   uint64_t timer_val;
   int initialSync = 0;
   int64_t avg = 0;
-  int dir = 0;
-  uint32_t dir_insert_sample = 0;
   int64_t buf_us = 0;
   pcm_chunk_fragment_t *fragment = NULL;
   size_t written;
@@ -1076,9 +1351,10 @@ static void player_task(void *pvParameters) {
   audio_set_mute(true);
 
   while (1) {
+    player_chunk_lead_drain();
+
     // ESP_LOGW( TAG, "32b f %d b %d", heap_caps_get_free_size
     //(MALLOC_CAP_8BIT), heap_caps_get_largest_free_block (MALLOC_CAP_8BIT));
-    // ESP_LOGW (TAG, "stack free: %d", uxTaskGetStackHighWaterMark(NULL));
 
     // check if we got changed setting available, if so we need to
     // reinitialize
@@ -1097,51 +1373,169 @@ static void player_task(void *pvParameters) {
 
         // this value is highly coupled with I2S DMA buffer
         // size. DMA buffer has a size of 1 chunk (e.g. 20ms)
-        // so next chunk we get from queue will be -20ms
+        // so next chunk we get from queue will be -20ms. Only used until
+        // i2s_custom_get_play_time() has a DMA EOF to measure from
         outputBufferDacTime = chkDur_us * CHNK_CTRL_CNT;
 
         clientDacLatency_us = (int64_t)__scSet.cDacLat_ms * 1000;
 
         if ((scSet.sr != __scSet.sr) || (scSet.bits != __scSet.bits) ||
             (scSet.ch != __scSet.ch)) {
-          i2s_custom_start(I2S_NUM_0);
+          player_outputs_start();
           audio_set_mute(true);
-          i2s_custom_stop(I2S_NUM_0);
+          player_outputs_stop();
 
-          ret = player_setup_i2s(I2S_NUM_0, &currentSnapcastSetting);
+          ret = player_setup_outputs(&currentSnapcastSetting);
           if (ret < 0) {
             ESP_LOGE(TAG, "player_setup_i2s failed: %d", ret);
 
             return;
           }
 
-          // force adjust_apll() to set playback speed
-          currentDir = 1;
-          adjust_apll(0);
+          // nominal playback speed, adjust_apll() only writes changes
+          rtc_clk_apll_enable(1, apll_normal_predefine[2],
+                              apll_normal_predefine[3],
+                              apll_normal_predefine[4],
+                              apll_normal_predefine[5]);
 
           i2s_custom_set_clk(I2S_NUM_0, __scSet.sr, __scSet.bits, __scSet.ch);
+#if CONFIG_SNAPCLIENT_DSP_SECOND_I2S
+          i2s_custom_set_clk(I2S_NUM_1, __scSet.sr, __scSet.bits, __scSet.ch);
+#endif
 
           initialSync = 0;
         }
 
         if ((__scSet.buf_ms != scSet.buf_ms) ||
-            (__scSet.chkInFrames != scSet.chkInFrames)) {
-          destroy_pcm_queue(&pcmChkQHdl);
+            (__scSet.chkInFrames != scSet.chkInFrames) ||
+            (__scSet.sr != scSet.sr) || (__scSet.ch != scSet.ch) ||
+            (__scSet.bits != scSet.bits) || (__scSet.codec != scSet.codec)) {
+          // give the pool a chance to get back all its chunks
+          if (chnk != NULL) {
+            free_pcm_chunk(chnk);
+            chnk = NULL;
+            initialSync = 0;
+          }
+
+#if CONFIG_SNAPCLIENT_I2S_ZERO_COPY
+          // the DMA may still play from chunks of the pool, stopping it
+          // returns them
+          audio_set_mute(true);
+          i2s_custom_stop(I2S_NUM_0);
+          initialSync = 0;
+#endif
+
+          destroy_pcm_queue();
         }
 
         //        xSemaphoreTake(playerPcmQueueMux, portMAX_DELAY);
 
-        if (pcmChkQHdl == NULL) {
+        if (pcmChkBuf == NULL) {
           int entries = ceil(((float)__scSet.sr / (float)__scSet.chkInFrames) *
                              ((float)__scSet.buf_ms / 1000));
+          size_t chunkBytes = pcm_pack_bytes(__scSet.chkInFrames, __scSet.ch,
+                                             pcm_pack_slot_bits(__scSet.bits));
+          int32_t blocks;
+          bool byteAccess;
 
           entries -=
               CHNK_CTRL_CNT;  // CHNK_CTRL_CNT chunks are placed in DMA buffer
                               // anyway so we can save this much RAM here
 
-          pcmChkQHdl = xQueueCreate(entries, sizeof(pcm_chunk_message_t *));
+#if CONFIG_SNAPCLIENT_ADAPTIVE_QUEUE
+          {
+            // chunks wait here for the buffer minus their latency, if that
+            // has been measured already
+            int32_t lowMs;
+
+            xSemaphoreTake(chunkLeadMux, portMAX_DELAY);
+            lowMs = chunk_lead_quantile_ms(&chunkLead, 1);
+            xSemaphoreGive(chunkLeadMux);
+
+            lowMs -= CHUNK_LEAD_BIN_MS + CHUNK_LEAD_MARGIN_MS;
+            if ((lowMs > 0) && (lowMs < __scSet.buf_ms)) {
+              int trimmed =
+                  ceil(((float)__scSet.sr / (float)__scSet.chkInFrames) *
+                       ((float)(__scSet.buf_ms - lowMs) / 1000)) +
+                  1 - CHNK_CTRL_CNT;
+
+              if ((trimmed > 0) && (trimmed < entries)) {
+                ESP_LOGI(TAG, "chunks arrive %dms late at least, queue trimmed"
+                         " to %d", lowMs, trimmed);
+
+                entries = trimmed;
+              }
+            }
+          }
+#endif
+
+#if CONFIG_SNAPCLIENT_COMPRESSED_BUFFER
+          // the buffer is held encoded in front of the decoder, which only
+          // runs this far ahead of us. pcm has nothing to gain from it.
+          decodeAhead = (__scSet.codec != PCM);
+          if ((decodeAhead == true) && (entries > PLAYER_DECODE_LEAD)) {
+            entries = PLAYER_DECODE_LEAD;
+          }
+#endif
+
+          // opus decodes in place unless the chunk is in IRAM
+          byteAccess = (__scSet.codec == OPUS);
+
+          // 24 bit samples take 32 bit slots once packed
+#if CONFIG_SNAPCLIENT_DSP_SECOND_I2S
+          // chunks of a flow with two outputs carry a second one as large
+          blocks = pcm_chunk_pool_create(
+                       chunkBytes, 2 * (entries + PCM_CHUNK_POOL_EXTRA),
+                       byteAccess) /
+                   2;
+#else
+          blocks = pcm_chunk_pool_create(
+              chunkBytes, entries + PCM_CHUNK_POOL_EXTRA, byteAccess);
+#endif
+
+          // the queue holds no more chunks than the pool has blocks for
+          // besides the ones in flight, so every chunk gets a block
+          if (blocks - PCM_CHUNK_POOL_EXTRA < entries) {
+            entries = blocks - PCM_CHUNK_POOL_EXTRA;
+            ESP_LOGW(TAG, "pcm chunk pool short, queue cut to %d", entries);
+          }
+
+          xSemaphoreTake(playerPcmQueueMux, portMAX_DELAY);
+          if ((entries > 0) &&
+              (jitter_buffer_init(&pcmJitterBuf, entries,
+                                  (double)__scSet.chkInFrames * 1E6 /
+                                      (double)__scSet.sr,
+                                  pcm_chunk_free_entry) == 0)) {
+            pcmChkBuf = &pcmJitterBuf;
+          } else {
+            ESP_LOGE(TAG, "Failed to create pcm chunk queue");
+          }
+          pcmChkGap.totalSize = chunkBytes;
+          xSemaphoreGive(playerPcmQueueMux);
 
           ESP_LOGI(TAG, "created new queue with %d", entries);
+
+#if CONFIG_SNAPCLIENT_SYNC_RESAMPLER
+          sync_ctrl_init(&syncCtrl, SYNC_CTRL_TC_S, SYNC_CTRL_TI_S,
+                         RESAMPLER_MAX_PPM);
+          resampler_free(&resampler);
+          if (resampler_init(&resampler, __scSet.chkInFrames, __scSet.ch,
+                             pcm_pack_slot_bits(__scSet.bits)) < 0) {
+            ESP_LOGE(TAG, "Failed to set up resampler, no drift correction");
+          }
+#elif CONFIG_SNAPCLIENT_SYNC_SAMPLE_INSERTION
+          sync_ctrl_init(&syncCtrl, SYNC_CTRL_TC_S, SYNC_CTRL_TI_S,
+                         SAMPLE_SLIP_MAX_PPM);
+          slipFrames = 0.0f;
+          if (sample_slip_init(&sampleSlip, __scSet.ch,
+                               pcm_pack_slot_bits(__scSet.bits)) < 0) {
+            ESP_LOGE(TAG, "Can't insert samples with %d channels, no drift "
+                     "correction", __scSet.ch);
+          }
+#else
+          sync_ctrl_init(&syncCtrl, SYNC_CTRL_TC_S, SYNC_CTRL_TI_S,
+                         SYNC_APLL_MAX_PPM);
+#endif
         }
 
         //        xSemaphoreGive(playerPcmQueueMux);
@@ -1182,8 +1576,8 @@ static void player_task(void *pvParameters) {
 
     if (chnk == NULL) {
       // xSemaphoreTake(playerPcmQueueMux, portMAX_DELAY);
-      if (pcmChkQHdl != NULL) {
-        ret = xQueueReceive(pcmChkQHdl, &chnk, pdMS_TO_TICKS(2000));
+      if (pcmChkBuf != NULL) {
+        ret = receive_pcm_chunk(&chnk, pdMS_TO_TICKS(2000));
 
         //        xSemaphoreGive(playerPcmQueueMux);
       } else {
@@ -1215,9 +1609,25 @@ static void player_task(void *pvParameters) {
         //        buf_us %lld", age, serverNow, chunkStart, buf_us);
 
         if (initialSync == 1) {
+          int64_t playTime;
+
           // on initialSync == 0 (hard sync) we don't have any data in i2s DMA
-          // buffer so in that case we don't need to add this
-          age += outputBufferDacTime;
+          // buffer so in that case we don't need to add this. The chunk goes
+          // out when the DMA reaches the write position, measured from the
+          // last DMA EOF. Until there is one, assume full DMA buffers.
+          if (i2s_custom_get_play_time(I2S_NUM_0, 0, &playTime) == ESP_OK) {
+            age += playTime - (serverNow - diff2Server);
+          } else {
+            age += outputBufferDacTime;
+          }
+
+#if CONFIG_SNAPCLIENT_SYNC_RESAMPLER
+          // lookahead the resampler holds back goes out before this chunk
+          if (resampler.hist != NULL) {
+            age += (int64_t)(resampler_delay_frames(&resampler) * 1e6f /
+                             (float)scSet.sr);
+          }
+#endif
         }
       } else {
         // ESP_LOGW(TAG, "couldn't get server now");
@@ -1234,16 +1644,24 @@ static void player_task(void *pvParameters) {
 
       if (age < 0) {  // get initial sync using hardware timer
         if (initialSync == 0) {
+          // don't start on silence standing in for a missing chunk
+          if (chnk->fragment->payload == NULL) {
+            free_pcm_chunk(chnk);
+            chnk = NULL;
+
+            continue;
+          }
+
           MEDIANFILTER_Init(&shortMedianFilter);
           MEDIANFILTER_Init(&miniMedianFilter);
 
           timer_set_auto_reload(TIMER_GROUP_1, TIMER_1, TIMER_AUTORELOAD_DIS);
           tg0_timer1_start(-age);  // timer with 1µs ticks
 
-          i2s_custom_stop(I2S_NUM_0);
-          i2s_custom_zero_dma_buffer(I2S_NUM_0);
+          player_outputs_stop();
+          player_outputs_zero_dma_buffer();
 
-          adjust_apll(0);  // reset to normal playback speed
+          adjust_apll(0.0f);  // reset to normal playback speed
 
           uint32_t currentDescriptor = 0, currentDescriptorOffset = 0;
           uint32_t tmpCnt = CHNK_CTRL_CNT;
@@ -1251,8 +1669,8 @@ static void player_task(void *pvParameters) {
           //          xSemaphoreTake(playerPcmQueueMux, portMAX_DELAY);
           while (tmpCnt) {
             if (chnk == NULL) {
-              if (pcmChkQHdl != NULL) {
-                ret = xQueueReceive(pcmChkQHdl, &chnk, portMAX_DELAY);
+              if (pcmChkBuf != NULL) {
+                ret = receive_pcm_chunk(&chnk, portMAX_DELAY);
               }
             }
             //            xSemaphoreGive(playerPcmQueueMux);
@@ -1261,6 +1679,28 @@ static void player_task(void *pvParameters) {
             p_payload = fragment->payload;
             size = fragment->size;
 
+            if (p_payload == NULL) {
+              // a missing chunk, the zeroed DMA buffers left play silence
+              free_pcm_chunk(chnk);
+              chnk = NULL;
+              size = 0;
+
+              break;
+            }
+
+#if CONFIG_SNAPCLIENT_SYNC_RESAMPLER
+            // these go to DMA as they are, the resampler continues after
+            if ((resampler.hist != NULL) && (p_payload != NULL)) {
+              resampler_prime(&resampler, p_payload,
+                              size / pcm_pack_bytes(1, scSet.ch,
+                                                    resampler.slotBits));
+            }
+#endif
+
+#if CONFIG_SNAPCLIENT_DSP_SECOND_I2S
+            player_init_aux_dma(chnk, p_payload, size, currentDescriptor,
+                                currentDescriptorOffset);
+#endif
             i2s_custom_init_dma_tx_queues(I2S_NUM_0, (uint8_t *)p_payload, size,
                                           &written, &currentDescriptor,
                                           &currentDescriptorOffset);
@@ -1293,7 +1733,7 @@ static void player_task(void *pvParameters) {
 
           timer_pause(TIMER_GROUP_1, TIMER_1);
 
-          i2s_custom_start(I2S_NUM_0);
+          player_outputs_start();
 
           // get timer value so we can get the real age
           timer_val = (int64_t)notifiedValue;
@@ -1309,6 +1749,9 @@ static void player_task(void *pvParameters) {
                                    portMAX_DELAY) != ESP_OK) {
                 ESP_LOGE(TAG, "i2s_playback_task: I2S write error");
               }
+#if CONFIG_SNAPCLIENT_DSP_SECOND_I2S
+              player_write_aux(chnk, p_payload, written);
+#endif
               if (written < size) {
                 ESP_LOGE(TAG,
                          "i2s_playback_task: I2S didn't "
@@ -1349,20 +1792,14 @@ static void player_task(void *pvParameters) {
           chnk = NULL;
         }
 
-        // get count of chunks we are late for
-        uint32_t c = ceil((float)age / (float)chkDur_us);  // round up
-        // now clear all those chunks which are probably late too
-        while (c--) {
-          //          xSemaphoreTake(playerPcmQueueMux, portMAX_DELAY);
-          ret = xQueueReceive(pcmChkQHdl, &chnk, pdMS_TO_TICKS(1));
-          //          xSemaphoreGive(playerPcmQueueMux);
-          if (ret == pdPASS) {
-            free_pcm_chunk(chnk);
-            chnk = NULL;
-          } else {
-            break;
-          }
+        // now clear all those chunks which are late too, all at once as
+        // they are ordered by time
+        xSemaphoreTake(playerPcmQueueMux, portMAX_DELAY);
+        if (pcmChkBuf != NULL) {
+          jitter_buffer_drop_before(pcmChkBuf,
+                                    serverNow - buf_us + clientDacLatency_us);
         }
+        xSemaphoreGive(playerPcmQueueMux);
 
         wifi_ap_record_t ap;
         esp_wifi_sta_get_ap_info(&ap);
@@ -1386,35 +1823,38 @@ static void player_task(void *pvParameters) {
                  age, diff2Server, heap_caps_get_free_size(MALLOC_CAP_32BIT),
                  heap_caps_get_largest_free_block(MALLOC_CAP_32BIT), ap.rssi);
 
-        dir = 0;
+        metric_inc(&hardResyncMetric);
 
         initialSync = 0;
 
         audio_set_mute(true);
 
-        i2s_custom_stop(I2S_NUM_0);
+        player_outputs_stop();
 
         continue;
       }
 
       const bool enableControlLoop = true;
 
-      const int64_t shortOffset = 2;              //µs, softsync
-      const int64_t miniOffset = 1;               //µs, softsync
       const int64_t hardResyncThreshold = 10000;  //µs, hard sync
 
       if (initialSync == 1) {
         avg = age;
 
         int64_t shortMedian, miniMedian;
+        float speedPpm = 0.0f;
+
+        metric_observe(&ageErrorMetric, (int32_t)avg);
 
         shortMedian = MEDIANFILTER_Insert(&shortMedianFilter, avg);
         miniMedian = MEDIANFILTER_Insert(&miniMedianFilter, avg);
 
         //        xSemaphoreTake(playerPcmQueueMux, portMAX_DELAY);
-        int msgWaiting = uxQueueMessagesWaiting(pcmChkQHdl);
+        int msgWaiting = pcm_chunk_queue_msg_waiting();
         //        xSemaphoreGive(playerPcmQueueMux);
 
+        metric_set(&queueMetric, msgWaiting);
+
         // resync hard if we are getting very late / early.
         // rest gets tuned in through apll speed control
         if ((msgWaiting == 0) || (MEDIANFILTER_isFull(&shortMedianFilter,0) &&
@@ -1437,6 +1877,8 @@ static void player_task(void *pvParameters) {
                    heap_caps_get_largest_free_block(MALLOC_CAP_32BIT),
                    msgWaiting, ap.rssi);
 
+          metric_inc(&hardResyncMetric);
+
           //          // get count of chunks we are late for
           //          uint32_t c = ceil((float)age / (float)chkDur_us);  //
           //          round up
@@ -1458,39 +1900,52 @@ static void player_task(void *pvParameters) {
 
           audio_set_mute(true);
 
-          i2s_custom_stop(I2S_NUM_0);
+          player_outputs_stop();
 
           initialSync = 0;
 
           continue;
         }
 
-#if USE_SAMPLE_INSERTION  // WIP: insert samples to adjust sync
-        if ((enableControlLoop == true) &&
-            (MEDIANFILTER_isFull(&shortMedianFilter,0))) {
-          if (avg < -miniOffset) {  // we are early
-            dir = -1;
-            dir_insert_sample = -1;
-          } else if (avg > miniOffset) {  // we are late
-            dir = 1;
-            dir_insert_sample = 1;
+#if CONFIG_SNAPCLIENT_SYNC_SAMPLE_INSERTION
+        if ((enableControlLoop == true) && (sampleSlip.ch != 0) &&
+            (MEDIANFILTER_isFull(&shortMedianFilter, 0))) {
+          // playing ppm faster drops that many frames per million
+          speedPpm = sync_ctrl_update(&syncCtrl, miniMedian, chkDur_us);
+          slipFrames += speedPpm * 1e-6f * scSet.chkInFrames;
+          if (slipFrames > 2.0f) {
+            slipFrames = 2.0f;
+          } else if (slipFrames < -2.0f) {
+            slipFrames = -2.0f;
           }
         }
+#elif CONFIG_SNAPCLIENT_SYNC_RESAMPLER
+        if ((enableControlLoop == true) && (resampler.hist != NULL) &&
+            (MEDIANFILTER_isFull(&shortMedianFilter, 0))) {
+          speedPpm = sync_ctrl_update(&syncCtrl, miniMedian, chkDur_us);
+          resampler_set_ppm(&resampler, speedPpm);
+        }
 #else  // use APLL to adjust sync
         if ((enableControlLoop == true) &&
             (MEDIANFILTER_isFull(&shortMedianFilter,0))) {
-          if ((shortMedian < -shortOffset) && (miniMedian < -miniOffset) &&
-              (avg < -miniOffset)) {  // we are early
-            dir = -1;
-          } else if ((shortMedian > shortOffset) && (miniMedian > miniOffset) &&
-                     (avg > miniOffset)) {  // we are late
-            dir = 1;
+          // PI control, the APLL is written when the correction moves by
+          // more than SYNC_APLL_HYSTERESIS
+          if (adjust_apll(
+                  sync_ctrl_update(&syncCtrl, miniMedian, chkDur_us))) {
+            metric_inc(&softResyncMetric);
           }
-
-          adjust_apll(dir);
+          speedPpm = sync_apll_get_ppm(&apll);
         }
 #endif
 
+        if (speedPpm > 0.0f) {
+          metric_inc(&speedFasterMetric);
+        } else if (speedPpm < 0.0f) {
+          metric_inc(&speedSlowerMetric);
+        } else {
+          metric_inc(&speedNominalMetric);
+        }
+
         const uint32_t tmpCntInit = 1;  // 250  // every 6s
         static uint32_t tmpcnt = 1;
         if (tmpcnt-- == 0) {
@@ -1526,36 +1981,108 @@ static void player_task(void *pvParameters) {
           //          xSemaphoreGive(playerPcmQueueMux);
         }
 
-        dir = 0;
+#if CONFIG_SNAPCLIENT_CHUNK_TRACE
+        {
+          int64_t playTime;
+
+          // when the DMA gets to it, ahead of now
+          if (i2s_custom_get_play_time(I2S_NUM_0, 0, &playTime) == ESP_OK) {
+            chunk_trace_record(CHUNK_TRACE_PLAY,
+                               (int64_t)chnk->timestamp.sec * 1000000LL +
+                                   (int64_t)chnk->timestamp.usec,
+                               0, playTime);
+          }
+        }
+#endif
 
         fragment = chnk->fragment;
         p_payload = fragment->payload;
         size = fragment->size;
 
+#if CONFIG_SNAPCLIENT_SYNC_RESAMPLER
+        if ((resampler.hist != NULL) && (p_payload != NULL) &&
+            (fragment->nextFragment == NULL)) {
+          size_t frameBytes = pcm_pack_bytes(1, scSet.ch, resampler.slotBits);
+
+          if (size / frameBytes <= resampler.maxFrames) {
+            // write the resampled frames instead, chnk is freed as usual
+            size = resampler_process(&resampler, p_payload, size / frameBytes) *
+                   frameBytes;
+            p_payload = (char *)resampler.out;
+          }
+        }
+#endif
+
+#if CONFIG_SNAPCLIENT_SYNC_SAMPLE_INSERTION
+        bool slipping = false;
+
+        if ((sampleSlip.ch != 0) && (p_payload != NULL) &&
+            (fragment->nextFragment == NULL)) {
+          size_t frameBytes =
+              pcm_pack_bytes(1, sampleSlip.ch, sampleSlip.slotBits);
+          uint32_t frames = size / frameBytes;
+          int8_t delta = 0;
+
+          if (slipFrames >= 1.0f) {
+            delta = -1;
+          } else if (slipFrames <= -1.0f) {
+            delta = 1;
+          }
+
+          if (delta != 0) {
+            metric_inc(&softResyncMetric);
+          }
+
+          // copied to DMA by sample_slip_fill(), chnk is freed as usual
+          size = sample_slip_start(&sampleSlip, p_payload, frames, delta) *
+                 frameBytes;
+          slipFrames += (float)(size / frameBytes) - frames;
+          slipping = true;
+        }
+#endif
+
+#if CONFIG_SNAPCLIENT_I2S_ZERO_COPY
+        // a pool block as it came from the decoder is sent by the DMA in
+        // place, the driver returns it to the pool
+        bool zeroCopy = (p_payload != NULL) &&
+                        (p_payload == fragment->payload) &&
+                        (fragment->nextFragment == NULL) &&
+                        (chnk->pool != NULL);
+#if CONFIG_SNAPCLIENT_SYNC_SAMPLE_INSERTION
+        zeroCopy = zeroCopy && (slipping == false);
+#endif
+
+        if (zeroCopy &&
+            (i2s_custom_write_zero_copy(I2S_NUM_0, p_payload, (size_t)size,
+                                        pcm_chunk_dma_release, chnk, &written,
+                                        portMAX_DELAY) == ESP_OK)) {
+          if (written < size) {
+            ESP_LOGE(TAG, "i2s_playback_task: I2S didn't write all data");
+          }
+
+          chnk = NULL;
+        } else
+#endif
         if (p_payload != NULL) {
           do {
             written = 0;
 
-#if USE_SAMPLE_INSERTION
-            uint32_t sampleSizeInBytes = 4 * 3;
-
-            if (dir_insert_sample == -1) {
-              if (i2s_custom_write(I2S_NUM_0, p_payload,
-                                   (size_t)sampleSizeInBytes, &written,
-                                   portMAX_DELAY) != ESP_OK) {
-                ESP_LOGE(TAG, "i2s_playback_task:  I2S write error %d", 1);
+#if CONFIG_SNAPCLIENT_SYNC_SAMPLE_INSERTION
+            if (slipping) {
+              if (i2s_custom_write_cb(I2S_NUM_0, sample_slip_fill,
+                                      &sampleSlip, (size_t)size, &written,
+                                      portMAX_DELAY) != ESP_OK) {
+                ESP_LOGE(TAG, "i2s_playback_task: I2S write error %d", size);
               }
-            } else if (dir_insert_sample == 1) {
-              size -= sampleSizeInBytes;
-            }
-
-            dir_insert_sample = 0;
+            } else
 #endif
-
             if (i2s_custom_write(I2S_NUM_0, p_payload, (size_t)size, &written,
                                  portMAX_DELAY) != ESP_OK) {
               ESP_LOGE(TAG, "i2s_playback_task: I2S write error %d", size);
             }
+#if CONFIG_SNAPCLIENT_DSP_SECOND_I2S
+            player_write_aux(chnk, p_payload, written);
+#endif
 
             if (written < size) {
               ESP_LOGE(TAG, "i2s_playback_task: I2S didn't write all data");
@@ -1563,6 +2090,15 @@ static void player_task(void *pvParameters) {
             size -= written;
             p_payload += written;
 
+#if CONFIG_SNAPCLIENT_SYNC_SAMPLE_INSERTION
+            if (slipping && (written == 0)) {
+              // sample_slip_fill() splits frames at DMA buffer ends, so
+              // this only stops a write error from spinning here
+              ESP_LOGE(TAG, "i2s_playback_task: sample slip stalled");
+              size = 0;
+            }
+#endif
+
             if (size == 0) {
               if (fragment->nextFragment != NULL) {
                 fragment = fragment->nextFragment;
@@ -1579,22 +2115,17 @@ static void player_task(void *pvParameters) {
             }
           } while (1);
         } else {
-          // here we have an empty fragment because of memory allocation error.
-          // fill DMA with zeros so we don't get out of sync
+          // a gap in the queue, zero the DMA buffers straight away so we
+          // don't get out of sync
           written = 0;
-          const size_t write_size = 4;
-          uint8_t tmpBuf[write_size];
-
-          memset(tmpBuf, 0, sizeof(tmpBuf));
-
-          do {
-            if (i2s_custom_write(I2S_NUM_0, tmpBuf, (size_t)write_size,
-                                 &written, portMAX_DELAY) != ESP_OK) {
-              ESP_LOGE(TAG, "i2s_playback_task: I2S write error %d", size);
-            }
-
-            size -= written;
-          } while (size);
+          if (i2s_custom_write_cb(I2S_NUM_0, player_fill_silence, NULL,
+                                  (size_t)size, &written,
+                                  portMAX_DELAY) != ESP_OK) {
+            ESP_LOGE(TAG, "i2s_playback_task: I2S write error %d", size);
+          }
+#if CONFIG_SNAPCLIENT_DSP_SECOND_I2S
+          player_write_aux(chnk, NULL, written);
+#endif
 
           free_pcm_chunk(chnk);
           chnk = NULL;
@@ -1609,21 +2140,19 @@ static void player_task(void *pvParameters) {
       usec = usec % 1000;
 
       //      xSemaphoreTake(playerPcmQueueMux, portMAX_DELAY);
-      if (pcmChkQHdl != NULL) {
+      if (pcmChkBuf != NULL) {
         ESP_LOGE(TAG,
                  "Couldn't get PCM chunk, recv: messages waiting %d, "
                  "diff2Server: %llds, %lld.%lldms",
-                 uxQueueMessagesWaiting(pcmChkQHdl), sec, msec, usec);
+                 pcm_chunk_queue_msg_waiting(), sec, msec, usec);
       }
       //      xSemaphoreGive(playerPcmQueueMux);
 
-      dir = 0;
-
       initialSync = 0;
 
       audio_set_mute(true);
 
-      i2s_custom_stop(I2S_NUM_0);
+      player_outputs_stop();
     }
   }
 }
@@ -0,0 +1,291 @@
+/* Polyphase resampler for drift correction
+
+   The ratio stays within RESAMPLER_MAX_PPM of 1, so the filter only has to
+   interpolate between input frames, not band limit for a different rate.
+   Coefficients for RESAMPLER_PHASES + 1 fractional positions are built once,
+   each phase normalized to unity DC gain. Output positions between two
+   phases interpolate the coefficients linearly, which keeps the table small
+   while the error stays below 16 bit resolution. The math is single
+   precision float like the DSP flows, the ESP32 FPU does a multiply
+   accumulate per cycle and Q15 coefficients alone would limit THD+N to
+   about -88 dB.
+*/
+
+#include "resampler.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// phase RESAMPLER_PHASES is phase 0 one frame later
+static float coefs[RESAMPLER_PHASES + 1][RESAMPLER_TAPS];
+static bool coefsBuilt = false;
+
+/**
+ * Modified Bessel function of the first kind, order 0.
+ */
+static double bessel_i0(double x) {
+  double sum = 1.0, term = 1.0;
+  int k;
+
+  for (k = 1; k < 32; k++) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+    if (term < sum * 1e-12) {
+      break;
+    }
+  }
+
+  return sum;
+}
+
+/**
+ *
+ */
+static void resampler_build_coefs(void) {
+  const double halfLen = RESAMPLER_TAPS / 2;
+  double h[RESAMPLER_TAPS];
+  int p, k;
+
+  for (p = 0; p <= RESAMPLER_PHASES; p++) {
+    double frac = (double)p / RESAMPLER_PHASES;
+    double sum = 0.0;
+
+    for (k = 0; k < RESAMPLER_TAPS; k++) {
+      // distance of the tap to the output position
+      double t = k - RESAMPLER_LEFT_TAPS - frac;
+      double x = t / halfLen;
+      double arg = 2.0 * RESAMPLER_CUTOFF * t;
+      double sinc = (fabs(arg) < 1e-9) ? 1.0 : sin(M_PI * arg) / (M_PI * arg);
+      double w = 0.0;
+
+      if (fabs(x) <= 1.0) {
+        w = bessel_i0(RESAMPLER_KAISER_BETA * sqrt(1.0 - x * x)) /
+            bessel_i0(RESAMPLER_KAISER_BETA);
+      }
+
+      h[k] = sinc * w;
+      sum += h[k];
+    }
+
+    for (k = 0; k < RESAMPLER_TAPS; k++) {
+      coefs[p][k] = (float)(h[k] / sum);
+    }
+  }
+
+  coefsBuilt = true;
+}
+
+/**
+ *
+ */
+int32_t resampler_init(resampler_t *rs, uint32_t maxFrames, uint8_t ch,
+                       uint8_t slotBits) {
+  memset(rs, 0, sizeof(resampler_t));
+
+  if ((maxFrames == 0) || (ch == 0) ||
+      ((slotBits != 16) && (slotBits != 32)) ||
+      ((slotBits == 16) && (ch & 1))) {
+    return -1;
+  }
+
+  if (coefsBuilt == false) {
+    resampler_build_coefs();
+  }
+
+  rs->ch = ch;
+  rs->slotBits = slotBits;
+  rs->maxFrames = maxFrames;
+  rs->outMaxFrames =
+      maxFrames + (uint64_t)maxFrames * RESAMPLER_MAX_PPM / 1000000 + 2;
+
+  rs->hist = (float *)calloc((size_t)(maxFrames + RESAMPLER_TAPS) * ch,
+                             sizeof(float));
+  rs->out = malloc((size_t)rs->outMaxFrames * ch * slotBits / 8);
+  if ((rs->hist == NULL) || (rs->out == NULL)) {
+    resampler_free(rs);
+
+    return -2;
+  }
+
+  resampler_prime(rs, NULL, 0);
+
+  return 0;
+}
+
+/**
+ *
+ */
+void resampler_free(resampler_t *rs) {
+  free(rs->hist);
+  free(rs->out);
+
+  memset(rs, 0, sizeof(resampler_t));
+}
+
+/**
+ * Append samples in slot layout to the history.
+ */
+static void resampler_unpack(resampler_t *rs, const void *src,
+                             uint32_t frames) {
+  const volatile uint32_t *in = (const volatile uint32_t *)src;
+  float *dst = &rs->hist[rs->filled * rs->ch];
+  uint32_t samples = frames * rs->ch;
+  uint32_t n;
+
+  if (rs->slotBits == 16) {
+    for (n = 0; n < samples / 2; n++) {
+      uint32_t w = in[n];
+
+      dst[2 * n] = (int16_t)(w >> 16);
+      dst[2 * n + 1] = (int16_t)w;
+    }
+  } else {
+    for (n = 0; n < samples; n++) {
+      // scaled to 24 bit, float has no more
+      dst[n] = (float)((int32_t)in[n] >> 8);
+    }
+  }
+
+  rs->filled += frames;
+}
+
+/**
+ *
+ */
+void resampler_prime(resampler_t *rs, const void *src, uint32_t frames) {
+  rs->filled = 0;
+
+  if (frames >= RESAMPLER_LEFT_TAPS) {
+    uint32_t offset = (frames - RESAMPLER_LEFT_TAPS) * rs->ch;
+
+    resampler_unpack(rs, (const uint8_t *)src + offset * rs->slotBits / 8,
+                     RESAMPLER_LEFT_TAPS);
+  } else {
+    memset(rs->hist, 0, RESAMPLER_LEFT_TAPS * rs->ch * sizeof(float));
+    rs->filled = RESAMPLER_LEFT_TAPS;
+  }
+
+  rs->pos = 0;
+  resampler_set_ppm(rs, 0.0f);
+}
+
+/**
+ *
+ */
+void resampler_set_ppm(resampler_t *rs, float ppm) {
+  if (ppm > RESAMPLER_MAX_PPM) {
+    ppm = RESAMPLER_MAX_PPM;
+  } else if (ppm < -RESAMPLER_MAX_PPM) {
+    ppm = -RESAMPLER_MAX_PPM;
+  }
+
+  rs->ppm = ppm;
+  // 2^32 / 1e6 per ppm
+  rs->step = (1ULL << 32) + (int64_t)(ppm * 4294.967296f);
+}
+
+/**
+ * Coefficients for the fractional part of an output position.
+ */
+static inline void resampler_coefs(uint32_t frac, float *c) {
+  const float *a = coefs[frac >> (32 - RESAMPLER_PHASE_BITS)];
+  const float *b = a + RESAMPLER_TAPS;
+  float mix = (float)(frac << RESAMPLER_PHASE_BITS) * (1.0f / 4294967296.0f);
+  int k;
+
+  for (k = 0; k < RESAMPLER_TAPS; k++) {
+    c[k] = a[k] + (b[k] - a[k]) * mix;
+  }
+}
+
+/**
+ *
+ */
+static inline int32_t resampler_round(float v, float max) {
+  if (v >= max) {
+    return (int32_t)max;
+  } else if (v <= -max - 1.0f) {
+    return (int32_t)(-max - 1.0f);
+  }
+
+  // lrintf() is a library call on the ESP32
+  return (int32_t)(v + ((v >= 0.0f) ? 0.5f : -0.5f));
+}
+
+/**
+ *
+ */
+uint32_t resampler_process(resampler_t *rs, const void *src, uint32_t frames) {
+  const uint32_t ch = rs->ch;
+  float c[RESAMPLER_TAPS];
+  uint32_t n = 0, used, i, k, s;
+
+  if (frames > rs->maxFrames) {
+    return 0;
+  }
+
+  resampler_unpack(rs, src, frames);
+
+  while (((rs->pos >> 32) + RESAMPLER_TAPS <= rs->filled) &&
+         (n < rs->outMaxFrames)) {
+    const float *x = &rs->hist[(rs->pos >> 32) * ch];
+
+    resampler_coefs((uint32_t)rs->pos, c);
+
+    if (rs->slotBits == 16) {
+      uint32_t *out = (uint32_t *)rs->out + n * ch / 2;
+
+      for (s = 0; s < ch; s += 2) {
+        float acc0 = 0.0f, acc1 = 0.0f;
+
+        for (k = 0; k < RESAMPLER_TAPS; k++) {
+          acc0 += c[k] * x[k * ch + s];
+          acc1 += c[k] * x[k * ch + s + 1];
+        }
+
+        out[s / 2] = ((uint32_t)resampler_round(acc0, 32767.0f) << 16) |
+                     ((uint32_t)resampler_round(acc1, 32767.0f) & 0xFFFF);
+      }
+    } else {
+      uint32_t *out = (uint32_t *)rs->out + n * ch;
+
+      for (s = 0; s < ch; s++) {
+        float acc = 0.0f;
+
+        for (k = 0; k < RESAMPLER_TAPS; k++) {
+          acc += c[k] * x[k * ch + s];
+        }
+
+        out[s] = (uint32_t)resampler_round(acc, 8388607.0f) << 8;
+      }
+    }
+
+    rs->pos += rs->step;
+    n++;
+  }
+
+  // drop frames no output position reaches any more
+  used = rs->pos >> 32;
+  if (used > rs->filled) {
+    used = rs->filled;
+  }
+
+  for (i = 0; i < (rs->filled - used) * ch; i++) {
+    rs->hist[i] = rs->hist[used * ch + i];
+  }
+
+  rs->filled -= used;
+  rs->pos -= (uint64_t)used << 32;
+
+  return n;
+}
+
+/**
+ *
+ */
+float resampler_delay_frames(const resampler_t *rs) {
+  return (float)rs->filled - RESAMPLER_LEFT_TAPS -
+         (float)rs->pos / 4294967296.0f;
+}
@@ -0,0 +1,243 @@
+/* Sample insertion and deletion for drift correction
+
+   Dropping output frame k of a chunk is done by gliding from x[n] to
+   x[n + 1] over the fade, y[n] = x[n] + r[n - k] * (x[n + 1] - x[n]), and
+   continuing with x[n + 1] afterwards. Repeating one glides to x[n - 1]. r
+   is a raised cosine in Q15, so the output is a linear interpolation whose
+   position moves by one frame without a step in value or slope. The error
+   against an ideal fractional delay is that of linear interpolation during
+   the fade only, smallest where neighbouring frames differ least, which is
+   where the fade is put.
+*/
+
+#include "sample_slip.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int16_t ramp[SAMPLE_SLIP_FADE_FRAMES];
+static bool rampBuilt = false;
+
+/**
+ *
+ */
+static void sample_slip_build_ramp(void) {
+  int i;
+
+  for (i = 0; i < SAMPLE_SLIP_FADE_FRAMES; i++) {
+    double x = (double)(i + 1) / (SAMPLE_SLIP_FADE_FRAMES + 1);
+
+    ramp[i] = (int16_t)lround(32768.0 * (0.5 - 0.5 * cos(M_PI * x)));
+  }
+
+  rampBuilt = true;
+}
+
+/**
+ *
+ */
+int32_t sample_slip_init(sample_slip_t *slip, uint8_t ch, uint8_t slotBits) {
+  memset(slip, 0, sizeof(sample_slip_t));
+
+  if ((ch == 0) || (ch > SAMPLE_SLIP_MAX_CH) ||
+      ((slotBits != 16) && (slotBits != 32)) ||
+      ((slotBits == 16) && (ch & 1))) {
+    return -1;
+  }
+
+  if (rampBuilt == false) {
+    sample_slip_build_ramp();
+  }
+
+  slip->ch = ch;
+  slip->slotBits = slotBits;
+  slip->frameWords = (slotBits == 16) ? ch / 2 : ch;
+
+  return 0;
+}
+
+/**
+ * How much frames change from one to the next over a fade starting at k,
+ * every 4th frame is enough to rank candidates.
+ */
+static uint64_t sample_slip_cost(const sample_slip_t *slip, uint32_t k) {
+  const volatile uint32_t *in = (const volatile uint32_t *)slip->src;
+  const uint32_t words = slip->frameWords;
+  uint64_t cost = 0;
+  uint32_t n, w;
+
+  for (n = k; n < k + SAMPLE_SLIP_FADE_FRAMES; n += 4) {
+    const volatile uint32_t *a = &in[n * words];
+    const volatile uint32_t *b = (slip->delta < 0) ? a + words : a - words;
+
+    for (w = 0; w < words; w++) {
+      uint32_t x = a[w], y = b[w];
+
+      if (slip->slotBits == 16) {
+        cost += abs((int16_t)(x >> 16) - (int16_t)(y >> 16)) +
+                abs((int16_t)x - (int16_t)y);
+      } else {
+        cost += llabs((int64_t)(int32_t)x - (int32_t)y);
+      }
+    }
+  }
+
+  return cost;
+}
+
+/**
+ *
+ */
+uint32_t sample_slip_start(sample_slip_t *slip, const void *src,
+                           uint32_t frames, int8_t delta) {
+  // fade positions that keep x[n + 1] or x[n - 1] within the chunk
+  int32_t lo = (delta > 0) ? 1 : 0;
+  int32_t hi =
+      (int32_t)frames - SAMPLE_SLIP_FADE_FRAMES - ((delta < 0) ? 1 : 0);
+
+  slip->src = (const uint32_t *)src;
+  slip->frames = frames;
+  slip->outPos = 0;
+  slip->delta = delta;
+  slip->carryBytes = 0;
+
+  if ((delta == 0) || (hi < lo)) {
+    slip->delta = 0;
+    slip->outFrames = frames;
+    slip->fadeAt = frames;
+
+    return frames;
+  }
+
+  {
+    uint64_t best = UINT64_MAX;
+    int i;
+
+    for (i = 0; i < SAMPLE_SLIP_CANDIDATES; i++) {
+      uint32_t k = lo + (uint32_t)((uint64_t)(hi - lo) * (2 * i + 1) /
+                                   (2 * SAMPLE_SLIP_CANDIDATES));
+      uint64_t cost = sample_slip_cost(slip, k);
+
+      if (cost < best) {
+        best = cost;
+        slip->fadeAt = k;
+      }
+    }
+  }
+
+  slip->outFrames = frames + delta;
+
+  return slip->outFrames;
+}
+
+/**
+ * Output frame n of the fade, j frames into it.
+ */
+static inline void sample_slip_blend(const sample_slip_t *slip, uint32_t *dst,
+                                     uint32_t n, uint32_t j) {
+  const volatile uint32_t *a = &slip->src[n * slip->frameWords];
+  const volatile uint32_t *b = a - slip->delta * (int32_t)slip->frameWords;
+  const int32_t r = ramp[j];
+  uint32_t w;
+
+  for (w = 0; w < slip->frameWords; w++) {
+    uint32_t x = a[w], y = b[w];
+
+    if (slip->slotBits == 16) {
+      int32_t xh = (int16_t)(x >> 16), xl = (int16_t)x;
+      int32_t yh = (int16_t)(y >> 16), yl = (int16_t)y;
+
+      // |difference| < 2^16, times r < 2^15 fits
+      xh += ((yh - xh) * r) >> 15;
+      xl += ((yl - xl) * r) >> 15;
+      dst[w] = ((uint32_t)xh << 16) | ((uint32_t)xl & 0xFFFF);
+    } else {
+      int32_t xs = (int32_t)x;
+      int64_t d = (int64_t)(int32_t)y - xs;
+
+      dst[w] = (uint32_t)(xs + (int32_t)((d * r) >> 15));
+    }
+  }
+}
+
+/**
+ * Output frame n to dst.
+ */
+static void sample_slip_frame(const sample_slip_t *slip, uint32_t *dst,
+                              uint32_t n) {
+  const uint32_t frameBytes = slip->frameWords * 4;
+
+  if (n < slip->fadeAt) {
+    memcpy(dst, &slip->src[n * slip->frameWords], frameBytes);
+  } else if (n < slip->fadeAt + SAMPLE_SLIP_FADE_FRAMES) {
+    sample_slip_blend(slip, dst, n, n - slip->fadeAt);
+  } else {
+    memcpy(dst, &slip->src[(n - slip->delta) * slip->frameWords], frameBytes);
+  }
+}
+
+/**
+ *
+ */
+size_t sample_slip_fill(void *dst, size_t size, void *arg) {
+  sample_slip_t *slip = (sample_slip_t *)arg;
+  const uint32_t frameBytes = slip->frameWords * 4;
+  const uint32_t fadeEnd = slip->fadeAt + SAMPLE_SLIP_FADE_FRAMES;
+  uint8_t *start = (uint8_t *)dst;
+  uint32_t *out = (uint32_t *)dst;
+  uint32_t n = slip->outPos;
+  uint32_t end, rest;
+
+  // the rest of a frame split by the last call
+  if (slip->carryBytes > 0) {
+    uint32_t m = (size < slip->carryBytes) ? size : slip->carryBytes;
+
+    memcpy(out, (uint8_t *)slip->carry + frameBytes - slip->carryBytes, m);
+    slip->carryBytes -= m;
+    size -= m;
+    out += m / 4;
+  }
+
+  end = n + size / frameBytes;
+  if (end > slip->outFrames) {
+    end = slip->outFrames;
+  }
+
+  // before the fade, as is
+  if (n < slip->fadeAt) {
+    uint32_t m = ((end < slip->fadeAt) ? end : slip->fadeAt) - n;
+
+    memcpy(out, &slip->src[n * slip->frameWords], m * frameBytes);
+    out += m * slip->frameWords;
+    n += m;
+  }
+
+  for (; (n < end) && (n < fadeEnd); n++) {
+    sample_slip_blend(slip, out, n, n - slip->fadeAt);
+    out += slip->frameWords;
+  }
+
+  // after the fade, one frame later or earlier
+  if (n < end) {
+    memcpy(out, &slip->src[(n - slip->delta) * slip->frameWords],
+           (end - n) * frameBytes);
+    out += (end - n) * slip->frameWords;
+    n = end;
+  }
+
+  // the DMA buffer ends within the next frame, split it
+  rest = size % frameBytes;
+  if ((rest > 0) && (n < slip->outFrames) && (slip->carryBytes == 0)) {
+    sample_slip_frame(slip, slip->carry, n);
+    memcpy(out, slip->carry, rest);
+    slip->carryBytes = frameBytes - rest;
+    out += rest / 4;
+    n++;
+  }
+
+  slip->outPos = n;
+
+  return (uint8_t *)out - start;
+}
@@ -0,0 +1,426 @@
+/* Snapcast client engine
+
+   Connection handling, handshake and message dispatching independent of the
+   network stack and the decoders, which are hooked in through the transport
+   and the callbacks.
+*/
+
+#include "snapcast_client.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+/* Logging tag */
+static const char *TAG = "SNAPCLIENT";
+
+/**
+ *
+ */
+int snapcast_client_init(snapcast_client_t *client,
+                         snapcast_transport_t *transport,
+                         const snapcast_client_callbacks_t *cb,
+                         int64_t (*now)(void)) {
+  if ((client == NULL) || (transport == NULL) || (cb == NULL) ||
+      (now == NULL)) {
+    return -1;
+  }
+
+  memset(client, 0, sizeof(snapcast_client_t));
+
+  client->transport = transport;
+  client->cb = *cb;
+  client->now = now;
+
+  snapcast_framer_init(&client->framer);
+
+  return 0;
+}
+
+/**
+ *
+ */
+int snapcast_client_connect(snapcast_client_t *client, hello_message_t *hello) {
+  base_message_t base_message_tx;
+  char base_message_serialized[BASE_MESSAGE_SIZE];
+  char *hello_message_serialized;
+  size_t size = 0;
+  int64_t now;
+  int rc;
+
+  if (client->transport->connect(client->transport->ctx) != 0) {
+    return -1;
+  }
+
+  client->connected = true;
+
+  hello_message_serialized = hello_message_serialize(hello, &size);
+  if (!hello_message_serialized) {
+    ESP_LOGE(TAG, "Failed to serialize hello message");
+
+    return -1;
+  }
+
+  now = client->now();
+
+  base_message_tx.type = SNAPCAST_MESSAGE_HELLO;
+  base_message_tx.id = 0x0000;
+  base_message_tx.refersTo = 0x0000;
+  base_message_tx.sent.sec = now / 1000000;
+  base_message_tx.sent.usec = now - base_message_tx.sent.sec * 1000000;
+  base_message_tx.received.sec = 0;
+  base_message_tx.received.usec = 0;
+  base_message_tx.size = size;
+
+  rc = base_message_serialize(&base_message_tx, base_message_serialized,
+                              BASE_MESSAGE_SIZE);
+  if (rc) {
+    ESP_LOGE(TAG, "Failed to serialize base message");
+
+    free(hello_message_serialized);
+
+    return -1;
+  }
+
+  rc = client->transport->send(client->transport->ctx, base_message_serialized,
+                               BASE_MESSAGE_SIZE);
+  if (rc == 0) {
+    rc = client->transport->send(client->transport->ctx,
+                                 hello_message_serialized, size);
+  }
+
+  free(hello_message_serialized);
+
+  if (rc != 0) {
+    ESP_LOGE(TAG, "failed to send hello message");
+
+    return -1;
+  }
+
+  ESP_LOGI(TAG, "sent hello message");
+
+  snapcast_framer_init(&client->framer);
+  client->idCounter = 1;
+
+  if (client->cb.connected) {
+    return client->cb.connected(client->cb.arg);
+  }
+
+  return 0;
+}
+
+/**
+ *
+ */
+void snapcast_client_disconnect(snapcast_client_t *client) {
+  if (client->msgBuf != NULL) {
+    free(client->msgBuf);
+    client->msgBuf = NULL;
+  }
+
+  if (client->connected == true) {
+    client->connected = false;
+
+    client->transport->close(client->transport->ctx);
+
+    if (client->cb.disconnected) {
+      client->cb.disconnected(client->cb.arg);
+    }
+  }
+}
+
+/**
+ *
+ */
+int snapcast_client_send_time_request(snapcast_client_t *client) {
+  base_message_t base_message_tx;
+  char pkt[BASE_MESSAGE_SIZE + TIME_MESSAGE_SIZE];
+  int64_t now;
+  int rc;
+
+  if (client->connected == false) {
+    return -1;
+  }
+
+  memset(pkt, 0, sizeof(pkt));
+
+  now = client->now();
+
+  base_message_tx.type = SNAPCAST_MESSAGE_TIME;
+  base_message_tx.id = client->idCounter++;
+  base_message_tx.refersTo = 0;
+  base_message_tx.received.sec = 0;
+  base_message_tx.received.usec = 0;
+  base_message_tx.sent.sec = now / 1000000;
+  base_message_tx.sent.usec = now - base_message_tx.sent.sec * 1000000;
+  base_message_tx.size = TIME_MESSAGE_SIZE;
+  rc = base_message_serialize(&base_message_tx, pkt, BASE_MESSAGE_SIZE);
+  if (rc) {
+    ESP_LOGE(TAG, "Failed to serialize base message for time");
+
+    return -1;
+  }
+
+  return client->transport->send(client->transport->ctx, pkt, sizeof(pkt));
+}
+
+/**
+ *
+ */
+static int handle_codec_header(snapcast_client_t *client, const char *payload,
+                               uint32_t size) {
+  codec_header_message_t codec_header_message;
+  int rc;
+
+  codec_header_message.codec = NULL;
+  rc = codec_header_message_deserialize(&codec_header_message, payload, size);
+  if ((rc) || (codec_header_message.size >
+                size - 8 - strlen(codec_header_message.codec))) {
+    ESP_LOGE(TAG, "Failed to read codec header: %d", rc);
+
+    codec_header_message_free(&codec_header_message);
+
+    return 0;
+  }
+
+  rc = 0;
+  if (client->cb.codec_header) {
+    rc = client->cb.codec_header(client->cb.arg, &codec_header_message);
+  }
+
+  codec_header_message_free(&codec_header_message);
+
+  return rc;
+}
+
+/**
+ *
+ */
+static int handle_server_settings(snapcast_client_t *client,
+                                  const char *payload, uint32_t size) {
+  server_settings_message_t server_settings_message;
+  uint32_t len;
+  char *tmp;
+  int rc;
+
+  if (size < sizeof(len)) {
+    ESP_LOGE(TAG, "server settings message too short %d", size);
+
+    return 0;
+  }
+
+  memcpy(&len, payload, sizeof(len));
+  if (len > size - sizeof(len)) {
+    ESP_LOGE(TAG, "server settings string too long %d", len);
+
+    return 0;
+  }
+
+  // need a NULL terminated string for cJSON
+  tmp = malloc(len + 1);
+  if (tmp == NULL) {
+    ESP_LOGE(TAG, "couldn't get memory for server settings string");
+
+    return 0;
+  }
+
+  memcpy(tmp, &payload[sizeof(len)], len);
+  tmp[len] = 0;
+
+  memset(&server_settings_message, 0, sizeof(server_settings_message));
+  rc = server_settings_message_deserialize(&server_settings_message, tmp);
+  free(tmp);
+  if (rc) {
+    ESP_LOGE(TAG, "Failed to read server settings: %d", rc);
+
+    return 0;
+  }
+
+  // log mute state, buffer, latency
+  ESP_LOGI(TAG, "Buffer length:  %d", server_settings_message.buffer_ms);
+  ESP_LOGI(TAG, "Latency:        %d", server_settings_message.latency);
+  ESP_LOGI(TAG, "Mute:           %d", server_settings_message.muted);
+  ESP_LOGI(TAG, "Setting volume: %d", server_settings_message.volume);
+
+  if (client->cb.server_settings) {
+    return client->cb.server_settings(client->cb.arg, &server_settings_message);
+  }
+
+  return 0;
+}
+
+/**
+ *
+ */
+static int dispatch(snapcast_client_t *client, const snapcast_frame_t *frame,
+                    int64_t now) {
+  const char *payload = NULL;
+  int rc = 0;
+
+  if (frame->event == SNAPCAST_FRAMER_MESSAGE) {
+    client->messages++;
+  }
+
+  // codec header and server settings are handled as a whole, use the
+  // segment in place if the message isn't split
+  if ((frame->event == SNAPCAST_FRAMER_PAYLOAD) &&
+      ((frame->base.type == SNAPCAST_MESSAGE_CODEC_HEADER) ||
+       (frame->base.type == SNAPCAST_MESSAGE_SERVER_SETTINGS))) {
+    if ((frame->offset == 0) && (frame->complete == true)) {
+      payload = frame->data;
+    } else {
+      if (frame->offset == 0) {
+        client->msgBuf = (char *)malloc(frame->total);
+        if (client->msgBuf == NULL) {
+          ESP_LOGE(TAG, "couldn't get memory for message %d",
+                   frame->base.type);
+        }
+      }
+
+      if (client->msgBuf != NULL) {
+        memcpy(&client->msgBuf[frame->offset], frame->data, frame->len);
+
+        if (frame->complete == true) {
+          payload = client->msgBuf;
+        }
+      }
+    }
+  }
+
+  switch (frame->base.type) {
+    case SNAPCAST_MESSAGE_WIRE_CHUNK: {
+      if ((frame->complete == true) &&
+          (frame->event == SNAPCAST_FRAMER_PAYLOAD)) {
+        client->wireChunks++;
+      }
+
+      if (client->cb.wire_chunk) {
+        rc = client->cb.wire_chunk(client->cb.arg, frame);
+      }
+
+      break;
+    }
+
+    case SNAPCAST_MESSAGE_CODEC_HEADER: {
+      if (payload != NULL) {
+        rc = handle_codec_header(client, payload, frame->total);
+      }
+
+      break;
+    }
+
+    case SNAPCAST_MESSAGE_SERVER_SETTINGS: {
+      if (payload != NULL) {
+        rc = handle_server_settings(client, payload, frame->total);
+      }
+
+      break;
+    }
+
+    case SNAPCAST_MESSAGE_TIME: {
+      if (frame->event == SNAPCAST_FRAMER_MESSAGE) {
+        int64_t trx, ttx, tdif;
+
+        trx = now;
+        ttx = (int64_t)frame->base.sent.sec * 1000000LL +
+              (int64_t)frame->base.sent.usec;
+        tdif = trx - ttx;
+        trx = (int64_t)frame->time.latency.sec * 1000000LL +
+              (int64_t)frame->time.latency.usec;
+
+        if (client->cb.time) {
+          rc = client->cb.time(client->cb.arg, (trx - tdif) / 2, trx + tdif,
+                               now);
+        }
+      }
+
+      break;
+    }
+
+    default: {
+      // stream tags and unknown messages are skipped
+      break;
+    }
+  }
+
+  if ((frame->complete == true) && (client->msgBuf != NULL)) {
+    free(client->msgBuf);
+    client->msgBuf = NULL;
+  }
+
+  return rc;
+}
+
+/**
+ *
+ */
+int snapcast_client_process(snapcast_client_t *client) {
+  snapcast_frame_t frame;
+  const char *start;
+  size_t len;
+  size_t used;
+  int64_t now = 0;
+  int rc;
+
+  rc = client->transport->recv(client->transport->ctx, &start, &len);
+  if (rc < 0) {
+    return -1;
+  } else if (rc == 0) {
+    return 0;
+  }
+
+  client->rxBytes += len;
+
+  if (client->cb.received) {
+    client->cb.received(client->cb.arg, start, len, client->now());
+  }
+
+  while (len > 0) {
+    used = snapcast_framer_parse(&client->framer, start, len, &frame);
+    start += used;
+    len -= used;
+
+    if (frame.event == SNAPCAST_FRAMER_NEED_DATA) {
+      continue;
+    }
+
+    if (frame.event == SNAPCAST_FRAMER_ERROR) {
+      ESP_LOGE(TAG, "malformed message, type %d size %d", frame.base.type,
+               frame.base.size);
+
+      return -1;
+    }
+
+    if (frame.event == SNAPCAST_FRAMER_MESSAGE) {
+      now = client->now();
+    }
+
+    if (dispatch(client, &frame, now) < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ *
+ */
+int snapcast_client_run(snapcast_client_t *client, hello_message_t *hello) {
+  int rc;
+
+  rc = snapcast_client_connect(client, hello);
+  if (rc == 0) {
+    ESP_LOGI(TAG, "connected");
+
+    while ((rc = snapcast_client_process(client)) == 0) {
+    }
+
+    ESP_LOGW(TAG, "connection lost");
+  }
+
+  snapcast_client_disconnect(client);
+
+  return rc;
+}
@@ -0,0 +1,98 @@
+/* Server clock estimation
+
+   Replaces the plain median over time sync results. Offset and drift
+   between server and local clock are fitted over the last samples, so
+   server time is predicted between time syncs instead of stepping whenever
+   the median changes, and few samples are enough to start playback.
+*/
+
+#include "snapcast_clock.h"
+
+#include <math.h>
+#include <string.h>
+
+/**
+ *
+ */
+void snapcast_clock_init(snapcast_clock_t *clock) {
+  memset(clock, 0, sizeof(snapcast_clock_t));
+}
+
+/**
+ *
+ */
+void snapcast_clock_insert(snapcast_clock_t *clock, int64_t local,
+                           int64_t offset, int64_t rtt) {
+  const snapcast_clock_sample_t *newest;
+  int64_t rttMin, oldest;
+  double sw = 0, swx = 0, swy = 0, swxx = 0, swxy = 0;
+  double maxDrift = SNAPCAST_CLOCK_MAX_DRIFT_PPM / 1e6;
+  uint32_t i;
+
+  clock->samples[clock->head].local = local;
+  clock->samples[clock->head].offset = offset;
+  clock->samples[clock->head].rtt = rtt;
+  newest = &clock->samples[clock->head];
+
+  clock->head = (clock->head + 1) % SNAPCAST_CLOCK_WINDOW;
+  if (clock->count < SNAPCAST_CLOCK_WINDOW) {
+    clock->count++;
+  }
+
+  rttMin = newest->rtt;
+  oldest = newest->local;
+  for (i = 0; i < clock->count; i++) {
+    if (clock->samples[i].rtt < rttMin) {
+      rttMin = clock->samples[i].rtt;
+    }
+
+    if (clock->samples[i].local < oldest) {
+      oldest = clock->samples[i].local;
+    }
+  }
+
+  // work relative to the newest sample to keep doubles exact
+  for (i = 0; i < clock->count; i++) {
+    const snapcast_clock_sample_t *s = &clock->samples[i];
+    double e = (double)(s->rtt - rttMin) / SNAPCAST_CLOCK_RTT_SCALE_US;
+    double w = 1.0 / (1.0 + e * e);
+    double x = (double)(s->local - newest->local);
+    double y = (double)(s->offset - newest->offset);
+
+    sw += w;
+    swx += w * x;
+    swy += w * y;
+    swxx += w * x * x;
+    swxy += w * x * y;
+  }
+
+  if ((newest->local - oldest >= SNAPCAST_CLOCK_DRIFT_SPAN_US) &&
+      (sw * swxx - swx * swx > 0)) {
+    clock->drift = (sw * swxy - swx * swy) / (sw * swxx - swx * swx);
+
+    if (clock->drift > maxDrift) {
+      clock->drift = maxDrift;
+    } else if (clock->drift < -maxDrift) {
+      clock->drift = -maxDrift;
+    }
+  }
+
+  // weighted mean through the centroid, drift stays as it was while the
+  // samples span too short a time
+  clock->ref = newest->local;
+  clock->offset = newest->offset + llround((swy - clock->drift * swx) / sw);
+}
+
+/**
+ *
+ */
+bool snapcast_clock_ready(const snapcast_clock_t *clock) {
+  return clock->count >= SNAPCAST_CLOCK_MIN_SAMPLES;
+}
+
+/**
+ *
+ */
+int64_t snapcast_clock_offset(const snapcast_clock_t *clock, int64_t now) {
+  return clock->offset + llround(clock->drift * (double)(now - clock->ref));
+}
@@ -0,0 +1,195 @@
+/* Bulk framing of the snapcast stream
+
+   Splits received TCP segments into snapcast messages without touching every
+   byte. Headers are decoded directly from the segment whenever they are
+   complete, payload is handed out as views into the segment.
+*/
+
+#include "snapcast_framer.h"
+
+#include <string.h>
+
+enum framer_state {
+  FRAMER_STATE_BASE = 0,
+  FRAMER_STATE_TYPED,
+  FRAMER_STATE_PAYLOAD,
+};
+
+static inline uint16_t read_u16(const char *p) {
+  const uint8_t *b = (const uint8_t *)p;
+
+  return (uint16_t)(b[0] | (b[1] << 8));
+}
+
+static inline uint32_t read_u32(const char *p) {
+  const uint8_t *b = (const uint8_t *)p;
+
+  return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) |
+         ((uint32_t)b[3] << 24);
+}
+
+/**
+ *
+ */
+static uint32_t typed_header_size(uint16_t type) {
+  switch (type) {
+    case SNAPCAST_MESSAGE_WIRE_CHUNK:
+      return WIRE_CHUNK_HEADER_SIZE;
+
+    case SNAPCAST_MESSAGE_TIME:
+      return TIME_MESSAGE_SIZE;
+
+    default:
+      return 0;
+  }
+}
+
+/**
+ * Get a pointer to need contiguous header bytes. If they are available in
+ * the segment and nothing is pending the segment is used in place, otherwise
+ * bytes are collected in framer->hdr until the header is complete.
+ *
+ * @return pointer to header or NULL if more data is needed
+ */
+static const char *collect(snapcast_framer_t *framer, const char **data,
+                           size_t *len, uint32_t need) {
+  uint32_t n;
+
+  if ((framer->fill == 0) && (*len >= need)) {
+    const char *p = *data;
+
+    *data += need;
+    *len -= need;
+
+    return p;
+  }
+
+  n = need - framer->fill;
+  if (n > *len) {
+    n = *len;
+  }
+
+  memcpy(&framer->hdr[framer->fill], *data, n);
+  framer->fill += n;
+  *data += n;
+  *len -= n;
+
+  if (framer->fill < need) {
+    return NULL;
+  }
+
+  framer->fill = 0;
+
+  return framer->hdr;
+}
+
+/**
+ *
+ */
+void snapcast_framer_init(snapcast_framer_t *framer) {
+  memset(framer, 0, sizeof(snapcast_framer_t));
+  framer->state = FRAMER_STATE_BASE;
+}
+
+/**
+ *
+ */
+size_t snapcast_framer_parse(snapcast_framer_t *framer, const char *data,
+                             size_t len, snapcast_frame_t *frame) {
+  const char *start = data;
+  const char *p;
+  uint32_t typedSize;
+  uint32_t n;
+
+  frame->event = SNAPCAST_FRAMER_NEED_DATA;
+  frame->complete = false;
+
+  if (framer->state == FRAMER_STATE_BASE) {
+    p = collect(framer, &data, &len, BASE_MESSAGE_SIZE);
+    if (p == NULL) {
+      return data - start;
+    }
+
+    framer->base.type = read_u16(&p[0]);
+    framer->base.id = read_u16(&p[2]);
+    framer->base.refersTo = read_u16(&p[4]);
+    framer->base.sent.sec = (int32_t)read_u32(&p[6]);
+    framer->base.sent.usec = (int32_t)read_u32(&p[10]);
+    framer->base.received.sec = (int32_t)read_u32(&p[14]);
+    framer->base.received.usec = (int32_t)read_u32(&p[18]);
+    framer->base.size = read_u32(&p[22]);
+
+    if (framer->base.size < typed_header_size(framer->base.type)) {
+      frame->event = SNAPCAST_FRAMER_ERROR;
+      frame->base = framer->base;
+
+      return data - start;
+    }
+
+    framer->state = FRAMER_STATE_TYPED;
+  }
+
+  if (framer->state == FRAMER_STATE_TYPED) {
+    typedSize = typed_header_size(framer->base.type);
+    if (typedSize > 0) {
+      p = collect(framer, &data, &len, typedSize);
+      if (p == NULL) {
+        return data - start;
+      }
+
+      if (framer->base.type == SNAPCAST_MESSAGE_WIRE_CHUNK) {
+        framer->wire_chunk.timestamp.sec = (int32_t)read_u32(&p[0]);
+        framer->wire_chunk.timestamp.usec = (int32_t)read_u32(&p[4]);
+        framer->wire_chunk.size = read_u32(&p[8]);
+        framer->wire_chunk.payload = NULL;
+      } else {
+        framer->time.latency.sec = (int32_t)read_u32(&p[0]);
+        framer->time.latency.usec = (int32_t)read_u32(&p[4]);
+      }
+    }
+
+    framer->payloadPos = 0;
+    framer->payloadLen = framer->base.size - typedSize;
+    framer->state =
+        (framer->payloadLen > 0) ? FRAMER_STATE_PAYLOAD : FRAMER_STATE_BASE;
+
+    frame->event = SNAPCAST_FRAMER_MESSAGE;
+    frame->base = framer->base;
+    frame->wire_chunk = framer->wire_chunk;
+    frame->time = framer->time;
+    frame->data = NULL;
+    frame->len = 0;
+    frame->offset = 0;
+    frame->total = framer->payloadLen;
+    frame->complete = (framer->payloadLen == 0);
+
+    return data - start;
+  }
+
+  // FRAMER_STATE_PAYLOAD
+  if (len == 0) {
+    return 0;
+  }
+
+  n = framer->payloadLen - framer->payloadPos;
+  if (n > len) {
+    n = len;
+  }
+
+  frame->event = SNAPCAST_FRAMER_PAYLOAD;
+  frame->base = framer->base;
+  frame->wire_chunk = framer->wire_chunk;
+  frame->time = framer->time;
+  frame->data = data;
+  frame->len = n;
+  frame->offset = framer->payloadPos;
+  frame->total = framer->payloadLen;
+
+  framer->payloadPos += n;
+  if (framer->payloadPos >= framer->payloadLen) {
+    frame->complete = true;
+    framer->state = FRAMER_STATE_BASE;
+  }
+
+  return n;
+}
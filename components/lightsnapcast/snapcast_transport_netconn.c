@@ -0,0 +1,247 @@
+/* lwIP netconn transport for the snapcast client engine
+
+   Received netbufs are handed out piece by piece without copying.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/api.h"
+#include "lwip/err.h"
+#include "lwip/sockets.h"
+#include "mdns.h"
+#include "snapcast_transport.h"
+
+/* Logging tag */
+static const char *TAG = "NETCONN";
+
+typedef struct netconn_transport {
+  snapcast_transport_t transport;
+  struct netconn *conn;
+  struct netbuf *buf;  // netbuf currently handed out
+  bool useMdns;
+  const char *host;
+  uint16_t port;
+} netconn_transport_t;
+
+/**
+ *
+ */
+static void netconn_transport_close(void *ctx) {
+  netconn_transport_t *t = (netconn_transport_t *)ctx;
+
+  if (t->buf != NULL) {
+    netbuf_delete(t->buf);
+    t->buf = NULL;
+  }
+
+  if (t->conn != NULL) {
+    netconn_close(t->conn);
+    netconn_delete(t->conn);
+    t->conn = NULL;
+  }
+}
+
+/**
+ *
+ */
+static int netconn_transport_lookup(netconn_transport_t *t,
+                                    ip_addr_t *remote_ip,
+                                    uint16_t *remotePort) {
+  if (t->useMdns) {
+    mdns_result_t *r = NULL;
+    esp_err_t err = 0;
+
+    // Find snapcast server
+    // Connect to first snapcast server found
+    while (!r || err) {
+      ESP_LOGI(TAG, "Lookup snapcast service on network");
+      err = mdns_query_ptr("_snapcast", "_tcp", 3000, 20, &r);
+      if (err) {
+        ESP_LOGE(TAG, "Query Failed");
+        vTaskDelay(pdMS_TO_TICKS(1000));
+      }
+
+      if (!r) {
+        ESP_LOGW(TAG, "No results found!");
+        vTaskDelay(pdMS_TO_TICKS(1000));
+      }
+    }
+
+    if (r->addr) {
+      ip_addr_copy(*remote_ip, (r->addr->addr));
+      remote_ip->type = IPADDR_TYPE_V4;
+      *remotePort = r->port;
+      ESP_LOGI(TAG, "Found %s:%d", ipaddr_ntoa(remote_ip), *remotePort);
+
+      mdns_query_results_free(r);
+    } else {
+      mdns_query_results_free(r);
+
+      ESP_LOGW(TAG, "No IP found in MDNS query");
+
+      return -1;
+    }
+  } else {
+    // configure a failsafe snapserver according to CONFIG values
+    inet_pton(AF_INET, t->host, &(remote_ip->u_addr.ip4.addr));
+    remote_ip->type = IPADDR_TYPE_V4;
+    *remotePort = t->port;
+
+    ESP_LOGI(TAG, "try connecting to static configuration %s:%d",
+             ipaddr_ntoa(remote_ip), *remotePort);
+  }
+
+  return 0;
+}
+
+/**
+ *
+ */
+static int netconn_transport_connect(void *ctx) {
+  netconn_transport_t *t = (netconn_transport_t *)ctx;
+  ip_addr_t remote_ip;
+  uint16_t remotePort = 0;
+  int rc1 = ERR_OK, rc2 = ERR_OK;
+
+  netconn_transport_close(t);
+
+  if (netconn_transport_lookup(t, &remote_ip, &remotePort) < 0) {
+    return -1;
+  }
+
+  t->conn = netconn_new(NETCONN_TCP);
+  if (t->conn == NULL) {
+    ESP_LOGE(TAG, "can't create netconn");
+
+    return -1;
+  }
+
+  rc1 = netconn_bind(t->conn, IPADDR_ANY, 0);
+  if (rc1 != ERR_OK) {
+    ESP_LOGE(TAG, "can't bind local IP");
+  }
+
+  rc2 = netconn_connect(t->conn, &remote_ip, remotePort);
+  if (rc2 != ERR_OK) {
+    ESP_LOGE(TAG, "can't connect to remote %s:%d, err %d",
+             ipaddr_ntoa(&remote_ip), remotePort, rc2);
+  }
+
+  if (rc1 != ERR_OK || rc2 != ERR_OK) {
+    netconn_transport_close(t);
+
+    return -1;
+  }
+
+  ESP_LOGI(TAG, "netconn connected");
+
+  return 0;
+}
+
+/**
+ *
+ */
+static int netconn_transport_send(void *ctx, const char *data, size_t len) {
+  netconn_transport_t *t = (netconn_transport_t *)ctx;
+  struct netconn *conn = t->conn;
+
+  if (conn == NULL) {
+    return -1;
+  }
+
+  if (netconn_write(conn, data, len, NETCONN_COPY) != ERR_OK) {
+    ESP_LOGW(TAG, "error writing %d bytes", len);
+
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ *
+ */
+static int netconn_transport_recv(void *ctx, const char **data, size_t *len) {
+  netconn_transport_t *t = (netconn_transport_t *)ctx;
+  uint16_t pieceLen;
+  int rc;
+
+  if (t->conn == NULL) {
+    return -1;
+  }
+
+  // next piece of the current netbuf or a new one
+  if ((t->buf == NULL) || (netbuf_next(t->buf) < 0)) {
+    if (t->buf != NULL) {
+      netbuf_delete(t->buf);
+      t->buf = NULL;
+    }
+
+    rc = netconn_recv(t->conn, &t->buf);
+    if (rc != ERR_OK) {
+      if (t->buf != NULL) {
+        netbuf_delete(t->buf);
+        t->buf = NULL;
+      }
+
+      if (rc == ERR_CONN || rc == ERR_CLSD || rc == ERR_RST ||
+          rc == ERR_ABRT) {
+        return -1;
+      }
+
+      return 0;
+    }
+
+    netbuf_first(t->buf);
+  }
+
+  if (netbuf_data(t->buf, (void **)data, &pieceLen) != ERR_OK) {
+    ESP_LOGE(TAG, "netconn rx, couldn't get data");
+
+    return -1;
+  }
+
+  *len = pieceLen;
+
+  return (pieceLen > 0) ? 1 : 0;
+}
+
+/**
+ *
+ */
+snapcast_transport_t *snapcast_transport_netconn_create(bool useMdns,
+                                                        const char *host,
+                                                        uint16_t port) {
+  netconn_transport_t *t;
+
+  t = (netconn_transport_t *)calloc(1, sizeof(netconn_transport_t));
+  if (t == NULL) {
+    return NULL;
+  }
+
+  t->useMdns = useMdns;
+  t->host = host;
+  t->port = port;
+
+  t->transport.ctx = t;
+  t->transport.connect = netconn_transport_connect;
+  t->transport.send = netconn_transport_send;
+  t->transport.recv = netconn_transport_recv;
+  t->transport.close = netconn_transport_close;
+
+  return &t->transport;
+}
+
+/**
+ *
+ */
+void snapcast_transport_netconn_destroy(snapcast_transport_t *transport) {
+  if (transport != NULL) {
+    netconn_transport_close(transport->ctx);
+    free(transport->ctx);
+  }
+}
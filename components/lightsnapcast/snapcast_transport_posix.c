@@ -0,0 +1,176 @@
+/* POSIX socket transport for the snapcast client engine
+
+   Used to run the client engine as a linux executable.
+*/
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "snapcast_transport.h"
+
+/* Logging tag */
+static const char *TAG = "POSIX";
+
+#define POSIX_TRANSPORT_RX_BUF_LEN 16384
+
+typedef struct posix_transport {
+  snapcast_transport_t transport;
+  int fd;
+  const char *host;
+  uint16_t port;
+  char buf[POSIX_TRANSPORT_RX_BUF_LEN];
+} posix_transport_t;
+
+/**
+ *
+ */
+static void posix_transport_close(void *ctx) {
+  posix_transport_t *t = (posix_transport_t *)ctx;
+
+  if (t->fd >= 0) {
+    close(t->fd);
+    t->fd = -1;
+  }
+}
+
+/**
+ *
+ */
+static int posix_transport_connect(void *ctx) {
+  posix_transport_t *t = (posix_transport_t *)ctx;
+  struct addrinfo hints, *res, *ai;
+  char port[8];
+  int one = 1;
+  int rc;
+
+  posix_transport_close(t);
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf(port, sizeof(port), "%u", t->port);
+
+  rc = getaddrinfo(t->host, port, &hints, &res);
+  if (rc != 0) {
+    ESP_LOGE(TAG, "can't resolve %s: %s", t->host, gai_strerror(rc));
+
+    return -1;
+  }
+
+  for (ai = res; ai != NULL; ai = ai->ai_next) {
+    t->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (t->fd < 0) {
+      continue;
+    }
+
+    if (connect(t->fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+      break;
+    }
+
+    close(t->fd);
+    t->fd = -1;
+  }
+
+  freeaddrinfo(res);
+
+  if (t->fd < 0) {
+    ESP_LOGE(TAG, "can't connect to remote %s:%d", t->host, t->port);
+
+    return -1;
+  }
+
+  setsockopt(t->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  ESP_LOGI(TAG, "connected to %s:%d", t->host, t->port);
+
+  return 0;
+}
+
+/**
+ *
+ */
+static int posix_transport_send(void *ctx, const char *data, size_t len) {
+  posix_transport_t *t = (posix_transport_t *)ctx;
+  ssize_t n;
+
+  while (len > 0) {
+    n = send(t->fd, data, len, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      return -1;
+    }
+
+    data += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+/**
+ *
+ */
+static int posix_transport_recv(void *ctx, const char **data, size_t *len) {
+  posix_transport_t *t = (posix_transport_t *)ctx;
+  ssize_t n;
+
+  n = recv(t->fd, t->buf, sizeof(t->buf), 0);
+  if (n < 0) {
+    return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+  } else if (n == 0) {
+    // closed by server
+    return -1;
+  }
+
+  *data = t->buf;
+  *len = n;
+
+  return 1;
+}
+
+/**
+ *
+ */
+snapcast_transport_t *snapcast_transport_posix_create(const char *host,
+                                                      uint16_t port) {
+  posix_transport_t *t;
+
+  t = (posix_transport_t *)calloc(1, sizeof(posix_transport_t));
+  if (t == NULL) {
+    return NULL;
+  }
+
+  t->fd = -1;
+  t->host = host;
+  t->port = port;
+
+  t->transport.ctx = t;
+  t->transport.connect = posix_transport_connect;
+  t->transport.send = posix_transport_send;
+  t->transport.recv = posix_transport_recv;
+  t->transport.close = posix_transport_close;
+
+  return &t->transport;
+}
+
+/**
+ *
+ */
+void snapcast_transport_posix_destroy(snapcast_transport_t *transport) {
+  if (transport != NULL) {
+    posix_transport_close(transport->ctx);
+    free(transport->ctx);
+  }
+}
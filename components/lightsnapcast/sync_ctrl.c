@@ -0,0 +1,110 @@
+/* Playback speed control
+
+   A PI controller on the filtered age error gives a speed correction in
+   ppm. With the APLL it is applied by scaling the APLL multiplier in fixed
+   point instead of searching the coefficients again, with the resampler by
+   its step.
+*/
+
+#include "sync_ctrl.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// 2^30 / 1e6, ppm to a Q30 fraction
+#define PPM_Q30 1073.741824f
+
+/**
+ *
+ */
+void sync_ctrl_init(sync_ctrl_t *ctrl, float tc, float ti, float maxPpm) {
+  memset(ctrl, 0, sizeof(sync_ctrl_t));
+
+  ctrl->tc = tc;
+  ctrl->ti = ti;
+  ctrl->maxPpm = maxPpm;
+}
+
+/**
+ *
+ */
+float sync_ctrl_update(sync_ctrl_t *ctrl, int64_t err, int64_t dt) {
+  float e = (float)err;
+  float ppm;
+
+  ctrl->drift += e * ((float)dt * 1e-6f) / (ctrl->tc * ctrl->ti);
+  if (ctrl->drift > ctrl->maxPpm) {
+    ctrl->drift = ctrl->maxPpm;
+  } else if (ctrl->drift < -ctrl->maxPpm) {
+    ctrl->drift = -ctrl->maxPpm;
+  }
+
+  // µs per s is ppm
+  ppm = e / ctrl->tc + ctrl->drift;
+  if (ppm > ctrl->maxPpm) {
+    ppm = ctrl->maxPpm;
+  } else if (ppm < -ctrl->maxPpm) {
+    ppm = -ctrl->maxPpm;
+  }
+
+  return ppm;
+}
+
+/**
+ *
+ */
+void sync_apll_init(sync_apll_t *apll, int sdm0, int sdm1, int sdm2,
+                    int oDiv) {
+  apll->nominal = ((4 + sdm2) << 16) | ((sdm1 & 0xFF) << 8) | (sdm0 & 0xFF);
+  apll->min = (4 + sdm2) << 16;
+  apll->max = apll->min | 0xFFFF;
+  apll->current = apll->nominal;
+  apll->oDiv = oDiv;
+}
+
+/**
+ *
+ */
+int32_t sync_apll_target(const sync_apll_t *apll, float ppm) {
+  // multiplier < 2^22, correction < 2^20 in Q30
+  int32_t corr = (int32_t)(ppm * PPM_Q30);
+
+  return (apll->nominal << 8) +
+         (int32_t)(((int64_t)apll->nominal * corr + (1 << 21)) >> 22);
+}
+
+/**
+ *
+ */
+bool sync_apll_set_ppm(sync_apll_t *apll, float ppm, int *sdm0, int *sdm1,
+                       int *sdm2, int *oDiv) {
+  int32_t target = sync_apll_target(apll, ppm);
+  int32_t m = apll->current;
+  bool changed = false;
+
+  if (abs(target - (m << 8)) > 128 + SYNC_APLL_HYSTERESIS) {
+    m = (target + 128) >> 8;
+    if (m < apll->min) {
+      m = apll->min;
+    } else if (m > apll->max) {
+      m = apll->max;
+    }
+
+    changed = (m != apll->current);
+    apll->current = m;
+  }
+
+  *sdm2 = (m >> 16) - 4;
+  *sdm1 = (m >> 8) & 0xFF;
+  *sdm0 = m & 0xFF;
+  *oDiv = apll->oDiv;
+
+  return changed;
+}
+
+/**
+ *
+ */
+float sync_apll_get_ppm(const sync_apll_t *apll) {
+  return (float)(apll->current - apll->nominal) * 1e6f / apll->nominal;
+}
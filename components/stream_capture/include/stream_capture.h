@@ -0,0 +1,26 @@
+#ifndef __STREAM_CAPTURE_H__
+#define __STREAM_CAPTURE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * Mount the SD card or start the websocket server, depending on
+ * configuration, and start the capture writer task.
+ */
+esp_err_t stream_capture_init(void);
+
+/**
+ * Start a new capture session, called on every connection to the server.
+ */
+void stream_capture_session_start(void);
+
+/**
+ * Queue received bytes for capture. Doesn't block, if the buffer is full
+ * capturing stops until the next session.
+ */
+void stream_capture_write(const char *data, size_t len, int64_t now);
+
+#endif  // __STREAM_CAPTURE_H__
@@ -0,0 +1,230 @@
+/* Capture of received snapcast streams
+
+   Received segments are stamped with their local receive time and put into
+   a byte ring buffer by the http task. A low priority task drains it to the
+   SD card or to the websocket clients. See snapcast_capture.h for the format.
+*/
+
+#include "stream_capture.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/ringbuf.h"
+#include "freertos/task.h"
+#include "snapcast_capture.h"
+
+#if CONFIG_SNAPCLIENT_CAPTURE_SDCARD
+#include "driver/sdmmc_host.h"
+#include "esp_vfs_fat.h"
+#elif CONFIG_SNAPCLIENT_CAPTURE_WEBSOCKET
+#include "websocket_if.h"
+#include "websocket_server.h"
+#endif
+
+#define CAPTURE_TASK_PRIORITY 2
+#define CAPTURE_TASK_CORE_ID tskNO_AFFINITY
+
+#define CAPTURE_WRITE_SIZE 4096
+#define CAPTURE_FLUSH_MS 1000
+
+#define CAPTURE_SDCARD_ROOT "/sdcard"
+
+static const char *TAG = "CAPTURE";
+
+static RingbufHandle_t captureRingBuf = NULL;
+static TaskHandle_t captureTaskHandle = NULL;
+static bool captureEnabled = false;
+static uint32_t captureDropped = 0;
+
+#if CONFIG_SNAPCLIENT_CAPTURE_SDCARD
+static FILE *captureFile = NULL;
+
+/**
+ *
+ */
+static esp_err_t capture_sdcard_open(void) {
+  esp_vfs_fat_sdmmc_mount_config_t mount_config = {
+      .format_if_mount_failed = false,
+      .max_files = 2,
+  };
+  sdmmc_host_t host = SDMMC_HOST_DEFAULT();
+  sdmmc_slot_config_t slot_config = SDMMC_SLOT_CONFIG_DEFAULT();
+  sdmmc_card_t *card = NULL;
+  struct stat st;
+  char path[32];
+  esp_err_t ret;
+  int i;
+
+  slot_config.width = 1;
+
+  ret = esp_vfs_fat_sdmmc_mount(CAPTURE_SDCARD_ROOT, &host, &slot_config,
+                                &mount_config, &card);
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "couldn't mount sd card: %s", esp_err_to_name(ret));
+
+    return ret;
+  }
+
+  // use the first free file name so earlier captures are kept
+  for (i = 0; i < 1000; i++) {
+    sprintf(path, CAPTURE_SDCARD_ROOT "/snap%03d.cap", i);
+    if (stat(path, &st) != 0) {
+      break;
+    }
+  }
+
+  captureFile = fopen(path, "wb");
+  if (captureFile == NULL) {
+    ESP_LOGE(TAG, "couldn't create %s", path);
+
+    return ESP_FAIL;
+  }
+
+  ESP_LOGI(TAG, "capturing to %s", path);
+
+  return ESP_OK;
+}
+#endif
+
+/**
+ *
+ */
+static void capture_output(const char *data, size_t len) {
+#if CONFIG_SNAPCLIENT_CAPTURE_SDCARD
+  if (fwrite(data, 1, len, captureFile) != len) {
+    ESP_LOGE(TAG, "sd card write failed");
+  }
+#elif CONFIG_SNAPCLIENT_CAPTURE_WEBSOCKET
+  ws_server_send_bin_all((char *)data, len);
+#endif
+}
+
+/**
+ *
+ */
+static void capture_task(void *pvParameters) {
+  char *data;
+  size_t size;
+
+  while (1) {
+    data = xRingbufferReceiveUpTo(captureRingBuf, &size,
+                                  pdMS_TO_TICKS(CAPTURE_FLUSH_MS),
+                                  CAPTURE_WRITE_SIZE);
+    if (data != NULL) {
+      capture_output(data, size);
+
+      vRingbufferReturnItem(captureRingBuf, data);
+    } else {
+#if CONFIG_SNAPCLIENT_CAPTURE_SDCARD
+      // idle, make sure captured data survives a power cut
+      fflush(captureFile);
+      fsync(fileno(captureFile));
+#endif
+    }
+  }
+}
+
+/**
+ *
+ */
+esp_err_t stream_capture_init(void) {
+  esp_err_t ret = ESP_OK;
+
+  if (captureRingBuf != NULL) {
+    return ESP_OK;
+  }
+
+#if CONFIG_SNAPCLIENT_CAPTURE_SDCARD
+  ret = capture_sdcard_open();
+#elif CONFIG_SNAPCLIENT_CAPTURE_WEBSOCKET
+  websocket_if_start();
+#else
+  ret = ESP_ERR_NOT_SUPPORTED;
+#endif
+  if (ret != ESP_OK) {
+    return ret;
+  }
+
+  captureRingBuf = xRingbufferCreate(CONFIG_SNAPCLIENT_CAPTURE_BUFFER_SIZE,
+                                     RINGBUF_TYPE_BYTEBUF);
+  if (captureRingBuf == NULL) {
+    ESP_LOGE(TAG, "couldn't create capture buffer");
+
+    return ESP_ERR_NO_MEM;
+  }
+
+  if (xTaskCreatePinnedToCore(capture_task, "capture", 4 * 1024, NULL,
+                              CAPTURE_TASK_PRIORITY, &captureTaskHandle,
+                              CAPTURE_TASK_CORE_ID) != pdPASS) {
+    ESP_LOGE(TAG, "couldn't create capture task");
+
+    vRingbufferDelete(captureRingBuf);
+    captureRingBuf = NULL;
+
+    return ESP_ERR_NO_MEM;
+  }
+
+  return ESP_OK;
+}
+
+/**
+ *
+ */
+void stream_capture_session_start(void) {
+  char hdr[SNAPCAST_CAPTURE_SESSION_HEADER_SIZE];
+
+  if (captureRingBuf == NULL) {
+    return;
+  }
+
+  captureEnabled = false;
+
+  if (captureDropped > 0) {
+    ESP_LOGW(TAG, "%u bytes of last session weren't captured", captureDropped);
+  }
+
+  snapcast_capture_session_header(hdr);
+  if (xRingbufferSend(captureRingBuf, hdr, sizeof(hdr), 0) != pdTRUE) {
+    ESP_LOGW(TAG, "capture buffer full, session not captured");
+
+    return;
+  }
+
+  captureDropped = 0;
+  captureEnabled = true;
+}
+
+/**
+ *
+ */
+void stream_capture_write(const char *data, size_t len, int64_t now) {
+  char hdr[SNAPCAST_CAPTURE_RECORD_HEADER_SIZE];
+
+  if (captureEnabled == false) {
+    if (captureRingBuf != NULL) {
+      captureDropped += len;
+    }
+
+    return;
+  }
+
+  // http task is the only writer, so a record either fits completely or
+  // isn't written at all
+  if (xRingbufferGetCurFreeSize(captureRingBuf) < sizeof(hdr) + len) {
+    ESP_LOGW(TAG, "capture buffer full, capturing stopped until reconnect");
+
+    captureEnabled = false;
+    captureDropped += len;
+
+    return;
+  }
+
+  snapcast_capture_record_header(hdr, now, len);
+  xRingbufferSend(captureRingBuf, hdr, sizeof(hdr), 0);
+  xRingbufferSend(captureRingBuf, data, len, 0);
+}
@@ -17,7 +17,10 @@
 #include <string.h>
 #include <sys/stat.h>
 
+#include "chunk_trace.h"
+#include "dsp_flow.h"
 #include "dsp_processor.h"
+#include "metrics.h"
 #include "esp_err.h"
 #include "esp_http_server.h"
 #include "esp_log.h"
@@ -273,6 +276,95 @@ static esp_err_t favicon_get_handler(httpd_req_t *req) {
   return ESP_OK;
 }
 
+/*
+ *
+ */
+static int resp_write(void *arg, const char *data, size_t len) {
+  if (httpd_resp_send_chunk((httpd_req_t *)arg, data, len) != ESP_OK) {
+    return -1;
+  }
+
+  return len;
+}
+
+/*
+ * metrics get handler, Prometheus text format
+ */
+static esp_err_t metrics_get_handler(httpd_req_t *req) {
+  httpd_resp_set_type(req, "text/plain; version=0.0.4");
+
+  if (metrics_export(resp_write, req) < 0) {
+    ESP_LOGW(TAG, "metrics export aborted");
+  }
+
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+#if CONFIG_USE_DSP_PROCESSOR
+
+/*
+ * dsp post handler, the body is a graph description as parsed by
+ * dsp_flow_parse_graph(), e.g. curl --data "bq 0 peak 1000 3 1.4" <ip>/dsp
+ */
+static esp_err_t dsp_post_handler(httpd_req_t *req) {
+  // too large for the stack, the server runs one handler at a time
+  static char body[1024];
+  static filterParams_t filterParams;
+  size_t len = 0;
+  int ret;
+
+  if (req->content_len >= sizeof(body)) {
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "graph too long");
+  }
+
+  while (len < req->content_len) {
+    ret = httpd_req_recv(req, body + len, req->content_len - len);
+    if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+      continue;
+    }
+    if (ret <= 0) {
+      return ESP_FAIL;
+    }
+    len += ret;
+  }
+  body[len] = 0;
+
+  memset(&filterParams, 0, sizeof(filterParams));
+  filterParams.dspFlow = dspfGraph;
+
+  if (dsp_flow_parse_graph(body, &filterParams.graph) < 0) {
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid graph");
+  }
+
+  if (dsp_processor_update_filter_params(&filterParams) != ESP_OK) {
+    return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                               "dsp processor not running");
+  }
+
+  ESP_LOGI(TAG, "dsp graph with %u nodes", filterParams.graph.nodeCnt);
+
+  return httpd_resp_sendstr(req, "ok\n");
+}
+#endif
+
+#if CONFIG_SNAPCLIENT_CHUNK_TRACE
+
+/*
+ * chunk trace get handler, open in chrome://tracing or ui.perfetto.dev
+ */
+static esp_err_t trace_get_handler(httpd_req_t *req) {
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Content-Disposition",
+                     "attachment; filename=\"snapclient_trace.json\"");
+
+  if (chunk_trace_export(resp_write, req) < 0) {
+    ESP_LOGW(TAG, "trace export aborted");
+  }
+
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+#endif
+
 /*
  * Function to start the web server
  */
@@ -314,6 +406,28 @@ esp_err_t start_server(const char *base_path, int port) {
   };
   httpd_register_uri_handler(server, &_favicon_get_handler);
 
+  /* URI handler for the metrics */
+  httpd_uri_t _metrics_get_handler = {
+      .uri = "/metrics", .method = HTTP_GET, .handler = metrics_get_handler,
+  };
+  httpd_register_uri_handler(server, &_metrics_get_handler);
+
+#if CONFIG_USE_DSP_PROCESSOR
+  /* URI handler for the dsp graph */
+  httpd_uri_t _dsp_post_handler = {
+      .uri = "/dsp", .method = HTTP_POST, .handler = dsp_post_handler,
+  };
+  httpd_register_uri_handler(server, &_dsp_post_handler);
+#endif
+
+#if CONFIG_SNAPCLIENT_CHUNK_TRACE
+  /* URI handler for the chunk trace */
+  httpd_uri_t _trace_get_handler = {
+      .uri = "/trace", .method = HTTP_GET, .handler = trace_get_handler,
+  };
+  httpd_register_uri_handler(server, &_trace_get_handler);
+#endif
+
   return ESP_OK;
 }
 
@@ -399,7 +513,8 @@ static void http_server_task(void *pvParameters) {
 
     // Waiting for post
     if (xQueueReceive(xQueueHttp, &urlBuf, portMAX_DELAY) == pdTRUE) {
-      filterParams_t filterParams;
+      // holds a graph, too large for this task's stack
+      static filterParams_t filterParams;
 
       ESP_LOGI(TAG, "str_value=%s gain_1=%f, gain_2=%f, gain_3=%f",
                urlBuf.str_value, urlBuf.gain_1, urlBuf.gain_2, urlBuf.gain_3);
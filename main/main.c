@@ -9,6 +9,7 @@
 #include <string.h>
 
 #include "esp_event.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
 #include "esp_system.h"
 #include "esp_wifi.h"
@@ -17,8 +18,10 @@
 #endif
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
+#include "freertos/ringbuf.h"
 #include "freertos/task.h"
 #include "nvs_flash.h"
+#include "soc/soc_memory_layout.h"
 #include "wifi_interface.h"
 
 // Minimum ESP-IDF stuff only hardware abstraction stuff
@@ -50,9 +53,17 @@
 
 // flac decoder is implemented as a subcomponet from master git repo
 #include "FLAC/stream_decoder.h"
+#include "chunk_trace.h"
+#include "metrics.h"
 #include "ota_server.h"
+#include "pcm_pack.h"
 #include "player.h"
 #include "snapcast.h"
+#include "snapcast_client.h"
+#include "snapcast_transport.h"
+#if !CONFIG_SNAPCLIENT_CAPTURE_NONE
+#include "stream_capture.h"
+#endif
 
 #include "ui_http_server.h"
 
@@ -72,11 +83,9 @@ static void error_callback(const FLAC__StreamDecoder *decoder,
 //#include "ma120.h"
 
 static FLAC__StreamDecoder *flacDecoder = NULL;
-static QueueHandle_t decoderReadQHdl = NULL;
-static QueueHandle_t decoderWriteQHdl = NULL;
-static QueueHandle_t decoderTaskQHdl = NULL;
-SemaphoreHandle_t decoderReadSemaphore = NULL;
-SemaphoreHandle_t decoderWriteSemaphore = NULL;
+static RingbufHandle_t flacRingBuf = NULL;
+static pcm_pack_fn_t flacPack = NULL;
+static RingbufHandle_t opusRingBuf = NULL;
 
 const char *VERSION_STRING = "0.0.2";
 
@@ -87,16 +96,26 @@ const char *VERSION_STRING = "0.0.2";
 #define OTA_TASK_CORE_ID tskNO_AFFINITY
 // 1  // tskNO_AFFINITY
 
-#define FLAC_DECODER_TASK_PRIORITY 7
+#define FLAC_DECODER_TASK_PRIORITY 8
 #define FLAC_DECODER_TASK_CORE_ID tskNO_AFFINITY
 // HTTP_TASK_CORE_ID  // 1  // tskNO_AFFINITY
 
-#define FLAC_TASK_PRIORITY 8
-#define FLAC_TASK_CORE_ID tskNO_AFFINITY
-
 #define OPUS_TASK_PRIORITY 8
 #define OPUS_TASK_CORE_ID tskNO_AFFINITY
 
+// snapserver's default chunk length
+#define OPUS_SCRATCH_MS 20
+
+// a single 20ms opus frame is at most 1275 bytes, snapserver's default of
+// 192kbit/s makes 480
+#define OPUS_PACKET_MAX_BYTES 1276
+#define OPUS_PACKET_TYPICAL_BYTES 512
+// xRingbufferSendAcquire() puts an 8 byte header in front of every item
+#define OPUS_RING_ITEM_OVERHEAD (8 + sizeof(decoderData_t))
+// items may take half of the ring, so the largest packet has to fit twice
+#define OPUS_RING_MIN_SIZE \
+  (2 * (OPUS_RING_ITEM_OVERHEAD + OPUS_PACKET_MAX_BYTES))
+
 // 1  // tskNO_AFFINITY
 
 xTaskHandle t_ota_task = NULL;
@@ -104,8 +123,24 @@ xTaskHandle t_http_get_task = NULL;
 xTaskHandle t_flac_decoder_task = NULL;
 xTaskHandle dec_task_handle = NULL;
 
+#if CONFIG_SNAPCLIENT_COMPRESSED_BUFFER
+// the opus ring buffer holds the stream buffer as received chunks
+#define DECODER_QUEUE_CHUNKS CONFIG_SNAPCLIENT_COMPRESSED_BUFFER_CHUNKS
+#else
+#define DECODER_QUEUE_CHUNKS 8
+#define FLAC_RING_BUFFER_SIZE (16 * 1024)
+#endif
+
+// the ring buffer holds the server buffer plus this much in compressed mode
+#define FLAC_RING_BUFFER_MARGIN_MS 50
+#define FLAC_RING_BUFFER_MIN_SIZE (8 * 1024)
+
+// decode time and latency are logged every this many frames
+#define FLAC_STATS_FRAMES 500
+
 #define FAST_SYNC_LATENCY_BUF 10000      // in µs
-#define NORMAL_SYNC_LATENCY_BUF 1000000  // in µs
+#define NORMAL_SYNC_LATENCY_BUF \
+  (CONFIG_SNAPCLIENT_TIME_SYNC_INTERVAL_MS * 1000LL)  // in µs
 
 struct timeval tdif, tavg;
 static audio_board_handle_t board_handle = NULL;
@@ -135,9 +170,39 @@ dspFlows_t dspFlow = dspfBassBoost;
 #if CONFIG_SNAPCLIENT_DSP_FLOW_BIAMP
 dspFlows_t dspFlow = dspfBiamp;
 #endif
+#if CONFIG_SNAPCLIENT_DSP_FLOW_2DOT1
+dspFlows_t dspFlow = dspf2DOT1;
+#endif
 #if CONFIG_SNAPCLIENT_DSP_FLOW_BASS_TREBLE_EQ
 dspFlows_t dspFlow = dspfEQBassTreble;
 #endif
+
+/**
+ * A chunk as large as pcmChunk for the second output of the DSP flow, if it
+ * has one and it is played. NULL drops that output.
+ */
+static char *dsp_aux_payload(pcm_chunk_message_t *pcmChunk) {
+#if CONFIG_SNAPCLIENT_DSP_SECOND_I2S
+  // the player mirrors single fragments only
+  if ((dsp_processor_outputs() == 4) && (pcmChunk->aux == NULL) &&
+      (pcmChunk->fragment->payload != NULL) &&
+      (pcmChunk->fragment->nextFragment == NULL)) {
+    if (allocate_pcm_chunk_memory(&pcmChunk->aux, pcmChunk->fragment->size) <
+        0) {
+      pcmChunk->aux = NULL;
+    } else if (pcmChunk->aux->fragment->payload == NULL) {
+      free_pcm_chunk(pcmChunk->aux);
+      pcmChunk->aux = NULL;
+    }
+  }
+
+  if (pcmChunk->aux != NULL) {
+    return pcmChunk->aux->fragment->payload;
+  }
+#endif
+
+  return NULL;
+}
 #endif
 
 typedef struct decoderData_s {
@@ -151,164 +216,195 @@ typedef struct decoderData_s {
 
 void time_sync_msg_cb(void *args);
 
-static char base_message_serialized[BASE_MESSAGE_SIZE];
-static char time_message_serialized[TIME_MESSAGE_SIZE];
 static const esp_timer_create_args_t tSyncArgs = {
     .callback = &time_sync_msg_cb,
     .dispatch_method = ESP_TIMER_TASK,
     .name = "tSyncMsg"};
 
-struct netconn *lwipNetconn;
-
-static int id_counter = 0;
+static snapcast_client_t snapClient;
+static snapcast_transport_t *snapTransport = NULL;
 
 static OpusDecoder *opusDecoder = NULL;
 
+// opus output for chunks in IRAM, which can't take its 16 bit stores. sized
+// for OPUS_SCRATCH_MS with the decoder, longer packets into IRAM are dropped.
+// the pool prefers byte accessible blocks for opus, so this is rarely used.
+static opus_int16 *opusScratch = NULL;
+static size_t opusScratchSize = 0;
+
+// stream state, changed by snapcast client callbacks in http task
+static snapcastSetting_t scSet;
+static codec_type_t codec = NONE;
+static bool received_header = false;
+static esp_timer_handle_t timeSyncMessageTimer = NULL;
+static uint64_t timeout = FAST_SYNC_LATENCY_BUF;
+static int64_t lastTimeSync = 0;
+static tv_t chunkTimestamp;
+static pcm_chunk_message_t *pcmData = NULL;
+static decoderData_t *opusPacket = NULL;  // being received, in opusRingBuf
+
+// precedes every chunk in flacRingBuf
+typedef struct flacChunkHeader_s {
+  tv_t timestamp;
+  int64_t received;  // esp_timer_get_time() of the first byte
+  uint32_t bytes;
+} flacChunkHeader_t;
+
+// chunk read_callback() is in, bytes counts down to the next header
+static flacChunkHeader_t flacChunk;
+
+static struct {
+  uint32_t frames;
+  int64_t wait;  // for ring buffer or player queue in the current frame
+  int64_t decodeSum;
+  int64_t decodeMax;
+  int64_t latencySum;
+  int64_t latencyMax;
+} flacStats;
+
+static const int32_t decodeBounds[] = {
+    250, 500, 1000, 2000, 4000, 8000, 16000, 32000,
+};
+static uint32_t decodeCounts[sizeof(decodeBounds) / sizeof(decodeBounds[0]) +
+                             1];
+static metric_t decodeMetric = METRIC_HISTOGRAM_INIT(
+    "snapclient_decode_us", "Time to decode a FLAC frame or an Opus packet",
+    decodeBounds, decodeCounts);
+
 /**
  *
  */
-void time_sync_msg_cb(void *args) {
-  base_message_t base_message_tx;
-  //  struct timeval now;
-  int64_t now;
-  // time_message_t time_message_tx = {{0, 0}};
-  int rc1;
-
-  // causes kernel panic, which shouldn't happen though?
-  // Isn't it called from timer task instead of ISR?
-  // xSemaphoreGive(timeSyncSemaphoreHandle);
-
-  //  result = gettimeofday(&now, NULL);
-  ////  ESP_LOGI(TAG, "time of day: %d", (int32_t)now.tv_sec +
-  ///(int32_t)now.tv_usec);
-  //  if (result) {
-  //    ESP_LOGI(TAG, "Failed to gettimeofday");
-  //
-  //    return;
-  //  }
+static bool read_heap_free(int32_t *value) {
+  *value = heap_caps_get_free_size(MALLOC_CAP_32BIT);
 
-  uint8_t *p_pkt = (uint8_t *)malloc(BASE_MESSAGE_SIZE + TIME_MESSAGE_SIZE);
-  if (p_pkt == NULL) {
-    ESP_LOGW(
-        TAG,
-        "%s: Failed to get memory for time sync message. Skipping this round.",
-        __func__);
+  return true;
+}
 
-    return;
-  }
+/**
+ *
+ */
+static bool read_heap_largest_block(int32_t *value) {
+  *value = heap_caps_get_largest_free_block(MALLOC_CAP_32BIT);
+
+  return true;
+}
 
-  memset(p_pkt, 0, BASE_MESSAGE_SIZE + TIME_MESSAGE_SIZE);
-
-  base_message_tx.type = SNAPCAST_MESSAGE_TIME;
-  base_message_tx.id = id_counter++;
-  base_message_tx.refersTo = 0;
-  base_message_tx.received.sec = 0;
-  base_message_tx.received.usec = 0;
-  now = esp_timer_get_time();
-  base_message_tx.sent.sec = now / 1000000;
-  base_message_tx.sent.usec = now - base_message_tx.sent.sec * 1000000;
-  base_message_tx.size = TIME_MESSAGE_SIZE;
-  rc1 = base_message_serialize(&base_message_tx, (char *)&p_pkt[0],
-                               BASE_MESSAGE_SIZE);
-  if (rc1) {
-    ESP_LOGE(TAG, "Failed to serialize base message for time");
+/**
+ * Not connected or on ethernet there is no RSSI.
+ */
+static bool read_wifi_rssi(int32_t *value) {
+  wifi_ap_record_t ap;
 
-    return;
+  if (esp_wifi_sta_get_ap_info(&ap) != ESP_OK) {
+    return false;
   }
+  *value = ap.rssi;
 
-  //  memset(&time_message_tx, 0, sizeof(time_message_tx));
-  //  result = time_message_serialize(&time_message_tx,
-  //  &p_pkt[BASE_MESSAGE_SIZE],
-  //                                  TIME_MESSAGE_SIZE);
-  //  if (result) {
-  //    ESP_LOGI(TAG, "Failed to serialize time message");
-  //
-  //    return;
-  //  }
+  return true;
+}
 
-  rc1 = netconn_write(lwipNetconn, p_pkt, BASE_MESSAGE_SIZE + TIME_MESSAGE_SIZE,
-                      NETCONN_NOCOPY);
-  if (rc1 != ERR_OK) {
-    ESP_LOGW(TAG, "error writing timesync msg");
+static metric_t heapFreeMetric =
+    METRIC_GAUGE_INIT("snapclient_heap_free_bytes", NULL,
+                      "Free 32 bit accessible heap", read_heap_free);
+static metric_t heapLargestMetric = METRIC_GAUGE_INIT(
+    "snapclient_heap_largest_free_block_bytes", NULL,
+    "Largest free block of 32 bit accessible heap", read_heap_largest_block);
+static metric_t rssiMetric = METRIC_GAUGE_INIT(
+    "snapclient_wifi_rssi_dbm", NULL, "RSSI of the access point",
+    read_wifi_rssi);
 
-    return;
+/**
+ *
+ */
+void time_sync_msg_cb(void *args) {
+  if (snapcast_client_send_time_request(&snapClient) != 0) {
+    ESP_LOGW(TAG, "error writing timesync msg");
   }
+}
+
+/**
+ * Copy exactly len bytes out of the flac ring buffer, blocks until they are
+ * there.
+ */
+static void flac_ring_read(uint8_t *dst, size_t len) {
+  while (len > 0) {
+    size_t got = 0;
+    uint8_t *item = (uint8_t *)xRingbufferReceiveUpTo(flacRingBuf, &got,
+                                                      portMAX_DELAY, len);
 
-  free(p_pkt);
+    if (item == NULL) {
+      continue;
+    }
 
-  //  ESP_LOGI(TAG, "%s: sent time sync message", __func__);
+    memcpy(dst, item, got);
+    vRingbufferReturnItem(flacRingBuf, item);
 
-  //  xSemaphoreGiveFromISR(timeSyncSemaphoreHandle, &xHigherPriorityTaskWoken);
-  //  if (xHigherPriorityTaskWoken) {
-  //    portYIELD_FROM_ISR();
-  //  }
+    dst += got;
+    len -= got;
+  }
 }
 
 /**
- *
+ * Blocks until the decoder made room, pieces bigger than half the ring
+ * buffer are split so they always fit.
  */
-void free_flac_data(decoderData_t *pFlacData) {
-  if (pFlacData->inData) {
-    free(pFlacData->inData);
-    pFlacData->inData = NULL;
-  }
+static void flac_ring_send(const void *data, size_t len) {
+  const uint8_t *src = (const uint8_t *)data;
+  size_t maxLen = xRingbufferGetMaxItemSize(flacRingBuf) / 2;
 
-  if (pFlacData->outData) {
-    free(pFlacData->outData);
-    pFlacData->outData = NULL;
-  }
+  while (len > 0) {
+    size_t n = (len > maxLen) ? maxLen : len;
 
-  if (pFlacData) {
-    free(pFlacData);
-    pFlacData = NULL;
+    if (xRingbufferSend(flacRingBuf, src, n, portMAX_DELAY) == pdTRUE) {
+      src += n;
+      len -= n;
+    }
   }
 }
 
 /**
- *
+ * Hand the decoder at most the rest of the current chunk, so a decoded frame
+ * always belongs to the chunk whose header was read last.
  */
 static FLAC__StreamDecoderReadStatus read_callback(
     const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes,
     void *client_data) {
   snapcastSetting_t *scSet = (snapcastSetting_t *)client_data;
-  decoderData_t *flacData;
+  int64_t t0 = esp_timer_get_time();
+  size_t got = 0;
+  uint8_t *item;
 
+  (void)decoder;
   (void)scSet;
 
-  xQueueReceive(decoderReadQHdl, &flacData, portMAX_DELAY);
-
-  // ESP_LOGI(TAG, "in flac read cb %d %p", flacData->bytes, flacData->inData);
+  if (flacChunk.bytes == 0) {
+    flac_ring_read((uint8_t *)&flacChunk, sizeof(flacChunk));
 
-  if (flacData->bytes <= 0) {
-    free_flac_data(flacData);
-
-    return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
+    CHUNK_TRACE(CHUNK_TRACE_DECODE_IN, flacChunk.timestamp, flacChunk.bytes);
   }
 
-  if (flacData->inData == NULL) {
-    free_flac_data(flacData);
-
-    return FLAC__STREAM_DECODER_READ_STATUS_ABORT;
+  if (*bytes > flacChunk.bytes) {
+    *bytes = flacChunk.bytes;
   }
 
-  if (flacData->bytes <= *bytes) {
-    memcpy(buffer, flacData->inData, flacData->bytes);
-    *bytes = flacData->bytes;
-    //      ESP_LOGW(TAG, "read all flac inData %d", *bytes);
-  } else {
-    memcpy(buffer, flacData->inData, *bytes);
-    // ESP_LOGW(TAG, "dind't read all flac inData %d", *bytes);
-    flacData->inData += *bytes;
-    flacData->bytes -= *bytes;
+  if (*bytes == 0) {
+    return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
   }
 
-  free_flac_data(flacData);
+  // may return less on wrap around, libFLAC asks again
+  do {
+    item = (uint8_t *)xRingbufferReceiveUpTo(flacRingBuf, &got, portMAX_DELAY,
+                                             *bytes);
+  } while (item == NULL);
 
-  // xQueueSend (flacReadQHdl, &flacData, portMAX_DELAY);
+  memcpy(buffer, item, got);
+  vRingbufferReturnItem(flacRingBuf, item);
 
-  // xSemaphoreGive(decoderReadSemaphore);
+  *bytes = got;
+  flacChunk.bytes -= got;
 
-  // ESP_LOGE(TAG, "%s: data processed", __func__);
+  // don't count waiting for the network as decode time
+  flacStats.wait += esp_timer_get_time() - t0;
 
   return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
 }
@@ -319,21 +415,13 @@ static FLAC__StreamDecoderReadStatus read_callback(
 static FLAC__StreamDecoderWriteStatus write_callback(
     const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame,
     const FLAC__int32 *const buffer[], void *client_data) {
-  size_t i;
-  decoderData_t *flacData = NULL;  // = &flacOutData;
+  pcm_chunk_message_t *pcmChunk = NULL;
   snapcastSetting_t *scSet = (snapcastSetting_t *)client_data;
-  int ret = 0;
-  uint32_t fragmentCnt = 0;
+  uint32_t bytes;
+  int64_t t0, latency;
 
   (void)decoder;
 
-  // xSemaphoreTake(decoderWriteSemaphore, portMAX_DELAY);
-
-  // xQueueReceive (flacReadQHdl, &flacData, portMAX_DELAY);
-
-  //    ESP_LOGI(TAG, "in flac write cb %d %p", frame->header.blocksize,
-  //    flacData);
-
   if (frame->header.channels != scSet->ch) {
     ESP_LOGE(TAG,
              "ERROR: frame header reports different channel count %d than "
@@ -352,71 +440,59 @@ static FLAC__StreamDecoderWriteStatus write_callback(
     ESP_LOGE(TAG, "ERROR: buffer [0] is NULL\n");
     return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
   }
-  if (buffer[1] == NULL) {
-    ESP_LOGE(TAG, "ERROR: buffer [1] is NULL\n");
-    return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
-  }
-
-  flacData = (decoderData_t *)malloc(sizeof(decoderData_t));
-  if (flacData == NULL) {
-    return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
-  }
-
-  memset(flacData, 0, sizeof(decoderData_t));
 
-  flacData->bytes = frame->header.blocksize * frame->header.channels *
-                    (frame->header.bits_per_sample / 8);
+  bytes = pcm_pack_bytes(frame->header.blocksize, frame->header.channels,
+                         pcm_pack_slot_bits(frame->header.bits_per_sample));
 
-  ret = allocate_pcm_chunk_memory(&(flacData->outData), flacData->bytes);
+  if (allocate_pcm_chunk_memory(&pcmChunk, bytes) < 0) {
+    // drop the chunk, the player resyncs if it misses too many
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+  }
 
-  //   ESP_LOGI (TAG, "mem %p %p %d", flacData->outData,
-  //   flacData->outData->fragment->payload, flacData->bytes);
+  // TODO: for now fragmented payload is not supported and the whole
+  // chunk is expected to be in the first fragment
+  if (pcmChunk->fragment->payload != NULL) {
+    // kernel for this format was picked with the codec header
+    flacPack(pcmChunk->fragment->payload, buffer, frame->header.blocksize);
+  }
 
-  if (ret == 0) {
-    pcm_chunk_fragment_t *fragment = flacData->outData->fragment;
+  pcmChunk->timestamp = flacChunk.timestamp;
 
-    if (fragment->payload != NULL) {
-      fragmentCnt = 0;
+  CHUNK_TRACE(CHUNK_TRACE_DECODED, pcmChunk->timestamp, bytes);
 
-      for (i = 0; i < frame->header.blocksize; i++) {
-        // write little endian
-        // flacData->outData[4 * i] = (uint8_t)buffer[0][i];
-        // flacData->outData[4 * i + 1] = (uint8_t) (buffer[0][i] >> 8);
-        // flacData->outData[4 * i + 2] = (uint8_t)buffer[1][i];
-        // flacData->outData[4 * i + 3] = (uint8_t)(buffer[1][i] >> 8);
+  scSet->chkInFrames = frame->header.blocksize;
+  if (player_send_snapcast_setting(scSet) != pdPASS) {
+    ESP_LOGE(TAG,
+             "Failed to notify sync task about codec. Did you init player?");
 
-        // TODO: for now fragmented payload is not supported and the whole
-        // chunk is expected to be in the first fragment
-        uint32_t tmpData;
-        tmpData = ((uint32_t)((buffer[0][i] >> 8) & 0xFF) << 24) |
-                  ((uint32_t)((buffer[0][i] >> 0) & 0xFF) << 16) |
-                  ((uint32_t)((buffer[1][i] >> 8) & 0xFF) << 8) |
-                  ((uint32_t)((buffer[1][i] >> 0) & 0xFF) << 0);
+    free_pcm_chunk(pcmChunk);
 
-        if (fragment != NULL) {
-          volatile uint32_t *test =
-              (volatile uint32_t *)(&(fragment->payload[fragmentCnt]));
-          *test = (volatile uint32_t *)tmpData;
-        }
+    return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+  }
 
-        fragmentCnt += 4;
-        if (fragmentCnt >= fragment->size) {
-          fragmentCnt = 0;
+#if CONFIG_USE_DSP_PROCESSOR
+  // dsp flows work on stereo, see codec_header_cb()
+  if (scSet->ch == 2) {
+    dsp_processor_worker(pcmChunk->fragment->payload,
+                         dsp_aux_payload(pcmChunk), pcmChunk->fragment->size,
+                         scSet->sr, pcm_pack_slot_bits(scSet->bits));
 
-          fragment = fragment->nextFragment;
-        }
-      }
-    }
+    CHUNK_TRACE(CHUNK_TRACE_DSP, pcmChunk->timestamp, 0);
   }
-  //  else {
-  //    flacData->outData = NULL;
-  //  }
-
-  xQueueSend(decoderWriteQHdl, &flacData, portMAX_DELAY);
+#endif
 
-  // ESP_LOGE(TAG, "%s: data processed", __func__);
+  // received to decoded, waiting in the ring buffer included
+  t0 = esp_timer_get_time();
+  latency = t0 - flacChunk.received;
+  flacStats.latencySum += latency;
+  if (latency > flacStats.latencyMax) {
+    flacStats.latencyMax = latency;
+  }
 
-  // xSemaphoreGive(flacWriteSemaphore);
+  // blocks with a compressed buffer until the player makes room
+  t0 = esp_timer_get_time();
+  insert_pcm_chunk(pcmChunk);
+  flacStats.wait += esp_timer_get_time() - t0;
 
   return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
@@ -427,25 +503,11 @@ static FLAC__StreamDecoderWriteStatus write_callback(
 void metadata_callback(const FLAC__StreamDecoder *decoder,
                        const FLAC__StreamMetadata *metadata,
                        void *client_data) {
-  decoderData_t *flacData;  // = &flacOutData;
   snapcastSetting_t *scSet = (snapcastSetting_t *)client_data;
 
   (void)decoder;
 
-  // xQueueReceive (flacReadQHdl, &flacData, portMAX_DELAY);
-
   if (metadata->type == FLAC__METADATA_TYPE_STREAMINFO) {
-    //		ESP_LOGI(TAG, "in flac meta cb");
-
-    flacData = (decoderData_t *)malloc(sizeof(decoderData_t));
-    if (flacData == NULL) {
-      ESP_LOGE(TAG, "in flac meta cb, malloc failed");
-
-      return;
-    }
-
-    memset(flacData, 0, sizeof(decoderData_t));
-
     // save for later
     scSet->sr = metadata->data.stream_info.sample_rate;
     scSet->ch = metadata->data.stream_info.channels;
@@ -453,13 +515,7 @@ void metadata_callback(const FLAC__StreamDecoder *decoder,
 
     ESP_LOGI(TAG, "fLaC sampleformat: %d:%d:%d", scSet->sr, scSet->bits,
              scSet->ch);
-
-    xQueueSend(decoderWriteQHdl, &flacData, portMAX_DELAY);
-
-    // ESP_LOGE(TAG, "%s: data processed", __func__);
   }
-
-  //  xSemaphoreGive(flacReadSemaphore);
 }
 
 /**
@@ -473,8 +529,11 @@ void error_callback(const FLAC__StreamDecoder *decoder,
            FLAC__StreamDecoderErrorStatusString[status]);
 }
 
+/**
+ * Pulls the stream from flacRingBuf and decodes it frame by frame, decoded
+ * chunks go straight to the player from write_callback().
+ */
 static void flac_decoder_task(void *pvParameters) {
-  //  FLAC__bool ok = true;
   FLAC__StreamDecoderInitStatus init_status;
   snapcastSetting_t *scSet = (snapcastSetting_t *)pvParameters;
 
@@ -496,217 +555,154 @@ static void flac_decoder_task(void *pvParameters) {
   if (init_status != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
     ESP_LOGE(TAG, "ERROR: initializing decoder: %s\n",
              FLAC__StreamDecoderInitStatusString[init_status]);
-
-    //    ok = false;
-
     return;
   }
 
+  memset(&flacStats, 0, sizeof(flacStats));
+
   while (1) {
-    FLAC__stream_decoder_process_until_end_of_stream(flacDecoder);
+    int64_t t0 = esp_timer_get_time();
+    int64_t decode;
+
+    flacStats.wait = 0;
+
+    if (FLAC__stream_decoder_process_single(flacDecoder) == false) {
+      ESP_LOGW(TAG, "flac decoder state %s, flushing",
+               FLAC__stream_decoder_get_resolved_state_string(flacDecoder));
+
+      FLAC__stream_decoder_flush(flacDecoder);
+    }
+
+    decode = esp_timer_get_time() - t0 - flacStats.wait;
+    metric_observe(&decodeMetric, (int32_t)decode);
+    flacStats.decodeSum += decode;
+    if (decode > flacStats.decodeMax) {
+      flacStats.decodeMax = decode;
+    }
+
+    if (++flacStats.frames >= FLAC_STATS_FRAMES) {
+      ESP_LOGI(TAG,
+               "flac: decode %lldus avg %lldus max, latency %lldus avg "
+               "%lldus max",
+               flacStats.decodeSum / flacStats.frames, flacStats.decodeMax,
+               flacStats.latencySum / flacStats.frames,
+               flacStats.latencyMax);
+
+      memset(&flacStats, 0, sizeof(flacStats));
+    }
   }
 }
 
 /**
+ * Decode a packet straight into a pool chunk and pass it to the player.
  *
+ * @return 0 if the packet was played or dropped, -1 if the player isn't
+ * running
  */
-void flac_task(void *pvParameters) {
-  tv_t currentTimestamp;
-  decoderData_t *pFlacData = NULL;
-  snapcastSetting_t *scSet = (snapcastSetting_t *)pvParameters;
+static int32_t opus_decode_chunk(snapcastSetting_t *scSet,
+                                 const decoderData_t *pOpusData) {
+  pcm_chunk_message_t *pcmData = NULL;
+  opus_int16 *pcm;
+  int frames, decoded;
+  size_t bytes;
+  int64_t t0;
 
-  while (1) {
-    xQueueReceive(decoderTaskQHdl, &pFlacData,
-                  portMAX_DELAY);  // get data from tcp task
+  CHUNK_TRACE(CHUNK_TRACE_DECODE_IN, pOpusData->timestamp, pOpusData->bytes);
 
-    if (pFlacData != NULL) {
-      currentTimestamp = pFlacData->timestamp;
+  frames = opus_decoder_get_nb_samples(opusDecoder, pOpusData->inData,
+                                       pOpusData->bytes);
+  if (frames <= 0) {
+    ESP_LOGE(TAG, "couldn't get sample count of packet: %d", frames);
 
-      //      ESP_LOGE(TAG, "Got timestamp %lld",
-      //               (uint64_t)currentTimestamp.sec * 1000000 +
-      //                   (uint64_t)currentTimestamp.usec);
+    return 0;
+  }
 
-      // xSemaphoreTake(decoderReadSemaphore, portMAX_DELAY);
+  scSet->chkInFrames = frames;
+  if (player_send_snapcast_setting(scSet) != pdPASS) {
+    ESP_LOGE(TAG,
+             "Failed to notify sync task about codec. Did you init player?");
 
-      // send data to flac decoder
-      // ESP_LOGE(TAG, "%s: decoderReadQHdl start", __func__);
+    return -1;
+  }
 
-      xQueueSend(decoderReadQHdl, &pFlacData, portMAX_DELAY);
+  bytes = pcm_pack_bytes(frames, scSet->ch, 16);
+  if (allocate_pcm_chunk_memory(&pcmData, bytes) < 0) {
+    // drop the packet, the player resyncs if it misses too many
+    return 0;
+  }
 
-      // ESP_LOGE(TAG, "%s: decoderReadQHdl done", __func__);
-      // and wait until data was
-      // processed
-      // xSemaphoreTake(decoderReadSemaphore, portMAX_DELAY);
-      // need to release mutex
-      // afterwards for next round
-      // xSemaphoreGive(decoderReadSemaphore);
+  if (esp_ptr_byte_accessible(pcmData->fragment->payload)) {
+    pcm = (opus_int16 *)pcmData->fragment->payload;
+  } else {
+    if (bytes > opusScratchSize) {
+      ESP_LOGW(TAG, "no scratch buffer for %d frames, packet dropped",
+               frames);
 
-      //      free(pFlacData->inData);
-      //      free(pFlacData);
-    } else {
-      pcm_chunk_message_t *pcmData = NULL;
+      free_pcm_chunk(pcmData);
 
-      //      xSemaphoreGive(decoderWriteSemaphore);
-      // and wait until it is done
-      // ESP_LOGE(TAG, "%s: decoderWriteQHdl start", __func__);
+      return 0;
+    }
 
-      xQueueReceive(decoderWriteQHdl, &pFlacData, portMAX_DELAY);
+    pcm = opusScratch;
+  }
 
-      // ESP_LOGE(TAG, "%s: decoderWriteQHdl done", __func__);
+  t0 = esp_timer_get_time();
+  decoded = opus_decode(opusDecoder, pOpusData->inData, pOpusData->bytes, pcm,
+                        frames, 0);
+  metric_observe(&decodeMetric, (int32_t)(esp_timer_get_time() - t0));
+  if (decoded < 0) {
+    ESP_LOGE(TAG, "Decode error : %d", decoded);
 
-      if (pFlacData->outData != NULL) {
-        pcmData = pFlacData->outData;
-        pcmData->timestamp = currentTimestamp;
+    free_pcm_chunk(pcmData);
 
-        size_t decodedSize = pcmData->totalSize;  // pFlacData->bytes;
-        scSet->chkInFrames =
-            decodedSize / ((size_t)scSet->ch * (size_t)(scSet->bits / 8));
-        if (player_send_snapcast_setting(scSet) != pdPASS) {
-          ESP_LOGE(TAG,
-                   "Failed to "
-                   "notify "
-                   "sync task "
-                   "about "
-                   "codec. Did you "
-                   "init player?");
+    return 0;
+  }
 
-          return;
-        }
+  // I2S word order, in place unless opus wrote to the scratch buffer
+  pcm_pack_int16(pcmData->fragment->payload, pcm, decoded * scSet->ch);
+
+  pcmData->timestamp = pOpusData->timestamp;
+
+  CHUNK_TRACE(CHUNK_TRACE_DECODED, pcmData->timestamp, bytes);
 
 #if CONFIG_USE_DSP_PROCESSOR
-        dsp_processor_worker(pcmData->fragment->payload,
-                             pcmData->fragment->size, scSet->sr);
-#endif
+  dsp_processor_worker(pcmData->fragment->payload, dsp_aux_payload(pcmData),
+                       pcmData->fragment->size, scSet->sr, 16);
 
-        insert_pcm_chunk(pcmData);
+  CHUNK_TRACE(CHUNK_TRACE_DSP, pcmData->timestamp, 0);
+#endif
 
-        if (pFlacData->inData) {
-          free(pFlacData->inData);
-          pFlacData->inData = NULL;
-        }
+  insert_pcm_chunk(pcmData);
 
-        if (pFlacData) {
-          free(pFlacData);
-          pFlacData = NULL;
-        }
-      } else {
-        free_flac_data(pFlacData);
-      }
-    }
-  }
+  return 0;
 }
 
 /**
  *
  */
 void opus_decoder_task(void *pvParameters) {
-  tv_t currentTimestamp;
   decoderData_t *pOpusData = NULL;
   snapcastSetting_t *scSet = (snapcastSetting_t *)pvParameters;
+  int32_t ret = 0;
+  size_t size;
 
   while (1) {
-    // get data from tcp task
-    xQueueReceive(decoderTaskQHdl, &pOpusData, portMAX_DELAY);
+    // get data from tcp task, the packet follows its header in the ring
+    pOpusData = (decoderData_t *)xRingbufferReceive(opusRingBuf, &size,
+                                                    portMAX_DELAY);
 
     if (pOpusData) {
-      currentTimestamp = pOpusData->timestamp;
-
-      // ESP_LOGE(TAG, "%s: Got timestamp %lld", __func__,
-      //                                        (uint64_t)currentTimestamp.sec *
-      //                                        1000000 +
-      //                                        (uint64_t)currentTimestamp.usec);
-
-      if (pOpusData->inData) {
-        int frame_size = 0;
-        int sample_count = 0;
-        int samples_per_frame = 0;
-        int frame_count;
-        opus_int16 *audio;
-
-        samples_per_frame =
-            opus_packet_get_samples_per_frame(pOpusData->inData, scSet->sr);
-        if (samples_per_frame < 0) {
-          ESP_LOGE(TAG,
-                   "couldn't get samples per frame count "
-                   "of packet");
-        }
-
-        scSet->chkInFrames = samples_per_frame;
-
-        size_t bytes = samples_per_frame * scSet->ch * scSet->bits / 8;
-
-        if (samples_per_frame > 480) {
-          ESP_LOGE(TAG, "samples_per_frame: %d, pOpusData->bytes %d, bytes %d",
-                   samples_per_frame, pOpusData->bytes, bytes);
-        }
-
-        // TODO: insert some break condition if we wait
-        // too long
-        while ((audio = (opus_int16 *)malloc(bytes)) == NULL) {
-          ESP_LOGE(TAG, "couldn't get memory for audio");
-
-          vTaskDelay(pdMS_TO_TICKS(1));
-        }
-
-        frame_size =
-            opus_decode(opusDecoder, pOpusData->inData, pOpusData->bytes,
-                        (opus_int16 *)audio, samples_per_frame, 0);
-
-        free(pOpusData->inData);
-        pOpusData->inData = NULL;
-
-        if (frame_size < 0) {
-          ESP_LOGE(TAG, "Decode error : %d \n", frame_size);
-        } else {
-          pcm_chunk_message_t *pcmData = NULL;
-
-          bytes = frame_size * scSet->ch * scSet->bits / 8;
-          if (allocate_pcm_chunk_memory(&pcmData, bytes) < 0) {
-            pcmData = NULL;
-          } else {
-            pcmData->timestamp = currentTimestamp;
-
-            if (pcmData->fragment->payload) {
-              volatile uint32_t *sample;
-              uint32_t tmpData;
-              uint32_t cnt = 0;
-
-              for (int i = 0; i < bytes; i += 4) {
-                sample =
-                    (volatile uint32_t *)(&(pcmData->fragment->payload[i]));
-                tmpData = (((uint32_t)audio[cnt] << 16) & 0xFFFF0000) |
-                          (((uint32_t)audio[cnt + 1] << 0) & 0x0000FFFF);
-                *sample = (volatile uint32_t)tmpData;
-
-                cnt += 2;
-              }
-            }
-
-            free(audio);
-            audio = NULL;
-          }
-
-          if (player_send_snapcast_setting(scSet) != pdPASS) {
-            ESP_LOGE(TAG,
-                     "Failed to notify "
-                     "sync task about "
-                     "codec. Did you "
-                     "init player?");
-
-            return;
-          }
-
-#if CONFIG_USE_DSP_PROCESSOR
-          dsp_processor_worker(pcmData->fragment->payload,
-                               pcmData->fragment->size, scSet->sr);
-#endif
-
-          insert_pcm_chunk(pcmData);
-        }
+      // dropped packets are sent with 0 bytes
+      if (pOpusData->bytes > 0) {
+        ret = opus_decode_chunk(scSet, pOpusData);
       }
 
-      free(pOpusData);
+      vRingbufferReturnItem(opusRingBuf, pOpusData);
       pOpusData = NULL;
+
+      if (ret < 0) {
+        return;
+      }
     }
   }
 }
@@ -725,2007 +721,733 @@ esp_err_t audio_set_mute(bool mute) {
 }
 
 /**
- *
+ * Copy a piece of 16 bit stereo PCM wire chunk payload to the chunk's sample
+ * words, which hold the left channel in the upper 16 bit. Pieces may start
+ * and end anywhere inside a sample word. Chunk memory may be in IRAM, so it
+ * is only accessed with 32 bit loads and stores.
  */
-static void http_get_task(void *pvParameters) {
-  char *start;
-  base_message_t base_message_rx;
-  hello_message_t hello_message;
-  wire_chunk_message_t wire_chnk = {{0, 0}, 0, NULL};
-  char *hello_message_serialized = NULL;
-  int result;
-  int64_t now, trx, tdif, ttx;
-  time_message_t time_message_rx = {{0, 0}};
-  int64_t tmpDiffToServer;
-  int64_t lastTimeSync = 0;
-  esp_timer_handle_t timeSyncMessageTimer = NULL;
-  esp_err_t err = 0;
-  server_settings_message_t server_settings_message;
-  bool received_header = false;
-  mdns_result_t *r;
-  codec_type_t codec = NONE;
-  snapcastSetting_t scSet;
-  // flacData_t flacData = {SNAPCAST_MESSAGE_CODEC_HEADER, NULL, {0, 0}, NULL,
-  // 0};
-  decoderData_t *pDecData = NULL;
-  pcm_chunk_message_t *pcmData = NULL;
-  uint8_t *opusData = NULL;
-  ip_addr_t remote_ip;
-  uint16_t remotePort = 0;
-  int rc1 = ERR_OK, rc2 = ERR_OK;
-  struct netbuf *firstNetBuf = NULL;
-  struct netbuf *newNetBuf = NULL;
-  uint16_t len;
-  uint64_t timeout = FAST_SYNC_LATENCY_BUF;
-
-  // create a timer to send time sync messages every x µs
-  esp_timer_create(&tSyncArgs, &timeSyncMessageTimer);
-
-#if CONFIG_SNAPCLIENT_USE_MDNS
-  ESP_LOGI(TAG, "Enable mdns");
-  mdns_init();
-#endif
-
-  while (1) {
-    received_header = false;
-
-    if (reset_latency_buffer() < 0) {
-      ESP_LOGE(TAG,
-               "reset_diff_buffer: couldn't reset median filter long. STOP");
-      return;
-    }
-
-    timeout = FAST_SYNC_LATENCY_BUF;
-
-    esp_timer_stop(timeSyncMessageTimer);
-
-    if (opusDecoder != NULL) {
-      opus_decoder_destroy(opusDecoder);
-      opusDecoder = NULL;
-    }
-
-    if (t_flac_decoder_task != NULL) {
-      vTaskDelete(t_flac_decoder_task);
-      t_flac_decoder_task = NULL;
-    }
-
-    if (dec_task_handle != NULL) {
-      vTaskDelete(dec_task_handle);
-      dec_task_handle = NULL;
-    }
-
-    if (flacDecoder != NULL) {
-      FLAC__stream_decoder_finish(flacDecoder);
-      FLAC__stream_decoder_delete(flacDecoder);
-      flacDecoder = NULL;
-    }
-
-    if (decoderWriteQHdl != NULL) {
-      vQueueDelete(decoderWriteQHdl);
-      decoderWriteQHdl = NULL;
-    }
+static void pcm_copy_swap_channels(uint8_t *dst, const uint8_t *src,
+                                   uint32_t offset, uint32_t len) {
+  volatile uint32_t *sample;
+  uint32_t tmpData;
+  uint32_t shift;
+  uint32_t i = 0;
+
+  // finish sample word which was started by the last piece
+  while ((i < len) && ((offset + i) & 0x03)) {
+    sample = (volatile uint32_t *)(&dst[(offset + i) & ~0x03]);
+    shift = 8 * (((offset + i) & 0x03) ^ 0x02);
+    tmpData = *sample & ~((uint32_t)0xFF << shift);
+    *sample = tmpData | ((uint32_t)src[i] << shift);
+
+    i++;
+  }
 
-    if (decoderReadQHdl != NULL) {
-      vQueueDelete(decoderReadQHdl);
-      decoderReadQHdl = NULL;
-    }
+  for (; len - i >= 4; i += 4) {
+    memcpy(&tmpData, &src[i], sizeof(tmpData));
 
-    if (decoderTaskQHdl != NULL) {
-      vQueueDelete(decoderTaskQHdl);
-      decoderTaskQHdl = NULL;
-    }
+    sample = (volatile uint32_t *)(&dst[offset + i]);
+    *sample = (tmpData << 16) | (tmpData >> 16);
+  }
 
-#if SNAPCAST_SERVER_USE_MDNS
-    // Find snapcast server
-    // Connect to first snapcast server found
-    r = NULL;
-    err = 0;
-    while (!r || err) {
-      ESP_LOGI(TAG, "Lookup snapcast service on network");
-      esp_err_t err = mdns_query_ptr("_snapcast", "_tcp", 3000, 20, &r);
-      if (err) {
-        ESP_LOGE(TAG, "Query Failed");
-        vTaskDelay(pdMS_TO_TICKS(1000));
-      }
+  // start sample word which is finished by the next piece
+  for (; i < len; i++) {
+    sample = (volatile uint32_t *)(&dst[(offset + i) & ~0x03]);
+    shift = 8 * (((offset + i) & 0x03) ^ 0x02);
+    tmpData = *sample & ~((uint32_t)0xFF << shift);
+    *sample = tmpData | ((uint32_t)src[i] << shift);
+  }
+}
 
-      if (!r) {
-        ESP_LOGW(TAG, "No results found!");
-        vTaskDelay(pdMS_TO_TICKS(1000));
-      }
-    }
+/**
+ * Stop and delete decoder tasks, decoders and their ring buffers.
+ */
+static void decoders_free(void) {
+  if (t_flac_decoder_task != NULL) {
+    vTaskDelete(t_flac_decoder_task);
+    t_flac_decoder_task = NULL;
+  }
 
-    if (r->addr) {
-      ip_addr_copy(remote_ip, (r->addr->addr));
-      remote_ip.type = IPADDR_TYPE_V4;
-      remotePort = r->port;
-      ESP_LOGI(TAG, "Found %s:%d", ipaddr_ntoa(&remote_ip), remotePort);
+  if (dec_task_handle != NULL) {
+    vTaskDelete(dec_task_handle);
+    dec_task_handle = NULL;
+  }
 
-      mdns_query_results_free(r);
-    } else {
-      mdns_query_results_free(r);
+  if (flacDecoder != NULL) {
+    FLAC__stream_decoder_finish(flacDecoder);
+    FLAC__stream_decoder_delete(flacDecoder);
+    flacDecoder = NULL;
+  }
 
-      ESP_LOGW(TAG, "No IP found in MDNS query");
+  if (flacRingBuf != NULL) {
+    vRingbufferDelete(flacRingBuf);
+    flacRingBuf = NULL;
+  }
 
-      continue;
-    }
-#else
-    // configure a failsafe snapserver according to CONFIG values
-    struct sockaddr_in servaddr;
+  memset(&flacChunk, 0, sizeof(flacChunk));
+  flacPack = NULL;
 
-    servaddr.sin_family = AF_INET;
-    inet_pton(AF_INET, SNAPCAST_SERVER_HOST, &(servaddr.sin_addr.s_addr));
-    servaddr.sin_port = htons(SNAPCAST_SERVER_PORT);
+  // packets still waiting go with it
+  if (opusRingBuf != NULL) {
+    vRingbufferDelete(opusRingBuf);
+    opusRingBuf = NULL;
+  }
+  opusPacket = NULL;
 
-    inet_pton(AF_INET, SNAPCAST_SERVER_HOST, &(remote_ip.u_addr.ip4.addr));
-    remote_ip.type = IPADDR_TYPE_V4;
-    remotePort = SNAPCAST_SERVER_PORT;
+  if (opusDecoder != NULL) {
+    heap_caps_free(opusDecoder);
+    opusDecoder = NULL;
+  }
 
-    ESP_LOGI(TAG, "try connecting to static configuration %s:%d",
-             ipaddr_ntoa(&remote_ip), remotePort);
-#endif
+  if (opusScratch != NULL) {
+    heap_caps_free(opusScratch);
+    opusScratch = NULL;
+    opusScratchSize = 0;
+  }
+}
 
-    if (lwipNetconn != NULL) {
-      netconn_delete(lwipNetconn);
-      lwipNetconn = NULL;
-    }
+/**
+ *
+ */
+static int client_connected_cb(void *arg) {
+  (void)arg;
 
-    lwipNetconn = netconn_new(NETCONN_TCP);
-    if (lwipNetconn == NULL) {
-      ESP_LOGE(TAG, "can't create netconn");
+  received_header = false;
 
-      continue;
-    }
+  if (reset_latency_buffer() < 0) {
+    ESP_LOGE(TAG, "reset_diff_buffer: couldn't reset median filter long.");
 
-    rc1 = netconn_bind(lwipNetconn, IPADDR_ANY, 0);
-    if (rc1 != ERR_OK) {
-      ESP_LOGE(TAG, "can't bind local IP");
-    }
+    return -1;
+  }
 
-    rc2 = netconn_connect(lwipNetconn, &remote_ip, remotePort);
-    if (rc2 != ERR_OK) {
-      ESP_LOGE(TAG, "can't connect to remote %s:%d, err %d",
-               ipaddr_ntoa(&remote_ip), remotePort, rc2);
-    }
-    if (rc1 != ERR_OK || rc2 != ERR_OK) {
-      netconn_close(lwipNetconn);
-      netconn_delete(lwipNetconn);
-      lwipNetconn = NULL;
+  timeout = FAST_SYNC_LATENCY_BUF;
 
-      continue;
-    }
+  esp_timer_stop(timeSyncMessageTimer);
 
-    ESP_LOGI(TAG, "netconn connected");
+  decoders_free();
 
-    char mac_address[18];
-    uint8_t base_mac[6];
-    // Get MAC address for WiFi station
-#if CONFIG_SNAPCLIENT_ENABLE_ETHERNET
-    esp_read_mac(base_mac, ESP_MAC_ETH);
-#else
-    esp_read_mac(base_mac, ESP_MAC_WIFI_STA);
+#if !CONFIG_SNAPCLIENT_CAPTURE_NONE
+  stream_capture_session_start();
 #endif
-    sprintf(mac_address, "%02X:%02X:%02X:%02X:%02X:%02X", base_mac[0],
-            base_mac[1], base_mac[2], base_mac[3], base_mac[4], base_mac[5]);
-
-    now = esp_timer_get_time();
-
-    // init base message
-    base_message_rx.type = SNAPCAST_MESSAGE_HELLO;
-    base_message_rx.id = 0x0000;
-    base_message_rx.refersTo = 0x0000;
-    base_message_rx.sent.sec = now / 1000000;
-    base_message_rx.sent.usec = now - base_message_rx.sent.sec * 1000000;
-    base_message_rx.received.sec = 0;
-    base_message_rx.received.usec = 0;
-    base_message_rx.size = 0x00000000;
-
-    // init hello message
-    hello_message.mac = mac_address;
-    hello_message.hostname = SNAPCAST_CLIENT_NAME;
-    hello_message.version = (char *)VERSION_STRING;
-    hello_message.client_name = "libsnapcast";
-    hello_message.os = "esp32";
-    hello_message.arch = "xtensa";
-    hello_message.instance = 1;
-    hello_message.id = mac_address;
-    hello_message.protocol_version = 2;
-
-    if (hello_message_serialized == NULL) {
-      hello_message_serialized = hello_message_serialize(
-          &hello_message, (size_t *)&(base_message_rx.size));
-      if (!hello_message_serialized) {
-        ESP_LOGE(TAG, "Failed to serialize hello message");
-        return;
-      }
-    }
-
-    result = base_message_serialize(&base_message_rx, base_message_serialized,
-                                    BASE_MESSAGE_SIZE);
-    if (result) {
-      ESP_LOGE(TAG, "Failed to serialize base message");
-      return;
-    }
-
-    rc1 = netconn_write(lwipNetconn, base_message_serialized, BASE_MESSAGE_SIZE,
-                        NETCONN_NOCOPY);
-    if (rc1 != ERR_OK) {
-      ESP_LOGE(TAG, "netconn failed to send base message");
 
-      continue;
-    }
-    rc1 = netconn_write(lwipNetconn, hello_message_serialized,
-                        base_message_rx.size, NETCONN_NOCOPY);
-    if (rc1 != ERR_OK) {
-      ESP_LOGE(TAG, "netconn failed to send hello message");
-
-      continue;
-    }
-
-    ESP_LOGI(TAG, "netconn sent hello message");
+  // init default setting
+  scSet.buf_ms = 0;
+  scSet.codec = NONE;
+  scSet.bits = 0;
+  scSet.ch = 0;
+  scSet.sr = 0;
+  scSet.chkInFrames = 0;
+  scSet.volume = 0;
+  scSet.muted = true;
+
+  return 0;
+}
 
-    free(hello_message_serialized);
-    hello_message_serialized = NULL;
+/**
+ *
+ */
+static void client_disconnected_cb(void *arg) {
+  (void)arg;
 
-    // init default setting
-    scSet.buf_ms = 0;
-    scSet.codec = NONE;
-    scSet.bits = 0;
-    scSet.ch = 0;
-    scSet.sr = 0;
-    scSet.chkInFrames = 0;
-    scSet.volume = 0;
-    scSet.muted = true;
+  esp_timer_stop(timeSyncMessageTimer);
 
-    uint64_t startTime, endTime;
-    char *tmp;
-    int32_t remainderSize = 0;
-    size_t currentPos = 0;
-    size_t typedMsgCurrentPos = 0;
-    uint32_t typedMsgLen = 0;
-    uint32_t offset = 0;
-    uint32_t payloadOffset = 0;
-    uint32_t tmpData = 0;
-    int32_t payloadDataShift = 0;
+  // drop partially received chunk
+  if (pcmData != NULL) {
+    free_pcm_chunk(pcmData);
+    pcmData = NULL;
+  }
 
-    int16_t pcm_size = 120;
+  // an acquired item has to be sent, the decoder skips it
+  if (opusPacket != NULL) {
+    opusPacket->bytes = 0;
+    xRingbufferSendComplete(opusRingBuf, opusPacket);
+    opusPacket = NULL;
+  }
+}
 
-#define BASE_MESSAGE_STATE 0
-#define TYPED_MESSAGE_STATE 1
+/**
+ *
+ */
+static int codec_header_cb(void *arg, const codec_header_message_t *msg) {
+  char *tmp = msg->payload;
+  uint32_t typedMsgLen = msg->size;
 
-    // 0 ... base message, 1 ... typed message
-    uint32_t state = BASE_MESSAGE_STATE;
-    uint32_t internalState = 0;
+  (void)arg;
 
-    firstNetBuf = NULL;
+  // ESP_LOGI (TAG, "got codec string: %s", msg->codec);
 
-#define TEST_DECODER_TASK 1
+  if (strcmp(msg->codec, "opus") == 0) {
+    codec = OPUS;
+  } else if (strcmp(msg->codec, "flac") == 0) {
+    codec = FLAC;
+  } else if (strcmp(msg->codec, "pcm") == 0) {
+    codec = PCM;
+  } else {
+    codec = NONE;
 
-    decoderWriteSemaphore = xSemaphoreCreateMutex();
-    xSemaphoreTake(decoderWriteSemaphore, portMAX_DELAY);
+    ESP_LOGI(TAG, "Codec : %s not supported", msg->codec);
+    ESP_LOGI(TAG,
+             "Change encoder codec to "
+             "opus, flac or pcm in "
+             "/etc/snapserver.conf on "
+             "server");
 
-    decoderReadSemaphore = xSemaphoreCreateMutex();
-    xSemaphoreGive(decoderReadSemaphore);  // only decoder read callback/task
-                                           // can give semaphore
+    return -1;
+  }
 
-    while (1) {
-      rc2 = netconn_recv(lwipNetconn, &firstNetBuf);
-      if (rc2 != ERR_OK) {
-        if (rc2 == ERR_CONN) {
-          netconn_close(lwipNetconn);
+  // first ensure everything is set up
+  // correctly and resources are
+  // available
+  decoders_free();
 
-          // restart and try to reconnect
-          break;
-        }
+  if (codec == OPUS) {
+    size_t ringSize =
+        DECODER_QUEUE_CHUNKS *
+        (OPUS_RING_ITEM_OVERHEAD + OPUS_PACKET_TYPICAL_BYTES);
 
-        if (firstNetBuf != NULL) {
-          netbuf_delete(firstNetBuf);
+    // packets are received into the ring, nothing is allocated per packet
+    if (ringSize < OPUS_RING_MIN_SIZE) {
+      ringSize = OPUS_RING_MIN_SIZE;
+    }
 
-          firstNetBuf = NULL;
-        }
-        continue;
+    while (((opusRingBuf = xRingbufferCreate(
+                 ringSize, RINGBUF_TYPE_NOSPLIT)) == NULL) &&
+           (ringSize > OPUS_RING_MIN_SIZE)) {
+      ringSize = ringSize * 3 / 4;
+      if (ringSize < OPUS_RING_MIN_SIZE) {
+        ringSize = OPUS_RING_MIN_SIZE;
       }
+      ESP_LOGW(TAG, "out of memory, trying an opus ring buffer of %u bytes",
+               ringSize);
+    }
 
-      // now parse the data
-      netbuf_first(firstNetBuf);
-      do {
-        currentPos = 0;
-
-        rc1 = netbuf_data(firstNetBuf, (void **)&start, &len);
-        if (rc1 == ERR_OK) {
-          // ESP_LOGI (TAG, "netconn rx,"
-          // "data len: %d, %d", len, netbuf_len(firstNetBuf) -
-          // currentPos);
-        } else {
-          ESP_LOGE(TAG, "netconn rx, couldn't get data");
-
-          continue;
-        }
-
-        while (len > 0) {
-          rc1 = ERR_OK;  // probably not necessary
-
-          switch (state) {
-            // decode base message
-            case BASE_MESSAGE_STATE: {
-              switch (internalState) {
-                case 0:
-                  base_message_rx.type = *start & 0xFF;
-                  internalState++;
-                  break;
-
-                case 1:
-                  base_message_rx.type |= (*start & 0xFF) << 8;
-                  internalState++;
-                  break;
-
-                case 2:
-                  base_message_rx.id = *start & 0xFF;
-                  internalState++;
-                  break;
-
-                case 3:
-                  base_message_rx.id |= (*start & 0xFF) << 8;
-                  internalState++;
-                  break;
-
-                case 4:
-                  base_message_rx.refersTo = *start & 0xFF;
-                  internalState++;
-                  break;
-
-                case 5:
-                  base_message_rx.refersTo |= (*start & 0xFF) << 8;
-                  internalState++;
-                  break;
-
-                case 6:
-                  base_message_rx.sent.sec = *start & 0xFF;
-                  internalState++;
-                  break;
-
-                case 7:
-                  base_message_rx.sent.sec |= (*start & 0xFF) << 8;
-                  internalState++;
-                  break;
-
-                case 8:
-                  base_message_rx.sent.sec |= (*start & 0xFF) << 16;
-                  internalState++;
-                  break;
-
-                case 9:
-                  base_message_rx.sent.sec |= (*start & 0xFF) << 24;
-                  internalState++;
-                  break;
-
-                case 10:
-                  base_message_rx.sent.usec = *start & 0xFF;
-                  internalState++;
-                  break;
-
-                case 11:
-                  base_message_rx.sent.usec |= (*start & 0xFF) << 8;
-                  internalState++;
-                  break;
-
-                case 12:
-                  base_message_rx.sent.usec |= (*start & 0xFF) << 16;
-                  internalState++;
-                  break;
-
-                case 13:
-                  base_message_rx.sent.usec |= (*start & 0xFF) << 24;
-                  internalState++;
-                  break;
-
-                case 14:
-                  base_message_rx.received.sec = *start & 0xFF;
-                  internalState++;
-                  break;
-
-                case 15:
-                  base_message_rx.received.sec |= (*start & 0xFF) << 8;
-                  internalState++;
-                  break;
-
-                case 16:
-                  base_message_rx.received.sec |= (*start & 0xFF) << 16;
-                  internalState++;
-                  break;
-
-                case 17:
-                  base_message_rx.received.sec |= (*start & 0xFF) << 24;
-                  internalState++;
-                  break;
-
-                case 18:
-                  base_message_rx.received.usec = *start & 0xFF;
-                  internalState++;
-                  break;
-
-                case 19:
-                  base_message_rx.received.usec |= (*start & 0xFF) << 8;
-                  internalState++;
-                  break;
-
-                case 20:
-                  base_message_rx.received.usec |= (*start & 0xFF) << 16;
-                  internalState++;
-                  break;
-
-                case 21:
-                  base_message_rx.received.usec |= (*start & 0xFF) << 24;
-                  internalState++;
-                  break;
-
-                case 22:
-                  base_message_rx.size = *start & 0xFF;
-                  internalState++;
-                  break;
-
-                case 23:
-                  base_message_rx.size |= (*start & 0xFF) << 8;
-                  internalState++;
-                  break;
-
-                case 24:
-                  base_message_rx.size |= (*start & 0xFF) << 16;
-                  internalState++;
-                  break;
-
-                case 25:
-                  base_message_rx.size |= (*start & 0xFF) << 24;
-                  internalState = 0;
-
-                  now = esp_timer_get_time();
-
-                  base_message_rx.received.sec = now / 1000000;
-                  base_message_rx.received.usec =
-                      now - base_message_rx.received.sec * 1000000;
-
-                  typedMsgCurrentPos = 0;
-
-                  //                   ESP_LOGI(TAG,"BM type %d ts %d.%d",
-                  //                   base_message_rx.type,
-                  //                   base_message_rx.received.sec,
-                  //                   base_message_rx.received.usec);
-                  //                  								ESP_LOGI(TAG,"%d
-                  //                  %d.%d", base_message_rx.type,
-                  //                   base_message_rx.received.sec,
-                  //                   base_message_rx.received.usec);
-
-                  state = TYPED_MESSAGE_STATE;
-                  break;
-              }
-
-              currentPos++;
-              len--;
-              start++;
-
-              break;
-            }
-
-            // decode typed message
-            case TYPED_MESSAGE_STATE: {
-              switch (base_message_rx.type) {
-                case SNAPCAST_MESSAGE_WIRE_CHUNK: {
-                  switch (internalState) {
-                    case 0: {
-                      wire_chnk.timestamp.sec = *start & 0xFF;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      break;
-                    }
-
-                    case 1: {
-                      wire_chnk.timestamp.sec |= (*start & 0xFF) << 8;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      break;
-                    }
-
-                    case 2: {
-                      wire_chnk.timestamp.sec |= (*start & 0xFF) << 16;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      break;
-                    }
-
-                    case 3: {
-                      wire_chnk.timestamp.sec |= (*start & 0xFF) << 24;
-
-                      // ESP_LOGI(TAG,
-                      // "wire chunk time sec: %d",
-                      // wire_chnk.timestamp.sec);
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      break;
-                    }
-
-                    case 4: {
-                      wire_chnk.timestamp.usec = (*start & 0xFF);
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      break;
-                    }
-
-                    case 5: {
-                      wire_chnk.timestamp.usec |= (*start & 0xFF) << 8;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      break;
-                    }
-
-                    case 6: {
-                      wire_chnk.timestamp.usec |= (*start & 0xFF) << 16;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      break;
-                    }
-
-                    case 7: {
-                      wire_chnk.timestamp.usec |= (*start & 0xFF) << 24;
-
-                      // ESP_LOGI(TAG,
-                      // "wire chunk time usec: %d",
-                      // wire_chnk.timestamp.usec);
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      break;
-                    }
+    if (opusRingBuf == NULL) {
+      ESP_LOGE(TAG, "Failed to create opus ring buffer");
+      return -1;
+    }
 
-                    case 8: {
-                      wire_chnk.size = (*start & 0xFF);
+    ESP_LOGI(TAG, "opus ring buffer %u bytes", ringSize);
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
+    uint16_t channels;
+    uint32_t rate;
+    uint16_t bits;
 
-                      internalState++;
+    memcpy(&rate, tmp + 4, sizeof(rate));
+    memcpy(&bits, tmp + 8, sizeof(bits));
+    memcpy(&channels, tmp + 10, sizeof(channels));
 
-                      break;
-                    }
+    scSet.codec = codec;
+    scSet.bits = bits;
+    scSet.ch = channels;
+    scSet.sr = rate;
 
-                    case 9: {
-                      wire_chnk.size |= (*start & 0xFF) << 8;
+    ESP_LOGI(TAG, "Opus sample format: %d:%d:%d\n", rate, bits, channels);
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
+    int error = 0;
 
-                      internalState++;
+    // decoder state and scratch output are set up once per stream, nothing
+    // is allocated per packet
+    opusDecoder = (OpusDecoder *)heap_caps_malloc(
+        opus_decoder_get_size(scSet.ch), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (opusDecoder == NULL) {
+      ESP_LOGI(TAG, "Failed to allocate opus decoder");
+      return -1;
+    }
 
-                      break;
-                    }
+    error = opus_decoder_init(opusDecoder, scSet.sr, scSet.ch);
+    if (error != OPUS_OK) {
+      ESP_LOGI(TAG, "Failed to init opus coder");
+      heap_caps_free(opusDecoder);
+      opusDecoder = NULL;
+      return -1;
+    }
 
-                    case 10: {
-                      wire_chnk.size |= (*start & 0xFF) << 16;
+    opusScratchSize =
+        pcm_pack_bytes(scSet.sr * OPUS_SCRATCH_MS / 1000, scSet.ch, 16);
+    opusScratch = (opus_int16 *)heap_caps_malloc(
+        opusScratchSize, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (opusScratch == NULL) {
+      // chunks in IRAM are dropped
+      opusScratchSize = 0;
+    }
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
+    ESP_LOGI(TAG, "Initialized opus Decoder: %d", error);
 
-                      internalState++;
+    if (dec_task_handle == NULL) {
+      xTaskCreatePinnedToCore(&opus_decoder_task, "opus_task", 8 * 1024,
+                              &scSet, OPUS_TASK_PRIORITY, &dec_task_handle,
+                              OPUS_TASK_CORE_ID);
+    }
+  } else if (codec == FLAC) {
+    const uint8_t *streamInfo = (const uint8_t *)tmp;
+    flacChunkHeader_t header;
+    size_t ringSize;
+
+    // STREAMINFO follows "fLaC" and the metadata block header, needed now
+    // to size the ring buffer
+    if ((typedMsgLen < 22) || (memcmp(tmp, "fLaC", 4) != 0)) {
+      ESP_LOGE(TAG, "no STREAMINFO in flac codec header");
+      return -1;
+    }
 
-                      break;
-                    }
+    scSet.codec = codec;
+    scSet.sr = ((uint32_t)streamInfo[18] << 12) |
+               ((uint32_t)streamInfo[19] << 4) | (streamInfo[20] >> 4);
+    scSet.ch = ((streamInfo[20] >> 1) & 0x07) + 1;
+    scSet.bits = (((streamInfo[20] & 0x01) << 4) | (streamInfo[21] >> 4)) + 1;
+
+    flacPack =
+        pcm_pack_select(scSet.bits, scSet.ch, pcm_pack_slot_bits(scSet.bits));
+    if (flacPack == NULL) {
+      ESP_LOGE(TAG, "unsupported flac sampleformat %d:%d:%d", scSet.sr,
+               scSet.bits, scSet.ch);
+      return -1;
+    }
 
-                    case 11: {
-                      wire_chnk.size |= (*start & 0xFF) << 24;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      //                      ESP_LOGI(TAG,
-                      //                      "chunk with size: %d, at time"
-                      //                      " %d.%d", wire_chnk.size,
-                      //                      wire_chnk.timestamp.sec,
-                      //                      wire_chnk.timestamp.usec);
-
-                      break;
-                    }
-
-                    case 12: {
-                      size_t tmp;
-
-                      if ((base_message_rx.size - typedMsgCurrentPos) <= len) {
-                        tmp = base_message_rx.size - typedMsgCurrentPos;
-                      } else {
-                        tmp = len;
-                      }
-
-                      //                      static double lastChunkTimestamp =
-                      //                      0; double timestamp =
-                      //                      ((double)wire_chnk.timestamp.sec *
-                      //                      1000000.0 +
-                      //                      (double)wire_chnk.timestamp.usec)
-                      //                      / 1000.0;
-                      //
-                      //                      ESP_LOGI(TAG, "duration %lfms,
-                      //                      length %d", timestamp -
-                      //                      lastChunkTimestamp, tmp);
-                      //
-                      //                      lastChunkTimestamp = timestamp;
-
-                      if (received_header == true) {
-                        switch (codec) {
-                          case OPUS: {
-                            if (opusData == NULL) {
-                              // TODO: insert some break condition if we wait
-                              // too long
-                              while ((opusData = (uint8_t *)malloc(
-                                          wire_chnk.size)) == NULL) {
-                                ESP_LOGE(TAG, "couldn't memory for opusData");
-
-                                vTaskDelay(pdMS_TO_TICKS(1));
-                              }
-
-                              payloadOffset = 0;
-                            }
-
-                            memcpy(&opusData[payloadOffset], start, tmp);
-                            payloadOffset += tmp;
-
-                            //                            ESP_LOGE(TAG,"payloadOffset
-                            //                            %d, wire_chnk.size
-                            //                            %d", payloadOffset,
-                            //                            wire_chnk.size);
-
-                            if (payloadOffset >= wire_chnk.size) {
-                              pDecData = NULL;
-                              while (!pDecData) {
-                                pDecData = (decoderData_t *)malloc(
-                                    sizeof(decoderData_t));
-                                if (!pDecData) {
-                                  vTaskDelay(pdMS_TO_TICKS(1));
-                                }
-                              }
-
-                              // store timestamp for
-                              // later use
-                              pDecData->timestamp = wire_chnk.timestamp;
-                              pDecData->inData = opusData;
-                              pDecData->bytes = wire_chnk.size;
-                              pDecData->outData = NULL;
-                              pDecData->type = SNAPCAST_MESSAGE_WIRE_CHUNK;
-
-                              // send data to separate task which will handle
-                              // this
-                              xQueueSend(decoderTaskQHdl, &pDecData,
-                                         portMAX_DELAY);
-
-                              opusData = NULL;
-                              pDecData = NULL;
-                            }
-
-                            break;
-                          }
-
-                          case FLAC: {
-#if TEST_DECODER_TASK
-                            pDecData = NULL;
-                            while (!pDecData) {
-                              pDecData = (decoderData_t *)malloc(
-                                  sizeof(decoderData_t));
-                              if (!pDecData) {
-                                vTaskDelay(pdMS_TO_TICKS(1));
-                              }
-                            }
-
-                            pDecData->bytes = tmp;
-
-                            // store timestamp for
-                            // later use
-                            pDecData->timestamp = wire_chnk.timestamp;
-                            pDecData->inData = NULL;
-
-                            // while ((!pFlacData->inData) && (mallocCnt < 100))
-                            // {
-                            while (!pDecData->inData) {
-                              pDecData->inData =
-                                  (uint8_t *)malloc(pDecData->bytes);
-                              if (!pDecData->inData) {
-                                vTaskDelay(pdMS_TO_TICKS(1));
-                              }
-                            }
-
-                            if (pDecData->inData) {
-                              memcpy(pDecData->inData, start, tmp);
-                              pDecData->outData = NULL;
-                              pDecData->type = SNAPCAST_MESSAGE_WIRE_CHUNK;
-
-                              // send data to separate task which will handle
-                              // this
-                              xQueueSend(decoderTaskQHdl, &pDecData,
-                                         portMAX_DELAY);
-                            }
-#else
-                            flacData.bytes = tmp;
-                            flacData.timestamp =
-                                wire_chnk.timestamp;  // store timestamp for
-                                                      // later use
-                            flacData.inData = start;
-                            pDecData = &flacData;
-
-                            startTime = esp_timer_get_time();
-
-                            xSemaphoreTake(decoderReadSemaphore, portMAX_DELAY);
-
-                            // send data to flac decoder
-                            xQueueSend(decoderReadQHdl, &pDecData,
-                                       portMAX_DELAY);
-                            // and wait until data was
-                            // processed
-                            xSemaphoreTake(decoderReadSemaphore, portMAX_DELAY);
-                            // need to release mutex
-                            // afterwards for next round
-                            xSemaphoreGive(decoderReadSemaphore);
-
-#if 0  // enable heap memory analyzing
-                            {
-                              static uint32_t cnt = 0;
-                              if (++cnt % 8 == 0) {
-                                ESP_LOGI(
-                                    TAG, "8bit %d, block %d, 32 bit %d, block %d, waiting %d",
-                                    heap_caps_get_free_size(MALLOC_CAP_8BIT),
-                                    heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
-                                    heap_caps_get_free_size(MALLOC_CAP_32BIT |
-                                    MALLOC_CAP_EXEC),
-                                    heap_caps_get_largest_free_block(MALLOC_CAP_32BIT
-                                    | MALLOC_CAP_EXEC), pcm_chunk_queue_msg_waiting());
-                              }
-                            }
-#endif
+#if CONFIG_USE_DSP_PROCESSOR
+    if (scSet.ch != 2) {
+      ESP_LOGW(TAG, "dsp flows need stereo, %d channels play unprocessed",
+               scSet.ch);
+    }
 #endif
 
-                            break;
-                          }
-
-                          case PCM: {
-                            size_t _tmp = tmp;
-
-                            offset = 0;
-
-                            if (pcmData == NULL) {
-                              if (allocate_pcm_chunk_memory(
-                                      &pcmData, wire_chnk.size) < 0) {
-                                pcmData = NULL;
-                              }
-
-                              tmpData = 0;
-                              remainderSize = 0;
-                              payloadDataShift = 3;
-                              payloadOffset = 0;
-                            }
-
-                            while (_tmp--) {
-                              tmpData |= ((uint32_t)start[offset++]
-                                          << (8 * payloadDataShift));
-
-                              payloadDataShift--;
-                              if (payloadDataShift < 0) {
-                                payloadDataShift = 3;
-
-                                if ((pcmData) && (pcmData->fragment->payload)) {
-                                  volatile uint32_t *sample;
-                                  uint8_t dummy1;
-                                  uint32_t dummy2 = 0;
-
-                                  // TODO: find a more
-                                  // clever way to do this,
-                                  // best would be to
-                                  // actually store it the
-                                  // right way in the first
-                                  // place
-                                  dummy1 = tmpData >> 24;
-                                  dummy2 |= (uint32_t)dummy1 << 16;
-                                  dummy1 = tmpData >> 16;
-                                  dummy2 |= (uint32_t)dummy1 << 24;
-                                  dummy1 = tmpData >> 8;
-                                  dummy2 |= (uint32_t)dummy1 << 0;
-                                  dummy1 = tmpData >> 0;
-                                  dummy2 |= (uint32_t)dummy1 << 8;
-                                  tmpData = dummy2;
-
-                                  sample = (volatile uint32_t *)(&(
-                                      pcmData->fragment
-                                          ->payload[payloadOffset]));
-                                  *sample = (volatile uint32_t)tmpData;
-
-                                  payloadOffset += 4;
-                                }
-
-                                tmpData = 0;
-                              }
-                            }
-
-                            break;
-                          }
-
-                          default: {
-                            ESP_LOGE(TAG, "Decoder (1) not supported");
-
-                            return;
-
-                            break;
-                          }
-                        }
-                      }
-
-                      typedMsgCurrentPos += tmp;
-                      start += tmp;
-                      currentPos += tmp;
-                      len -= tmp;
-
-                      if (typedMsgCurrentPos >= base_message_rx.size) {
-                        if (received_header == true) {
-                          switch (codec) {
-                            case OPUS: {
-                              // nothing to do here
-                              break;
-                            }
-
-                            case FLAC: {
-#if TEST_DECODER_TASK
-                              pDecData = NULL;  // send NULL so we know to wait
-                                                // for decoded data in task
-
-                              // ESP_LOGE(TAG, "%s: flacTaskQHdl start
-                              // wireChnk", __func__);
-                              xQueueSend(decoderTaskQHdl, &pDecData,
-                                         portMAX_DELAY);
-                              // ESP_LOGE(TAG, "%s: flacTaskQHdl stop wireChnk",
-                              // __func__);
+#if CONFIG_SNAPCLIENT_COMPRESSED_BUFFER
+    // the server buffer at the expected compression ratio
+    ringSize = (uint64_t)((scSet.buf_ms > 0) ? scSet.buf_ms : 1000) +
+               FLAC_RING_BUFFER_MARGIN_MS;
+    ringSize = ringSize * scSet.sr * scSet.ch * (scSet.bits / 8) / 1000 *
+               CONFIG_SNAPCLIENT_COMPRESSED_BUFFER_FLAC_PERCENT / 100;
 #else
-                              xSemaphoreGive(decoderWriteSemaphore);
-                              // and wait until it is done
-                              xQueueReceive(decoderWriteQHdl, &pDecData,
-                                            portMAX_DELAY);
-
-                              if (pDecData->outData != NULL) {
-                                pcmData = pDecData->outData;
-                                pcmData->timestamp = wire_chnk.timestamp;
-
-                                size_t decodedSize =
-                                    pcmData->totalSize;  // pFlacData->bytes;
-
-                                //                                ESP_LOGE(TAG,
-                                //                                "decoded size:
-                                //                                %d",
-                                //                                decodedSize);
-
-                                scSet.chkInFrames =
-                                    decodedSize / ((size_t)scSet.ch *
-                                                   (size_t)(scSet.bits / 8));
-                                if (player_send_snapcast_setting(&scSet) !=
-                                    pdPASS) {
-                                  ESP_LOGE(TAG,
-                                           "Failed to "
-                                           "notify "
-                                           "sync task "
-                                           "about "
-                                           "codec. Did you "
-                                           "init player?");
-
-                                  return;
-                                }
-
-                                endTime = esp_timer_get_time();
-
-#if CONFIG_USE_DSP_PROCESSOR
-                                if ((pcmData) && (pcmData->fragment->payload)) {
-                                  dsp_processor_worker(
-                                      pcmData->fragment->payload,
-                                      pcmData->fragment->size, scSet.sr);
-                                }
-
+    ringSize = FLAC_RING_BUFFER_SIZE;
 #endif
 
-                                insert_pcm_chunk(pcmData);
-
-                                // ESP_LOGE(TAG, "duration = %lld", endTime -
-                                // startTime);
+    // a shorter buffer is better than none, the player resyncs if it runs
+    // short
+    while (((flacRingBuf = xRingbufferCreate(
+                 ringSize, RINGBUF_TYPE_BYTEBUF)) == NULL) &&
+           (ringSize > FLAC_RING_BUFFER_MIN_SIZE)) {
+      ringSize = ringSize * 3 / 4;
+      ESP_LOGW(TAG, "out of memory, trying a flac ring buffer of %u bytes",
+               ringSize);
+    }
 
-                                pcmData = NULL;
-                              }
-#endif
+    if (flacRingBuf == NULL) {
+      ESP_LOGE(TAG, "Failed to create flac ring buffer");
+      return -1;
+    }
 
-                              break;
-                            }
+    ESP_LOGI(TAG, "flac ring buffer %u bytes", ringSize);
 
-                            case PCM: {
-                              size_t decodedSize = wire_chnk.size;
+    if (t_flac_decoder_task == NULL) {
+      xTaskCreatePinnedToCore(&flac_decoder_task, "flac_decoder_task",
+                              4 * 1024, &scSet, FLAC_DECODER_TASK_PRIORITY,
+                              &t_flac_decoder_task, FLAC_DECODER_TASK_CORE_ID);
+    }
 
-                              //                              ESP_LOGW(TAG, "got
-                              //                              PCM chunk,
-                              //                              typedMsgCurrentPos
-                              //                              %d",
-                              //                              typedMsgCurrentPos);
+    // codec header goes through the decoder like any chunk
+    memset(&header, 0, sizeof(header));
+    header.received = esp_timer_get_time();
+    header.bytes = typedMsgLen;
+    flac_ring_send(&header, sizeof(header));
+    flac_ring_send(tmp, typedMsgLen);
+  } else if (codec == PCM) {
+    uint16_t channels;
+    uint32_t rate;
+    uint16_t bits;
+
+    memcpy(&channels, tmp + 22, sizeof(channels));
+    memcpy(&rate, tmp + 24, sizeof(rate));
+    memcpy(&bits, tmp + 34, sizeof(bits));
+
+    scSet.codec = codec;
+    scSet.bits = bits;
+    scSet.ch = channels;
+    scSet.sr = rate;
+
+    ESP_LOGI(TAG, "pcm sampleformat: %d:%d:%d", scSet.sr, scSet.bits,
+             scSet.ch);
+  }
 
-                              if (pcmData) {
-                                pcmData->timestamp = wire_chnk.timestamp;
-                              }
+  // ESP_LOGI(TAG, "done codec header msg");
 
-                              scSet.chkInFrames =
-                                  decodedSize /
-                                  ((size_t)scSet.ch * (size_t)(scSet.bits / 8));
+  received_header = true;
+  esp_timer_stop(timeSyncMessageTimer);
+  if (!esp_timer_is_active(timeSyncMessageTimer)) {
+    esp_timer_start_periodic(timeSyncMessageTimer, timeout);
+  }
 
-                              if (player_send_snapcast_setting(&scSet) !=
-                                  pdPASS) {
-                                ESP_LOGE(TAG,
-                                         "Failed to notify "
-                                         "sync task about "
-                                         "codec. Did you "
-                                         "init player?");
+  return 0;
+}
 
-                                return;
-                              }
+/**
+ *
+ */
+static int server_settings_cb(void *arg,
+                              const server_settings_message_t *msg) {
+  (void)arg;
 
-#if CONFIG_USE_DSP_PROCESSOR
-                              if ((pcmData) && (pcmData->fragment->payload)) {
-                                dsp_processor_worker(pcmData->fragment->payload,
-                                                     pcmData->fragment->size,
-                                                     scSet.sr);
-                              }
+  // Volume setting using ADF HAL
+  // abstraction
+  if (scSet.muted != msg->muted) {
+#if SNAPCAST_USE_SOFT_VOL
+    if (msg->muted) {
+      dsp_processor_set_volome(0.0);
+    } else {
+      dsp_processor_set_volome((double)msg->volume / 100);
+    }
 #endif
+    audio_hal_set_mute(board_handle->audio_hal, msg->muted);
+  }
 
-                              if (pcmData) {
-                                insert_pcm_chunk(pcmData);
-                              }
-
-                              pcmData = NULL;
-
-                              break;
-                            }
+  if (scSet.volume != msg->volume) {
+#if SNAPCAST_USE_SOFT_VOL
+    if (!msg->muted) {
+      dsp_processor_set_volome((double)msg->volume / 100);
+    }
+#else
+    audio_hal_set_volume(board_handle->audio_hal, msg->volume);
+#endif
+  }
 
-                            default: {
-                              ESP_LOGE(TAG,
-                                       "Decoder (2) not "
-                                       "supported");
+  scSet.cDacLat_ms = msg->latency;
+  scSet.buf_ms = msg->buffer_ms;
+  scSet.muted = msg->muted;
+  scSet.volume = msg->volume;
 
-                              return;
+  if (player_send_snapcast_setting(&scSet) != pdPASS) {
+    ESP_LOGE(TAG,
+             "Failed to notify sync task. "
+             "Did you init player?");
 
-                              break;
-                            }
-                          }
-                        }
+    return -1;
+  }
 
-                        state = BASE_MESSAGE_STATE;
-                        internalState = 0;
+  return 0;
+}
 
-                        typedMsgCurrentPos = 0;
-                      }
+/**
+ *
+ */
+static int wire_chunk_cb(void *arg, const snapcast_frame_t *frame) {
+  (void)arg;
 
-                      break;
-                    }
+  if ((received_header == false) || (frame->total == 0)) {
+    return 0;
+  }
 
-                    default: {
-                      ESP_LOGE(TAG,
-                               "wire chunk decoder "
-                               "shouldn't get here");
+  if (frame->event == SNAPCAST_FRAMER_MESSAGE) {
+    chunkTimestamp = frame->wire_chunk.timestamp;
 
-                      break;
-                    }
-                  }
+    CHUNK_TRACE(CHUNK_TRACE_RECEIVE, chunkTimestamp, frame->total);
 
-                  break;
-                }
+    if (codec == PCM) {
+      if (allocate_pcm_chunk_memory(&pcmData, frame->total) < 0) {
+        pcmData = NULL;
+      }
+    } else if (codec == FLAC) {
+      flacChunkHeader_t header;
+
+      header.timestamp = chunkTimestamp;
+      header.received = esp_timer_get_time();
+      header.bytes = frame->total;
+      flac_ring_send(&header, sizeof(header));
+    } else if (codec == OPUS) {
+      size_t itemSize = sizeof(decoderData_t) + frame->total;
+
+      // header and packet in one item, waits for the decoder like the flac
+      // ring buffer does
+      opusPacket = NULL;
+      if (itemSize > xRingbufferGetMaxItemSize(opusRingBuf)) {
+        ESP_LOGE(TAG, "opus packet of %u bytes doesn't fit ring buffer",
+                 frame->total);
+      } else {
+        while (xRingbufferSendAcquire(opusRingBuf, (void **)&opusPacket,
+                                      itemSize, portMAX_DELAY) != pdTRUE) {
+        }
 
-                case SNAPCAST_MESSAGE_CODEC_HEADER: {
-                  switch (internalState) {
-                    case 0: {
-                      typedMsgLen = *start & 0xFF;
+        opusPacket->type = SNAPCAST_MESSAGE_WIRE_CHUNK;
+        opusPacket->inData = (uint8_t *)(opusPacket + 1);
+        opusPacket->outData = NULL;
+        opusPacket->bytes = 0;
+      }
+    }
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
+    return 0;
+  }
 
-                      internalState++;
+  switch (codec) {
+    case OPUS: {
+      if ((opusPacket) && (frame->offset + frame->len <= frame->total)) {
+        memcpy(&opusPacket->inData[frame->offset], frame->data, frame->len);
+      }
 
-                      break;
-                    }
+      break;
+    }
 
-                    case 1: {
-                      typedMsgLen |= (*start & 0xFF) << 8;
+    case FLAC: {
+      // straight into the decoder's ring buffer
+      flac_ring_send(frame->data, frame->len);
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
+      break;
+    }
 
-                      internalState++;
+    case PCM: {
+      if ((pcmData) && (pcmData->fragment->payload) &&
+          (frame->offset + frame->len <= pcmData->fragment->size)) {
+        pcm_copy_swap_channels((uint8_t *)pcmData->fragment->payload,
+                               (const uint8_t *)frame->data, frame->offset,
+                               frame->len);
+      }
 
-                      break;
-                    }
+      break;
+    }
 
-                    case 2: {
-                      typedMsgLen |= (*start & 0xFF) << 16;
+    default: {
+      ESP_LOGE(TAG, "Decoder (1) not supported");
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
+      return -1;
+    }
+  }
 
-                      internalState++;
+  if (frame->complete == false) {
+    return 0;
+  }
 
-                      break;
-                    }
+  // how early chunks are here, for the recommended buffer
+  player_chunk_received((int64_t)chunkTimestamp.sec * 1000000LL +
+                        (int64_t)chunkTimestamp.usec);
 
-                    case 3: {
-                      typedMsgLen |= (*start & 0xFF) << 24;
+  switch (codec) {
+    case OPUS: {
+      if (opusPacket) {
+        // store timestamp for
+        // later use
+        opusPacket->timestamp = chunkTimestamp;
+        opusPacket->bytes = frame->total;
 
-                      tmp = malloc(typedMsgLen + 1);  // allocate memory for
-                                                      // codec string
-                      if (tmp == NULL) {
-                        ESP_LOGE(TAG,
-                                 "couldn't get memory "
-                                 "for codec string");
+        // hand it to the decoder task
+        xRingbufferSendComplete(opusRingBuf, opusPacket);
 
-                        return;
-                      }
+        opusPacket = NULL;
+      }
 
-                      offset = 0;
-                      // ESP_LOGI(TAG,
-                      // "codec header string is %d long",
-                      // typedMsgLen);
+      break;
+    }
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
+    case FLAC: {
+      break;
+    }
 
-                      internalState++;
+    case PCM: {
+      size_t decodedSize = frame->total;
 
-                      break;
-                    }
+      if (pcmData) {
+        pcmData->timestamp = chunkTimestamp;
+      }
 
-                    case 4: {
-                      if (len >= typedMsgLen) {
-                        memcpy(&tmp[offset], start, typedMsgLen);
+      // nothing to decode, complete is decoded
+      CHUNK_TRACE(CHUNK_TRACE_DECODED, chunkTimestamp, decodedSize);
 
-                        offset += typedMsgLen;
+      scSet.chkInFrames =
+          decodedSize / ((size_t)scSet.ch * (size_t)(scSet.bits / 8));
 
-                        typedMsgCurrentPos += typedMsgLen;
-                        start += typedMsgLen;
-                        currentPos += typedMsgLen;
-                        len -= typedMsgLen;
-                      } else {
-                        memcpy(&tmp[offset], start, typedMsgLen);
+      if (player_send_snapcast_setting(&scSet) != pdPASS) {
+        ESP_LOGE(TAG,
+                 "Failed to notify "
+                 "sync task about "
+                 "codec. Did you "
+                 "init player?");
 
-                        offset += len;
+        return -1;
+      }
 
-                        typedMsgCurrentPos += len;
-                        start += len;
-                        currentPos += len;
-                        len -= len;
-                      }
+#if CONFIG_USE_DSP_PROCESSOR
+      if ((pcmData) && (pcmData->fragment->payload)) {
+        dsp_processor_worker(pcmData->fragment->payload,
+                             dsp_aux_payload(pcmData), pcmData->fragment->size,
+                             scSet.sr, 16);
 
-                      if (offset == typedMsgLen) {
-                        // NULL terminate string
-                        tmp[typedMsgLen] = 0;
+        CHUNK_TRACE(CHUNK_TRACE_DSP, pcmData->timestamp, 0);
+      }
+#endif
 
-                        // ESP_LOGI (TAG, "got codec string: %s", tmp);
+      if (pcmData) {
+        insert_pcm_chunk(pcmData);
+      }
 
-                        if (strcmp(tmp, "opus") == 0) {
-                          codec = OPUS;
-                        } else if (strcmp(tmp, "flac") == 0) {
-                          codec = FLAC;
-                        } else if (strcmp(tmp, "pcm") == 0) {
-                          codec = PCM;
-                        } else {
-                          codec = NONE;
+      pcmData = NULL;
 
-                          ESP_LOGI(TAG, "Codec : %s not supported", tmp);
-                          ESP_LOGI(TAG,
-                                   "Change encoder codec to "
-                                   "opus, flac or pcm in "
-                                   "/etc/snapserver.conf on "
-                                   "server");
+      break;
+    }
 
-                          return;
-                        }
+    default: {
+      ESP_LOGE(TAG,
+               "Decoder (2) not "
+               "supported");
 
-                        free(tmp);
-                        tmp = NULL;
+      return -1;
+    }
+  }
 
-                        internalState++;
-                      }
+  return 0;
+}
 
-                      break;
-                    }
+/**
+ *
+ */
+static int time_cb(void *arg, int64_t diffToServer, int64_t rtt,
+                   int64_t now) {
+  int64_t diff;
 
-                    case 5: {
-                      typedMsgLen = *start & 0xFF;
+  (void)arg;
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
+  // clear diffBuffer if last update is
+  // older than a minute
+  diff = now - lastTimeSync;
+  if (diff > 60000000LL) {
+    ESP_LOGW(TAG,
+             "Last time sync older "
+             "than a minute. "
+             "Clearing time buffer");
 
-                      internalState++;
+    reset_latency_buffer();
 
-                      break;
-                    }
+    timeout = FAST_SYNC_LATENCY_BUF;
 
-                    case 6: {
-                      typedMsgLen |= (*start & 0xFF) << 8;
+    esp_timer_stop(timeSyncMessageTimer);
+    if (received_header == true) {
+      if (!esp_timer_is_active(timeSyncMessageTimer)) {
+        esp_timer_start_periodic(timeSyncMessageTimer, timeout);
+      }
+    }
+  }
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      break;
-                    }
+  player_latency_insert(diffToServer, rtt, now);
 
-                    case 7: {
-                      typedMsgLen |= (*start & 0xFF) << 16;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      break;
-                    }
-
-                    case 8: {
-                      typedMsgLen |= (*start & 0xFF) << 24;
-
-                      tmp = malloc(typedMsgLen);  // allocate memory for
-                                                  // codec string
-                      if (tmp == NULL) {
-                        ESP_LOGE(TAG,
-                                 "couldn't get memory "
-                                 "for codec string");
-
-                        return;
-                      }
-
-                      offset = 0;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      break;
-                    }
-
-                    case 9: {
-                      if (len >= typedMsgLen) {
-                        memcpy(&tmp[offset], start, typedMsgLen);
-
-                        offset += typedMsgLen;
-
-                        typedMsgCurrentPos += typedMsgLen;
-                        start += typedMsgLen;
-                        currentPos += typedMsgLen;
-                        len -= typedMsgLen;
-                      } else {
-                        memcpy(&tmp[offset], start, typedMsgLen);
-
-                        offset += len;
-
-                        typedMsgCurrentPos += len;
-                        start += len;
-                        currentPos += len;
-                        len -= len;
-                      }
-
-                      if (offset == typedMsgLen) {
-                        // first ensure everything is set up
-                        // correctly and resources are
-                        // available
-                        if (t_flac_decoder_task != NULL) {
-                          vTaskDelete(t_flac_decoder_task);
-                          t_flac_decoder_task = NULL;
-                        }
-
-                        if (dec_task_handle != NULL) {
-                          vTaskDelete(dec_task_handle);
-                          dec_task_handle = NULL;
-                        }
-
-                        if (flacDecoder != NULL) {
-                          FLAC__stream_decoder_finish(flacDecoder);
-                          FLAC__stream_decoder_delete(flacDecoder);
-                          flacDecoder = NULL;
-                        }
-
-                        if (decoderWriteQHdl != NULL) {
-                          vQueueDelete(decoderWriteQHdl);
-                          decoderWriteQHdl = NULL;
-                        }
-
-                        if (decoderReadQHdl != NULL) {
-                          vQueueDelete(decoderReadQHdl);
-                          decoderReadQHdl = NULL;
-                        }
-
-                        if (decoderTaskQHdl != NULL) {
-                          vQueueDelete(decoderTaskQHdl);
-                          decoderTaskQHdl = NULL;
-                        }
-
-                        if (opusDecoder != NULL) {
-                          opus_decoder_destroy(opusDecoder);
-                          opusDecoder = NULL;
-                        }
-
-                        if (codec == OPUS) {
-                          decoderTaskQHdl =
-                              xQueueCreate(8, sizeof(decoderData_t *));
-                          if (decoderTaskQHdl == NULL) {
-                            ESP_LOGE(TAG, "Failed to create decoderTaskQHdl");
-                            return;
-                          }
-
-                          //                          ESP_LOGI(TAG, "OPUS not
-                          //                          implemented yet"); return;
-                          uint16_t channels;
-                          uint32_t rate;
-                          uint16_t bits;
-
-                          memcpy(&rate, tmp + 4, sizeof(rate));
-                          memcpy(&bits, tmp + 8, sizeof(bits));
-                          memcpy(&channels, tmp + 10, sizeof(channels));
-
-                          scSet.codec = codec;
-                          scSet.bits = bits;
-                          scSet.ch = channels;
-                          scSet.sr = rate;
-
-                          ESP_LOGI(TAG, "Opus sample format: %d:%d:%d\n", rate,
-                                   bits, channels);
-
-                          int error = 0;
-
-                          opusDecoder =
-                              opus_decoder_create(scSet.sr, scSet.ch, &error);
-                          if (error != 0) {
-                            ESP_LOGI(TAG, "Failed to init opus coder");
-                            return;
-                          }
-
-                          ESP_LOGI(TAG, "Initialized opus Decoder: %d", error);
-
-                          if (dec_task_handle == NULL) {
-                            xTaskCreatePinnedToCore(
-                                &opus_decoder_task, "opus_task", 8 * 1024,
-                                &scSet, OPUS_TASK_PRIORITY, &dec_task_handle,
-                                OPUS_TASK_CORE_ID);
-                          }
-                        } else if (codec == FLAC) {
-                          decoderTaskQHdl =
-                              xQueueCreate(8, sizeof(decoderData_t *));
-                          if (decoderTaskQHdl == NULL) {
-                            ESP_LOGE(TAG, "Failed to create decoderTaskQHdl");
-                            return;
-                          }
-
-                          decoderReadQHdl =
-                              xQueueCreate(1, sizeof(decoderData_t *));
-                          if (decoderReadQHdl == NULL) {
-                            ESP_LOGE(TAG, "Failed to create flac read queue");
-                            return;
-                          }
-
-                          decoderWriteQHdl =
-                              xQueueCreate(1, sizeof(decoderData_t *));
-                          if (decoderWriteQHdl == NULL) {
-                            ESP_LOGE(TAG, "Failed to create flac write queue");
-                            return;
-                          }
-
-                          if (t_flac_decoder_task == NULL) {
-                            xTaskCreatePinnedToCore(
-                                &flac_decoder_task, "flac_decoder_task",
-                                9 * 256, &scSet, FLAC_DECODER_TASK_PRIORITY,
-                                &t_flac_decoder_task,
-                                FLAC_DECODER_TASK_CORE_ID);
-                          }
-
-#if TEST_DECODER_TASK
-                          if (dec_task_handle == NULL) {
-                            xTaskCreatePinnedToCore(
-                                &flac_task, "flac_task", 9 * 256, &scSet,
-                                FLAC_TASK_PRIORITY, &dec_task_handle,
-                                FLAC_TASK_CORE_ID);
-                          }
-
-                          pDecData =
-                              (decoderData_t *)malloc(sizeof(decoderData_t));
-                          memset(pDecData, 0, sizeof(decoderData_t));
-
-                          pDecData->bytes = typedMsgLen;
-                          pDecData->inData = (uint8_t *)malloc(typedMsgLen);
-                          memcpy(pDecData->inData, tmp, typedMsgLen);
-                          pDecData->outData = NULL;
-                          pDecData->type = SNAPCAST_MESSAGE_CODEC_HEADER;
-
-                          // ESP_LOGE(TAG, "%s: flacTaskQHdl start codec
-                          // header", __func__);
-
-                          // send codec header to flac decoder
-                          xQueueSend(decoderTaskQHdl, &pDecData, portMAX_DELAY);
-
-                          // ESP_LOGE(TAG, "sent codec header");
-
-                          // send NULL so we know to wait
-                          // for decoded data in task
-                          pDecData = NULL;
-                          xQueueSend(decoderTaskQHdl, &pDecData, portMAX_DELAY);
-
-                          // ESP_LOGE(TAG, "%s: flacTaskQHdl done codec header",
-                          // __func__);
+  // ESP_LOGI(TAG, "Current latency:%lld:", diffToServer);
 
-#else
+  // store current time
+  lastTimeSync = now;
 
-                          if (flacData.outData != NULL) {
-                            free(flacData.outData);
-                            flacData.outData = NULL;
-                          }
-
-                          flacData.bytes = typedMsgLen;
-                          flacData.inData = tmp;
-                          pDecData = &flacData;
-
-                          // TODO: find a smarter way for
-                          // this wait for task creation done
-                          while (decoderReadQHdl == NULL) {
-                            vTaskDelay(10);
-                          }
-
-                          xSemaphoreTake(decoderReadSemaphore, portMAX_DELAY);
-
-                          // send data to flac decoder
-                          xQueueSend(decoderReadQHdl, &pDecData, portMAX_DELAY);
-                          // and wait until data was
-                          // processed
-                          xSemaphoreTake(decoderReadSemaphore, portMAX_DELAY);
-                          // need to release mutex afterwards
-                          // for next round
-                          xSemaphoreGive(decoderReadSemaphore);
-                          // wait until it is done
-                          xQueueReceive(decoderWriteQHdl, &pDecData,
-                                        portMAX_DELAY);
-
-                          ESP_LOGI(TAG, "fLaC sampleformat: %d:%d:%d", scSet.sr,
-                                   scSet.bits, scSet.ch);
-#endif
-                        } else if (codec == PCM) {
-                          uint16_t channels;
-                          uint32_t rate;
-                          uint16_t bits;
-
-                          memcpy(&channels, tmp + 22, sizeof(channels));
-                          memcpy(&rate, tmp + 24, sizeof(rate));
-                          memcpy(&bits, tmp + 34, sizeof(bits));
-
-                          scSet.codec = codec;
-                          scSet.bits = bits;
-                          scSet.ch = channels;
-                          scSet.sr = rate;
+  if (received_header == true) {
+    if (!esp_timer_is_active(timeSyncMessageTimer)) {
+      esp_timer_start_periodic(timeSyncMessageTimer, timeout);
+    }
 
-                          ESP_LOGI(TAG, "pcm sampleformat: %d:%d:%d", scSet.sr,
-                                   scSet.bits, scSet.ch);
-                        } else {
-                          ESP_LOGE(TAG,
-                                   "codec header decoder "
-                                   "shouldn't get here after "
-                                   "codec string was detected");
+    bool is_full = false;
+    latency_buffer_full(&is_full, portMAX_DELAY);
+    if ((is_full == true) && (timeout < NORMAL_SYNC_LATENCY_BUF)) {
+      timeout = NORMAL_SYNC_LATENCY_BUF;
 
-                          return;
-                        }
+      ESP_LOGI(TAG, "latency buffer full");
 
-                        free(tmp);
-                        tmp = NULL;
+      if (esp_timer_is_active(timeSyncMessageTimer)) {
+        esp_timer_stop(timeSyncMessageTimer);
+      }
 
-                        // ESP_LOGI(TAG, "done codec header msg");
+      esp_timer_start_periodic(timeSyncMessageTimer, timeout);
+    } else if ((is_full == false) && (timeout > FAST_SYNC_LATENCY_BUF)) {
+      timeout = FAST_SYNC_LATENCY_BUF;
 
-                        state = BASE_MESSAGE_STATE;
-                        internalState = 0;
+      ESP_LOGI(TAG, "latency buffer not full");
 
-                        received_header = true;
-                        esp_timer_stop(timeSyncMessageTimer);
-                        if (!esp_timer_is_active(timeSyncMessageTimer)) {
-                          esp_timer_start_periodic(timeSyncMessageTimer,
-                                                   timeout);
-                        }
-                      }
+      if (esp_timer_is_active(timeSyncMessageTimer)) {
+        esp_timer_stop(timeSyncMessageTimer);
+      }
 
-                      break;
-                    }
+      esp_timer_start_periodic(timeSyncMessageTimer, timeout);
+    }
+  }
 
-                    default: {
-                      ESP_LOGE(TAG,
-                               "codec header decoder "
-                               "shouldn't get here");
+  return 0;
+}
 
-                      break;
-                    }
-                  }
+#if !CONFIG_SNAPCLIENT_CAPTURE_NONE
+/**
+ *
+ */
+static void received_cb(void *arg, const char *data, size_t len, int64_t now) {
+  (void)arg;
 
-                  break;
-                }
+  stream_capture_write(data, len, now);
+}
+#endif
 
-                case SNAPCAST_MESSAGE_SERVER_SETTINGS: {
-                  switch (internalState) {
-                    case 0: {
-                      while ((netbuf_len(firstNetBuf) - currentPos) <
-                             base_message_rx.size) {
-                        ESP_LOGI(TAG, "need more data");
+/**
+ *
+ */
+static void http_get_task(void *pvParameters) {
+  hello_message_t hello_message;
+  char mac_address[18];
+  uint8_t base_mac[6];
+  const snapcast_client_callbacks_t cb = {
+      .arg = NULL,
+      .connected = client_connected_cb,
+      .codec_header = codec_header_cb,
+      .server_settings = server_settings_cb,
+      .wire_chunk = wire_chunk_cb,
+      .time = time_cb,
+      .disconnected = client_disconnected_cb,
+#if !CONFIG_SNAPCLIENT_CAPTURE_NONE
+      .received = received_cb,
+#endif
+  };
 
-                        // we need more data to process
-                        rc1 = netconn_recv(lwipNetconn, &newNetBuf);
-                        if (rc1 != ERR_OK) {
-                          ESP_LOGE(TAG, "rx error for need more data");
+  // create a timer to send time sync messages every x µs
+  esp_timer_create(&tSyncArgs, &timeSyncMessageTimer);
 
-                          if (rc1 == ERR_CONN) {
-                            // netconn_close(lwipNetconn);
-                            // closing later, see first
-                            // netconn_recv() in the loop
-
-                            break;
-                          }
-
-                          if (newNetBuf != NULL) {
-                            netbuf_delete(newNetBuf);
-
-                            newNetBuf = NULL;
-                          }
-
-                          continue;
-                        }
-
-                        netbuf_chain(firstNetBuf, newNetBuf);
-                      }
-
-                      if (rc1 == ERR_OK) {
-                        typedMsgLen = *start & 0xFF;
-
-                        typedMsgCurrentPos++;
-                        start++;
-                        currentPos++;
-                        len--;
-
-                        internalState++;
-                      } else {
-                        ESP_LOGE(TAG, "some error");
-                      }
-
-                      break;
-                    }
-
-                    case 1: {
-                      typedMsgLen |= (*start & 0xFF) << 8;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      break;
-                    }
-
-                    case 2: {
-                      typedMsgLen |= (*start & 0xFF) << 16;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      break;
-                    }
-
-                    case 3: {
-                      typedMsgLen |= (*start & 0xFF) << 24;
-
-                      //                       ESP_LOGI(TAG,
-                      //                       "server settings string is %d
-                      //                       long", typedMsgLen);
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      break;
-                    }
-
-                    case 4: {
-                      // now get some memory for server settings
-                      // string at this point there is still
-                      // plenty of RAM available, so we use
-                      // malloc and netbuf_copy() here
-                      tmp = malloc(typedMsgLen + 1);
-
-                      if (tmp == NULL) {
-                        ESP_LOGE(TAG,
-                                 "couldn't get memory for "
-                                 "server settings string");
-                      } else {
-                        netbuf_copy_partial(firstNetBuf, tmp, typedMsgLen,
-                                            currentPos);
-
-                        tmp[typedMsgLen] = 0;  // NULL terminate string
-
-                        // ESP_LOGI
-                        //(TAG, "got string: %s", tmp);
-
-                        result = server_settings_message_deserialize(
-                            &server_settings_message, tmp);
-                        if (result) {
-                          ESP_LOGE(TAG,
-                                   "Failed to read server "
-                                   "settings: %d",
-                                   result);
-                        } else {
-                          // log mute state, buffer, latency
-                          ESP_LOGI(TAG, "Buffer length:  %d",
-                                   server_settings_message.buffer_ms);
-                          ESP_LOGI(TAG, "Latency:        %d",
-                                   server_settings_message.latency);
-                          ESP_LOGI(TAG, "Mute:           %d",
-                                   server_settings_message.muted);
-                          ESP_LOGI(TAG, "Setting volume: %d",
-                                   server_settings_message.volume);
-                        }
-
-                        // Volume setting using ADF HAL
-                        // abstraction
-                        if (scSet.muted != server_settings_message.muted) {
-#if SNAPCAST_USE_SOFT_VOL
-                            if (server_settings_message.muted) {
-                                dsp_processor_set_volome(0.0);
-                            }
-                            else {
-                                dsp_processor_set_volome(
-                                    (double)server_settings_message.volume / 100);
-                            }
+#if CONFIG_SNAPCLIENT_USE_MDNS
+  ESP_LOGI(TAG, "Enable mdns");
+  mdns_init();
 #endif
-                          audio_hal_set_mute(board_handle->audio_hal,
-                                             server_settings_message.muted);
-                        }
-                                             
-                        if (scSet.volume != server_settings_message.volume) {
-#if SNAPCAST_USE_SOFT_VOL
-                            if (!server_settings_message.muted) {
-                                dsp_processor_set_volome(
-                                (double)server_settings_message.volume / 100);
-                            }
+
+#if SNAPCAST_SERVER_USE_MDNS
+  snapTransport = snapcast_transport_netconn_create(true, NULL, 0);
 #else
-                          audio_hal_set_volume(board_handle->audio_hal,
-                                               server_settings_message.volume);
+  snapTransport = snapcast_transport_netconn_create(
+      false, SNAPCAST_SERVER_HOST, SNAPCAST_SERVER_PORT);
 #endif
-                        }
-
-                        scSet.cDacLat_ms = server_settings_message.latency;
-                        scSet.buf_ms = server_settings_message.buffer_ms;
-                        scSet.muted = server_settings_message.muted;
-                        scSet.volume = server_settings_message.volume;
-
-                        if (player_send_snapcast_setting(&scSet) != pdPASS) {
-                          ESP_LOGE(TAG,
-                                   "Failed to notify sync task. "
-                                   "Did you init player?");
-
-                          return;
-                        }
-
-                        free(tmp);
-                        tmp = NULL;
-                      }
-
-                      internalState++;
-                      // fall through
-                    }
-
-                    case 5: {
-                      size_t tmpSize =
-                          base_message_rx.size - typedMsgCurrentPos;
-
-                      if (len > 0) {
-                        if (tmpSize < len) {
-                          start += tmpSize;
-                          currentPos += tmpSize;  // will be
-                                                  // incremented by 1
-                                                  // later so -1 here
-                          typedMsgCurrentPos += tmpSize;
-                          len -= tmpSize;
-                        } else {
-                          start += len;
-                          currentPos += len;  // will be incremented
-                                              // by 1 later so -1
-                                              // here
-                          typedMsgCurrentPos += len;
-                          len = 0;
-                        }
-                      }
-
-                      if (typedMsgCurrentPos >= base_message_rx.size) {
-                        // ESP_LOGI(TAG,
-                        // "done server settings");
-
-                        state = BASE_MESSAGE_STATE;
-                        internalState = 0;
-
-                        typedMsgCurrentPos = 0;
-                      }
-
-                      break;
-                    }
-
-                    default: {
-                      ESP_LOGE(TAG,
-                               "server settings decoder "
-                               "shouldn't get here");
-
-                      break;
-                    }
-                  }
-
-                  break;
-                }
-
-                case SNAPCAST_MESSAGE_STREAM_TAGS: {
-                  size_t tmpSize = base_message_rx.size - typedMsgCurrentPos;
+  if ((snapTransport == NULL) ||
+      (snapcast_client_init(&snapClient, snapTransport, &cb,
+                            esp_timer_get_time) != 0)) {
+    ESP_LOGE(TAG, "couldn't create snapcast client. STOP");
 
-                  if (tmpSize < len) {
-                    start += tmpSize;
-                    currentPos += tmpSize;
-                    typedMsgCurrentPos += tmpSize;
-                    len -= tmpSize;
-                  } else {
-                    start += len;
-                    currentPos += len;
+    vTaskDelete(NULL);
 
-                    typedMsgCurrentPos += len;
-                    len = 0;
-                  }
-
-                  if (typedMsgCurrentPos >= base_message_rx.size) {
-                    // ESP_LOGI(TAG,
-                    // "done stream tags with length %d %d %d",
-                    // base_message_rx.size, currentPos,
-                    // tmpSize);
-
-                    typedMsgCurrentPos = 0;
-                    // currentPos = 0;
-
-                    state = BASE_MESSAGE_STATE;
-                    internalState = 0;
-                  }
-
-                  break;
-                }
-
-                case SNAPCAST_MESSAGE_TIME: {
-                  switch (internalState) {
-                    case 0: {
-                      time_message_rx.latency.sec = *start;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      break;
-                    }
-
-                    case 1: {
-                      time_message_rx.latency.sec |= (int32_t)*start << 8;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      break;
-                    }
-
-                    case 2: {
-                      time_message_rx.latency.sec |= (int32_t)*start << 16;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      break;
-                    }
-
-                    case 3: {
-                      time_message_rx.latency.sec |= (int32_t)*start << 24;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      break;
-                    }
-
-                    case 4: {
-                      time_message_rx.latency.usec = *start;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      break;
-                    }
-
-                    case 5: {
-                      time_message_rx.latency.usec |= (int32_t)*start << 8;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      break;
-                    }
-
-                    case 6: {
-                      time_message_rx.latency.usec |= (int32_t)*start << 16;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      break;
-                    }
-
-                    case 7: {
-                      time_message_rx.latency.usec |= (int32_t)*start << 24;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      currentPos++;
-                      len--;
-                      if (typedMsgCurrentPos >= base_message_rx.size) {
-                        // ESP_LOGI(TAG, "done time message");
-
-                        typedMsgCurrentPos = 0;
-
-                        state = BASE_MESSAGE_STATE;
-                        internalState = 0;
-
-                        trx =
-                            (int64_t)base_message_rx.received.sec * 1000000LL +
-                            (int64_t)base_message_rx.received.usec;
-                        ttx = (int64_t)base_message_rx.sent.sec * 1000000LL +
-                              (int64_t)base_message_rx.sent.usec;
-                        tdif = trx - ttx;
-                        trx = (int64_t)time_message_rx.latency.sec * 1000000LL +
-                              (int64_t)time_message_rx.latency.usec;
-                        tmpDiffToServer = (trx - tdif) / 2;
-
-                        int64_t diff;
-
-                        // clear diffBuffer if last update is
-                        // older than a minute
-                        diff = now - lastTimeSync;
-                        if (diff > 60000000LL) {
-                          ESP_LOGW(TAG,
-                                   "Last time sync older "
-                                   "than a minute. "
-                                   "Clearing time buffer");
-
-                          reset_latency_buffer();
-
-                          timeout = FAST_SYNC_LATENCY_BUF;
-
-                          esp_timer_stop(timeSyncMessageTimer);
-                          if (received_header == true) {
-                            if (!esp_timer_is_active(timeSyncMessageTimer)) {
-                              esp_timer_start_periodic(timeSyncMessageTimer,
-                                                       timeout);
-                            }
-                          }
-                        }
-
-                        player_latency_insert(tmpDiffToServer);
-
-                        // ESP_LOGI(TAG, "Current latency:%lld:",
-                        // tmpDiffToServer);
-
-                        // store current time
-                        lastTimeSync = now;
-
-                        if (received_header == true) {
-                          if (!esp_timer_is_active(timeSyncMessageTimer)) {
-                            esp_timer_start_periodic(timeSyncMessageTimer,
-                                                     timeout);
-                          }
-
-                          bool is_full = false;
-                          latency_buffer_full(&is_full, portMAX_DELAY);
-                          if ((is_full == true) &&
-                              (timeout < NORMAL_SYNC_LATENCY_BUF)) {
-                            timeout = NORMAL_SYNC_LATENCY_BUF;
-
-                            ESP_LOGI(TAG, "latency buffer full");
-
-                            if (esp_timer_is_active(timeSyncMessageTimer)) {
-                              esp_timer_stop(timeSyncMessageTimer);
-                            }
-
-                            esp_timer_start_periodic(timeSyncMessageTimer,
-                                                     timeout);
-                          }
-                          else if ((is_full == false) &&
-                              (timeout > FAST_SYNC_LATENCY_BUF)){
-                            timeout = FAST_SYNC_LATENCY_BUF;
-
-                            ESP_LOGI(TAG, "latency buffer not full");
-
-                            if (esp_timer_is_active(timeSyncMessageTimer)) {
-                              esp_timer_stop(timeSyncMessageTimer);
-                            }
-
-                            esp_timer_start_periodic(timeSyncMessageTimer,
-                                                     timeout);
-                          }
-                        }
-                      } else {
-                        ESP_LOGE(TAG,
-                                 "error time message, this "
-                                 "shouldn't happen! %d %d",
-                                 typedMsgCurrentPos, base_message_rx.size);
-
-                        typedMsgCurrentPos = 0;
-
-                        state = BASE_MESSAGE_STATE;
-                        internalState = 0;
-                      }
-
-                      break;
-                    }
-
-                    default: {
-                      ESP_LOGE(TAG,
-                               "time message decoder shouldn't "
-                               "get here %d %d %d",
-                               typedMsgCurrentPos, base_message_rx.size,
-                               internalState);
-
-                      break;
-                    }
-                  }
-
-                  break;
-                }
-
-                default: {
-                  typedMsgCurrentPos++;
-                  start++;
-                  currentPos++;
-                  len--;
-
-                  if (typedMsgCurrentPos >= base_message_rx.size) {
-                    ESP_LOGI(TAG, "done unknown typed message %d",
-                             base_message_rx.type);
-
-                    state = BASE_MESSAGE_STATE;
-                    internalState = 0;
-
-                    typedMsgCurrentPos = 0;
-                  }
-
-                  break;
-                }
-              }
-
-              break;
-            }
-
-            default: { break; }
-          }
-
-          if (rc1 != ERR_OK) {
-            break;
-          }
-        }
-      } while (netbuf_next(firstNetBuf) >= 0);
+    return;
+  }
 
-      netbuf_delete(firstNetBuf);
+#if !CONFIG_SNAPCLIENT_CAPTURE_NONE
+  if (stream_capture_init() != ESP_OK) {
+    ESP_LOGE(TAG, "couldn't start stream capture");
+  }
+#endif
 
-      if (rc1 != ERR_OK) {
-        ESP_LOGE(TAG, "Data error, closing netconn");
+  // Get MAC address for WiFi station
+#if CONFIG_SNAPCLIENT_ENABLE_ETHERNET
+  esp_read_mac(base_mac, ESP_MAC_ETH);
+#else
+  esp_read_mac(base_mac, ESP_MAC_WIFI_STA);
+#endif
+  sprintf(mac_address, "%02X:%02X:%02X:%02X:%02X:%02X", base_mac[0],
+          base_mac[1], base_mac[2], base_mac[3], base_mac[4], base_mac[5]);
+
+  // init hello message
+  hello_message.mac = mac_address;
+  hello_message.hostname = SNAPCAST_CLIENT_NAME;
+  hello_message.version = (char *)VERSION_STRING;
+  hello_message.client_name = "libsnapcast";
+  hello_message.os = "esp32";
+  hello_message.arch = "xtensa";
+  hello_message.instance = 1;
+  hello_message.id = mac_address;
+  hello_message.protocol_version = 2;
 
-        netconn_close(lwipNetconn);
+  while (1) {
+    // returns if connection is lost, restart and try to reconnect
+    snapcast_client_run(&snapClient, &hello_message);
 
-        break;
-      }
-    }
+    vTaskDelay(pdMS_TO_TICKS(100));
   }
 }
 
@@ -2816,6 +1538,11 @@ void app_main(void) {
   audio_hal_set_mute(board_handle->audio_hal,
                      true);  // ensure no noise is sent after firmware crash
 
+  metrics_register(&decodeMetric);
+  metrics_register(&heapFreeMetric);
+  metrics_register(&heapLargestMetric);
+  metrics_register(&rssiMetric);
+
   ESP_LOGI(TAG, "init player");
   init_player();
   // setup_ma120();
@@ -0,0 +1,413 @@
+/* Closed loop simulation of the APLL speed control
+
+   Compares the former bang-bang control, +-100ppm whenever the short and
+   mini medians and the last age agree on a direction, with the PI control
+   of sync_ctrl.c setting the APLL multiplier in its smallest steps. Server
+   time comes from snapcast_clock.c over a network with exponential jitter
+   and occasional delay spikes like in clock_sim, the local crystal drifts
+   against the server and every 20ms chunk adds an age sample with some
+   measurement noise. Playback starts off by an initial error.
+
+   Reports the time until the age error, played against estimated server
+   time without measurement noise, stays below CONVERGED_US, rms and largest
+   age error in the second half, hard resyncs and APLL writes per
+   minute. Before that the fixed point multiplier of sync_apll_target() is
+   checked against double precision for the usual sample formats.
+
+   usage: apll_sim [-d drift ppm] [-j jitter us] [-s spike rate] [-m noise
+                   us] [-o initial error us] [-t seconds] [-r seed]
+
+   Returns 1 if the multiplier is off by more than 1/256 step.
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "MedianFilter.h"
+#include "snapcast_clock.h"
+#include "sync_ctrl.h"
+
+// see player.h and player_task()
+#define SHORT_BUFFER_LEN 99
+#define MINI_BUFFER_LEN 19
+#define HARD_RESYNC_THRESHOLD 10000
+#define SHORT_OFFSET 2
+#define MINI_OFFSET 1
+#define BANG_BANG_PPM 100.0f
+
+#define CONVERGED_US 100
+
+#define XTAL_HZ 40000000.0
+#define APLL_MIN_HZ 350000000.0
+#define APLL_MAX_HZ 500000000.0
+
+#define FAST_SYNC_INTERVAL 10000
+#define SYNC_INTERVAL 1000000
+#define CHUNK_US 20000
+#define BASE_DELAY_US 1000
+#define SPIKE_US 50000
+#define SERVER_EPOCH 123456789LL
+
+typedef enum control_type {
+  CONTROL_BANG_BANG = 0,
+  CONTROL_PI,
+} control_type_t;
+
+typedef struct sim_params {
+  double drift;   // server µs per local µs - 1
+  double jitter;  // mean of exponential one way jitter in µs
+  double spikes;  // probability of a delay spike per message
+  double noise;   // largest age measurement error in µs, uniform
+  int64_t offset;
+  int64_t duration;
+  unsigned int seed;
+} sim_params_t;
+
+typedef struct sim_result {
+  int64_t converged;  // -1 if never
+  double syncSum2;
+  int64_t syncMax;
+  uint32_t samples;
+  uint32_t resyncs;
+  uint32_t writes;
+  uint32_t steadyWrites;
+} sim_result_t;
+
+/**
+ *
+ */
+static double rand_exp(double mean) {
+  return -mean * log(1.0 - (rand() + 0.5) / ((double)RAND_MAX + 1.0));
+}
+
+/**
+ *
+ */
+static double rand_uniform(double max) {
+  return max * (2.0 * rand() / RAND_MAX - 1.0);
+}
+
+/**
+ *
+ */
+static int64_t one_way_delay(const sim_params_t *p) {
+  double d = BASE_DELAY_US + rand_exp(p->jitter);
+
+  if ((double)rand() / RAND_MAX < p->spikes) {
+    d += rand_exp(SPIKE_US);
+  }
+
+  return (int64_t)d;
+}
+
+/**
+ *
+ */
+static int64_t server_time(const sim_params_t *p, int64_t local) {
+  return SERVER_EPOCH + local + (int64_t)llround(p->drift * local);
+}
+
+/**
+ * Nominal coefficients for an I2S clock of fi2s Hz, first o_div that puts
+ * the APLL in range, like i2s_apll_calculate_fi2s() to within a step.
+ *
+ * @return 0 on success, -1 if out of range
+ */
+static int apll_nominal(double fi2s, int *sdm0, int *sdm1, int *sdm2,
+                        int *oDiv) {
+  int o;
+
+  for (o = 0; o < 32; o++) {
+    double fout = fi2s * 2 * 2 * (o + 2);
+
+    if ((fout >= APLL_MIN_HZ) && (fout <= APLL_MAX_HZ)) {
+      int32_t m = (int32_t)llround(fout / XTAL_HZ * 65536.0);
+
+      *sdm2 = (m >> 16) - 4;
+      *sdm1 = (m >> 8) & 0xFF;
+      *sdm0 = m & 0xFF;
+      *oDiv = o;
+
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * sync_apll_target() against the multiplier scaled in double precision, must
+ * be within 1/256 step. sync_apll_set_ppm() following a sweep must stay
+ * within the hysteresis and half a step unless clamped to keep sdm2.
+ *
+ * @return number of mismatches
+ */
+static int check_apll(void) {
+  static const uint32_t rates[] = {32000, 44100, 48000, 88200, 96000};
+  static const uint8_t bits[] = {16, 24, 32};
+  const double maxLag = 0.5 + (SYNC_APLL_HYSTERESIS + 1) / 256.0;
+  int errors = 0, checks = 0;
+  double worst = 0.0;
+  uint32_t r, b;
+
+  for (r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+    for (b = 0; b < sizeof(bits) / sizeof(bits[0]); b++) {
+      // see player_setup_i2s()
+      double fi2s = (double)rates[r] * 2 * bits[b] * 8;
+      int sdm0, sdm1, sdm2, oDiv;
+      sync_apll_t apll;
+      int ppm;
+
+      if (apll_nominal(fi2s, &sdm0, &sdm1, &sdm2, &oDiv) < 0) {
+        continue;
+      }
+
+      sync_apll_init(&apll, sdm0, sdm1, sdm2, oDiv);
+
+      for (ppm = -SYNC_APLL_MAX_PPM * 4; ppm <= SYNC_APLL_MAX_PPM * 4;
+           ppm++) {
+        double want = apll.nominal * (1.0 + ppm / 4.0 * 1e-6);
+        double diff = fabs(sync_apll_target(&apll, ppm / 4.0f) / 256.0 - want);
+        int s0, s1, s2, o;
+        double lag;
+
+        sync_apll_set_ppm(&apll, ppm / 4.0f, &s0, &s1, &s2, &o);
+        checks++;
+
+        if (diff > worst) {
+          worst = diff;
+        }
+
+        lag = fabs(((4 + s2) * 65536 + s1 * 256 + s0) - want);
+        if ((want < apll.min) || (want > apll.max)) {
+          lag = 0.0;
+        }
+
+        if ((diff > 1.0 / 256) || (lag > maxLag) || (o != oDiv) ||
+            (s2 != sdm2)) {
+          if (errors++ < 10) {
+            printf("  %u Hz %u bit %.2fppm: %d %d %d %d, want %.3f\n",
+                   rates[r], bits[b], ppm / 4.0, s0, s1, s2, o, want);
+          }
+        }
+      }
+    }
+  }
+
+  printf("apll coefficients: %d checks, worst %.4f steps off, %s\n", checks,
+         worst, errors ? "FAILED" : "passed");
+
+  return errors;
+}
+
+/**
+ *
+ */
+static void simulate(const sim_params_t *p, control_type_t type,
+                     sim_result_t *res) {
+  snapcast_clock_t clock;
+  sMedianFilter_t shortFilter, miniFilter;
+  sMedianNode_t shortNodes[SHORT_BUFFER_LEN], miniNodes[MINI_BUFFER_LEN];
+  sync_ctrl_t ctrl;
+  sync_apll_t apll;
+  int64_t nextSync = 0, nextChunk = 0, ready = 0, start = 0;
+  int64_t played = 0;  // server time of the sample being played
+  int synced = 0;
+  int dir = 0;
+  int sdm0, sdm1, sdm2, oDiv;
+  int64_t t;
+
+  memset(res, 0, sizeof(sim_result_t));
+  res->converged = -1;
+  snapcast_clock_init(&clock);
+  shortFilter.numNodes = SHORT_BUFFER_LEN;
+  shortFilter.medianBuffer = shortNodes;
+  miniFilter.numNodes = MINI_BUFFER_LEN;
+  miniFilter.medianBuffer = miniNodes;
+
+  // 48kHz, 16 bit stereo
+  apll_nominal(48000.0 * 2 * 16 * 8, &sdm0, &sdm1, &sdm2, &oDiv);
+  sync_apll_init(&apll, sdm0, sdm1, sdm2, oDiv);
+  sync_ctrl_init(&ctrl, SYNC_CTRL_TC_S, SYNC_CTRL_TI_S, SYNC_APLL_MAX_PPM);
+
+  // same random numbers for both controls
+  srand(p->seed);
+
+  for (t = 0; t < p->duration; t += 1000) {
+    if (t >= nextSync) {
+      int64_t d1 = one_way_delay(p);
+      int64_t d2 = one_way_delay(p);
+      int64_t serverRx = server_time(p, t + d1);
+      int64_t c2s = serverRx - t;
+      int64_t s2c = (t + d1 + d2) - serverRx;
+
+      snapcast_clock_insert(&clock, t + d1 + d2, (c2s - s2c) / 2, c2s + s2c);
+
+      if ((ready == 0) && snapcast_clock_ready(&clock)) {
+        ready = t + d1 + d2;
+      }
+
+      nextSync = t + (ready ? SYNC_INTERVAL : FAST_SYNC_INTERVAL);
+    }
+
+    if ((ready == 0) || (t < nextChunk)) {
+      continue;
+    }
+
+    nextChunk = t + CHUNK_US;
+
+    {
+      int64_t estServer = t + snapcast_clock_offset(&clock, t);
+      int64_t age, shortMedian, miniMedian, err;
+      float ppm;
+
+      if (synced == 0) {
+        MEDIANFILTER_Init(&shortFilter);
+        MEDIANFILTER_Init(&miniFilter);
+        played = estServer - p->offset;
+        synced = 1;
+        dir = 0;
+        if (start == 0) {
+          start = t;
+        }
+
+        // back to nominal speed like the hard resync in player_task()
+        if (sync_apll_set_ppm(&apll, 0.0f, &sdm0, &sdm1, &sdm2, &oDiv)) {
+          res->writes++;
+        }
+      } else {
+        // playback follows the local crystal, corrected by the APLL
+        played += llround(CHUNK_US * (1.0 + sync_apll_get_ppm(&apll) * 1e-6));
+      }
+
+      age = estServer - played + (int64_t)rand_uniform(p->noise);
+      shortMedian = MEDIANFILTER_Insert(&shortFilter, age);
+      miniMedian = MEDIANFILTER_Insert(&miniFilter, age);
+
+      if (MEDIANFILTER_isFull(&shortFilter, 0) &&
+          (llabs(shortMedian) > HARD_RESYNC_THRESHOLD)) {
+        res->resyncs++;
+        synced = 0;
+
+        continue;
+      }
+
+      if (MEDIANFILTER_isFull(&shortFilter, 0)) {
+        if (type == CONTROL_BANG_BANG) {
+          dir = 0;
+          if ((shortMedian < -SHORT_OFFSET) && (miniMedian < -MINI_OFFSET) &&
+              (age < -MINI_OFFSET)) {
+            dir = -1;
+          } else if ((shortMedian > SHORT_OFFSET) &&
+                     (miniMedian > MINI_OFFSET) && (age > MINI_OFFSET)) {
+            dir = 1;
+          }
+
+          ppm = dir * BANG_BANG_PPM;
+        } else {
+          ppm = sync_ctrl_update(&ctrl, miniMedian, CHUNK_US);
+        }
+
+        if (sync_apll_set_ppm(&apll, ppm, &sdm0, &sdm1, &sdm2, &oDiv)) {
+          res->writes++;
+          if (t - start >= p->duration / 2) {
+            res->steadyWrites++;
+          }
+        }
+      }
+
+      err = estServer - played;
+      if (llabs(err) > CONVERGED_US) {
+        res->converged = -1;
+      } else if (res->converged < 0) {
+        res->converged = t - start;
+      }
+
+      if (t - start >= p->duration / 2) {
+        res->samples++;
+        res->syncSum2 += (double)err * err;
+        if (llabs(err) > res->syncMax) {
+          res->syncMax = llabs(err);
+        }
+      }
+    }
+  }
+}
+
+/**
+ *
+ */
+static void print_result(const char *name, const sim_params_t *p,
+                         const sim_result_t *r) {
+  double minutes = p->duration / 60e6;
+
+  if (r->converged < 0) {
+    printf("%-10s %10s", name, "never");
+  } else {
+    printf("%-10s %9.1fs", name, r->converged / 1e6);
+  }
+
+  printf(" %9.1f %9lld %8u %12.1f %12.1f\n",
+         r->samples ? sqrt(r->syncSum2 / r->samples) : 0,
+         (long long)r->syncMax, r->resyncs, r->writes / minutes,
+         r->steadyWrites / (minutes / 2));
+}
+
+int main(int argc, char **argv) {
+  sim_params_t p = {
+      .drift = 50e-6,
+      .jitter = 500,
+      .spikes = 0.01,
+      .noise = 50,
+      .offset = 500,
+      .duration = 600000000LL,
+      .seed = 1,
+  };
+  sim_result_t bangBang, pi;
+  int errors;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-d") == 0) && (i + 1 < argc)) {
+      p.drift = atof(argv[++i]) / 1e6;
+    } else if ((strcmp(argv[i], "-j") == 0) && (i + 1 < argc)) {
+      p.jitter = atof(argv[++i]);
+    } else if ((strcmp(argv[i], "-s") == 0) && (i + 1 < argc)) {
+      p.spikes = atof(argv[++i]);
+    } else if ((strcmp(argv[i], "-m") == 0) && (i + 1 < argc)) {
+      p.noise = atof(argv[++i]);
+    } else if ((strcmp(argv[i], "-o") == 0) && (i + 1 < argc)) {
+      p.offset = atoll(argv[++i]);
+    } else if ((strcmp(argv[i], "-t") == 0) && (i + 1 < argc)) {
+      p.duration = atoll(argv[++i]) * 1000000LL;
+    } else if ((strcmp(argv[i], "-r") == 0) && (i + 1 < argc)) {
+      p.seed = atoi(argv[++i]);
+    } else {
+      fprintf(stderr,
+              "usage: %s [-d drift ppm] [-j jitter us] [-s spike rate] "
+              "[-m noise us] [-o initial error us] [-t seconds] [-r seed]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  errors = check_apll();
+
+  printf("drift %.1fppm, jitter %.0fus, spikes %.3f, noise %.0fus, initial "
+         "error %lldus, %llds\n",
+         p.drift * 1e6, p.jitter, p.spikes, p.noise, (long long)p.offset,
+         (long long)p.duration / 1000000);
+
+  simulate(&p, CONTROL_BANG_BANG, &bangBang);
+  simulate(&p, CONTROL_PI, &pi);
+
+  printf("%-10s %10s %9s %9s %8s %12s %12s\n", "", "converged", "rms age",
+         "max age", "resyncs", "writes/min", "steady w/min");
+  print_result("bang-bang", &p, &bangBang);
+  print_result("pi", &p, &pi);
+
+  return errors ? 1 : 0;
+}
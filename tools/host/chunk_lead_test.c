@@ -0,0 +1,198 @@
+/* Host test for the wire chunk latency statistics
+
+   Feeds chunk_lead.c latencies and checks what the recommended buffer is
+   built on: no figure before CHUNK_LEAD_MIN_SAMPLES, quantiles at the upper
+   edge of their bin, early chunks in the first and very late ones in the
+   last bin, the last window kept and the one before dropped on rollover,
+   and bins that saturate instead of wrapping, with the count staying in
+   step. Then prints the cost of an insert.
+
+   usage: chunk_lead_test [-n chunks]
+
+   Returns 1 if a check fails.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chunk_lead.h"
+
+static uint32_t errors = 0;
+
+#define CHECK(cond)                                                 \
+  do {                                                              \
+    if (!(cond)) {                                                  \
+      printf("  %s:%d: %s failed\n", __func__, __LINE__, #cond);    \
+      errors++;                                                     \
+    }                                                               \
+  } while (0)
+
+/**
+ *
+ */
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * 1000 chunks of 0 to 999ms, 4 per bin.
+ */
+static void test_quantile(void) {
+  static chunk_lead_t lead;
+  int64_t now = 1000000;
+  int32_t i;
+
+  chunk_lead_init(&lead);
+
+  for (i = 0; i < CHUNK_LEAD_MIN_SAMPLES - 1; i++) {
+    CHECK(chunk_lead_insert(&lead, (int64_t)i * 1000, now) == 0);
+  }
+  CHECK(chunk_lead_quantile_ms(&lead, 500) == -1);
+  CHECK(chunk_lead_recommended_ms(&lead, 40) == -1);
+
+  for (; i < 1000; i++) {
+    CHECK(chunk_lead_insert(&lead, (int64_t)i * 1000, now) == 0);
+  }
+  CHECK(lead.max == 999000);
+
+  CHECK(chunk_lead_quantile_ms(&lead, 0) == CHUNK_LEAD_BIN_MS);
+  CHECK(chunk_lead_quantile_ms(&lead, 500) == 500);
+  CHECK(chunk_lead_quantile_ms(&lead, 999) == 1000);
+  CHECK(chunk_lead_quantile_ms(&lead, 1000) == 1000);
+
+  // 1000ms, the DMA lead and the margin, rounded up to 10ms
+  CHECK(chunk_lead_recommended_ms(&lead, 45) ==
+        (1000 + 45 + CHUNK_LEAD_MARGIN_MS + 9) / 10 * 10);
+
+  // early chunks count as 0, anything beyond the range as the last bin
+  chunk_lead_init(&lead);
+  for (i = 0; i < CHUNK_LEAD_MIN_SAMPLES; i++) {
+    chunk_lead_insert(&lead, (i & 1) ? -5000 : 3600000000LL, now);
+  }
+  CHECK(chunk_lead_quantile_ms(&lead, 500) == CHUNK_LEAD_BIN_MS);
+  CHECK(chunk_lead_quantile_ms(&lead, 1000) ==
+        CHUNK_LEAD_BINS * CHUNK_LEAD_BIN_MS);
+}
+
+/**
+ *
+ */
+static void test_rollover(void) {
+  static chunk_lead_t lead;
+  int64_t start = 5000000;
+  int32_t i;
+
+  chunk_lead_init(&lead);
+
+  // a window of 100ms
+  for (i = 0; i < 600; i++) {
+    CHECK(chunk_lead_insert(&lead, 100000,
+                            start + (int64_t)i * CHUNK_LEAD_WINDOW_US / 600) ==
+          0);
+  }
+
+  // the next one of 500ms, the first is still counted
+  CHECK(chunk_lead_insert(&lead, 500000, start + CHUNK_LEAD_WINDOW_US) == 1);
+  for (i = 1; i < 600; i++) {
+    CHECK(chunk_lead_insert(&lead, 500000, start + CHUNK_LEAD_WINDOW_US + i) ==
+          0);
+  }
+  CHECK(chunk_lead_quantile_ms(&lead, 500) == 100 + CHUNK_LEAD_BIN_MS);
+  CHECK(chunk_lead_quantile_ms(&lead, 999) == 500 + CHUNK_LEAD_BIN_MS);
+
+  // a third of 200ms replaces the first
+  CHECK(chunk_lead_insert(&lead, 200000, start + 2 * CHUNK_LEAD_WINDOW_US) ==
+        1);
+  for (i = 1; i < 10; i++) {
+    CHECK(chunk_lead_insert(&lead, 200000,
+                            start + 2 * CHUNK_LEAD_WINDOW_US + i) == 0);
+  }
+  CHECK(lead.count[0] + lead.count[1] == 610);
+  CHECK(chunk_lead_quantile_ms(&lead, 10) == 200 + CHUNK_LEAD_BIN_MS);
+  CHECK(chunk_lead_quantile_ms(&lead, 999) == 500 + CHUNK_LEAD_BIN_MS);
+
+  // the maximum is since init, not per window
+  CHECK(lead.max == 500000);
+}
+
+/**
+ *
+ */
+static void test_saturation(void) {
+  static chunk_lead_t lead;
+  int64_t now = 0;
+  uint32_t i;
+
+  chunk_lead_init(&lead);
+
+  // more than a bin holds within one window
+  for (i = 0; i < UINT16_MAX + 1000; i++) {
+    chunk_lead_insert(&lead, 20000, now);
+  }
+  CHECK(lead.bins[lead.current][20 / CHUNK_LEAD_BIN_MS] == UINT16_MAX);
+  CHECK(lead.count[lead.current] == UINT16_MAX);
+
+  // the count doesn't run ahead of the bins, the top permille is found
+  for (i = 0; i < 100; i++) {
+    chunk_lead_insert(&lead, 300000, now);
+  }
+  CHECK(lead.count[lead.current] == UINT16_MAX + 100);
+  CHECK(chunk_lead_quantile_ms(&lead, 990) == 20 + CHUNK_LEAD_BIN_MS);
+  CHECK(chunk_lead_quantile_ms(&lead, 999) == 300 + CHUNK_LEAD_BIN_MS);
+}
+
+/**
+ * @return ns per chunk inserted
+ */
+static double bench_insert(uint32_t chunks) {
+  static chunk_lead_t lead;
+  uint64_t t0;
+  uint32_t n;
+
+  chunk_lead_init(&lead);
+
+  t0 = now_ns();
+  for (n = 0; n < chunks; n++) {
+    // 20ms chunks, latency spread over the first 256 bins
+    chunk_lead_insert(&lead, (int64_t)(n * 2654435761u % 1024000),
+                      (int64_t)n * 20000);
+  }
+  t0 = now_ns() - t0;
+
+  if (chunk_lead_quantile_ms(&lead, 500) < 0) {
+    printf("  no quantile\n");
+  }
+
+  return (double)t0 / chunks;
+}
+
+int main(int argc, char **argv) {
+  uint32_t chunks = 10000000;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc)) {
+      chunks = strtoul(argv[++i], NULL, 0);
+    } else {
+      fprintf(stderr, "usage: %s [-n chunks]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  test_quantile();
+  test_rollover();
+  test_saturation();
+  printf("%s\n", errors ? "FAILED" : "passed");
+
+  printf("%18s\n", "insert ns/chunk");
+  printf("%18.1f\n", bench_insert(chunks));
+
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,482 @@
+/* Summary of a chunk trace exported by the client on /trace
+
+   Reads the Chrome trace event JSON written by chunk_trace_export() and
+   prints for every pair of stages a chunk went through the count, average,
+   99th percentile and maximum time between them, and the same from receive
+   to play. Only understands the format chunk_trace.c writes, not trace JSON
+   in general.
+
+   usage: chunk_trace_report [file]      reads stdin without file
+          chunk_trace_report -s          self test
+
+   The self test records a synthetic pipeline with known latencies, also from
+   two threads while exporting, and checks the report. Returns 1 if a check
+   fails or the file can't be read.
+*/
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chunk_trace.h"
+
+#define RECEIVED_KEPT 256
+
+typedef struct {
+  int64_t *d;
+  uint32_t n, size;
+} samples_t;
+
+typedef struct {
+  // transitions [from][to], receive to play in [0][CHUNK_TRACE_PLAY]
+  samples_t hop[CHUNK_TRACE_STAGES][CHUNK_TRACE_STAGES];
+  samples_t endToEnd;
+  int64_t receivedChunk[RECEIVED_KEPT];
+  int64_t receivedTime[RECEIVED_KEPT];
+  uint32_t received;
+  uint32_t events;
+  uint32_t instants;
+  uint32_t malformed;
+} report_t;
+
+typedef struct {
+  char *data;
+  size_t len, size;
+} out_t;
+
+static uint32_t errors = 0;
+
+#define CHECK(cond)                                              \
+  do {                                                           \
+    if (!(cond)) {                                               \
+      printf("  %s:%d: %s failed\n", __func__, __LINE__, #cond); \
+      errors++;                                                  \
+    }                                                            \
+  } while (0)
+
+/**
+ *
+ */
+static void samples_add(samples_t *s, int64_t v) {
+  if (s->n == s->size) {
+    s->size = s->size ? s->size * 2 : 64;
+    s->d = (int64_t *)realloc(s->d, s->size * sizeof(int64_t));
+  }
+  s->d[s->n++] = v;
+}
+
+/**
+ *
+ */
+static int cmp_i64(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * Stage by name, -1 if unknown.
+ */
+static int stage_by_name(const char *name, size_t len) {
+  int s;
+
+  for (s = 0; s < CHUNK_TRACE_STAGES; s++) {
+    const char *n = chunk_trace_stage_name((chunk_trace_stage_t)s);
+
+    if ((strlen(n) == len) && (strncmp(n, name, len) == 0)) {
+      return s;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * Find "key": in obj[0, len) and return what follows it.
+ */
+static const char *json_key(const char *obj, size_t len, const char *key) {
+  char pattern[32];
+  size_t plen;
+  const char *p;
+
+  plen = snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+  for (p = obj; p + plen <= obj + len; p++) {
+    if (memcmp(p, pattern, plen) == 0) {
+      return p + plen;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ *
+ */
+static bool json_int(const char *obj, size_t len, const char *key,
+                     int64_t *v) {
+  const char *p = json_key(obj, len, key);
+  char *end;
+
+  if (p == NULL) {
+    return false;
+  }
+  *v = strtoll(p, &end, 10);
+
+  return end != p;
+}
+
+/**
+ * Stage named by the string value of key, -1 if missing or unknown.
+ */
+static int json_stage(const char *obj, size_t len, const char *key) {
+  const char *p = json_key(obj, len, key);
+  const char *end;
+
+  if ((p == NULL) || (*p != '"')) {
+    return -1;
+  }
+  p++;
+  end = memchr(p, '"', obj + len - p);
+  if (end == NULL) {
+    return -1;
+  }
+
+  return stage_by_name(p, end - p);
+}
+
+/**
+ *
+ */
+static void report_event(report_t *r, const char *obj, size_t len) {
+  const char *ph = json_key(obj, len, "ph");
+  int64_t ts, dur = 0, chunk;
+  int stage, from = -1;
+  uint32_t i;
+
+  if ((ph == NULL) || (ph[1] == 'M')) {
+    return;
+  }
+
+  stage = json_stage(obj, len, "name");
+  if ((stage < 0) || (json_int(obj, len, "ts", &ts) == false) ||
+      (json_int(obj, len, "chunk", &chunk) == false)) {
+    r->malformed++;
+    return;
+  }
+
+  if (ph[1] == 'X') {
+    from = json_stage(obj, len, "from");
+    if ((from < 0) || (from >= stage) ||
+        (json_int(obj, len, "dur", &dur) == false) || (dur < 0)) {
+      r->malformed++;
+      return;
+    }
+    samples_add(&r->hop[from][stage], dur);
+  } else if (ph[1] == 'i') {
+    r->instants++;
+  } else {
+    r->malformed++;
+    return;
+  }
+  r->events++;
+
+  // the event ends when the chunk reached the stage
+  ts += dur;
+
+  if (stage == CHUNK_TRACE_RECEIVE) {
+    r->receivedChunk[r->received % RECEIVED_KEPT] = chunk;
+    r->receivedTime[r->received % RECEIVED_KEPT] = ts;
+    r->received++;
+  } else if (stage == CHUNK_TRACE_PLAY) {
+    for (i = 0; (i < r->received) && (i < RECEIVED_KEPT); i++) {
+      uint32_t k = (r->received - 1 - i) % RECEIVED_KEPT;
+
+      if (r->receivedChunk[k] == chunk) {
+        samples_add(&r->endToEnd, ts - r->receivedTime[k]);
+        break;
+      }
+    }
+  }
+}
+
+/**
+ * Feed every object in the traceEvents array to report_event().
+ */
+static void report_parse(report_t *r, const char *json, size_t len) {
+  const char *p = json_key(json, len, "traceEvents");
+  const char *end = json + len;
+
+  memset(r, 0, sizeof(report_t));
+
+  if ((p == NULL) || (*p != '[')) {
+    r->malformed++;
+    return;
+  }
+
+  for (p++; p < end;) {
+    const char *obj;
+    int depth = 0;
+
+    while ((p < end) && (*p != '{') && (*p != ']')) {
+      p++;
+    }
+    if ((p >= end) || (*p == ']')) {
+      return;
+    }
+
+    // our strings hold no braces
+    for (obj = p; p < end; p++) {
+      if (*p == '{') {
+        depth++;
+      } else if ((*p == '}') && (--depth == 0)) {
+        break;
+      }
+    }
+    if (p >= end) {
+      r->malformed++;
+      return;
+    }
+    p++;
+
+    report_event(r, obj, p - obj);
+  }
+
+  // no closing bracket
+  r->malformed++;
+}
+
+/**
+ * @return average and fills p99 and max, µs
+ */
+static double samples_stats(samples_t *s, int64_t *p99, int64_t *max) {
+  double sum = 0;
+  uint32_t i;
+
+  qsort(s->d, s->n, sizeof(int64_t), cmp_i64);
+  for (i = 0; i < s->n; i++) {
+    sum += s->d[i];
+  }
+  *p99 = s->d[(s->n - 1) * 99 / 100];
+  *max = s->d[s->n - 1];
+
+  return sum / s->n;
+}
+
+/**
+ *
+ */
+static void report_print(report_t *r) {
+  int64_t p99, max;
+  double avg;
+  int from, to;
+
+  printf("%u events, %u without an earlier stage, %u malformed\n", r->events,
+         r->instants, r->malformed);
+  printf("%-22s %8s %10s %10s %10s\n", "stage", "count", "avg us", "p99 us",
+         "max us");
+
+  for (to = 1; to < CHUNK_TRACE_STAGES; to++) {
+    for (from = 0; from < to; from++) {
+      samples_t *s = &r->hop[from][to];
+      char name[32];
+
+      if (s->n == 0) {
+        continue;
+      }
+      avg = samples_stats(s, &p99, &max);
+      snprintf(name, sizeof(name), "%s>%s",
+               chunk_trace_stage_name((chunk_trace_stage_t)from),
+               chunk_trace_stage_name((chunk_trace_stage_t)to));
+      printf("%-22s %8u %10.0f %10lld %10lld\n", name, s->n, avg,
+             (long long)p99, (long long)max);
+    }
+  }
+
+  if (r->endToEnd.n > 0) {
+    avg = samples_stats(&r->endToEnd, &p99, &max);
+    printf("%-22s %8u %10.0f %10lld %10lld\n", "receive>play", r->endToEnd.n,
+           avg, (long long)p99, (long long)max);
+  }
+}
+
+/**
+ *
+ */
+static void report_free(report_t *r) {
+  int from, to;
+
+  for (from = 0; from < CHUNK_TRACE_STAGES; from++) {
+    for (to = 0; to < CHUNK_TRACE_STAGES; to++) {
+      free(r->hop[from][to].d);
+    }
+  }
+  free(r->endToEnd.d);
+}
+
+/**
+ *
+ */
+static int out_write(void *arg, const char *data, size_t len) {
+  out_t *o = (out_t *)arg;
+
+  if (o->len + len > o->size) {
+    o->size = (o->len + len) * 2;
+    o->data = (char *)realloc(o->data, o->size);
+  }
+  memcpy(o->data + o->len, data, len);
+  o->len += len;
+
+  return len;
+}
+
+// µs from receiving a chunk to each stage in the self test
+static const int64_t stageAt[CHUNK_TRACE_STAGES] = {
+    0, 150, 900, 1100, 1120, 480000, 482000,
+};
+
+/**
+ * Record chunks n to n + count - 1 of 20ms, one stage at a time like the
+ * tasks would.
+ */
+static void record_chunks(int64_t n, int64_t count) {
+  int64_t i;
+  int s;
+
+  for (i = n; i < n + count; i++) {
+    int64_t chunk = 1700000000000000LL + i * 20000;
+    int64_t rx = 1000000 + i * 20000;
+
+    for (s = 0; s < CHUNK_TRACE_STAGES; s++) {
+      chunk_trace_record((chunk_trace_stage_t)s, chunk, 3840, rx + stageAt[s]);
+    }
+  }
+}
+
+typedef struct {
+  int64_t first;
+  int64_t count;
+} writer_arg_t;
+
+/**
+ *
+ */
+static void *writer_task(void *arg) {
+  writer_arg_t *w = (writer_arg_t *)arg;
+
+  record_chunks(w->first, w->count);
+
+  return NULL;
+}
+
+/**
+ *
+ */
+static void self_test(void) {
+  out_t out = {0};
+  report_t r;
+  int s;
+
+  CHECK(chunk_trace_init(1000) == 0);
+
+  // empty ring, just the metadata
+  CHECK(chunk_trace_export(out_write, &out) == 0);
+  report_parse(&r, out.data, out.len);
+  CHECK((r.events == 0) && (r.malformed == 0));
+  report_free(&r);
+
+  // 512 records, rounded down from 1000, the oldest quarter isn't exported
+  record_chunks(0, 300);
+  out.len = 0;
+  CHECK(chunk_trace_export(out_write, &out) == 384);
+  report_parse(&r, out.data, out.len);
+  report_print(&r);
+  CHECK((r.events == 384) && (r.malformed == 0));
+  for (s = 1; s < CHUNK_TRACE_STAGES; s++) {
+    samples_t *h = &r.hop[s - 1][s];
+
+    CHECK(h->n >= 384 / CHUNK_TRACE_STAGES - 1);
+    CHECK((h->n > 0) && (h->d[0] == stageAt[s] - stageAt[s - 1]) &&
+          (h->d[h->n - 1] == stageAt[s] - stageAt[s - 1]));
+  }
+  CHECK(r.endToEnd.n >= 384 / CHUNK_TRACE_STAGES - 1);
+  CHECK((r.endToEnd.n > 0) &&
+        (r.endToEnd.d[0] == stageAt[CHUNK_TRACE_PLAY]));
+  report_free(&r);
+
+  // recording from two tasks while exporting, records may be skipped but
+  // what is exported has to be whole
+  {
+    writer_arg_t w[2] = {{1000, 200000}, {1000000, 200000}};
+    pthread_t t[2];
+    int i, rounds = 0;
+
+    for (i = 0; i < 2; i++) {
+      pthread_create(&t[i], NULL, writer_task, &w[i]);
+    }
+    for (; rounds < 50; rounds++) {
+      out.len = 0;
+      CHECK(chunk_trace_export(out_write, &out) >= 0);
+      report_parse(&r, out.data, out.len);
+      CHECK(r.malformed == 0);
+      for (s = 1; s < CHUNK_TRACE_STAGES; s++) {
+        samples_t *h = &r.hop[s - 1][s];
+        uint32_t k;
+
+        for (k = 0; k < h->n; k++) {
+          CHECK(h->d[k] == stageAt[s] - stageAt[s - 1]);
+        }
+      }
+      report_free(&r);
+    }
+    for (i = 0; i < 2; i++) {
+      pthread_join(t[i], NULL);
+    }
+  }
+
+  free(out.data);
+}
+
+int main(int argc, char **argv) {
+  out_t in = {0};
+  report_t r;
+  FILE *f = stdin;
+  char buf[4096];
+  size_t n;
+
+  if ((argc == 2) && (strcmp(argv[1], "-s") == 0)) {
+    self_test();
+    printf("%s\n", errors ? "FAILED" : "passed");
+
+    return errors ? 1 : 0;
+  }
+
+  if (argc > 2) {
+    fprintf(stderr, "usage: %s [file] | -s\n", argv[0]);
+    return 1;
+  }
+
+  if (argc == 2) {
+    f = fopen(argv[1], "r");
+    if (f == NULL) {
+      perror(argv[1]);
+      return 1;
+    }
+  }
+
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    out_write(&in, buf, n);
+  }
+  if (f != stdin) {
+    fclose(f);
+  }
+
+  report_parse(&r, in.data ? in.data : "", in.len);
+  report_print(&r);
+  report_free(&r);
+  free(in.data);
+
+  return r.malformed ? 1 : 0;
+}
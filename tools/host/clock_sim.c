@@ -0,0 +1,319 @@
+/* Simulation of server time estimation
+
+   Compares the former 199 entry median filter with the drift aware clock
+   estimator of snapcast_clock.c. A server clock with configurable drift is
+   synced over a network with exponential jitter and occasional delay
+   spikes. Time syncs are sent every 10ms until the estimate is ready and at
+   the normal interval afterwards, like main.c does.
+
+   Both estimates drive a model of the player's control loop: one age sample
+   per 20ms chunk, +-100ppm APLL adjustment from the short and mini medians
+   and a hard resync if the short median exceeds 10ms.
+
+   usage: clock_sim [-d drift ppm] [-j jitter us] [-s spike rate] [-i interval
+                    ms] [-t seconds] [-r seed]
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "MedianFilter.h"
+#include "snapcast_clock.h"
+
+// see player.h and player_task()
+#define LATENCY_MEDIAN_FILTER_LEN 199
+#define LATENCY_MEDIAN_FILTER_FULL 19
+#define SHORT_BUFFER_LEN 99
+#define MINI_BUFFER_LEN 19
+#define HARD_RESYNC_THRESHOLD 10000
+#define SHORT_OFFSET 2
+#define MINI_OFFSET 1
+#define SR_SCALER 0.0001
+
+#define FAST_SYNC_INTERVAL 10000
+#define CHUNK_US 20000
+#define BASE_DELAY_US 1000
+#define SPIKE_US 50000
+#define SERVER_EPOCH 123456789LL
+
+typedef enum estimator_type {
+  ESTIMATOR_MEDIAN = 0,
+  ESTIMATOR_CLOCK,
+} estimator_type_t;
+
+typedef struct sim_params {
+  double drift;   // server µs per local µs - 1
+  double jitter;  // mean of exponential one way jitter in µs
+  double spikes;  // probability of a delay spike per message
+  int64_t interval;
+  int64_t duration;
+  unsigned int seed;
+} sim_params_t;
+
+typedef struct estimator {
+  estimator_type_t type;
+  sMedianFilter_t median;
+  sMedianNode_t medianNodes[LATENCY_MEDIAN_FILTER_LEN];
+  int64_t medianValue;
+  snapcast_clock_t clock;
+} estimator_t;
+
+typedef struct sim_result {
+  int64_t ready;  // local time estimate got ready
+  double errSum2;
+  int64_t errMax;
+  int64_t stepMax;  // largest change of estimate error between chunks
+  double syncSum2;  // played server time vs true server time
+  int64_t syncMax;
+  uint32_t samples;
+  uint32_t resyncs;
+  uint32_t timeSyncs;
+} sim_result_t;
+
+/**
+ *
+ */
+static double rand_exp(double mean) {
+  return -mean * log(1.0 - (rand() + 0.5) / ((double)RAND_MAX + 1.0));
+}
+
+/**
+ *
+ */
+static int64_t one_way_delay(const sim_params_t *p) {
+  double d = BASE_DELAY_US + rand_exp(p->jitter);
+
+  if ((double)rand() / RAND_MAX < p->spikes) {
+    d += rand_exp(SPIKE_US);
+  }
+
+  return (int64_t)d;
+}
+
+/**
+ *
+ */
+static int64_t server_time(const sim_params_t *p, int64_t local) {
+  return SERVER_EPOCH + local + (int64_t)llround(p->drift * local);
+}
+
+/**
+ *
+ */
+static void estimator_init(estimator_t *e, estimator_type_t type) {
+  memset(e, 0, sizeof(estimator_t));
+  e->type = type;
+  e->median.numNodes = LATENCY_MEDIAN_FILTER_LEN;
+  e->median.medianBuffer = e->medianNodes;
+  MEDIANFILTER_Init(&e->median);
+  snapcast_clock_init(&e->clock);
+}
+
+/**
+ *
+ */
+static void estimator_insert(estimator_t *e, int64_t local, int64_t offset,
+                             int64_t rtt) {
+  if (e->type == ESTIMATOR_MEDIAN) {
+    e->medianValue = MEDIANFILTER_Insert(&e->median, offset);
+  } else {
+    snapcast_clock_insert(&e->clock, local, offset, rtt);
+  }
+}
+
+/**
+ *
+ */
+static int estimator_ready(estimator_t *e) {
+  if (e->type == ESTIMATOR_MEDIAN) {
+    return MEDIANFILTER_isFull(&e->median, LATENCY_MEDIAN_FILTER_FULL);
+  }
+
+  return snapcast_clock_ready(&e->clock);
+}
+
+/**
+ *
+ */
+static int64_t estimator_offset(estimator_t *e, int64_t local) {
+  if (e->type == ESTIMATOR_MEDIAN) {
+    return e->medianValue;
+  }
+
+  return snapcast_clock_offset(&e->clock, local);
+}
+
+/**
+ *
+ */
+static void simulate(const sim_params_t *p, estimator_type_t type,
+                     sim_result_t *res) {
+  estimator_t e;
+  sMedianFilter_t shortFilter, miniFilter;
+  sMedianNode_t shortNodes[SHORT_BUFFER_LEN], miniNodes[MINI_BUFFER_LEN];
+  int64_t nextSync = 0, nextChunk = 0;
+  int64_t played = 0;  // server time of the sample being played
+  int64_t lastErr = 0;
+  int synced = 0;
+  int dir = 0;
+  int64_t t;
+
+  memset(res, 0, sizeof(sim_result_t));
+  estimator_init(&e, type);
+  shortFilter.numNodes = SHORT_BUFFER_LEN;
+  shortFilter.medianBuffer = shortNodes;
+  miniFilter.numNodes = MINI_BUFFER_LEN;
+  miniFilter.medianBuffer = miniNodes;
+
+  // same random numbers for both estimators
+  srand(p->seed);
+
+  for (t = 0; t < p->duration; t += 1000) {
+    if (t >= nextSync) {
+      int64_t d1 = one_way_delay(p);
+      int64_t d2 = one_way_delay(p);
+      int64_t serverRx = server_time(p, t + d1);
+      int64_t c2s = serverRx - t;
+      int64_t s2c = (t + d1 + d2) - serverRx;
+
+      // answer arrives later, apply it right away, the estimate isn't used
+      // until the next chunk anyway
+      estimator_insert(&e, t + d1 + d2, (c2s - s2c) / 2, c2s + s2c);
+      res->timeSyncs++;
+
+      if ((res->ready == 0) && estimator_ready(&e)) {
+        res->ready = t + d1 + d2;
+      }
+
+      nextSync = t + (res->ready ? p->interval : FAST_SYNC_INTERVAL);
+    }
+
+    if ((res->ready == 0) || (t < nextChunk)) {
+      continue;
+    }
+
+    nextChunk = t + CHUNK_US;
+
+    {
+      int64_t estServer = t + estimator_offset(&e, t);
+      int64_t truth = server_time(p, t);
+      int64_t err = estServer - truth;
+      int64_t age, shortMedian, miniMedian;
+
+      if (synced == 0) {
+        MEDIANFILTER_Init(&shortFilter);
+        MEDIANFILTER_Init(&miniFilter);
+        played = estServer;
+        synced = 1;
+        dir = 0;
+        lastErr = err;
+      } else {
+        // playback follows the local crystal, corrected by the APLL
+        played += llround(CHUNK_US * (1.0 + dir * SR_SCALER));
+      }
+
+      age = estServer - played;
+      shortMedian = MEDIANFILTER_Insert(&shortFilter, age);
+      miniMedian = MEDIANFILTER_Insert(&miniFilter, age);
+
+      if (MEDIANFILTER_isFull(&shortFilter, 0) &&
+          (llabs(shortMedian) > HARD_RESYNC_THRESHOLD)) {
+        res->resyncs++;
+        synced = 0;
+
+        continue;
+      }
+
+      dir = 0;
+      if (MEDIANFILTER_isFull(&shortFilter, 0)) {
+        if ((shortMedian < -SHORT_OFFSET) && (miniMedian < -MINI_OFFSET) &&
+            (age < -MINI_OFFSET)) {
+          dir = -1;
+        } else if ((shortMedian > SHORT_OFFSET) &&
+                   (miniMedian > MINI_OFFSET) && (age > MINI_OFFSET)) {
+          dir = 1;
+        }
+      }
+
+      res->samples++;
+      res->errSum2 += (double)err * err;
+      if (llabs(err) > res->errMax) {
+        res->errMax = llabs(err);
+      }
+
+      if (llabs(err - lastErr) > res->stepMax) {
+        res->stepMax = llabs(err - lastErr);
+      }
+
+      lastErr = err;
+
+      res->syncSum2 += (double)(played - truth) * (played - truth);
+      if (llabs(played - truth) > res->syncMax) {
+        res->syncMax = llabs(played - truth);
+      }
+    }
+  }
+}
+
+/**
+ *
+ */
+static void print_result(const char *name, const sim_result_t *r) {
+  printf("%-8s %8.3fs %9.0f %9lld %9lld %9.0f %9lld %8u %8u\n", name,
+         r->ready / 1e6, r->samples ? sqrt(r->errSum2 / r->samples) : 0,
+         (long long)r->errMax, (long long)r->stepMax,
+         r->samples ? sqrt(r->syncSum2 / r->samples) : 0,
+         (long long)r->syncMax, r->resyncs, r->timeSyncs);
+}
+
+int main(int argc, char **argv) {
+  sim_params_t p = {
+      .drift = 50e-6,
+      .jitter = 2000,
+      .spikes = 0.05,
+      .interval = 1000000,
+      .duration = 600000000LL,
+      .seed = 1,
+  };
+  sim_result_t median, clock;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-d") == 0) && (i + 1 < argc)) {
+      p.drift = atof(argv[++i]) / 1e6;
+    } else if ((strcmp(argv[i], "-j") == 0) && (i + 1 < argc)) {
+      p.jitter = atof(argv[++i]);
+    } else if ((strcmp(argv[i], "-s") == 0) && (i + 1 < argc)) {
+      p.spikes = atof(argv[++i]);
+    } else if ((strcmp(argv[i], "-i") == 0) && (i + 1 < argc)) {
+      p.interval = atoll(argv[++i]) * 1000;
+    } else if ((strcmp(argv[i], "-t") == 0) && (i + 1 < argc)) {
+      p.duration = atoll(argv[++i]) * 1000000LL;
+    } else if ((strcmp(argv[i], "-r") == 0) && (i + 1 < argc)) {
+      p.seed = atoi(argv[++i]);
+    } else {
+      fprintf(stderr,
+              "usage: %s [-d drift ppm] [-j jitter us] [-s spike rate] "
+              "[-i interval ms] [-t seconds] [-r seed]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  printf("drift %.1fppm, jitter %.0fus, spikes %.3f, interval %lldms, %llds\n",
+         p.drift * 1e6, p.jitter, p.spikes, (long long)p.interval / 1000,
+         (long long)p.duration / 1000000);
+
+  simulate(&p, ESTIMATOR_MEDIAN, &median);
+  simulate(&p, ESTIMATOR_CLOCK, &clock);
+
+  printf("%-8s %9s %9s %9s %9s %9s %9s %8s %8s\n", "", "ready", "rms err",
+         "max err", "max step", "rms sync", "max sync", "resyncs", "syncs");
+  print_result("median", &median);
+  print_result("clock", &clock);
+
+  return 0;
+}
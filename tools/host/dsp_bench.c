@@ -0,0 +1,1007 @@
+/* Benchmark and check of the DSP graphs on the ANSI esp-dsp kernels
+
+   Runs dsp_flow.c over chunks of noise for the fixed stereo flows and
+   compares it with the former dsp_processor_worker(), which allocated its
+   work buffers per chunk, converted in double and filtered 16 frames at a
+   time. Checks the output differs by at most 4 LSB at 44.1kHz, the float
+   rounding of the direct form II states, which grows with the square of
+   the sample rate. Checks new parameters for the same flow keep
+   the filter states and the work buffers aren't reallocated while the
+   format stays. Prints ns and, on x86, cycles per sample of both.
+
+   Then checks graph descriptions are parsed and invalid ones rejected, the
+   gain of a peaking band at its center, that mix and route nodes sum and
+   swap channels and that the stereo pair kernels give the same samples as
+   the block executor. Prints the cost per band of N band parametric EQs on
+   both channels with either.
+
+   Checks the LR4 crossovers of the bi-amp and 2.1 flows: both sides are
+   -6dB at the crossover frequency, about -24dB an octave into their stop
+   band and sum up flat, the 2.1 sub is mono and the fused crossover passes
+   give the same samples on both outputs as the block executor. Prints
+   cycles per frame of the 4 output crossover at 48kHz, the ESP32 at 240MHz
+   has 5000 per frame.
+
+   Checks flows on 32 bit slots give the samples of the 16 bit path, in
+   float and fixed point, and saturate.
+
+   usage: dsp_bench [-n chunks] [-f frames per chunk] [-r sample rate]
+
+   Returns 1 if a check fails.
+*/
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+#include "dsp_flow.h"
+#include "dsps_biquad.h"
+#include "dsps_biquad_gen.h"
+
+#define REF_LEN 16
+
+static uint32_t errors = 0;
+
+#define CHECK(cond)                                              \
+  do {                                                           \
+    if (!(cond)) {                                               \
+      printf("  %s:%d: %s failed\n", __func__, __LINE__, #cond); \
+      errors++;                                                  \
+    }                                                            \
+  } while (0)
+
+static const struct {
+  dspFlows_t flow;
+  const char *name;
+  filterParams_t params;
+} flows[] = {
+    {dspfStereo, "stereo", {dspfStereo}},
+    {dspfBassBoost, "bass boost", {dspfBassBoost, 300.0f, 6.0f}},
+    {dspfEQBassTreble,
+     "bass treble eq",
+     {dspfEQBassTreble, 300.0f, 4.0f, 0, 0, 4000.0f, -3.0f}},
+};
+
+/**
+ *
+ */
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ *
+ */
+static uint64_t cycles(void) {
+#if HAVE_RDTSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+/**
+ * Filters as the former worker set them up.
+ */
+static void ref_init(ptype_t *f, const filterParams_t *p, uint32_t sr) {
+  memset(f, 0, 4 * sizeof(ptype_t));
+
+  switch (p->dspFlow) {
+    case dspfEQBassTreble:
+      dsps_biquad_gen_lowShelf_f32(f[0].coeffs, p->fc_1 / sr, p->gain_1,
+                                   0.707);
+      dsps_biquad_gen_highShelf_f32(f[1].coeffs, p->fc_3 / sr, p->gain_3,
+                                    0.707);
+      dsps_biquad_gen_lowShelf_f32(f[2].coeffs, p->fc_1 / sr, p->gain_1,
+                                   0.707);
+      dsps_biquad_gen_highShelf_f32(f[3].coeffs, p->fc_3 / sr, p->gain_3,
+                                    0.707);
+      break;
+
+    case dspfBassBoost:
+      dsps_biquad_gen_lowShelf_f32(f[0].coeffs, p->fc_1 / sr, 6.0, 0.707);
+      dsps_biquad_gen_lowShelf_f32(f[1].coeffs, p->fc_1 / sr, 6.0, 0.707);
+      break;
+
+    default:
+      break;
+  }
+}
+
+/**
+ * One channel the way the former worker did, cnt biquads.
+ */
+static void ref_channel(volatile uint32_t *tmp, uint32_t max, int shift,
+                        double scale, ptype_t *f, int cnt, float *sbuffer0,
+                        float *sbufout0) {
+  uint32_t i;
+
+  for (i = 0; i < max; i++) {
+    sbuffer0[i] = scale * ((float)((int16_t)(tmp[i] >> shift))) / INT16_MAX;
+  }
+
+  if (cnt == 1) {
+    dsps_biquad_f32(sbuffer0, sbufout0, max, f[0].coeffs, f[0].w);
+    memcpy(sbuffer0, sbufout0, max * sizeof(float));
+  } else {
+    dsps_biquad_f32(sbuffer0, sbufout0, max, f[0].coeffs, f[0].w);
+    dsps_biquad_f32(sbufout0, sbuffer0, max, f[1].coeffs, f[1].w);
+  }
+
+  for (i = 0; i < max; i++) {
+    int16_t valint = (int16_t)(sbuffer0[i] * INT16_MAX);
+
+    if (shift == 0) {
+      tmp[i] = (tmp[i] & 0xFFFF0000) + (uint16_t)valint;
+    } else {
+      tmp[i] = (tmp[i] & 0xFFFF) + ((uint32_t)valint << 16);
+    }
+  }
+}
+
+/**
+ * The former dsp_processor_worker() without the parameter queue.
+ */
+static void ref_worker(dspFlows_t flow, ptype_t *f, char *audio,
+                       size_t chunk_size, double vol) {
+  volatile uint32_t *audio_tmp = (volatile uint32_t *)audio;
+  int len = chunk_size / 4;
+  float *sbuffer0 = (float *)malloc(sizeof(float) * REF_LEN);
+  float *sbufout0 = (float *)malloc(sizeof(float) * REF_LEN);
+
+  for (int k = 0; k < len; k += REF_LEN) {
+    volatile uint32_t *tmp = &audio_tmp[k];
+    uint32_t max = (len - k < REF_LEN) ? len - k : REF_LEN;
+    uint32_t i;
+
+    switch (flow) {
+      case dspfEQBassTreble:
+        ref_channel(tmp, max, 0, vol, &f[0], 2, sbuffer0, sbufout0);
+        ref_channel(tmp, max, 16, vol, &f[2], 2, sbuffer0, sbufout0);
+        break;
+
+      case dspfBassBoost:
+        ref_channel(tmp, max, 0, vol * 0.5, &f[0], 1, sbuffer0, sbufout0);
+        ref_channel(tmp, max, 16, vol * 0.5, &f[1], 1, sbuffer0, sbufout0);
+        break;
+
+      default:
+        if (vol != 1.0) {
+          for (i = 0; i < max; i++) {
+            int16_t l = (int16_t)(vol * (float)(int16_t)(tmp[i] & 0xFFFF));
+            int16_t r = (int16_t)(vol * (float)(int16_t)(tmp[i] >> 16));
+
+            tmp[i] = ((uint32_t)(uint16_t)r << 16) | (uint16_t)l;
+          }
+        }
+        break;
+    }
+  }
+
+  free(sbuffer0);
+  free(sbufout0);
+}
+
+/**
+ * Noise at about -12dBFS with a slow sine below, so no filter clips.
+ */
+static void make_noise(uint32_t *audio, uint32_t frames, uint32_t seed) {
+  uint32_t i;
+
+  for (i = 0; i < frames; i++) {
+    int16_t l, r;
+
+    seed = seed * 1664525u + 1013904223u;
+    l = (int16_t)((int32_t)(seed >> 16) / 8 - 4096 + (i % 512) * 8);
+    seed = seed * 1664525u + 1013904223u;
+    r = (int16_t)((int32_t)(seed >> 16) / 8 - 4096 - (i % 512) * 8);
+    audio[i] = ((uint32_t)(uint16_t)r << 16) | (uint16_t)l;
+  }
+}
+
+/**
+ * @return largest difference of two chunks in LSB
+ */
+static int max_diff(const uint32_t *a, const uint32_t *b, uint32_t frames) {
+  int d = 0;
+  uint32_t i;
+  int shift;
+
+  for (i = 0; i < frames; i++) {
+    for (shift = 0; shift <= 16; shift += 16) {
+      int e = abs((int16_t)(a[i] >> shift) - (int16_t)(b[i] >> shift));
+
+      if (e > d) {
+        d = e;
+      }
+    }
+  }
+
+  return d;
+}
+
+/**
+ *
+ */
+static void check_flow(int idx, uint32_t frames, uint32_t sr) {
+  dsp_flow_ctx_t ctx, cont;
+  ptype_t ref[4];
+  uint32_t *a = malloc(frames * 4), *b = malloc(frames * 4);
+  uint32_t *c = malloc(frames * 4);
+  float *in;
+  int diff = 0, n;
+  double rate = (sr > 44100) ? (double)sr / 44100 : 1.0;
+  int maxDiff = (int)ceil(4.0 * rate * rate);
+
+  dsp_flow_init(&ctx);
+  dsp_flow_set_params(&ctx, &flows[idx].params);
+  dsp_flow_init(&cont);
+  dsp_flow_set_params(&cont, &flows[idx].params);
+  ref_init(ref, &flows[idx].params, sr);
+
+  CHECK(dsp_flow_set_format(&ctx, sr, 2, frames) == 0);
+  CHECK(dsp_flow_set_format(&cont, sr, 2, frames) == 0);
+  in = ctx.buf[0];
+
+  for (n = 0; n < 20; n++) {
+    make_noise(a, frames, n);
+    memcpy(b, a, frames * 4);
+    memcpy(c, a, frames * 4);
+
+    // a new chunk of the same format, same parameters sent again
+    CHECK(dsp_flow_set_format(&ctx, sr, 2, frames) == 0);
+    if (n == 10) {
+      dsp_flow_set_params(&ctx, &flows[idx].params);
+    }
+
+    dsp_flow_process(&ctx, a, NULL, frames, 0.8f);
+    dsp_flow_process(&cont, c, NULL, frames, 0.8f);
+    ref_worker(flows[idx].flow, ref, (char *)b, frames * 4, 0.8);
+
+    if (max_diff(a, b, frames) > diff) {
+      diff = max_diff(a, b, frames);
+    }
+    CHECK(max_diff(a, c, frames) == 0);
+  }
+
+  CHECK(diff <= maxDiff);
+  CHECK(ctx.buf[0] == in);
+  printf("%-16s max diff to former %d LSB\n", flows[idx].name, diff);
+
+  dsp_flow_deinit(&ctx);
+  dsp_flow_deinit(&cont);
+  free(a);
+  free(b);
+  free(c);
+}
+
+/**
+ *
+ */
+static void bench_flow(int idx, uint32_t frames, uint32_t sr, uint32_t chunks) {
+  dsp_flow_ctx_t ctx;
+  ptype_t ref[4];
+  uint32_t *src = malloc(frames * 4), *a = malloc(frames * 4);
+  uint64_t t0, c0, tFlow, cFlow, tRef, cRef;
+  double samples = 2.0 * frames * chunks;  // both channels
+  uint32_t n;
+
+  make_noise(src, frames, 1);
+
+  dsp_flow_init(&ctx);
+  dsp_flow_set_params(&ctx, &flows[idx].params);
+  dsp_flow_set_format(&ctx, sr, 2, frames);
+
+  t0 = now_ns();
+  c0 = cycles();
+  for (n = 0; n < chunks; n++) {
+    memcpy(a, src, frames * 4);
+    dsp_flow_process(&ctx, a, NULL, frames, 0.8f);
+  }
+  cFlow = cycles() - c0;
+  tFlow = now_ns() - t0;
+
+  ref_init(ref, &flows[idx].params, sr);
+
+  t0 = now_ns();
+  c0 = cycles();
+  for (n = 0; n < chunks; n++) {
+    memcpy(a, src, frames * 4);
+    ref_worker(flows[idx].flow, ref, (char *)a, frames * 4, 0.8);
+  }
+  cRef = cycles() - c0;
+  tRef = now_ns() - t0;
+
+  printf("%-16s %10.2f %10.2f %12.2f %12.2f\n", flows[idx].name,
+         tFlow / samples, tRef / samples, cFlow / samples, cRef / samples);
+
+  dsp_flow_deinit(&ctx);
+  free(src);
+  free(a);
+}
+
+/**
+ *
+ */
+static void test_parse(void) {
+  dspGraph_t g;
+
+  CHECK(dsp_flow_parse_graph("in -6;bq 0 peak 1000 3 1.4\nbq 1 notch 50 -40 "
+                             "10; gain 1 -6 ;mix 2 0 0.5;route 0 2\n",
+                             &g) == 5);
+  CHECK(fabsf(g.inGain - 0.501f) < 0.001f);
+  CHECK((g.node[0].type == DSP_NODE_BIQUAD) && (g.node[0].ch == 0) &&
+        (g.node[0].filtertype == PEAKINGEQ) && (g.node[0].freq == 1000.0f) &&
+        (g.node[0].gain == 3.0f) && (fabsf(g.node[0].q - 1.4f) < 1e-6f));
+  CHECK((g.node[1].filtertype == NOTCH) && (g.node[1].ch == 1));
+  CHECK((g.node[2].type == DSP_NODE_GAIN) &&
+        (fabsf(g.node[2].gain - 0.501f) < 0.001f));
+  CHECK((g.node[3].type == DSP_NODE_MIX) && (g.node[3].ch == 2) &&
+        (g.node[3].src == 0) && (g.node[3].gain == 0.5f));
+  CHECK((g.node[4].type == DSP_NODE_ROUTE) && (g.node[4].src == 2) &&
+        (g.node[4].gain == 1.0f));
+  CHECK(dsp_flow_parse_graph("", &g) == 0);
+
+  CHECK(dsp_flow_parse_graph("lr4 2 lpf 80; lr4 0 hpf 80", &g) == 4);
+  CHECK((g.node[1].type == DSP_NODE_BIQUAD) && (g.node[1].ch == 2) &&
+        (g.node[1].filtertype == LPF) && (g.node[1].freq == 80.0f) &&
+        (fabsf(g.node[1].q - 0.7071f) < 1e-6f) && (g.node[3].ch == 0) &&
+        (g.node[3].filtertype == HPF));
+  CHECK(dsp_flow_parse_graph("lr4 0 bpf 80", &g) < 0);
+  CHECK(dsp_flow_parse_graph("lr4 5 lpf 80", &g) < 0);
+  CHECK(dsp_flow_parse_graph("bq 5 peak 1000 3 1.4", &g) < 0);
+  CHECK(dsp_flow_parse_graph("bq 0 bell 1000 3 1.4", &g) < 0);
+  CHECK(dsp_flow_parse_graph("bq 0 peak 1000 3", &g) < 0);
+  CHECK(dsp_flow_parse_graph("bq 0 peak 1000 3 0", &g) < 0);
+  CHECK(dsp_flow_parse_graph("mix 0 5 1", &g) < 0);
+  CHECK(dsp_flow_parse_graph("delay 0 10", &g) < 0);
+
+  g.nodeCnt = DSP_GRAPH_MAX_NODES + 1;
+  CHECK(dsp_flow_check_graph(&g) < 0);
+}
+
+/**
+ * Amplitude of channel shift after a graph, for a sine of freq at -12dBFS
+ * on both channels, 0 dB is the input.
+ */
+static float graph_gain_db(const char *text, float freq, uint32_t sr,
+                           int shift) {
+  filterParams_t params = {dspfGraph};
+  dsp_flow_ctx_t ctx;
+  uint32_t frames = sr / 10, i, n;
+  uint32_t *a = malloc(frames * 4);
+  float peak = 0;
+
+  CHECK(dsp_flow_parse_graph(text, &params.graph) >= 0);
+  dsp_flow_init(&ctx);
+  CHECK(dsp_flow_set_params(&ctx, &params) == 0);
+  dsp_flow_set_format(&ctx, sr, 2, frames);
+
+  // settle for 0.5s, measure the last 0.1s
+  for (n = 0; n < 6; n++) {
+    for (i = 0; i < frames; i++) {
+      int16_t v = (int16_t)(8192.0f * sinf(2.0f * (float)M_PI * freq *
+                                           (n * frames + i) / sr));
+
+      a[i] = ((uint32_t)(uint16_t)v << 16) | (uint16_t)v;
+    }
+    dsp_flow_process(&ctx, a, NULL, frames, 1.0f);
+  }
+
+  for (i = 0; i < frames; i++) {
+    float v = fabsf((float)(int16_t)(a[i] >> shift));
+
+    if (v > peak) {
+      peak = v;
+    }
+  }
+
+  dsp_flow_deinit(&ctx);
+  free(a);
+
+  return 20.0f * log10f(peak / 8192.0f);
+}
+
+/**
+ *
+ */
+static void test_graph(uint32_t sr) {
+  filterParams_t params = {dspfGraph};
+  dsp_flow_ctx_t ctx;
+  uint32_t a[64];
+  float g;
+  int i;
+
+  // a peaking band boosts its center by its gain and leaves the rest
+  g = graph_gain_db("in -6; bq 0 peak 1000 6 1.4", 1000.0f, sr, 0);
+  CHECK(fabsf(g) < 0.1f);
+  g = graph_gain_db("in -6; bq 0 peak 1000 6 1.4", 100.0f, sr, 0);
+  CHECK(fabsf(g + 6.0f) < 0.1f);
+  g = graph_gain_db("bq 0 peak 1000 -9 4", 1000.0f, sr, 0);
+  CHECK(fabsf(g + 9.0f) < 0.1f);
+  g = graph_gain_db("bq 1 notch 1000 -40 5", 1000.0f, sr, 16);
+  CHECK(g < -36.0f);
+  g = graph_gain_db("bq 0 ap360 1000 0 0.707; bq 0 ap180 500 0 1", 3000.0f,
+                    sr, 0);
+  CHECK(fabsf(g) < 0.1f);
+
+  // swap the channels through scratch, then sum them on the right
+  CHECK(dsp_flow_parse_graph("route 4 0; route 0 1; route 1 4; mix 1 0 1",
+                             &params.graph) == 4);
+  dsp_flow_init(&ctx);
+  CHECK(dsp_flow_set_params(&ctx, &params) == 0);
+  dsp_flow_set_format(&ctx, sr, 2, 64);
+  for (i = 0; i < 64; i++) {
+    a[i] = ((uint32_t)(uint16_t)(int16_t)(-100 * i) << 16) | (100 * i);
+  }
+  dsp_flow_process(&ctx, a, NULL, 64, 1.0f);
+  for (i = 0; i < 64; i++) {
+    CHECK(abs((int16_t)(a[i] & 0xFFFF) + 100 * i) <= 1);
+    CHECK(abs((int16_t)(a[i] >> 16)) <= 1);
+  }
+
+  // an invalid graph keeps the current one
+  params.graph.node[0].ch = DSP_GRAPH_CHANNELS;
+  CHECK(dsp_flow_set_params(&ctx, &params) < 0);
+  CHECK(ctx.graph.nodeCnt == 4);
+
+  // clipping saturates instead of wrapping
+  CHECK(dsp_flow_parse_graph("gain 0 12", &params.graph) == 1);
+  CHECK(dsp_flow_set_params(&ctx, &params) == 0);
+  a[0] = 20000;
+  dsp_flow_process(&ctx, a, NULL, 1, 1.0f);
+  CHECK((int16_t)(a[0] & 0xFFFF) == INT16_MAX);
+
+  // so does the input gain without nodes, in float and fixed point
+  for (i = 0; i < 2; i++) {
+    CHECK(dsp_flow_parse_graph("in 6", &params.graph) == 0);
+    dsp_flow_set_fixed(&ctx, i);
+    CHECK(dsp_flow_set_params(&ctx, &params) == 0);
+    a[0] = ((uint32_t)(uint16_t)(INT16_MIN + 1) << 16) | (INT16_MAX - 1);
+    dsp_flow_process(&ctx, a, NULL, 1, 1.0f);
+    // within the dither of the fixed point path
+    CHECK((int16_t)(a[0] & 0xFFFF) >= INT16_MAX - 1);
+    CHECK((int16_t)(a[0] >> 16) <= INT16_MIN + 1);
+  }
+
+  dsp_flow_deinit(&ctx);
+}
+
+/**
+ * Graphs of paired biquads run through the stereo kernels, with a unity
+ * gain node they take the block executor. Both give the same samples.
+ */
+static void test_pairs(uint32_t frames, uint32_t sr) {
+  static const char *graphs[] = {
+      "bq 0 lowshelf 300 4 0.707; bq 1 lowshelf 300 4 0.707",
+      "in -6; bq 0 lowshelf 300 4 0.707; bq 0 highshelf 4000 -3 0.707; "
+      "bq 1 lowshelf 300 4 0.707; bq 1 highshelf 4000 -3 0.707",
+      "in -6; bq 0 peak 100 3 1; bq 1 peak 200 3 1; bq 0 peak 1000 -3 2; "
+      "bq 1 notch 1000 -20 2; bq 0 lpf 8000 0 0.707; bq 1 hpf 50 0 0.707",
+  };
+  filterParams_t params = {dspfGraph}, slow = {dspfGraph};
+  dsp_flow_ctx_t ctx, ref;
+  uint32_t *a = malloc(frames * 4), *b = malloc(frames * 4);
+  int i, n, diff = 0;
+
+  for (i = 0; i < (int)(sizeof(graphs) / sizeof(graphs[0])); i++) {
+    char text[256];
+
+    snprintf(text, sizeof(text), "%s; gain 0 0", graphs[i]);
+    CHECK(dsp_flow_parse_graph(graphs[i], &params.graph) > 0);
+    CHECK(dsp_flow_parse_graph(text, &slow.graph) > 0);
+
+    dsp_flow_init(&ctx);
+    dsp_flow_init(&ref);
+    dsp_flow_set_params(&ctx, &params);
+    dsp_flow_set_params(&ref, &slow);
+    dsp_flow_set_format(&ctx, sr, 2, frames);
+    dsp_flow_set_format(&ref, sr, 2, frames);
+    CHECK(ctx.fused && !ref.fused);
+
+    for (n = 0; n < 10; n++) {
+      make_noise(a, frames, n);
+      memcpy(b, a, frames * 4);
+
+      // states go through the nodes and back into the pairs
+      if (n == 5) {
+        dsp_flow_set_params(&ctx, &params);
+      }
+
+      dsp_flow_process(&ctx, a, NULL, frames, 0.8f);
+      dsp_flow_process(&ref, b, NULL, frames, 0.8f);
+      if (max_diff(a, b, frames) > diff) {
+        diff = max_diff(a, b, frames);
+      }
+    }
+
+    dsp_flow_deinit(&ctx);
+    dsp_flow_deinit(&ref);
+  }
+
+  CHECK(diff == 0);
+
+  free(a);
+  free(b);
+}
+
+/**
+ * Flows on 32 bit slots give the samples of the 16 bit path shifted up,
+ * within the truncation of either, and saturate instead of wrapping.
+ */
+static void test_s32(uint32_t frames, uint32_t sr) {
+  static const char *graphs[] = {
+      "bq 0 lowshelf 300 4 0.707; bq 1 lowshelf 300 4 0.707",
+      "in -6; bq 0 peak 1000 3 1.4; gain 1 -2; mix 0 1 0.25",
+      "route 2 0; route 3 1; lr4 0 hpf 300; lr4 1 hpf 300; lr4 2 lpf 300; "
+      "lr4 3 lpf 300",
+  };
+  filterParams_t params = {dspfGraph};
+  dsp_flow_ctx_t ctx, ref;
+  uint32_t *a = malloc(frames * 4), *auxA = malloc(frames * 4);
+  uint32_t *w = malloc(frames * 8), *auxW = malloc(frames * 8);
+  uint32_t *b = malloc(frames * 4), *auxB = malloc(frames * 4);
+  int i, fixed, n, diff = 0;
+  uint32_t k;
+
+  for (fixed = 0; fixed < 2; fixed++) {
+    for (i = 0; i < (int)(sizeof(graphs) / sizeof(graphs[0])); i++) {
+      CHECK(dsp_flow_parse_graph(graphs[i], &params.graph) > 0);
+
+      dsp_flow_init(&ctx);
+      dsp_flow_init(&ref);
+      dsp_flow_set_fixed(&ctx, fixed);
+      dsp_flow_set_fixed(&ref, fixed);
+      dsp_flow_set_params(&ctx, &params);
+      dsp_flow_set_params(&ref, &params);
+      dsp_flow_set_format(&ctx, sr, 2, frames);
+      dsp_flow_set_format(&ref, sr, 2, frames);
+
+      for (n = 0; n < 4; n++) {
+        make_noise(a, frames, n);
+        for (k = 0; k < frames; k++) {
+          w[2 * k] = a[k] << 16;
+          w[2 * k + 1] = a[k] & 0xFFFF0000;
+        }
+
+        dsp_flow_process(&ref, a, auxA, frames, 0.8f);
+        dsp_flow_process_s32(&ctx, w, auxW, frames, 0.8f);
+
+        for (k = 0; k < frames; k++) {
+          b[k] = (w[2 * k + 1] & 0xFFFF0000) | (w[2 * k] >> 16);
+          auxB[k] = (auxW[2 * k + 1] & 0xFFFF0000) | (auxW[2 * k] >> 16);
+        }
+        if (max_diff(a, b, frames) > diff) {
+          diff = max_diff(a, b, frames);
+        }
+        if ((ctx.outputs == 4) && (max_diff(auxA, auxB, frames) > diff)) {
+          diff = max_diff(auxA, auxB, frames);
+        }
+      }
+
+      dsp_flow_deinit(&ctx);
+      dsp_flow_deinit(&ref);
+    }
+  }
+
+  // truncation and, in fixed point, the dither of the 16 bit path
+  CHECK(diff <= 2);
+
+  // +6dB of a full scale sample clips at full scale
+  for (fixed = 0; fixed < 2; fixed++) {
+    CHECK(dsp_flow_parse_graph("in 6", &params.graph) == 0);
+    dsp_flow_init(&ctx);
+    dsp_flow_set_fixed(&ctx, fixed);
+    dsp_flow_set_params(&ctx, &params);
+    dsp_flow_set_format(&ctx, sr, 2, frames);
+    w[0] = (uint32_t)INT32_MAX - 0xFF;
+    w[1] = (uint32_t)INT32_MIN + 0x100;
+    dsp_flow_process_s32(&ctx, w, NULL, 1, 1.0f);
+    CHECK(w[0] == (uint32_t)INT32_MAX);
+    CHECK(w[1] == (uint32_t)INT32_MIN);
+    dsp_flow_deinit(&ctx);
+  }
+
+  free(a);
+  free(b);
+  free(w);
+  free(auxA);
+  free(auxB);
+  free(auxW);
+}
+
+/**
+ * Gains of the left channel of both outputs of a flow and of their sum for
+ * a sine of freq at -12dBFS on both channels, in dB of the input.
+ */
+static void xover_gain_db(const filterParams_t *params, float freq,
+                          uint32_t sr, float *hi, float *lo, float *sum) {
+  dsp_flow_ctx_t ctx;
+  uint32_t frames = sr / 10, i, n;
+  uint32_t *a = malloc(frames * 4), *aux = malloc(frames * 4);
+  float peak[3] = {0, 0, 0};
+
+  dsp_flow_init(&ctx);
+  CHECK(dsp_flow_set_params(&ctx, params) == 0);
+  dsp_flow_set_format(&ctx, sr, 2, frames);
+  CHECK(ctx.outputs == 4);
+
+  // settle for 0.5s, measure the last 0.1s
+  for (n = 0; n < 6; n++) {
+    for (i = 0; i < frames; i++) {
+      int16_t v = (int16_t)(8192.0f * sinf(2.0f * (float)M_PI * freq *
+                                           (n * frames + i) / sr));
+
+      a[i] = ((uint32_t)(uint16_t)v << 16) | (uint16_t)v;
+    }
+    dsp_flow_process(&ctx, a, aux, frames, 1.0f);
+  }
+
+  for (i = 0; i < frames; i++) {
+    float h = (float)(int16_t)(a[i] & 0xFFFF);
+    float l = (float)(int16_t)(aux[i] & 0xFFFF);
+
+    peak[0] = fmaxf(peak[0], fabsf(h));
+    peak[1] = fmaxf(peak[1], fabsf(l));
+    peak[2] = fmaxf(peak[2], fabsf(h + l));
+  }
+
+  *hi = 20.0f * log10f(peak[0] / 8192.0f);
+  *lo = 20.0f * log10f(peak[1] / 8192.0f);
+  *sum = 20.0f * log10f(peak[2] / 8192.0f);
+
+  dsp_flow_deinit(&ctx);
+  free(a);
+  free(aux);
+}
+
+/**
+ * The LR4 crossovers of the fixed flows, and graphs of them taking the
+ * fused passes checked against the block executor on both outputs.
+ */
+static void test_xover(uint32_t frames, uint32_t sr) {
+  static const char *graphs[] = {
+      // the bi-amp flow
+      "route 2 0; route 3 1; lr4 0 hpf 300; lr4 1 hpf 300; lr4 2 lpf 300; "
+      "lr4 3 lpf 300",
+      // the 2.1 flow
+      "route 2 0 0.5; mix 2 1 0.5; route 3 2; lr4 0 hpf 80; lr4 1 hpf 80; "
+      "lr4 2 lpf 80; lr4 3 lpf 80",
+      // three pairs on both sides, the block wise split
+      "in -6; route 2 0; route 3 1; lr4 0 hpf 2000; lr4 1 hpf 2000; "
+      "lr4 2 lpf 2000; lr4 3 lpf 2000; bq 0 peak 5000 3 1; "
+      "bq 1 peak 5000 3 1; bq 2 lowshelf 100 3 0.707; "
+      "bq 3 lowshelf 100 3 0.707",
+      // one pair on the lows
+      "route 2 1; route 3 0 0.7; lr4 0 hpf 500; lr4 1 hpf 500; "
+      "bq 2 lpf 500 0 0.7071; bq 3 lpf 500 0 0.7071",
+  };
+  filterParams_t biamp = {dspfBiamp, 300.0f}, sub = {dspf2DOT1, 80.0f};
+  filterParams_t params = {dspfGraph}, slow = {dspfGraph};
+  dsp_flow_ctx_t ctx, ref;
+  uint32_t *a = malloc(frames * 4), *b = malloc(frames * 4);
+  uint32_t *auxA = malloc(frames * 4), *auxB = malloc(frames * 4);
+  static const float octaves[] = {0.25f, 0.5f, 1.0f, 2.0f, 4.0f};
+  float hi, lo, sum;
+  int i, n, diff = 0;
+  uint32_t k;
+
+  // -6dB each at the crossover frequency, -24dB an octave into the stop
+  // band, the two in phase summing up to an all pass
+  for (i = 0; i < (int)(sizeof(octaves) / sizeof(octaves[0])); i++) {
+    xover_gain_db(&biamp, 300.0f * octaves[i], sr, &hi, &lo, &sum);
+    CHECK(fabsf(sum) < 0.2f);
+    if (octaves[i] == 1.0f) {
+      CHECK(fabsf(hi + 6.0f) < 0.2f);
+      CHECK(fabsf(lo + 6.0f) < 0.2f);
+    }
+    if (octaves[i] == 0.5f) {
+      CHECK((hi < -23.0f) && (hi > -26.0f));
+    }
+    if (octaves[i] == 2.0f) {
+      CHECK((lo < -23.0f) && (lo > -26.0f));
+    }
+  }
+  xover_gain_db(&sub, 80.0f, sr, &hi, &lo, &sum);
+  CHECK(fabsf(hi + 6.0f) < 0.2f);
+  CHECK(fabsf(lo + 6.0f) < 0.2f);
+  CHECK(fabsf(sum) < 0.2f);
+  xover_gain_db(&sub, 20.0f, sr, &hi, &lo, &sum);
+  CHECK(fabsf(lo) < 0.2f);
+
+  // the sub is the mono sum of left and right
+  dsp_flow_init(&ctx);
+  dsp_flow_set_params(&ctx, &sub);
+  dsp_flow_set_format(&ctx, sr, 2, frames);
+  CHECK(ctx.fused && (ctx.auxPairCnt == 2));
+  make_noise(a, frames, 1);
+  dsp_flow_process(&ctx, a, auxA, frames, 0.8f);
+  for (k = 0; k < frames; k++) {
+    CHECK((auxA[k] & 0xFFFF) == (auxA[k] >> 16));
+  }
+  dsp_flow_deinit(&ctx);
+
+  // the flows are these graphs
+  for (i = 0; i < 2; i++) {
+    CHECK(dsp_flow_parse_graph(graphs[i], &params.graph) > 0);
+    dsp_flow_init(&ctx);
+    dsp_flow_init(&ref);
+    dsp_flow_set_params(&ctx, (i == 0) ? &biamp : &sub);
+    dsp_flow_set_params(&ref, &params);
+    dsp_flow_set_format(&ctx, sr, 2, frames);
+    dsp_flow_set_format(&ref, sr, 2, frames);
+    make_noise(a, frames, 2);
+    memcpy(b, a, frames * 4);
+    dsp_flow_process(&ctx, a, auxA, frames, 0.8f);
+    dsp_flow_process(&ref, b, auxB, frames, 0.8f);
+    CHECK(max_diff(a, b, frames) == 0);
+    CHECK(max_diff(auxA, auxB, frames) == 0);
+    dsp_flow_deinit(&ctx);
+    dsp_flow_deinit(&ref);
+  }
+
+  for (i = 0; i < (int)(sizeof(graphs) / sizeof(graphs[0])); i++) {
+    char text[320];
+
+    snprintf(text, sizeof(text), "%s; gain 0 0", graphs[i]);
+    CHECK(dsp_flow_parse_graph(graphs[i], &params.graph) > 0);
+    CHECK(dsp_flow_parse_graph(text, &slow.graph) > 0);
+
+    dsp_flow_init(&ctx);
+    dsp_flow_init(&ref);
+    dsp_flow_set_params(&ctx, &params);
+    dsp_flow_set_params(&ref, &slow);
+    dsp_flow_set_format(&ctx, sr, 2, frames);
+    dsp_flow_set_format(&ref, sr, 2, frames);
+    CHECK(ctx.fused && (ctx.auxPairCnt > 0) && !ref.fused);
+    CHECK((ctx.outputs == 4) && (ref.outputs == 4));
+
+    for (n = 0; n < 10; n++) {
+      make_noise(a, frames, n);
+      memcpy(b, a, frames * 4);
+
+      // states go through the nodes and back into the pairs
+      if (n == 5) {
+        dsp_flow_set_params(&ctx, &params);
+      }
+
+      dsp_flow_process(&ctx, a, auxA, frames, 0.8f);
+      dsp_flow_process(&ref, b, auxB, frames, 0.8f);
+      if (max_diff(a, b, frames) > diff) {
+        diff = max_diff(a, b, frames);
+      }
+      if (max_diff(auxA, auxB, frames) > diff) {
+        diff = max_diff(auxA, auxB, frames);
+      }
+    }
+
+    dsp_flow_deinit(&ctx);
+    dsp_flow_deinit(&ref);
+  }
+
+  CHECK(diff == 0);
+
+  free(a);
+  free(b);
+  free(auxA);
+  free(auxB);
+}
+
+/**
+ * @return cycles per frame of a flow with both outputs, 0 without rdtsc,
+ * ns per frame in ns. Unless fused a unity gain node makes it take the
+ * block executor.
+ */
+static double bench_xover(const filterParams_t *flow, bool fused,
+                          uint32_t frames, uint32_t sr, uint32_t chunks,
+                          double *ns) {
+  filterParams_t params = {dspfGraph};
+  dsp_flow_ctx_t ctx;
+  uint32_t *src = malloc(frames * 4), *a = malloc(frames * 4);
+  uint32_t *aux = malloc(frames * 4);
+  dspNode_t *node;
+  uint64_t t0, c0;
+  uint32_t n;
+
+  // the graph of the flow, with the gain node appended
+  dsp_flow_init(&ctx);
+  dsp_flow_set_params(&ctx, flow);
+  params.graph = ctx.graph;
+  dsp_flow_deinit(&ctx);
+  if (!fused) {
+    node = &params.graph.node[params.graph.nodeCnt++];
+    memset(node, 0, sizeof(dspNode_t));
+    node->type = DSP_NODE_GAIN;
+    node->gain = 1.0f;
+  }
+
+  make_noise(src, frames, 1);
+  dsp_flow_init(&ctx);
+  dsp_flow_set_params(&ctx, &params);
+  dsp_flow_set_format(&ctx, sr, 2, frames);
+  CHECK(ctx.fused == fused);
+
+  t0 = now_ns();
+  c0 = cycles();
+  for (n = 0; n < chunks; n++) {
+    memcpy(a, src, frames * 4);
+    dsp_flow_process(&ctx, a, aux, frames, 0.8f);
+  }
+  c0 = cycles() - c0;
+  t0 = now_ns() - t0;
+
+  dsp_flow_deinit(&ctx);
+  free(src);
+  free(a);
+  free(aux);
+
+  *ns = (double)t0 / ((double)frames * chunks);
+
+  return (double)c0 / ((double)frames * chunks);
+}
+
+/**
+ * @return cycles per frame of an N band EQ on both channels, 0 without
+ * rdtsc, ns per frame in ns. Paired runs the stereo kernels, else a unity
+ * gain node makes it take the block executor.
+ */
+static double bench_bands(int bands, bool paired, uint32_t frames,
+                          uint32_t sr, uint32_t chunks, double *ns) {
+  static const float centers[] = {31.0f,  62.0f,   125.0f,  250.0f,
+                                  500.0f, 1000.0f, 2000.0f, 4000.0f,
+                                  8000.0f, 16000.0f};
+  filterParams_t params = {dspfGraph};
+  dsp_flow_ctx_t ctx;
+  uint32_t *src = malloc(frames * 4), *a = malloc(frames * 4);
+  dspNode_t *node;
+  uint64_t t0, c0;
+  uint32_t n;
+  int b, ch;
+
+  params.graph.inGain = 0.25f;
+  for (ch = 0; ch < 2; ch++) {
+    for (b = 0; b < bands; b++) {
+      node = &params.graph.node[params.graph.nodeCnt++];
+      node->type = DSP_NODE_BIQUAD;
+      node->ch = ch;
+      node->filtertype = PEAKINGEQ;
+      node->freq = centers[b % 10];
+      node->gain = (b & 1) ? -3.0f : 3.0f;
+      node->q = 1.4f;
+    }
+  }
+  if (!paired) {
+    node = &params.graph.node[params.graph.nodeCnt++];
+    node->type = DSP_NODE_GAIN;
+    node->gain = 1.0f;
+  }
+
+  make_noise(src, frames, 1);
+  dsp_flow_init(&ctx);
+  dsp_flow_set_params(&ctx, &params);
+  dsp_flow_set_format(&ctx, sr, 2, frames);
+  CHECK(ctx.fused == paired);
+
+  t0 = now_ns();
+  c0 = cycles();
+  for (n = 0; n < chunks; n++) {
+    memcpy(a, src, frames * 4);
+    dsp_flow_process(&ctx, a, NULL, frames, 0.8f);
+  }
+  c0 = cycles() - c0;
+  t0 = now_ns() - t0;
+
+  dsp_flow_deinit(&ctx);
+  free(src);
+  free(a);
+
+  *ns = (double)t0 / ((double)frames * chunks);
+
+  return (double)c0 / ((double)frames * chunks);
+}
+
+int main(int argc, char **argv) {
+  uint32_t chunks = 2000, frames = 1152, sr = 44100;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc)) {
+      chunks = strtoul(argv[++i], NULL, 0);
+    } else if ((strcmp(argv[i], "-f") == 0) && (i + 1 < argc)) {
+      frames = strtoul(argv[++i], NULL, 0);
+    } else if ((strcmp(argv[i], "-r") == 0) && (i + 1 < argc)) {
+      sr = strtoul(argv[++i], NULL, 0);
+    } else {
+      fprintf(stderr,
+              "usage: %s [-n chunks] [-f frames per chunk] [-r sample rate]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  for (i = 0; i < (int)(sizeof(flows) / sizeof(flows[0])); i++) {
+    check_flow(i, frames, sr);
+  }
+  test_parse();
+  test_graph(sr);
+  test_pairs(frames, sr);
+  test_xover(frames, sr);
+  test_s32(frames, sr);
+  printf("%s\n", errors ? "FAILED" : "passed");
+
+  printf("%u chunks of %u frames at %uHz, per sample\n", chunks, frames, sr);
+  printf("%-16s %10s %10s %12s %12s\n", "flow", "ns", "former ns",
+#if HAVE_RDTSC
+         "cycles", "former cyc"
+#else
+         "cycles n/a", "former n/a"
+#endif
+  );
+  for (i = 0; i < (int)(sizeof(flows) / sizeof(flows[0])); i++) {
+    bench_flow(i, frames, sr, chunks);
+  }
+
+  printf("peaking EQ on both channels, per biquad and sample with the "
+         "conversions, stereo pairs and block executor\n");
+  printf("%-16s %10s %10s %12s %12s\n", "bands", "ns", "block ns",
+#if HAVE_RDTSC
+         "cycles", "block cyc"
+#else
+         "cycles n/a", "block n/a"
+#endif
+  );
+  {
+    static const int bandCnt[] = {1, 2, 5, 10, 15};
+    double c, cBlock, ns, nsBlock, biquads;
+
+    for (i = 0; i < (int)(sizeof(bandCnt) / sizeof(bandCnt[0])); i++) {
+      biquads = 2.0 * bandCnt[i];
+      c = bench_bands(bandCnt[i], true, frames, sr, chunks, &ns);
+      cBlock = bench_bands(bandCnt[i], false, frames, sr, chunks, &nsBlock);
+      printf("%-16d %10.2f %10.2f %12.2f %12.2f\n", bandCnt[i], ns / biquads,
+             nsBlock / biquads, c / biquads, cBlock / biquads);
+    }
+  }
+
+  printf("LR4 crossovers with both outputs at 48kHz, per frame, fused "
+         "and block executor\n");
+  printf("%-16s %10s %10s %12s %12s\n", "flow", "ns", "block ns",
+#if HAVE_RDTSC
+         "cycles", "block cyc"
+#else
+         "cycles n/a", "block n/a"
+#endif
+  );
+  {
+    static const struct {
+      const char *name;
+      filterParams_t params;
+    } xovers[] = {
+        {"bi-amp", {dspfBiamp, 300.0f}},
+        {"2.1", {dspf2DOT1, 80.0f}},
+    };
+    double c, cBlock, ns, nsBlock;
+
+    for (i = 0; i < (int)(sizeof(xovers) / sizeof(xovers[0])); i++) {
+      c = bench_xover(&xovers[i].params, true, frames, 48000, chunks, &ns);
+      cBlock = bench_xover(&xovers[i].params, false, frames, 48000, chunks,
+                           &nsBlock);
+      printf("%-16s %10.2f %10.2f %12.2f %12.2f\n", xovers[i].name, ns,
+             nsBlock, c, cBlock);
+    }
+  }
+
+  return errors ? 1 : 0;
+}
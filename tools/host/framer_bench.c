@@ -0,0 +1,391 @@
+/* Host benchmark for the snapcast bulk framer
+
+   Feeds a 48kHz/16bit/2ch PCM and a FLAC like snapcast stream through the
+   framer and through a byte wise reference parser (the way http_get_task
+   used to decode headers) and reports MB/s and cycles per message. While
+   timed both copy the payload out like wire_chunk_cb() does, so MB/s is
+   parsing plus the copy every client pays, not just the header decode. Both
+   parsers must see the same messages, the framer is additionally checked
+   with 1 byte and random segment sizes.
+
+   usage: framer_bench [-n repetitions] [-s segment size] [stream file ...]
+
+   A stream file contains the raw bytes received from a snapserver (e.g.
+   written by nc or a capture) and is benchmarked in addition to the
+   generated streams.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLE_COUNTER 1
+#endif
+
+#include "snapcast_framer.h"
+#include "test_stream.h"
+
+#define STREAM_SECONDS 60
+#define TCP_MSS 1460
+
+typedef struct parse_result {
+  int check;  // calculate checksum over payload, copy it out for timing
+  uint32_t messages;
+  uint32_t wireChunks;
+  uint64_t payloadBytes;
+  uint64_t checksum;
+} parse_result_t;
+
+// payload is copied here while timing, at most one segment at a time
+static char *payloadSink;
+
+/**
+ *
+ */
+static uint64_t checksum_add(uint64_t sum, const char *data, uint32_t len) {
+  uint32_t i;
+
+  for (i = 0; i < len; i++) {
+    sum = (sum ^ (uint8_t)data[i]) * 0x100000001b3ULL;
+  }
+
+  return sum;
+}
+
+/**
+ * Checksum of the payload or, while timing, copy it to payloadSink.
+ */
+static void payload_consume(parse_result_t *res, const char *data,
+                            uint32_t len) {
+  if (res->check) {
+    res->checksum = checksum_add(res->checksum, data, len);
+  } else if (len > 0) {
+    memcpy(payloadSink, data, len);
+    res->checksum += (uint8_t)payloadSink[len - 1];
+  }
+}
+
+/**
+ * Byte wise reference parser, decodes base message, wire chunk and time
+ * headers one byte per iteration like http_get_task did. Payload is consumed
+ * in bulk.
+ */
+static void parse_bytewise(const char *data, size_t size, size_t segment,
+                           int check, parse_result_t *res) {
+  base_message_t base = {0};
+  wire_chunk_message_t wire_chnk = {{0, 0}, 0, NULL};
+  time_message_t time_msg = {{0, 0}};
+  uint32_t state = 0;
+  uint32_t internalState = 0;
+  uint32_t typedMsgCurrentPos = 0;
+  size_t pos = 0;
+
+  memset(res, 0, sizeof(parse_result_t));
+  res->check = check;
+
+  while (pos < size) {
+    const char *start = &data[pos];
+    size_t len = (size - pos < segment) ? size - pos : segment;
+
+    pos += len;
+
+    while (len > 0) {
+      if (state == 0) {
+        uint32_t b = *start & 0xFF;
+
+        switch (internalState) {
+          case 0: base.type = b; break;
+          case 1: base.type |= b << 8; break;
+          case 2: base.id = b; break;
+          case 3: base.id |= b << 8; break;
+          case 4: base.refersTo = b; break;
+          case 5: base.refersTo |= b << 8; break;
+          case 6: base.sent.sec = b; break;
+          case 7: base.sent.sec |= b << 8; break;
+          case 8: base.sent.sec |= b << 16; break;
+          case 9: base.sent.sec |= b << 24; break;
+          case 10: base.sent.usec = b; break;
+          case 11: base.sent.usec |= b << 8; break;
+          case 12: base.sent.usec |= b << 16; break;
+          case 13: base.sent.usec |= b << 24; break;
+          case 14: base.received.sec = b; break;
+          case 15: base.received.sec |= b << 8; break;
+          case 16: base.received.sec |= b << 16; break;
+          case 17: base.received.sec |= b << 24; break;
+          case 18: base.received.usec = b; break;
+          case 19: base.received.usec |= b << 8; break;
+          case 20: base.received.usec |= b << 16; break;
+          case 21: base.received.usec |= b << 24; break;
+          case 22: base.size = b; break;
+          case 23: base.size |= b << 8; break;
+          case 24: base.size |= b << 16; break;
+          case 25: base.size |= b << 24; break;
+        }
+
+        internalState++;
+        if (internalState == BASE_MESSAGE_SIZE) {
+          internalState = 0;
+          typedMsgCurrentPos = 0;
+          state = 1;
+          res->messages++;
+        }
+
+        start++;
+        len--;
+
+        continue;
+      }
+
+      if ((base.type == SNAPCAST_MESSAGE_WIRE_CHUNK) && (internalState < 12)) {
+        uint32_t b = *start & 0xFF;
+        uint32_t shift = 8 * (internalState & 0x03);
+
+        if (internalState < 4) {
+          wire_chnk.timestamp.sec =
+              (internalState ? wire_chnk.timestamp.sec : 0) | (b << shift);
+        } else if (internalState < 8) {
+          wire_chnk.timestamp.usec =
+              (internalState > 4 ? wire_chnk.timestamp.usec : 0) |
+              (b << shift);
+        } else {
+          wire_chnk.size = (internalState > 8 ? wire_chnk.size : 0) |
+                           (b << shift);
+        }
+
+        internalState++;
+        typedMsgCurrentPos++;
+        start++;
+        len--;
+      } else if ((base.type == SNAPCAST_MESSAGE_TIME) && (internalState < 8)) {
+        uint32_t b = *start & 0xFF;
+        uint32_t shift = 8 * (internalState & 0x03);
+
+        if (internalState < 4) {
+          time_msg.latency.sec =
+              (internalState ? time_msg.latency.sec : 0) | (b << shift);
+        } else {
+          time_msg.latency.usec =
+              (internalState > 4 ? time_msg.latency.usec : 0) | (b << shift);
+        }
+
+        internalState++;
+        typedMsgCurrentPos++;
+        start++;
+        len--;
+      } else {
+        size_t tmp = base.size - typedMsgCurrentPos;
+
+        if (tmp > len) {
+          tmp = len;
+        }
+
+        res->payloadBytes += tmp;
+        payload_consume(res, start, tmp);
+
+        typedMsgCurrentPos += tmp;
+        start += tmp;
+        len -= tmp;
+      }
+
+      if (typedMsgCurrentPos >= base.size) {
+        if (base.type == SNAPCAST_MESSAGE_WIRE_CHUNK) {
+          res->wireChunks++;
+        }
+
+        state = 0;
+        internalState = 0;
+      }
+    }
+  }
+}
+
+/**
+ *
+ */
+static int parse_framer(const char *data, size_t size, size_t segment,
+                        int randomSegments, int check, parse_result_t *res) {
+  snapcast_framer_t framer;
+  snapcast_frame_t frame;
+  size_t pos = 0;
+
+  memset(res, 0, sizeof(parse_result_t));
+  res->check = check;
+  snapcast_framer_init(&framer);
+
+  while (pos < size) {
+    const char *start = &data[pos];
+    size_t len = randomSegments ? 1 + rand() % segment : segment;
+
+    if (len > size - pos) {
+      len = size - pos;
+    }
+
+    pos += len;
+
+    while (len > 0) {
+      size_t used = snapcast_framer_parse(&framer, start, len, &frame);
+
+      start += used;
+      len -= used;
+
+      switch (frame.event) {
+        case SNAPCAST_FRAMER_MESSAGE:
+          res->messages++;
+          break;
+
+        case SNAPCAST_FRAMER_PAYLOAD:
+          res->payloadBytes += frame.len;
+          payload_consume(res, frame.data, frame.len);
+          break;
+
+        case SNAPCAST_FRAMER_ERROR:
+          return -1;
+
+        default:
+          break;
+      }
+
+      if ((frame.complete == true) &&
+          (frame.base.type == SNAPCAST_MESSAGE_WIRE_CHUNK)) {
+        res->wireChunks++;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/**
+ *
+ */
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ *
+ */
+static uint64_t now_cycles(void) {
+#if HAVE_CYCLE_COUNTER
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+/**
+ *
+ */
+static int bench_stream(const char *name, const stream_t *s, int reps,
+                        size_t segment) {
+  parse_result_t ref, res;
+  uint64_t t0, t1, c0, c1;
+  double mb = (double)s->size * reps / (1024.0 * 1024.0);
+  int i;
+
+  // random segments are up to twice as long
+  payloadSink = malloc(2 * segment);
+  if (payloadSink == NULL) {
+    return -1;
+  }
+
+  // correctness first
+  parse_bytewise(s->data, s->size, segment, 1, &ref);
+  if ((parse_framer(s->data, s->size, segment, 0, 1, &res) < 0) ||
+      (memcmp(&ref, &res, sizeof(ref)) != 0)) {
+    printf("%s: framer and byte wise parser disagree\n", name);
+    free(payloadSink);
+    return -1;
+  }
+
+  if ((parse_framer(s->data, s->size, 1, 0, 1, &res) < 0) ||
+      (memcmp(&ref, &res, sizeof(ref)) != 0)) {
+    printf("%s: framer fails with 1 byte segments\n", name);
+    free(payloadSink);
+    return -1;
+  }
+
+  srand(42);
+  if ((parse_framer(s->data, s->size, 2 * segment, 1, 1, &res) < 0) ||
+      (memcmp(&ref, &res, sizeof(ref)) != 0)) {
+    printf("%s: framer fails with random segments\n", name);
+    free(payloadSink);
+    return -1;
+  }
+
+  printf("%s: %zu bytes, %u messages, %u wire chunks, segment %zu\n", name,
+         s->size, ref.messages, ref.wireChunks, segment);
+
+  t0 = now_ns();
+  c0 = now_cycles();
+  for (i = 0; i < reps; i++) {
+    parse_bytewise(s->data, s->size, segment, 0, &res);
+  }
+  c1 = now_cycles();
+  t1 = now_ns();
+  printf("  byte wise: %8.1f MB/s, %7.1f cycles/msg, %6.1f ns/msg\n",
+         mb / ((t1 - t0) / 1e9),
+         (double)(c1 - c0) / ((double)ref.messages * reps),
+         (double)(t1 - t0) / ((double)ref.messages * reps));
+
+  t0 = now_ns();
+  c0 = now_cycles();
+  for (i = 0; i < reps; i++) {
+    parse_framer(s->data, s->size, segment, 0, 0, &res);
+  }
+  c1 = now_cycles();
+  t1 = now_ns();
+  printf("  framer:    %8.1f MB/s, %7.1f cycles/msg, %6.1f ns/msg\n",
+         mb / ((t1 - t0) / 1e9),
+         (double)(c1 - c0) / ((double)ref.messages * reps),
+         (double)(t1 - t0) / ((double)ref.messages * reps));
+
+  free(payloadSink);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  stream_t pcm = {0}, flac = {0};
+  size_t segment = TCP_MSS;
+  int reps = 20;
+  int ret = 0;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc)) {
+      reps = atoi(argv[++i]);
+    } else if ((strcmp(argv[i], "-s") == 0) && (i + 1 < argc)) {
+      segment = atoi(argv[++i]);
+    } else {
+      stream_t file = {0};
+
+      if (stream_load(&file, argv[i]) == 0) {
+        ret |= bench_stream(argv[i], &file, reps, segment);
+      } else {
+        ret = -1;
+      }
+
+      stream_free(&file);
+    }
+  }
+
+  test_stream_generate(&pcm, 0, STREAM_SECONDS, 1);
+  test_stream_generate(&flac, 1, STREAM_SECONDS, 1);
+
+  ret |= bench_stream("pcm 48000:16:2", &pcm, reps, segment);
+  ret |= bench_stream("flac 48000:16:2", &flac, reps, segment);
+
+  stream_free(&pcm);
+  stream_free(&flac);
+
+  return ret ? 1 : 0;
+}
@@ -0,0 +1,9 @@
+/* Minimal esp_attr.h replacement for host builds */
+
+#ifndef __ESP_ATTR_H__
+#define __ESP_ATTR_H__
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+#endif  // __ESP_ATTR_H__
@@ -0,0 +1,13 @@
+/* Minimal esp_err.h replacement for host builds */
+
+#ifndef __ESP_ERR_H__
+#define __ESP_ERR_H__
+
+#include <stdint.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+#endif  // __ESP_ERR_H__
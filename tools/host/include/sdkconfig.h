@@ -0,0 +1,6 @@
+/* Host builds have no menuconfig, components fall back to their defaults */
+
+#ifndef __SDKCONFIG_H__
+#define __SDKCONFIG_H__
+
+#endif  // __SDKCONFIG_H__
@@ -0,0 +1,10 @@
+/* Empty Xtensa core configuration for host builds, esp-dsp falls back to
+   its ANSI C kernels */
+
+#ifndef __XTENSA_CORE_ISA_H__
+#define __XTENSA_CORE_ISA_H__
+
+#define XCHAL_HAVE_FP 0
+#define XCHAL_HAVE_LOOPS 0
+
+#endif  // __XTENSA_CORE_ISA_H__
@@ -0,0 +1,6 @@
+/* Empty Xtensa core configuration for host builds */
+
+#ifndef __XTENSA_CORE_MATMAP_H__
+#define __XTENSA_CORE_MATMAP_H__
+
+#endif  // __XTENSA_CORE_MATMAP_H__
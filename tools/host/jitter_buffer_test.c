@@ -0,0 +1,276 @@
+/* Host test for the timestamp indexed pcm chunk buffer
+
+   Feeds jitter_buffer.c chunks of 20ms and of 1152 frames at 44.1kHz, whose
+   timestamps don't fall on whole µs, and checks the cases the player relies
+   on: order kept, a missing chunk popped as a gap at its timestamp, chunks
+   with the same timestamp played in the order they came, late chunks
+   refused, dropping everything before a time, a full buffer refusing the
+   chunk too far ahead, a new stream once the old one is played and
+   lookup by timestamp. Then compares the cost of insert and pop with a ring
+   of pointers like the FreeRTOS queue it replaces.
+
+   usage: jitter_buffer_test [-n chunks]
+
+   Returns 1 if a check fails.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "jitter_buffer.h"
+
+#define CAPACITY 16
+
+static uint32_t freed = 0;
+static uint32_t errors = 0;
+
+#define CHECK(cond)                                                 \
+  do {                                                              \
+    if (!(cond)) {                                                  \
+      printf("  %s:%d: %s failed\n", __func__, __LINE__, #cond);    \
+      errors++;                                                     \
+    }                                                               \
+  } while (0)
+
+/**
+ *
+ */
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ *
+ */
+static void count_free(void *entry) { freed++; }
+
+/**
+ * Timestamp of chunk n as the server would send it, truncated to µs.
+ */
+static int64_t chunk_ts(int64_t start, double chunkUs, int64_t n) {
+  return start + (int64_t)((double)n * chunkUs);
+}
+
+/**
+ *
+ */
+static void test_order_and_gap(double chunkUs) {
+  jitter_buffer_t jb;
+  int64_t start = 1700000000123456LL;
+  int64_t ts;
+  void *entry;
+  uintptr_t n;
+
+  CHECK(jitter_buffer_init(&jb, CAPACITY, chunkUs, count_free) == 0);
+
+  // chunks 0 to 9 without 4 and 7
+  for (n = 0; n < 10; n++) {
+    if ((n == 4) || (n == 7)) {
+      continue;
+    }
+    CHECK(jitter_buffer_insert(&jb, chunk_ts(start, chunkUs, n),
+                               (void *)(n + 1)) == JITTER_BUFFER_OK);
+  }
+  CHECK(jitter_buffer_count(&jb) == 8);
+
+  // lookup in the middle of a chunk
+  CHECK(jitter_buffer_at(&jb, chunk_ts(start, chunkUs, 5) + 100) ==
+        (void *)6);
+  CHECK(jitter_buffer_at(&jb, chunk_ts(start, chunkUs, 4) + 100) == NULL);
+
+  for (n = 0; n < 10; n++) {
+    int32_t ret = jitter_buffer_pop(&jb, &entry, &ts);
+    int64_t d = ts - chunk_ts(start, chunkUs, n);
+
+    if ((n == 4) || (n == 7)) {
+      CHECK(ret == JITTER_BUFFER_GAP);
+      CHECK(entry == NULL);
+    } else {
+      CHECK(ret == JITTER_BUFFER_CHUNK);
+      CHECK(entry == (void *)(n + 1));
+    }
+    CHECK((d >= -1) && (d <= 1));
+  }
+  CHECK(jitter_buffer_pop(&jb, &entry, &ts) == JITTER_BUFFER_EMPTY);
+
+  // a late chunk, its time has passed
+  CHECK(jitter_buffer_insert(&jb, chunk_ts(start, chunkUs, 7), (void *)8) ==
+        JITTER_BUFFER_STALE);
+
+  // the stream continues where it was
+  CHECK(jitter_buffer_insert(&jb, chunk_ts(start, chunkUs, 10), (void *)11) ==
+        JITTER_BUFFER_OK);
+  CHECK(jitter_buffer_pop(&jb, &entry, &ts) == JITTER_BUFFER_CHUNK);
+  CHECK(entry == (void *)11);
+
+  jitter_buffer_deinit(&jb);
+}
+
+/**
+ *
+ */
+static void test_same_timestamp(double chunkUs) {
+  jitter_buffer_t jb;
+  int64_t start = 5000;
+  void *entry;
+  uintptr_t n;
+
+  CHECK(jitter_buffer_init(&jb, CAPACITY, chunkUs, count_free) == 0);
+
+  // a decoder handing out a chunk in two pieces with the same timestamp
+  CHECK(jitter_buffer_insert(&jb, start, (void *)1) == JITTER_BUFFER_OK);
+  CHECK(jitter_buffer_insert(&jb, start, (void *)2) == JITTER_BUFFER_OK);
+  CHECK(jitter_buffer_insert(&jb, chunk_ts(start, chunkUs, 2), (void *)3) ==
+        JITTER_BUFFER_OK);
+
+  for (n = 1; n <= 3; n++) {
+    CHECK(jitter_buffer_pop(&jb, &entry, NULL) == JITTER_BUFFER_CHUNK);
+    CHECK(entry == (void *)n);
+  }
+
+  jitter_buffer_deinit(&jb);
+}
+
+/**
+ *
+ */
+static void test_full_and_drop(double chunkUs) {
+  jitter_buffer_t jb;
+  int64_t start = 0;
+  int64_t ts;
+  void *entry;
+  uintptr_t n;
+
+  CHECK(jitter_buffer_init(&jb, CAPACITY, chunkUs, count_free) == 0);
+
+  for (n = 0; n < CAPACITY; n++) {
+    CHECK(jitter_buffer_insert(&jb, chunk_ts(start, chunkUs, n),
+                               (void *)(n + 1)) == JITTER_BUFFER_OK);
+  }
+  CHECK(jitter_buffer_insert(&jb, chunk_ts(start, chunkUs, CAPACITY),
+                             (void *)(CAPACITY + 1)) == JITTER_BUFFER_FULL);
+
+  // hard resync: everything starting before chunk 5 is late
+  freed = 0;
+  CHECK(jitter_buffer_drop_before(&jb, chunk_ts(start, chunkUs, 5) - 1) == 5);
+  CHECK(freed == 5);
+  CHECK(jitter_buffer_count(&jb) == CAPACITY - 5);
+  CHECK(jitter_buffer_pop(&jb, &entry, &ts) == JITTER_BUFFER_CHUNK);
+  CHECK(entry == (void *)6);
+
+  // room again, the slots wrap around
+  CHECK(jitter_buffer_insert(&jb, chunk_ts(start, chunkUs, CAPACITY),
+                             (void *)(CAPACITY + 1)) == JITTER_BUFFER_OK);
+
+  // a new stream starting anew is refused until the old one is played
+  CHECK(jitter_buffer_insert(&jb, 1000000000000LL, (void *)100) ==
+        JITTER_BUFFER_FULL);
+  freed = 0;
+  CHECK(jitter_buffer_drop_before(&jb, chunk_ts(start, chunkUs, 100)) ==
+        CAPACITY - 5);
+  CHECK(freed == CAPACITY - 5);
+  CHECK(jitter_buffer_insert(&jb, 1000000000000LL, (void *)100) ==
+        JITTER_BUFFER_OK);
+  CHECK(jitter_buffer_pop(&jb, &entry, &ts) == JITTER_BUFFER_CHUNK);
+  CHECK((entry == (void *)100) && (ts == 1000000000000LL));
+
+  // flush and deinit free what is left
+  CHECK(jitter_buffer_insert(&jb, 1000000000000LL + (int64_t)chunkUs,
+                             (void *)101) == JITTER_BUFFER_OK);
+  freed = 0;
+  jitter_buffer_deinit(&jb);
+  CHECK(freed == 1);
+}
+
+/**
+ * @return ns per chunk inserted and popped
+ */
+static double bench_jitter_buffer(double chunkUs, uint32_t chunks) {
+  jitter_buffer_t jb;
+  uint64_t t0;
+  void *entry;
+  uintptr_t sum = 0;
+  uint32_t n;
+
+  jitter_buffer_init(&jb, CAPACITY, chunkUs, count_free);
+
+  t0 = now_ns();
+  for (n = 0; n < chunks; n++) {
+    jitter_buffer_insert(&jb, chunk_ts(0, chunkUs, n), (void *)(uintptr_t)n);
+    if (jitter_buffer_count(&jb) >= CAPACITY / 2) {
+      jitter_buffer_pop(&jb, &entry, NULL);
+      sum += (uintptr_t)entry;
+    }
+  }
+  t0 = now_ns() - t0;
+
+  jitter_buffer_deinit(&jb);
+
+  if (sum == 0) {
+    printf("  nothing popped\n");
+  }
+
+  return (double)t0 / chunks;
+}
+
+/**
+ * @return ns per chunk sent and received through a ring of pointers
+ */
+static double bench_ring(uint32_t chunks) {
+  static void *ring[CAPACITY];
+  volatile uint32_t head = 0, tail = 0;
+  uint64_t t0;
+  uintptr_t sum = 0;
+  uint32_t n;
+
+  t0 = now_ns();
+  for (n = 0; n < chunks; n++) {
+    ring[tail++ % CAPACITY] = (void *)(uintptr_t)n;
+    if (tail - head >= CAPACITY / 2) {
+      sum += (uintptr_t)ring[head++ % CAPACITY];
+    }
+  }
+  t0 = now_ns() - t0;
+
+  if (sum == 0) {
+    printf("  nothing popped\n");
+  }
+
+  return (double)t0 / chunks;
+}
+
+int main(int argc, char **argv) {
+  const double chunkUs[] = {20000.0, 1152 * 1e6 / 44100};
+  uint32_t chunks = 10000000;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc)) {
+      chunks = strtoul(argv[++i], NULL, 0);
+    } else {
+      fprintf(stderr, "usage: %s [-n chunks]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  for (i = 0; i < 2; i++) {
+    printf("chunk %.3fus\n", chunkUs[i]);
+    test_order_and_gap(chunkUs[i]);
+    test_same_timestamp(chunkUs[i]);
+    test_full_and_drop(chunkUs[i]);
+  }
+  printf("%s\n", errors ? "FAILED" : "passed");
+
+  printf("%22s %22s\n", "jitter buffer ns/chunk", "pointer ring ns/chunk");
+  printf("%22.1f %22.1f\n", bench_jitter_buffer(chunkUs[1], chunks),
+         bench_ring(chunks));
+
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,230 @@
+/* Host benchmark for libmedian
+
+   Checks the two heap implementation against the linked list one: both get
+   the same samples (random, few distinct values, ramps and the latency like
+   series the player sees) and must return the same median after every
+   insert, while filling and full, and the same MEDIANFILTER_get_median() and
+   MEDIANFILTER_isFull() results. Then reports the cost per insert for a
+   range of window sizes, including the 19/99/199 the player uses.
+
+   usage: median_bench [-n inserts] [-w window ...]
+
+   Returns 1 if the implementations differ.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLE_COUNTER 1
+#endif
+
+#include "median_impl.h"
+
+#define MAX_WINDOWS 16
+#define CHECK_INSERTS 5000
+
+typedef enum sample_type {
+  SAMPLES_RANDOM = 0,
+  SAMPLES_FEW_VALUES,
+  SAMPLES_RAMP,
+  SAMPLES_AGE,
+  SAMPLES_CNT
+} sample_type_t;
+
+static const char *sampleNames[] = {"random", "few values", "ramp", "age"};
+
+/**
+ *
+ */
+static int64_t sample(sample_type_t type, uint32_t i) {
+  switch (type) {
+    case SAMPLES_RANDOM:
+      return ((int64_t)rand() << 16) ^ rand();
+
+    case SAMPLES_FEW_VALUES:
+      return rand() % 5;
+
+    case SAMPLES_RAMP:
+      return (i % 1000 < 500) ? i % 1000 : 1000 - i % 1000;
+
+    case SAMPLES_AGE:
+    default:
+      // chunk age in µs, slowly wandering with jitter and some outliers
+      return (int64_t)(i % 4000) / 4 - 500 + rand() % 200 +
+             ((rand() % 50 == 0) ? 20000 : 0);
+  }
+}
+
+/**
+ *
+ */
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ *
+ */
+static uint64_t now_cycles(void) {
+#if HAVE_CYCLE_COUNTER
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+/**
+ * @return number of mismatches
+ */
+static int check(unsigned int window, sample_type_t type) {
+  void *ref = medianList.create(window);
+  void *dut = medianHeaps.create(window);
+  int errors = 0;
+  uint32_t i, n;
+
+  if ((ref == NULL) || (dut == NULL)) {
+    fprintf(stderr, "can't create filters of %u\n", window);
+
+    return 1;
+  }
+
+  srand(window * SAMPLES_CNT + type);
+
+  for (i = 0; i < CHECK_INSERTS; i++) {
+    int64_t s = sample(type, i);
+    int64_t a = medianList.insert(ref, s);
+    int64_t b = medianHeaps.insert(dut, s);
+
+    if (a != b) {
+      if (errors++ < 5) {
+        printf("  window %u %s insert %u: median %lld != %lld\n", window,
+               sampleNames[type], i, (long long)a, (long long)b);
+      }
+    }
+
+    if (medianList.is_full(ref, 0) != medianHeaps.is_full(dut, 0)) {
+      errors++;
+    }
+
+    // averaging around the median
+    for (n = 0; n < window; n += 1 + window / 8) {
+      a = medianList.get_median(ref, n);
+      b = medianHeaps.get_median(dut, n);
+      if (a != b) {
+        if (errors++ < 5) {
+          printf("  window %u %s insert %u: get_median(%u) %lld != %lld\n",
+                 window, sampleNames[type], i, n, (long long)a,
+                 (long long)b);
+        }
+      }
+    }
+  }
+
+  medianList.destroy(ref);
+  medianHeaps.destroy(dut);
+
+  return errors;
+}
+
+/**
+ *
+ */
+static void bench(const median_impl_t *impl, unsigned int window,
+                  uint32_t inserts, const int64_t *samples, double *ns,
+                  double *cycles) {
+  void *f = impl->create(window);
+  volatile int64_t sink = 0;
+  uint64_t t0, c0;
+  uint32_t i;
+
+  // measure the full window like the player does most of the time
+  for (i = 0; i < window; i++) {
+    sink += impl->insert(f, samples[i]);
+  }
+
+  t0 = now_ns();
+  c0 = now_cycles();
+  for (i = 0; i < inserts; i++) {
+    sink += impl->insert(f, samples[i]);
+  }
+  *cycles = (double)(now_cycles() - c0) / inserts;
+  *ns = (double)(now_ns() - t0) / inserts;
+
+  (void)sink;
+  impl->destroy(f);
+}
+
+int main(int argc, char **argv) {
+  unsigned int windows[MAX_WINDOWS] = {19, 99, 199, 499, 999, 4999};
+  int windowCnt = 6, userWindows = 0;
+  uint32_t inserts = 1000000;
+  int64_t *samples;
+  int errors = 0;
+  int i, t;
+
+  for (i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc)) {
+      inserts = atoi(argv[++i]);
+    } else if ((strcmp(argv[i], "-w") == 0) && (i + 1 < argc) &&
+               (userWindows < MAX_WINDOWS)) {
+      windows[userWindows++] = atoi(argv[++i]) | 1;
+      windowCnt = userWindows;
+    } else {
+      fprintf(stderr, "usage: %s [-n inserts] [-w window ...]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (inserts < 1) {
+    inserts = 1;
+  }
+
+  for (i = 0; i < windowCnt; i++) {
+    for (t = 0; t < SAMPLES_CNT; t++) {
+      errors += check(windows[i], t);
+    }
+  }
+
+  printf("%s vs %s: %s\n", medianHeaps.name, medianList.name,
+         errors ? "MISMATCH" : "same results");
+
+  samples = malloc(inserts * sizeof(int64_t));
+  if (samples == NULL) {
+    return 1;
+  }
+
+  srand(1);
+  for (i = 0; i < (int)inserts; i++) {
+    samples[i] = sample(SAMPLES_AGE, i);
+  }
+
+  printf("%8s %14s %14s %14s %14s\n", "window", "list ns", "list cycles",
+         "heaps ns", "heaps cycles");
+  for (i = 0; i < windowCnt; i++) {
+    double listNs, listCycles, heapNs, heapCycles;
+    unsigned int w = windows[i];
+
+    if (w > inserts) {
+      // bench() primes with the first window samples
+      continue;
+    }
+
+    bench(&medianList, w, inserts, samples, &listNs, &listCycles);
+    bench(&medianHeaps, w, inserts, samples, &heapNs, &heapCycles);
+    printf("%8u %14.1f %14.1f %14.1f %14.1f\n", w, listNs, listCycles, heapNs,
+           heapCycles);
+  }
+
+  free(samples);
+
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,68 @@
+/* One libmedian implementation behind median_impl_t, see median_impl.h
+
+   Built with MEDIAN_IMPL set to the name of the exported median_impl_t and
+   MEDIANFILTER_TWO_HEAPS selecting the implementation.
+*/
+
+#include "median_impl.h"
+
+#include <stdlib.h>
+
+#include "MedianFilter.h"
+
+typedef struct median_filter {
+  sMedianFilter_t filter;
+  sMedianNode_t nodes[];
+} median_filter_t;
+
+/**
+ *
+ */
+static void *create(unsigned int numNodes) {
+  median_filter_t *m =
+      malloc(sizeof(median_filter_t) + numNodes * sizeof(sMedianNode_t));
+
+  if (m == NULL) {
+    return NULL;
+  }
+
+  m->filter.numNodes = numNodes;
+  m->filter.medianBuffer = m->nodes;
+  if (MEDIANFILTER_Init(&m->filter) < 0) {
+    free(m);
+
+    return NULL;
+  }
+
+  return m;
+}
+
+/**
+ *
+ */
+static int64_t insert(void *filter, int64_t sample) {
+  return MEDIANFILTER_Insert(&((median_filter_t *)filter)->filter, sample);
+}
+
+/**
+ *
+ */
+static int64_t get_median(void *filter, uint32_t n) {
+  return MEDIANFILTER_get_median(&((median_filter_t *)filter)->filter, n);
+}
+
+/**
+ *
+ */
+static uint32_t is_full(void *filter, uint32_t n) {
+  return MEDIANFILTER_isFull(&((median_filter_t *)filter)->filter, n);
+}
+
+const median_impl_t MEDIAN_IMPL = {
+    .name = MEDIANFILTER_TWO_HEAPS ? "two heaps" : "linked list",
+    .create = create,
+    .insert = insert,
+    .get_median = get_median,
+    .is_full = is_full,
+    .destroy = free,
+};
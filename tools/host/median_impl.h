@@ -0,0 +1,25 @@
+/* Both libmedian implementations in one binary
+
+   median_impl.c is compiled once per implementation with the MEDIANFILTER_*
+   functions renamed, so the node and filter types of the two never meet in
+   one translation unit.
+*/
+
+#ifndef __MEDIAN_IMPL_H__
+#define __MEDIAN_IMPL_H__
+
+#include <stdint.h>
+
+typedef struct median_impl {
+  const char *name;
+  void *(*create)(unsigned int numNodes);
+  int64_t (*insert)(void *filter, int64_t sample);
+  int64_t (*get_median)(void *filter, uint32_t n);
+  uint32_t (*is_full)(void *filter, uint32_t n);
+  void (*destroy)(void *filter);
+} median_impl_t;
+
+extern const median_impl_t medianList;
+extern const median_impl_t medianHeaps;
+
+#endif  // __MEDIAN_IMPL_H__
@@ -0,0 +1,269 @@
+/* Host test for the metrics registry
+
+   Registers a counter family with two labels, a gauge read on export, one
+   without a value and a histogram, and checks the Prometheus text export
+   line by line. Then updates counter and histogram from several threads
+   while exporting and checks no update is lost and the exported buckets
+   always add up to _count, and prints the cost of an update.
+
+   usage: metrics_test [-n updates per thread]
+
+   Returns 1 if a check fails.
+*/
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "metrics.h"
+
+#define THREADS 4
+
+static uint32_t errors = 0;
+
+#define CHECK(cond)                                              \
+  do {                                                           \
+    if (!(cond)) {                                               \
+      printf("  %s:%d: %s failed\n", __func__, __LINE__, #cond); \
+      errors++;                                                  \
+    }                                                            \
+  } while (0)
+
+typedef struct {
+  char *data;
+  size_t len, size;
+} out_t;
+
+static const char resyncHelp[] = "Resyncs";
+static metric_t hard =
+    METRIC_COUNTER_INIT("test_resyncs_total", "kind=\"hard\"", resyncHelp);
+static metric_t soft =
+    METRIC_COUNTER_INIT("test_resyncs_total", "kind=\"soft\"", resyncHelp);
+
+static const int32_t bounds[] = {-100, 0, 100};
+static uint32_t counts[sizeof(bounds) / sizeof(bounds[0]) + 1];
+static metric_t age =
+    METRIC_HISTOGRAM_INIT("test_age_us", "Age error", bounds, counts);
+
+static metric_t queue =
+    METRIC_GAUGE_INIT("test_queue_chunks", NULL, "Queued", NULL);
+
+/**
+ *
+ */
+static bool read_rssi(int32_t *value) {
+  *value = -61;
+
+  return true;
+}
+
+/**
+ *
+ */
+static bool read_nothing(int32_t *value) { return false; }
+
+static metric_t rssi =
+    METRIC_GAUGE_INIT("test_rssi_dbm", NULL, "RSSI", read_rssi);
+static metric_t absent =
+    METRIC_GAUGE_INIT("test_absent", NULL, "Not there", read_nothing);
+
+/**
+ *
+ */
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ *
+ */
+static int out_write(void *arg, const char *data, size_t len) {
+  out_t *o = (out_t *)arg;
+
+  if (o->len + len + 1 > o->size) {
+    o->size = (o->len + len + 1) * 2;
+    o->data = (char *)realloc(o->data, o->size);
+  }
+  memcpy(o->data + o->len, data, len);
+  o->len += len;
+  o->data[o->len] = 0;
+
+  return len;
+}
+
+/**
+ *
+ */
+static int count_lines(const char *text, const char *prefix) {
+  const char *p = text;
+  int n = 0;
+
+  while (p != NULL && *p) {
+    if (strncmp(p, prefix, strlen(prefix)) == 0) {
+      n++;
+    }
+    p = strchr(p, '\n');
+    if (p != NULL) {
+      p++;
+    }
+  }
+
+  return n;
+}
+
+/**
+ * Value after "name " at the start of a line, -1 if missing.
+ */
+static long long value_of(const char *text, const char *series) {
+  char pattern[128];
+  const char *p;
+
+  snprintf(pattern, sizeof(pattern), "\n%s ", series);
+  p = strstr(text, pattern);
+  if (p == NULL) {
+    return -1;
+  }
+
+  return strtoll(p + strlen(pattern), NULL, 10);
+}
+
+/**
+ *
+ */
+static void test_export(void) {
+  out_t out = {0};
+  int32_t n;
+
+  metrics_register(&hard);
+  metrics_register(&soft);
+  metrics_register(&age);
+  metrics_register(&queue);
+  metrics_register(&rssi);
+  metrics_register(&absent);
+  // twice is ignored
+  metrics_register(&hard);
+
+  metric_inc(&hard);
+  metric_add(&soft, 41);
+  metric_inc(&soft);
+  metric_set(&queue, 7);
+  metric_observe(&age, -500);
+  metric_observe(&age, -100);
+  metric_observe(&age, 50);
+  metric_observe(&age, 100000);
+
+  n = metrics_export(out_write, &out);
+  CHECK(n == (int32_t)out.len);
+  printf("%s", out.data);
+
+  CHECK(count_lines(out.data, "# HELP test_resyncs_total Resyncs") == 1);
+  CHECK(count_lines(out.data, "# TYPE test_resyncs_total counter") == 1);
+  CHECK(count_lines(out.data, "# TYPE test_age_us histogram") == 1);
+  CHECK(count_lines(out.data, "test_absent") == 0);
+  CHECK(strncmp(out.data, "# HELP", 6) == 0);
+
+  CHECK(value_of(out.data, "test_resyncs_total{kind=\"hard\"}") == 1);
+  CHECK(value_of(out.data, "test_resyncs_total{kind=\"soft\"}") == 42);
+  CHECK(value_of(out.data, "test_queue_chunks") == 7);
+  CHECK(value_of(out.data, "test_rssi_dbm") == -61);
+  CHECK(value_of(out.data, "test_age_us_bucket{le=\"-100\"}") == 2);
+  CHECK(value_of(out.data, "test_age_us_bucket{le=\"0\"}") == 2);
+  CHECK(value_of(out.data, "test_age_us_bucket{le=\"100\"}") == 3);
+  CHECK(value_of(out.data, "test_age_us_bucket{le=\"+Inf\"}") == 4);
+  CHECK(value_of(out.data, "test_age_us_count") == 4);
+  CHECK(value_of(out.data, "test_age_us_sum") == 100000 - 550);
+
+  free(out.data);
+}
+
+static uint32_t updates = 1000000;
+
+/**
+ *
+ */
+static void *update_task(void *arg) {
+  uint32_t i;
+
+  (void)arg;
+
+  for (i = 0; i < updates; i++) {
+    metric_inc(&hard);
+    metric_observe(&age, (int32_t)(i % 301) - 150);
+  }
+
+  return NULL;
+}
+
+/**
+ *
+ */
+static void test_concurrent(void) {
+  pthread_t t[THREADS];
+  out_t out = {0};
+  long long hard0, count0;
+  uint64_t t0;
+  int i, rounds = 0;
+
+  out_write(&out, "\n", 1);
+  metrics_export(out_write, &out);
+  hard0 = value_of(out.data, "test_resyncs_total{kind=\"hard\"}");
+  count0 = value_of(out.data, "test_age_us_count");
+
+  t0 = now_ns();
+  for (i = 0; i < THREADS; i++) {
+    pthread_create(&t[i], NULL, update_task, NULL);
+  }
+
+  // exported while updating, the buckets add up to _count
+  for (rounds = 0; rounds < 200; rounds++) {
+    out.len = 0;
+    out_write(&out, "\n", 1);
+    CHECK(metrics_export(out_write, &out) > 0);
+    CHECK(value_of(out.data, "test_age_us_bucket{le=\"+Inf\"}") ==
+          value_of(out.data, "test_age_us_count"));
+  }
+
+  for (i = 0; i < THREADS; i++) {
+    pthread_join(t[i], NULL);
+  }
+  t0 = now_ns() - t0;
+
+  out.len = 0;
+  out_write(&out, "\n", 1);
+  metrics_export(out_write, &out);
+  CHECK(value_of(out.data, "test_resyncs_total{kind=\"hard\"}") ==
+        hard0 + (long long)THREADS * updates);
+  CHECK(value_of(out.data, "test_age_us_count") ==
+        count0 + (long long)THREADS * updates);
+
+  printf("%d threads, %.1f ns per counter and histogram update\n", THREADS,
+         (double)t0 / ((double)THREADS * updates));
+
+  free(out.data);
+}
+
+int main(int argc, char **argv) {
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc)) {
+      updates = strtoul(argv[++i], NULL, 0);
+    } else {
+      fprintf(stderr, "usage: %s [-n updates per thread]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  test_export();
+  test_concurrent();
+  printf("%s\n", errors ? "FAILED" : "passed");
+
+  return errors ? 1 : 0;
+}
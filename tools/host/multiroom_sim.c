@@ -0,0 +1,874 @@
+/* Multiroom sync simulation
+
+   Runs the sync logic of player_task() for several clients against one
+   virtual server, faster than real time and reproducible from a seed. The
+   server sends a 20ms chunk every 20ms, stamped with its play time minus the
+   buffer. Each client has its own crystal offset, spread evenly over
+   -drift..+drift, its own network and:
+
+   - estimates server time with snapcast_clock.c from time messages, fast
+     at start then once a second,
+   - hard syncs by dropping late chunks and starting the next one when the
+     estimated server time reaches it (RESYNCING HARD 1),
+   - measures the age of every chunk at the time the DMA reaches it, see
+     i2s_custom_get_play_time(), plus uniform measurement noise,
+   - resyncs if no chunk is waiting, the chunk isn't there in time or the
+     short median exceeds 10ms (RESYNCING HARD 2),
+   - corrects the speed with sync_ctrl.c through the APLL in its smallest
+     steps, the resampler or one frame slips per chunk (-c).
+
+   The network adds exponential jitter in both directions, loses messages,
+   a lost chunk arrives a TCP retransmission later and holds back the ones
+   after it, and bufferbloat queues up to -b on the way to the client and
+   drains every 10s, shifted per client.
+
+   The error of a client is when it plays a chunk against when the server
+   meant it to be played. Reported are the spread between the clients over
+   time (-i), per client the convergence time, error and resyncs, and for
+   the group the convergence time and the spread in the second half. A
+   client has converged at the start of the first CONVERGED_HOLD_US its
+   error stays within CONVERGED_RMS_K times its rms in the second half, the
+   spread the same way and within the gate. The group has converged once
+   the spread and the last client have. A fixed bound would either sit in
+   the measurement noise and record its last spike or be wide enough to be
+   met right away. -S sweeps jitter, loss and bufferbloat.
+
+   usage: multiroom_sim [-n clients] [-c apll|resampler|slip] [-d drift ppm]
+                        [-j jitter us] [-l loss rate] [-b bloat us]
+                        [-m noise us] [-B buffer ms] [-t seconds]
+                        [-i interval s] [-g gate us] [-S] [-r seed]
+
+   Returns 1 if a run doesn't converge, resyncs in the second half or its
+   largest spread there exceeds the gate.
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "MedianFilter.h"
+#include "resampler.h"
+#include "sample_slip.h"
+#include "snapcast_clock.h"
+#include "sync_ctrl.h"
+
+// see player.h and player_task()
+#define SHORT_BUFFER_LEN 99
+#define MINI_BUFFER_LEN 19
+#define HARD_RESYNC_THRESHOLD 10000
+#define CHNK_CTRL_CNT 2
+
+// nominal APLL coefficients for 48kHz, 16 bit stereo
+#define APLL_SDM0 149
+#define APLL_SDM1 212
+#define APLL_SDM2 5
+#define APLL_O_DIV 6
+
+#define MAX_CLIENTS 16
+#define CONVERGED_RMS_K 4
+#define CONVERGED_HOLD_US 10000000
+#define PEAK_US 100000  // resolution of the convergence time
+
+#define TICK_US 1000
+#define FAST_SYNC_INTERVAL 10000
+#define SYNC_INTERVAL 1000000
+#define CHUNK_US 20000
+#define CHUNK_FRAMES 960
+#define BASE_DELAY_US 1000
+#define RTO_US 200000
+#define BLOAT_PERIOD_US 10000000LL
+#define SERVER_EPOCH 123456789LL
+
+// chunks kept per client, more than the buffer plus a retransmission
+#define CHUNK_RING 1024
+
+typedef enum control_type {
+  CONTROL_APLL = 0,
+  CONTROL_RESAMPLER,
+  CONTROL_SLIP,
+} control_type_t;
+
+static const char *controlNames[] = {"apll", "resampler", "slip"};
+
+typedef struct sim_params {
+  int clients;
+  control_type_t control;
+  double drift;   // largest crystal offset, local µs per true µs - 1
+  double jitter;  // mean of exponential one way jitter in µs
+  double loss;    // probability a message is lost
+  double bloat;   // largest queueing delay towards the client in µs
+  double noise;   // largest age measurement error in µs, uniform
+  int64_t bufUs;
+  int64_t duration;
+  int64_t interval;  // timeline interval, 0 for none
+  int64_t gate;
+  unsigned int seed;
+} sim_params_t;
+
+typedef struct sim_client {
+  uint64_t rng;
+  double xtal;  // local µs per true µs - 1
+  double bloatPhase;
+  int64_t localEpoch;
+
+  snapcast_clock_t clock;
+  sMedianFilter_t shortFilter, miniFilter;
+  sMedianNode_t shortNodes[SHORT_BUFFER_LEN], miniNodes[MINI_BUFFER_LEN];
+  sync_ctrl_t ctrl;
+  sync_apll_t apll;
+  float ppm;  // applied speed correction
+  float slipFrames;
+
+  int64_t nextSync;
+  int64_t arrival[CHUNK_RING];
+  int64_t lastArrival;
+  int64_t arrived;  // chunks received so far
+
+  int synced;
+  int64_t next;     // next chunk to play or to check
+  double playAt;    // true time chunk next starts playing
+  int64_t playing;  // true time the first chunk after a sync starts
+  int64_t err;      // of the last chunk, true play time - server play time
+
+  // statistics
+  int64_t converged;  // -1 if never
+  int64_t *peak;      // largest error per PEAK_US, INT64_MAX if not playing
+  double errSum2;
+  int64_t errMax;
+  uint32_t samples;
+  uint32_t resyncs;
+  uint32_t steadyResyncs;
+  uint32_t underruns;
+  uint32_t drops;
+  uint32_t writes;
+} sim_client_t;
+
+typedef struct sim_result {
+  int64_t converged;  // -1 if never
+  int64_t *peak;      // largest spread per PEAK_US, INT64_MAX if muted
+  double spreadSum2;
+  int64_t spreadMax;
+  uint32_t samples;
+  uint32_t resyncs;
+  uint32_t steadyResyncs;
+} sim_result_t;
+
+static sim_client_t clients[MAX_CLIENTS];
+
+/**
+ * xorshift64*, one stream per client so they don't depend on each other
+ */
+static double rand_unit(uint64_t *s) {
+  uint64_t x = *s;
+
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *s = x;
+
+  return ((x * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ *
+ */
+static double rand_exp(uint64_t *s, double mean) {
+  return -mean * log(1.0 - rand_unit(s));
+}
+
+/**
+ *
+ */
+static double rand_uniform(uint64_t *s, double max) {
+  return max * (2.0 * rand_unit(s) - 1.0);
+}
+
+/**
+ *
+ */
+static int64_t local_time(const sim_client_t *c, int64_t t) {
+  return c->localEpoch + t + llround(c->xtal * t);
+}
+
+/**
+ *
+ */
+static int64_t server_time(int64_t t) { return SERVER_EPOCH + t; }
+
+/**
+ *
+ */
+static int64_t uplink_delay(sim_client_t *c, const sim_params_t *p) {
+  return BASE_DELAY_US + (int64_t)rand_exp(&c->rng, p->jitter);
+}
+
+/**
+ * Bufferbloat builds up over BLOAT_PERIOD_US and drains at once.
+ */
+static int64_t downlink_delay(sim_client_t *c, const sim_params_t *p,
+                              int64_t t) {
+  double phase = fmod((double)t / BLOAT_PERIOD_US + c->bloatPhase, 1.0);
+
+  return BASE_DELAY_US + (int64_t)rand_exp(&c->rng, p->jitter) +
+         (int64_t)(p->bloat * phase);
+}
+
+/**
+ *
+ */
+static void client_init(sim_client_t *c, const sim_params_t *p, int i) {
+  memset(c, 0, sizeof(sim_client_t));
+
+  c->rng = (p->seed + 1) * 0x9E3779B97F4A7C15ULL +
+           (i + 1) * 0xD1B54A32D192ED03ULL;
+  if (c->rng == 0) {
+    c->rng = 1;
+  }
+
+  c->xtal = (p->clients > 1) ? p->drift * (2.0 * i / (p->clients - 1) - 1.0)
+                             : p->drift;
+  c->bloatPhase = (double)i / p->clients;
+  c->localEpoch = (int64_t)(rand_unit(&c->rng) * 1e9);
+
+  snapcast_clock_init(&c->clock);
+  c->shortFilter.numNodes = SHORT_BUFFER_LEN;
+  c->shortFilter.medianBuffer = c->shortNodes;
+  c->miniFilter.numNodes = MINI_BUFFER_LEN;
+  c->miniFilter.medianBuffer = c->miniNodes;
+  MEDIANFILTER_Init(&c->shortFilter);
+  MEDIANFILTER_Init(&c->miniFilter);
+
+  // 48kHz, 16 bit stereo, see apll_nominal() in apll_sim.c
+  sync_apll_init(&c->apll, APLL_SDM0, APLL_SDM1, APLL_SDM2, APLL_O_DIV);
+
+  switch (p->control) {
+    case CONTROL_RESAMPLER:
+      sync_ctrl_init(&c->ctrl, SYNC_CTRL_TC_S, SYNC_CTRL_TI_S,
+                     RESAMPLER_MAX_PPM);
+      break;
+    case CONTROL_SLIP:
+      sync_ctrl_init(&c->ctrl, SYNC_CTRL_TC_S, SYNC_CTRL_TI_S,
+                     SAMPLE_SLIP_MAX_PPM);
+      break;
+    default:
+      sync_ctrl_init(&c->ctrl, SYNC_CTRL_TC_S, SYNC_CTRL_TI_S,
+                     SYNC_APLL_MAX_PPM);
+      break;
+  }
+
+  c->converged = -1;
+}
+
+/**
+ * Start of the first hold window with all peaks within limit.
+ *
+ * @return µs or -1 if there is none
+ */
+static int64_t converged_at(const int64_t *peak, int64_t periods,
+                            double limit) {
+  int64_t hold = CONVERGED_HOLD_US / PEAK_US;
+  int64_t n, run = 0;
+
+  for (n = 0; n < periods; n++) {
+    if ((double)peak[n] > limit) {
+      run = 0;
+    } else if (++run >= hold) {
+      return (n + 1 - hold) * PEAK_US;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ *
+ */
+static void client_time_sync(sim_client_t *c, const sim_params_t *p,
+                             int64_t t) {
+  int64_t d1, d2, serverRx, c2s, s2c;
+
+  if (t < c->nextSync) {
+    return;
+  }
+
+  c->nextSync = t + (snapcast_clock_ready(&c->clock) ? SYNC_INTERVAL
+                                                     : FAST_SYNC_INTERVAL);
+
+  d1 = uplink_delay(c, p);
+  d2 = downlink_delay(c, p, t + d1);
+  if (rand_unit(&c->rng) < p->loss) {
+    return;
+  }
+
+  serverRx = server_time(t + d1);
+  c2s = serverRx - local_time(c, t);
+  s2c = local_time(c, t + d1 + d2) - serverRx;
+
+  snapcast_clock_insert(&c->clock, local_time(c, t + d1 + d2),
+                        (c2s - s2c) / 2, c2s + s2c);
+}
+
+/**
+ * Chunk k is sent when its audio is complete, a lost one is retransmitted
+ * and TCP delivers the ones after it no earlier.
+ */
+static void client_receive(sim_client_t *c, const sim_params_t *p, int64_t k,
+                           int64_t t) {
+  int64_t a = t + downlink_delay(c, p, t);
+
+  if (rand_unit(&c->rng) < p->loss) {
+    a += RTO_US;
+  }
+
+  if (a < c->lastArrival) {
+    a = c->lastArrival;
+  }
+
+  c->lastArrival = a;
+  c->arrival[k % CHUNK_RING] = a;
+}
+
+/**
+ *
+ */
+static int64_t chunk_timestamp(int64_t k) {
+  return SERVER_EPOCH + k * CHUNK_US;
+}
+
+/**
+ *
+ */
+static void client_resync(sim_client_t *c, const sim_params_t *p, int64_t t,
+                          int underrun) {
+  c->synced = 0;
+  c->resyncs++;
+  if (underrun) {
+    c->underruns++;
+  }
+  if (t >= p->duration / 2) {
+    c->steadyResyncs++;
+  }
+}
+
+/**
+ * Speed of chunk k from the correction, true µs it plays.
+ */
+static double client_chunk_duration(sim_client_t *c, const sim_params_t *p,
+                                    float ppm) {
+  double frames = CHUNK_FRAMES;
+
+  switch (p->control) {
+    case CONTROL_RESAMPLER:
+      c->ppm = ppm;
+      break;
+
+    case CONTROL_SLIP: {
+      // see the write path of player_task()
+      int8_t delta = 0;
+
+      c->slipFrames += ppm * 1e-6f * CHUNK_FRAMES;
+      if (c->slipFrames > 2.0f) {
+        c->slipFrames = 2.0f;
+      } else if (c->slipFrames < -2.0f) {
+        c->slipFrames = -2.0f;
+      }
+
+      if (c->slipFrames >= 1.0f) {
+        delta = -1;
+      } else if (c->slipFrames <= -1.0f) {
+        delta = 1;
+      }
+
+      c->slipFrames += delta;
+      frames += delta;
+      c->ppm = 0.0f;
+      break;
+    }
+
+    default: {
+      int sdm0, sdm1, sdm2, oDiv;
+
+      if (sync_apll_set_ppm(&c->apll, ppm, &sdm0, &sdm1, &sdm2, &oDiv)) {
+        c->writes++;
+      }
+      c->ppm = sync_apll_get_ppm(&c->apll);
+      break;
+    }
+  }
+
+  return CHUNK_US * frames / CHUNK_FRAMES / (1.0 + c->ppm * 1e-6) /
+         (1.0 + c->xtal);
+}
+
+/**
+ * Hard sync: drop late chunks, start the first one that isn't on time.
+ */
+static void client_sync(sim_client_t *c, const sim_params_t *p, int64_t t) {
+  int64_t local = local_time(c, t);
+  int64_t offset = snapcast_clock_offset(&c->clock, local);
+  int i;
+
+  while (c->next < c->arrived) {
+    int64_t age = local + offset - chunk_timestamp(c->next) - p->bufUs;
+
+    if (age > 0) {
+      c->next++;
+      c->drops++;
+
+      continue;
+    }
+
+    MEDIANFILTER_Init(&c->shortFilter);
+    MEDIANFILTER_Init(&c->miniFilter);
+
+    // back to nominal speed like the hard resync in player_task()
+    if (p->control == CONTROL_APLL) {
+      int sdm0, sdm1, sdm2, oDiv;
+
+      if (sync_apll_set_ppm(&c->apll, 0.0f, &sdm0, &sdm1, &sdm2, &oDiv)) {
+        c->writes++;
+      }
+      c->ppm = 0.0f;
+    }
+
+    // timer in local µs, then the preloaded chunks play as they are
+    c->playAt = t + -age / (1.0 + c->xtal);
+    c->playing = (int64_t)c->playAt;
+    c->synced = 1;
+
+    for (i = 0; (i < CHNK_CTRL_CNT) && (c->next < c->arrived); i++) {
+      c->err = llround(c->playAt) + SERVER_EPOCH - chunk_timestamp(c->next) -
+               p->bufUs;
+      c->playAt += CHUNK_US / (1.0 + c->xtal);
+      c->next++;
+    }
+
+    return;
+  }
+}
+
+/**
+ * Chunk next, written to DMA when CHNK_CTRL_CNT chunks are in front of it.
+ */
+static void client_play(sim_client_t *c, const sim_params_t *p, int64_t t) {
+  int64_t local, age, shortMedian, miniMedian;
+  float ppm = c->ppm;
+
+  if (t < c->playAt - CHNK_CTRL_CNT * CHUNK_US) {
+    return;
+  }
+
+  if (c->next >= c->arrived) {
+    client_resync(c, p, t, 1);
+
+    return;
+  }
+
+  local = local_time(c, t);
+  age = local_time(c, llround(c->playAt)) +
+        snapcast_clock_offset(&c->clock, local) -
+        chunk_timestamp(c->next) - p->bufUs +
+        (int64_t)rand_uniform(&c->rng, p->noise);
+  shortMedian = MEDIANFILTER_Insert(&c->shortFilter, age);
+  miniMedian = MEDIANFILTER_Insert(&c->miniFilter, age);
+
+  if ((c->arrived - c->next - 1 == 0) ||
+      (MEDIANFILTER_isFull(&c->shortFilter, 0) &&
+       (llabs(shortMedian) > HARD_RESYNC_THRESHOLD))) {
+    client_resync(c, p, t, 0);
+
+    return;
+  }
+
+  if (MEDIANFILTER_isFull(&c->shortFilter, 0)) {
+    ppm = sync_ctrl_update(&c->ctrl, miniMedian, CHUNK_US);
+  } else if (p->control != CONTROL_APLL) {
+    // the resampler keeps its ratio, slips wait for the filter
+    ppm = (p->control == CONTROL_RESAMPLER) ? c->ppm : 0.0f;
+  }
+
+  c->err = llround(c->playAt) + SERVER_EPOCH - chunk_timestamp(c->next) -
+           p->bufUs;
+  c->playAt += client_chunk_duration(c, p, ppm);
+  c->next++;
+}
+
+/**
+ *
+ */
+static void print_timeline_head(const sim_params_t *p) {
+  int i;
+
+  printf("%8s %8s", "t", "spread");
+  for (i = 0; i < p->clients; i++) {
+    printf(" %7s%d", "c", i);
+  }
+  printf("\n");
+}
+
+/**
+ *
+ */
+static void print_timeline(const sim_params_t *p, int64_t t, int64_t spread) {
+  int i;
+
+  printf("%7llds", (long long)(t / 1000000));
+  if (spread < 0) {
+    printf(" %8s", "-");
+  } else {
+    printf(" %8lld", (long long)spread);
+  }
+
+  for (i = 0; i < p->clients; i++) {
+    if (clients[i].synced && (t >= clients[i].playing)) {
+      printf(" %8lld", (long long)clients[i].err);
+    } else {
+      printf(" %8s", "-");
+    }
+  }
+  printf("\n");
+}
+
+/**
+ *
+ */
+static void simulate(const sim_params_t *p, sim_result_t *res) {
+  int64_t periods = (p->duration + PEAK_US - 1) / PEAK_US;
+  int64_t sent = 0, t;
+  int i;
+
+  memset(res, 0, sizeof(sim_result_t));
+  res->converged = -1;
+  res->peak = calloc(periods, sizeof(int64_t));
+
+  for (i = 0; i < p->clients; i++) {
+    client_init(&clients[i], p, i);
+    clients[i].peak = calloc(periods, sizeof(int64_t));
+  }
+
+  if (p->interval) {
+    print_timeline_head(p);
+  }
+
+  for (t = 0; t < p->duration; t += TICK_US) {
+    int64_t lo = INT64_MAX, hi = INT64_MIN;
+    int64_t n = t / PEAK_US;
+    int all = 1;
+
+    // server side, chunk k is complete at the true time it was recorded
+    while (sent * CHUNK_US <= t) {
+      for (i = 0; i < p->clients; i++) {
+        client_receive(&clients[i], p, sent, t);
+      }
+      sent++;
+    }
+
+    for (i = 0; i < p->clients; i++) {
+      sim_client_t *c = &clients[i];
+
+      client_time_sync(c, p, t);
+
+      while ((c->arrived < sent) &&
+             (c->arrival[c->arrived % CHUNK_RING] <= t)) {
+        c->arrived++;
+      }
+
+      if (snapcast_clock_ready(&c->clock) == false) {
+        all = 0;
+        c->peak[n] = INT64_MAX;
+
+        continue;
+      }
+
+      if (c->synced == 0) {
+        client_sync(c, p, t);
+      } else {
+        client_play(c, p, t);
+      }
+
+      if ((c->synced == 0) || (t < c->playing)) {
+        all = 0;
+        c->peak[n] = INT64_MAX;
+
+        continue;
+      }
+
+      if (llabs(c->err) > c->peak[n]) {
+        c->peak[n] = llabs(c->err);
+      }
+
+      if (t >= p->duration / 2) {
+        c->samples++;
+        c->errSum2 += (double)c->err * c->err;
+        if (llabs(c->err) > c->errMax) {
+          c->errMax = llabs(c->err);
+        }
+      }
+
+      if (c->err < lo) {
+        lo = c->err;
+      }
+      if (c->err > hi) {
+        hi = c->err;
+      }
+    }
+
+    if (all == 0) {
+      res->peak[n] = INT64_MAX;
+    } else if (hi - lo > res->peak[n]) {
+      res->peak[n] = hi - lo;
+    }
+
+    if (all && (t >= p->duration / 2)) {
+      res->samples++;
+      res->spreadSum2 += (double)(hi - lo) * (hi - lo);
+      if (hi - lo > res->spreadMax) {
+        res->spreadMax = hi - lo;
+      }
+    } else if ((all == 0) && (t >= p->duration / 2)) {
+      // nobody is in sync with a client that is muted
+      res->spreadMax = INT64_MAX;
+    }
+
+    if (p->interval && (t % p->interval == 0)) {
+      print_timeline(p, t, all ? hi - lo : -1);
+    }
+  }
+
+  for (i = 0; i < p->clients; i++) {
+    sim_client_t *c = &clients[i];
+
+    if (c->samples) {
+      c->converged = converged_at(
+          c->peak, periods, CONVERGED_RMS_K * sqrt(c->errSum2 / c->samples));
+    }
+    free(c->peak);
+    c->peak = NULL;
+
+    res->resyncs += c->resyncs;
+    res->steadyResyncs += c->steadyResyncs;
+  }
+
+  if (res->samples) {
+    double limit = CONVERGED_RMS_K * sqrt(res->spreadSum2 / res->samples);
+
+    res->converged =
+        converged_at(res->peak, periods, fmin(limit, (double)p->gate));
+  }
+  free(res->peak);
+  res->peak = NULL;
+
+  // a group isn't converged before any of its clients
+  for (i = 0; (i < p->clients) && (res->converged >= 0); i++) {
+    if (clients[i].converged < 0) {
+      res->converged = -1;
+    } else if (clients[i].converged > res->converged) {
+      res->converged = clients[i].converged;
+    }
+  }
+}
+
+/**
+ *
+ */
+static int check_result(const sim_params_t *p, const sim_result_t *r) {
+  int i;
+
+  for (i = 0; i < p->clients; i++) {
+    if ((r->converged >= 0) && ((clients[i].converged < 0) ||
+                                (clients[i].converged > r->converged))) {
+      printf("group converged before client %d\n", i);
+
+      return 0;
+    }
+  }
+
+  return (r->converged >= 0) && (r->steadyResyncs == 0) &&
+         (r->spreadMax <= p->gate);
+}
+
+/**
+ *
+ */
+static void print_spread(const sim_result_t *r) {
+  if (r->converged < 0) {
+    printf(" %10s", "never");
+  } else {
+    printf(" %9.1fs", r->converged / 1e6);
+  }
+
+  if (r->spreadMax == INT64_MAX) {
+    printf(" %9s %9s", "-", "muted");
+  } else {
+    printf(" %9.1f %9lld", r->samples ? sqrt(r->spreadSum2 / r->samples) : 0,
+           (long long)r->spreadMax);
+  }
+}
+
+/**
+ *
+ */
+static void print_clients(const sim_params_t *p) {
+  int i;
+
+  printf("%-8s %8s %10s %9s %9s %8s %9s %6s %8s\n", "client", "xtal ppm",
+         "converged", "rms err", "max err", "resyncs", "underrun", "drops",
+         "writes");
+
+  for (i = 0; i < p->clients; i++) {
+    const sim_client_t *c = &clients[i];
+
+    printf("%-8d %8.1f", i, c->xtal * 1e6);
+    if (c->converged < 0) {
+      printf(" %10s", "never");
+    } else {
+      printf(" %9.1fs", c->converged / 1e6);
+    }
+    printf(" %9.1f %9lld %8u %9u %6u %8u\n",
+           c->samples ? sqrt(c->errSum2 / c->samples) : 0,
+           (long long)c->errMax, c->resyncs, c->underruns, c->drops,
+           c->writes);
+  }
+}
+
+/**
+ *
+ */
+static int sweep(sim_params_t p) {
+  static const double jitters[] = {200, 500, 1000};
+  static const double losses[] = {0, 0.01, 0.05};
+  static const double bloats[] = {0, 5000, 10000};
+  uint32_t j, l, b;
+  int failed = 0;
+
+  p.interval = 0;
+
+  printf("%7s %6s %7s %10s %9s %9s %8s %6s\n", "jitter", "loss", "bloat",
+         "converged", "rms sprd", "max sprd", "resyncs", "");
+
+  for (j = 0; j < sizeof(jitters) / sizeof(jitters[0]); j++) {
+    for (l = 0; l < sizeof(losses) / sizeof(losses[0]); l++) {
+      for (b = 0; b < sizeof(bloats) / sizeof(bloats[0]); b++) {
+        sim_result_t r;
+        int ok;
+
+        p.jitter = jitters[j];
+        p.loss = losses[l];
+        p.bloat = bloats[b];
+        simulate(&p, &r);
+        ok = check_result(&p, &r);
+
+        printf("%7.0f %6.2f %7.0f", p.jitter, p.loss, p.bloat);
+        print_spread(&r);
+        printf(" %8u %6s\n", r.resyncs, ok ? "ok" : "FAILED");
+
+        failed += !ok;
+      }
+    }
+  }
+
+  return failed;
+}
+
+int main(int argc, char **argv) {
+  sim_params_t p = {
+      .clients = 4,
+      .control = CONTROL_APLL,
+      .drift = 50e-6,
+      .jitter = 500,
+      .loss = 0.001,
+      .bloat = 0,
+      .noise = 50,
+      .bufUs = 1000000,
+      .duration = 300000000LL,
+      .interval = 0,
+      .gate = 2500,
+      .seed = 1,
+  };
+  sim_result_t r;
+  int doSweep = 0;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc)) {
+      p.clients = atoi(argv[++i]);
+    } else if ((strcmp(argv[i], "-c") == 0) && (i + 1 < argc)) {
+      i++;
+      if (strcmp(argv[i], "resampler") == 0) {
+        p.control = CONTROL_RESAMPLER;
+      } else if (strcmp(argv[i], "slip") == 0) {
+        p.control = CONTROL_SLIP;
+      } else {
+        p.control = CONTROL_APLL;
+      }
+    } else if ((strcmp(argv[i], "-d") == 0) && (i + 1 < argc)) {
+      p.drift = atof(argv[++i]) / 1e6;
+    } else if ((strcmp(argv[i], "-j") == 0) && (i + 1 < argc)) {
+      p.jitter = atof(argv[++i]);
+    } else if ((strcmp(argv[i], "-l") == 0) && (i + 1 < argc)) {
+      p.loss = atof(argv[++i]);
+    } else if ((strcmp(argv[i], "-b") == 0) && (i + 1 < argc)) {
+      p.bloat = atof(argv[++i]);
+    } else if ((strcmp(argv[i], "-m") == 0) && (i + 1 < argc)) {
+      p.noise = atof(argv[++i]);
+    } else if ((strcmp(argv[i], "-B") == 0) && (i + 1 < argc)) {
+      p.bufUs = atoll(argv[++i]) * 1000LL;
+    } else if ((strcmp(argv[i], "-t") == 0) && (i + 1 < argc)) {
+      p.duration = atoll(argv[++i]) * 1000000LL;
+    } else if ((strcmp(argv[i], "-i") == 0) && (i + 1 < argc)) {
+      p.interval = atoll(argv[++i]) * 1000000LL;
+    } else if ((strcmp(argv[i], "-g") == 0) && (i + 1 < argc)) {
+      p.gate = atoll(argv[++i]);
+    } else if (strcmp(argv[i], "-S") == 0) {
+      doSweep = 1;
+    } else if ((strcmp(argv[i], "-r") == 0) && (i + 1 < argc)) {
+      p.seed = atoi(argv[++i]);
+    } else {
+      fprintf(stderr,
+              "usage: %s [-n clients] [-c apll|resampler|slip] [-d drift ppm] "
+              "[-j jitter us] [-l loss rate] [-b bloat us] [-m noise us] "
+              "[-B buffer ms] [-t seconds] [-i interval s] [-g gate us] [-S] "
+              "[-r seed]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  if ((p.clients < 1) || (p.clients > MAX_CLIENTS)) {
+    fprintf(stderr, "1 to %d clients\n", MAX_CLIENTS);
+    return 1;
+  }
+
+  printf("%d clients, %s, drift +-%.1fppm, noise %.0fus, buffer %lldms, "
+         "%llds, gate %lldus\n",
+         p.clients, controlNames[p.control], p.drift * 1e6, p.noise,
+         (long long)p.bufUs / 1000, (long long)p.duration / 1000000,
+         (long long)p.gate);
+
+  if (doSweep) {
+    return sweep(p) ? 1 : 0;
+  }
+
+  printf("jitter %.0fus, loss %.3f, bloat %.0fus\n", p.jitter, p.loss,
+         p.bloat);
+
+  simulate(&p, &r);
+
+  print_clients(&p);
+
+  printf("%-8s %10s %9s %9s %8s\n", "group", "converged", "rms sprd",
+         "max sprd", "resyncs");
+  printf("%-8s", "");
+  print_spread(&r);
+  printf(" %8u\n", r.resyncs);
+
+  if (check_result(&p, &r) == 0) {
+    printf("FAILED\n");
+
+    return 1;
+  }
+
+  return 0;
+}
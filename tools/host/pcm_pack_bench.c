@@ -0,0 +1,370 @@
+/* Host benchmark for pcm_pack
+
+   Checks every kernel against a per sample reference for 16, 24 and 32 bit
+   input, 1 to 8 channels and both slot widths, over frame counts hitting the
+   odd channel tail, plus a few hand written byte patterns of the I2S layout.
+   The in place conversion of opus output is checked the same way. Then
+   reports the cost per frame of the loops write_callback and the opus task
+   used before and of the kernels for the formats streams usually have.
+
+   usage: pcm_pack_bench [-n frames]
+
+   Returns 1 if a kernel differs from the reference.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pcm_pack.h"
+
+#define BENCH_ROUNDS 200
+
+static const uint32_t checkFrames[] = {0, 1, 2, 3, 17, 4096};
+
+/**
+ *
+ */
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Sign extended random sample of bits like FLAC__int32.
+ */
+static int32_t sample(uint8_t bits) {
+  uint32_t raw = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+
+  return (int32_t)(raw << (32 - bits)) >> (32 - bits);
+}
+
+/**
+ * One sample at a time in frame order, as the layout is documented.
+ */
+static void reference(uint32_t *dst, int32_t *const src[], uint32_t frames,
+                      uint8_t bits, uint8_t ch, uint8_t slotBits) {
+  uint32_t n = 0, i, c;
+
+  for (i = 0; i < frames; i++) {
+    for (c = 0; c < ch; c++, n++) {
+      if (slotBits == 32) {
+        dst[n] = (uint32_t)src[c][i] << (32 - bits);
+      } else {
+        uint32_t s = (uint32_t)(src[c][i] >> (bits - 16)) & 0xFFFF;
+
+        if (n & 1) {
+          dst[n / 2] |= s;
+        } else {
+          dst[n / 2] = s << 16;
+        }
+      }
+    }
+  }
+}
+
+/**
+ * @return number of mismatches
+ */
+static int check(uint8_t bits, uint8_t ch, uint8_t slotBits) {
+  pcm_pack_fn_t pack = pcm_pack_select(bits, ch, slotBits);
+  int32_t *src[PCM_PACK_MAX_CHANNELS];
+  uint32_t maxFrames = checkFrames[sizeof(checkFrames) / sizeof(uint32_t) - 1];
+  uint32_t *ref, *dut;
+  int errors = 0;
+  uint32_t f, c, i;
+
+  if (pack == NULL) {
+    printf("  no kernel for %u bit %u ch %u bit slots\n", bits, ch, slotBits);
+
+    return 1;
+  }
+
+  // one guard word behind the packed size
+  ref = malloc(maxFrames * ch * 4 + 4);
+  dut = malloc(maxFrames * ch * 4 + 4);
+  for (c = 0; c < ch; c++) {
+    src[c] = malloc(maxFrames * sizeof(int32_t));
+  }
+
+  srand(bits * 100 + ch * 10 + slotBits);
+
+  for (f = 0; f < sizeof(checkFrames) / sizeof(uint32_t); f++) {
+    uint32_t frames = checkFrames[f];
+    size_t bytes = pcm_pack_bytes(frames, ch, slotBits);
+
+    for (c = 0; c < ch; c++) {
+      for (i = 0; i < frames; i++) {
+        src[c][i] = sample(bits);
+      }
+    }
+
+    memset(ref, 0xA5, maxFrames * ch * 4 + 4);
+    memset(dut, 0xA5, maxFrames * ch * 4 + 4);
+
+    reference(ref, src, frames, bits, ch, slotBits);
+    pack(dut, (const int32_t *const *)src, frames);
+
+    if (memcmp(ref, dut, bytes + 4) != 0) {
+      if (errors++ < 5) {
+        printf("  %u bit %u ch %u bit slots, %u frames differ\n", bits, ch,
+               slotBits, frames);
+      }
+    }
+  }
+
+  for (c = 0; c < ch; c++) {
+    free(src[c]);
+  }
+  free(ref);
+  free(dut);
+
+  return errors;
+}
+
+/**
+ * @return number of mismatches
+ */
+static int golden(void) {
+  static const struct {
+    uint8_t bits, ch, slotBits;
+    uint32_t frames;
+    int32_t samples[6];  // in frame order
+    uint8_t bytes[24];
+    size_t len;
+  } cases[] = {
+      // L 0x1234 R 0x5678 is the word 0x12345678, little endian in memory
+      {16, 2, 16, 1, {0x1234, 0x5678}, {0x78, 0x56, 0x34, 0x12}, 4},
+      {16, 2, 32, 1, {0x1234, -2},
+       {0x00, 0x00, 0x34, 0x12, 0x00, 0x00, 0xFE, 0xFF}, 8},
+      {24, 1, 32, 1, {0x123456}, {0x00, 0x56, 0x34, 0x12}, 4},
+      {24, 2, 16, 1, {0x123456, -0x100}, {0xFF, 0xFF, 0x34, 0x12}, 4},
+      {32, 1, 32, 1, {0x12345678}, {0x78, 0x56, 0x34, 0x12}, 4},
+      // three channels share a word every other frame
+      {16, 3, 16, 2, {1, 2, 3, 4, 5, 6},
+       {0x02, 0x00, 0x01, 0x00, 0x04, 0x00, 0x03, 0x00, 0x06, 0x00, 0x05,
+        0x00},
+       12},
+      {16, 1, 16, 1, {0x1234}, {0x00, 0x00, 0x34, 0x12}, 4},
+  };
+  int errors = 0;
+  uint32_t n, c, i;
+
+  for (n = 0; n < sizeof(cases) / sizeof(cases[0]); n++) {
+    int32_t planar[PCM_PACK_MAX_CHANNELS][2];
+    const int32_t *src[PCM_PACK_MAX_CHANNELS];
+    uint8_t out[24];
+    pcm_pack_fn_t pack =
+        pcm_pack_select(cases[n].bits, cases[n].ch, cases[n].slotBits);
+
+    for (c = 0; c < cases[n].ch; c++) {
+      for (i = 0; i < cases[n].frames; i++) {
+        planar[c][i] = cases[n].samples[i * cases[n].ch + c];
+      }
+      src[c] = planar[c];
+    }
+
+    memset(out, 0xA5, sizeof(out));
+    pack(out, src, cases[n].frames);
+
+    if ((pcm_pack_bytes(cases[n].frames, cases[n].ch, cases[n].slotBits) !=
+         cases[n].len) ||
+        (memcmp(out, cases[n].bytes, cases[n].len) != 0)) {
+      printf("  golden %u: %u bit %u ch %u bit slots differ\n", n,
+             cases[n].bits, cases[n].ch, cases[n].slotBits);
+      errors++;
+    }
+  }
+
+  if ((pcm_pack_select(8, 2, 16) != NULL) ||
+      (pcm_pack_select(16, 0, 16) != NULL) ||
+      (pcm_pack_select(16, 9, 16) != NULL) ||
+      (pcm_pack_select(16, 2, 24) != NULL)) {
+    printf("  unsupported formats not rejected\n");
+    errors++;
+  }
+
+  return errors;
+}
+
+/**
+ * @return number of mismatches
+ */
+static int check_int16(void) {
+  static const uint32_t counts[] = {0, 1, 2, 3, 960, 1919};
+  int16_t src[1920 + 2];
+  uint32_t ref[961], dut[961], inPlace[961];
+  int32_t planar[1920];
+  const int32_t *mono[1] = {planar};
+  int errors = 0;
+  uint32_t n, i;
+
+  srand(16);
+
+  for (n = 0; n < sizeof(counts) / sizeof(counts[0]); n++) {
+    uint32_t samples = counts[n];
+    size_t bytes = pcm_pack_bytes(samples, 1, 16);
+
+    // interleaved samples in one channel give the same layout
+    for (i = 0; i < samples; i++) {
+      planar[i] = sample(16);
+      src[i] = (int16_t)planar[i];
+    }
+    src[samples] = 0x5A5A;  // read up to the word boundary
+
+    memset(ref, 0xA5, sizeof(ref));
+    memset(dut, 0xA5, sizeof(dut));
+    memcpy(inPlace, src, sizeof(inPlace));
+
+    pcm_pack_select(16, 1, 16)(ref, mono, samples);
+    pcm_pack_int16(dut, src, samples);
+    pcm_pack_int16(inPlace, inPlace, samples);
+
+    if ((memcmp(ref, dut, bytes + 4) != 0) ||
+        (memcmp(ref, inPlace, bytes) != 0)) {
+      if (errors++ < 5) {
+        printf("  int16 %u samples differ\n", samples);
+      }
+    }
+  }
+
+  return errors;
+}
+
+/**
+ * write_callback before the kernels, 16 bit stereo only.
+ */
+static void legacy(void *dst, const int32_t *const buffer[],
+                   uint32_t frames) {
+  volatile uint32_t *out = (volatile uint32_t *)dst;
+  uint32_t i;
+
+  for (i = 0; i < frames; i++) {
+    out[i] = ((uint32_t)((buffer[0][i] >> 8) & 0xFF) << 24) |
+             ((uint32_t)((buffer[0][i] >> 0) & 0xFF) << 16) |
+             ((uint32_t)((buffer[1][i] >> 8) & 0xFF) << 8) |
+             ((uint32_t)((buffer[1][i] >> 0) & 0xFF) << 0);
+  }
+}
+
+/**
+ * opus task before decoding in place, interleaved 16 bit stereo in buffer[0].
+ */
+static void legacy_int16(void *dst, const int32_t *const buffer[],
+                         uint32_t frames) {
+  const int16_t *audio = (const int16_t *)buffer[0];
+  volatile uint32_t *sample;
+  uint32_t tmpData;
+  uint32_t cnt = 0;
+  uint32_t i;
+
+  for (i = 0; i < frames * 4; i += 4) {
+    sample = (volatile uint32_t *)((uint8_t *)dst + i);
+    tmpData = (((uint32_t)audio[cnt] << 16) & 0xFFFF0000) |
+              (((uint32_t)audio[cnt + 1] << 0) & 0x0000FFFF);
+    *sample = (volatile uint32_t)tmpData;
+
+    cnt += 2;
+  }
+}
+
+/**
+ * pcm_pack_int16 in place on 16 bit stereo.
+ */
+static void in_place_int16(void *dst, const int32_t *const buffer[],
+                           uint32_t frames) {
+  (void)buffer;
+
+  pcm_pack_int16(dst, dst, frames * 2);
+}
+
+/**
+ * @return ns per frame
+ */
+static double bench(pcm_pack_fn_t pack, uint8_t bits, uint8_t ch,
+                    uint32_t frames) {
+  int32_t *src[PCM_PACK_MAX_CHANNELS];
+  uint32_t *dst = malloc(frames * ch * 4);
+  uint64_t t0;
+  uint32_t c, i;
+  double ns;
+
+  for (c = 0; c < ch; c++) {
+    src[c] = malloc(frames * sizeof(int32_t));
+    for (i = 0; i < frames; i++) {
+      src[c][i] = sample(bits);
+    }
+  }
+
+  pack(dst, (const int32_t *const *)src, frames);
+
+  t0 = now_ns();
+  for (i = 0; i < BENCH_ROUNDS; i++) {
+    pack(dst, (const int32_t *const *)src, frames);
+  }
+  ns = (double)(now_ns() - t0) / ((double)BENCH_ROUNDS * frames);
+
+  for (c = 0; c < ch; c++) {
+    free(src[c]);
+  }
+  free(dst);
+
+  return ns;
+}
+
+int main(int argc, char **argv) {
+  static const uint8_t benchFormats[][2] = {
+      {16, 1}, {16, 2}, {24, 2}, {32, 2}, {16, 6}, {24, 8}};
+  uint32_t frames = 4608;  // largest common FLAC block size
+  int errors = 0;
+  uint8_t bits, ch;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc)) {
+      frames = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: %s [-n frames]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (frames < 1) {
+    frames = 1;
+  }
+
+  errors += golden();
+  errors += check_int16();
+  for (bits = 16; bits <= 32; bits += 8) {
+    for (ch = 1; ch <= PCM_PACK_MAX_CHANNELS; ch++) {
+      errors += check(bits, ch, 16);
+      errors += check(bits, ch, 32);
+    }
+  }
+
+  printf("pcm_pack vs reference: %s\n", errors ? "MISMATCH" : "same results");
+
+  printf("%6s %4s %6s %14s\n", "bits", "ch", "slot", "ns per frame");
+  printf("%6u %4u %6u %14.2f  (byte wise loop)\n", 16, 2, 16,
+         bench(legacy, 16, 2, frames));
+  printf("%6u %4u %6u %14.2f  (opus repack loop)\n", 16, 2, 16,
+         bench(legacy_int16, 16, 2, frames));
+  printf("%6u %4u %6u %14.2f  (opus in place)\n", 16, 2, 16,
+         bench(in_place_int16, 16, 2, frames));
+  for (i = 0; i < (int)(sizeof(benchFormats) / sizeof(benchFormats[0]));
+       i++) {
+    bits = benchFormats[i][0];
+    ch = benchFormats[i][1];
+
+    printf("%6u %4u %6u %14.2f\n", bits, ch, pcm_pack_slot_bits(bits),
+           bench(pcm_pack_select(bits, ch, pcm_pack_slot_bits(bits)), bits,
+                 ch, frames));
+  }
+
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,311 @@
+/* Host test for the drift correction resampler
+
+   Feeds sines in 20ms chunks through resampler.c at 44.1k and 48k with fixed
+   speed corrections and with a correction changing every chunk, as the
+   player's control loop does. Every output frame has a known position in
+   the input, so THD+N is the residual after fitting a sine of the input
+   frequency at those positions. Then reports the cost per second of audio.
+
+   usage: resampler_test [-s seconds]
+
+   Returns 1 if THD+N of a 1 kHz tone at 16 bit is above THD_N_LIMIT_DB or
+   the output length doesn't follow the ratio.
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "resampler.h"
+
+#define CHUNK_MS 20
+#define AMPLITUDE 0.89  // -1 dBFS
+#define THD_N_LIMIT_DB -90.0
+#define SKIP_FRAMES 64  // start of the output, primed with silence
+
+/**
+ *
+ */
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Stereo sine in slot layout, right channel a quarter period later.
+ */
+static void *make_input(uint32_t frames, double w, uint8_t slotBits) {
+  uint32_t *buf = malloc((size_t)frames * 2 * slotBits / 8);
+  uint32_t i;
+
+  for (i = 0; i < frames; i++) {
+    double l = AMPLITUDE * sin(w * i);
+    double r = AMPLITUDE * cos(w * i);
+
+    if (slotBits == 16) {
+      int16_t sl = (int16_t)lrint(l * 32767.0);
+      int16_t sr = (int16_t)lrint(r * 32767.0);
+
+      buf[i] = ((uint32_t)(uint16_t)sl << 16) | (uint16_t)sr;
+    } else {
+      // 24 bit left aligned
+      buf[2 * i] = (uint32_t)((int32_t)lrint(l * 8388607.0) << 8);
+      buf[2 * i + 1] = (uint32_t)((int32_t)lrint(r * 8388607.0) << 8);
+    }
+  }
+
+  return buf;
+}
+
+/**
+ * Output sample of channel ch in full scale units.
+ */
+static double output_sample(const void *out, uint32_t j, int ch,
+                            uint8_t slotBits) {
+  if (slotBits == 16) {
+    uint32_t w = ((const uint32_t *)out)[j];
+
+    return (double)(int16_t)(ch ? w : (w >> 16)) / 32767.0;
+  }
+
+  return (double)((const int32_t *)out)[2 * j + ch] / 2147483392.0;
+}
+
+typedef struct fit {
+  // normal equations of x = a sin + b cos + c
+  double ss, sc, cc, s1, c1, n, xs, xc, x1, xx;
+} fit_t;
+
+/**
+ *
+ */
+static void fit_add(fit_t *f, double phase, double x) {
+  double s = sin(phase), c = cos(phase);
+
+  f->ss += s * s;
+  f->sc += s * c;
+  f->cc += c * c;
+  f->s1 += s;
+  f->c1 += c;
+  f->n += 1;
+  f->xs += x * s;
+  f->xc += x * c;
+  f->x1 += x;
+  f->xx += x * x;
+}
+
+/**
+ * @return residual power relative to the fitted sine in dB
+ */
+static double fit_thd_n(const fit_t *f) {
+  double m[3][4] = {{f->ss, f->sc, f->s1, f->xs},
+                    {f->sc, f->cc, f->c1, f->xc},
+                    {f->s1, f->c1, f->n, f->x1}};
+  double v[3], signal, residual;
+  int i, j, k;
+
+  // gaussian elimination, the system is well conditioned
+  for (i = 0; i < 3; i++) {
+    for (j = i + 1; j < 3; j++) {
+      double r = m[j][i] / m[i][i];
+
+      for (k = i; k < 4; k++) {
+        m[j][k] -= r * m[i][k];
+      }
+    }
+  }
+  for (i = 2; i >= 0; i--) {
+    v[i] = m[i][3];
+    for (k = i + 1; k < 3; k++) {
+      v[i] -= m[i][k] * v[k];
+    }
+    v[i] /= m[i][i];
+  }
+
+  // sum (x - fit)^2 = xx - fit . rhs for the least squares solution
+  residual = f->xx - (v[0] * f->xs + v[1] * f->xc + v[2] * f->x1);
+  signal = (v[0] * v[0] + v[1] * v[1]) / 2 * f->n;
+
+  if (residual < signal * 1e-15) {
+    residual = signal * 1e-15;
+  }
+
+  return 10.0 * log10(residual / signal);
+}
+
+/**
+ * Resample seconds of a tone of freq, ppm < -RESAMPLER_MAX_PPM sweeps the
+ * correction per chunk.
+ *
+ * @return THD+N in dB of the worse channel, 0 on error
+ */
+static double run(uint32_t sr, double freq, float ppm, uint8_t slotBits,
+                  uint32_t seconds, int *lengthErrors) {
+  const uint32_t chunk = sr * CHUNK_MS / 1000;
+  const uint32_t chunks = seconds * 1000 / CHUNK_MS;
+  const double w = 2.0 * M_PI * freq / sr;
+  uint32_t inFrames = chunk * chunks + RESAMPLER_TAPS;
+  void *in = make_input(inFrames, w, slotBits);
+  fit_t fits[2];
+  resampler_t rs;
+  double pos = 0.0;
+  uint64_t outTotal = 0;
+  double thdN[2];
+  uint32_t c, j;
+  int ch;
+
+  memset(fits, 0, sizeof(fits));
+
+  if ((in == NULL) || (resampler_init(&rs, chunk, 2, slotBits) < 0)) {
+    free(in);
+
+    return 0.0;
+  }
+
+  for (c = 0; c < chunks; c++) {
+    const uint8_t *src = (const uint8_t *)in + (size_t)c * chunk * slotBits / 4;
+    double step;
+    uint32_t n;
+
+    if (ppm < -RESAMPLER_MAX_PPM) {
+      // sweep back and forth like a control loop pulling in
+      resampler_set_ppm(&rs, 300.0f * sinf(2.0f * (float)M_PI * c / 250.0f));
+    } else {
+      resampler_set_ppm(&rs, ppm);
+    }
+
+    step = (double)rs.step / 4294967296.0;
+    n = resampler_process(&rs, src, chunk);
+
+    for (j = 0; j < n; j++, outTotal++) {
+      if (outTotal >= SKIP_FRAMES) {
+        for (ch = 0; ch < 2; ch++) {
+          fit_add(&fits[ch], w * pos, output_sample(rs.out, j, ch, slotBits));
+        }
+      }
+
+      pos += step;
+    }
+  }
+
+  // the output has advanced pos input frames, the rest is held back
+  if (fabs(pos + resampler_delay_frames(&rs) - (double)chunk * chunks) >
+      0.01) {
+    printf("  %u Hz %g ppm: %llu frames out covering %.3f of %u input "
+           "frames, %.3f held back\n",
+           sr, ppm, (unsigned long long)outTotal, pos, chunk * chunks,
+           resampler_delay_frames(&rs));
+    (*lengthErrors)++;
+  }
+
+  for (ch = 0; ch < 2; ch++) {
+    thdN[ch] = fit_thd_n(&fits[ch]);
+  }
+
+  resampler_free(&rs);
+  free(in);
+
+  return (thdN[0] > thdN[1]) ? thdN[0] : thdN[1];
+}
+
+/**
+ * @return ms of cpu time per second of audio
+ */
+static double bench(uint32_t sr, uint8_t slotBits, uint32_t seconds) {
+  const uint32_t chunk = sr * CHUNK_MS / 1000;
+  const uint32_t chunks = seconds * 1000 / CHUNK_MS;
+  void *in = make_input(chunk, 2.0 * M_PI * 1000.0 / sr, slotBits);
+  resampler_t rs;
+  uint64_t t0;
+  uint32_t c;
+
+  resampler_init(&rs, chunk, 2, slotBits);
+  resampler_set_ppm(&rs, 73.0f);
+
+  t0 = now_ns();
+  for (c = 0; c < chunks; c++) {
+    resampler_process(&rs, in, chunk);
+  }
+  t0 = now_ns() - t0;
+
+  resampler_free(&rs);
+  free(in);
+
+  return (double)t0 / 1e6 / seconds;
+}
+
+int main(int argc, char **argv) {
+  static const uint32_t rates[] = {44100, 48000};
+  static const double freqs[] = {1000.0, 10000.0};
+  // below -RESAMPLER_MAX_PPM: sweep per chunk
+  static const float ppms[] = {0.0f, 100.0f, -100.0f, 1000.0f, -1000.0f,
+                               -2000.0f};
+  uint32_t seconds = 10;
+  int errors = 0, lengthErrors = 0;
+  uint32_t r, f, p;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-s") == 0) && (i + 1 < argc)) {
+      seconds = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: %s [-s seconds]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (seconds < 1) {
+    seconds = 1;
+  }
+
+  printf("THD+N in dB, %u taps, %u phases\n", RESAMPLER_TAPS,
+         RESAMPLER_PHASES);
+  printf("%6s %6s %5s", "rate", "tone", "bits");
+  for (p = 0; p < sizeof(ppms) / sizeof(ppms[0]); p++) {
+    if (ppms[p] < -RESAMPLER_MAX_PPM) {
+      printf(" %9s", "sweep");
+    } else {
+      printf(" %5.0fppm", ppms[p]);
+    }
+  }
+  printf("\n");
+
+  for (r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+    for (f = 0; f < sizeof(freqs) / sizeof(freqs[0]); f++) {
+      uint8_t slotBits;
+
+      for (slotBits = 16; slotBits <= 32; slotBits += 16) {
+        printf("%6u %6.0f %5u", rates[r], freqs[f], slotBits == 16 ? 16 : 24);
+
+        for (p = 0; p < sizeof(ppms) / sizeof(ppms[0]); p++) {
+          double thdN = run(rates[r], freqs[f], ppms[p], slotBits, seconds,
+                            &lengthErrors);
+
+          printf(" %9.1f", thdN);
+
+          if ((slotBits == 16) && (freqs[f] == 1000.0) &&
+              (thdN > THD_N_LIMIT_DB)) {
+            errors++;
+          }
+        }
+        printf("\n");
+      }
+    }
+  }
+
+  printf("%s\n", (errors || lengthErrors) ? "FAILED" : "passed");
+
+  printf("%6s %5s %22s\n", "rate", "bits", "cpu ms per s of audio");
+  for (r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+    printf("%6u %5u %22.2f\n", rates[r], 16, bench(rates[r], 16, seconds));
+    printf("%6u %5u %22.2f\n", rates[r], 24, bench(rates[r], 32, seconds));
+  }
+
+  return (errors || lengthErrors) ? 1 : 0;
+}
@@ -0,0 +1,449 @@
+/* Host test for sample insertion and deletion
+
+   Checks sample_slip.c against a straightforward reference for 16 and 32
+   bit slots at several channel counts, filled in DMA buffer sized pieces
+   that don't line up with frames. Then slips sines once every 20ms chunk,
+   the largest correction, faded and as a plain drop or repeat of a frame.
+   The click is the largest third difference of the output relative to that
+   of the clean sine, 0 dB is no discontinuity. THD+N of the faded output is
+   the residual after fitting a sine at the positions the fade glides
+   through, the error of its linear interpolation. Also reports the cost per
+   second of audio against a plain copy.
+
+   usage: sample_slip_test [-s seconds]
+
+   Returns 1 on a mismatch with the reference or if the faded slips of a 1
+   kHz tone are above THD_N_LIMIT_DB or CLICK_LIMIT_DB.
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sample_slip.h"
+
+#define SR 48000
+#define CHUNK_FRAMES (SR / 50)
+#define AMPLITUDE 0.89  // -1 dBFS
+#define THD_N_LIMIT_DB -65.0
+#define CLICK_LIMIT_DB 3.0
+
+/**
+ *
+ */
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Raised cosine ramp as documented in sample_slip.c.
+ */
+static int32_t ref_ramp(uint32_t i) {
+  double x = (double)(i + 1) / (SAMPLE_SLIP_FADE_FRAMES + 1);
+
+  return (int32_t)lround(32768.0 * (0.5 - 0.5 * cos(M_PI * x)));
+}
+
+/**
+ * Sample s of frame n in an interleaved buffer of 16 or 32 bit slots.
+ */
+static int32_t get_sample(const uint32_t *buf, uint32_t n, uint32_t s,
+                          uint8_t ch, uint8_t slotBits) {
+  uint32_t i = n * ch + s;
+
+  if (slotBits == 16) {
+    uint32_t w = buf[i / 2];
+
+    return (int16_t)((i & 1) ? w : (w >> 16));
+  }
+
+  return (int32_t)buf[i];
+}
+
+/**
+ *
+ */
+static void set_sample(uint32_t *buf, uint32_t n, uint32_t s, uint8_t ch,
+                       uint8_t slotBits, int32_t v) {
+  uint32_t i = n * ch + s;
+
+  if (slotBits == 16) {
+    if (i & 1) {
+      buf[i / 2] = (buf[i / 2] & 0xFFFF0000) | ((uint32_t)v & 0xFFFF);
+    } else {
+      buf[i / 2] = (buf[i / 2] & 0xFFFF) | ((uint32_t)v << 16);
+    }
+  } else {
+    buf[i] = (uint32_t)v;
+  }
+}
+
+/**
+ * Output of a slip with the fade at k, sample by sample.
+ */
+static void reference(const uint32_t *in, uint32_t frames, int8_t delta,
+                      uint32_t k, uint8_t ch, uint8_t slotBits,
+                      uint32_t *out) {
+  uint32_t n, s;
+
+  for (n = 0; n < frames + delta; n++) {
+    for (s = 0; s < ch; s++) {
+      int32_t v;
+
+      if (n < k) {
+        v = get_sample(in, n, s, ch, slotBits);
+      } else if (n < k + SAMPLE_SLIP_FADE_FRAMES) {
+        int64_t a = get_sample(in, n, s, ch, slotBits);
+        int64_t b = get_sample(in, n - delta, s, ch, slotBits);
+
+        v = (int32_t)(a + (((b - a) * ref_ramp(n - k)) >> 15));
+      } else {
+        v = get_sample(in, n - delta, s, ch, slotBits);
+      }
+
+      set_sample(out, n, s, ch, slotBits, v);
+    }
+  }
+}
+
+/**
+ * Random chunks through sample_slip_fill() into DMA buffers of dmaBytes the
+ * way i2s_custom_write_cb() calls it, with what is left of the buffer, so
+ * frames get split where buffers don't end on one.
+ *
+ * @return number of mismatches
+ */
+static int check(uint8_t ch, uint8_t slotBits, uint32_t dmaBytes) {
+  const uint32_t words = CHUNK_FRAMES * ch * slotBits / 32;
+  const uint32_t frameBytes = ch * slotBits / 8;
+  uint32_t *in = malloc(words * 4);
+  uint32_t *out = malloc((words + ch) * 4);
+  uint32_t *want = malloc((words + ch) * 4);
+  int errors = 0;
+  sample_slip_t slip;
+  int8_t delta;
+  uint32_t i;
+
+  if (sample_slip_init(&slip, ch, slotBits) < 0) {
+    printf("  init failed for %u ch %u bit slots\n", ch, slotBits);
+    return 1;
+  }
+
+  for (i = 0; i < words; i++) {
+    in[i] = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+  }
+
+  for (delta = -1; delta <= 1; delta++) {
+    uint32_t outFrames = sample_slip_start(&slip, in, CHUNK_FRAMES, delta);
+    uint8_t *p = (uint8_t *)out;
+    size_t total = 0, got, pos = 0, left;
+
+    memset(out, 0, (words + ch) * 4);
+    memset(want, 0, (words + ch) * 4);
+    reference(in, CHUNK_FRAMES, delta, slip.fadeAt, ch, slotBits, want);
+
+    left = outFrames * frameBytes;
+    while (left > 0) {
+      size_t space = dmaBytes - pos;
+
+      got = sample_slip_fill(p, (space < left) ? space : left, &slip);
+      if (got == 0) {
+        break;
+      }
+      p += got;
+      total += got;
+      left -= got;
+      pos = (pos + got) % dmaBytes;
+    }
+
+    if ((outFrames != CHUNK_FRAMES + delta) ||
+        (total != outFrames * frameBytes) ||
+        (memcmp(out, want, total) != 0)) {
+      printf("  %u ch %u bit slots delta %d: %u frames, %zu bytes, %s\n", ch,
+             slotBits, delta, outFrames, total,
+             memcmp(out, want, total) ? "differs" : "same");
+      errors++;
+    }
+  }
+
+  free(in);
+  free(out);
+  free(want);
+
+  return errors;
+}
+
+typedef struct fit {
+  // normal equations of x = a sin + b cos + c
+  double ss, sc, cc, s1, c1, n, xs, xc, x1, xx;
+} fit_t;
+
+/**
+ *
+ */
+static void fit_add(fit_t *f, double phase, double x) {
+  double s = sin(phase), c = cos(phase);
+
+  f->ss += s * s;
+  f->sc += s * c;
+  f->cc += c * c;
+  f->s1 += s;
+  f->c1 += c;
+  f->n += 1;
+  f->xs += x * s;
+  f->xc += x * c;
+  f->x1 += x;
+  f->xx += x * x;
+}
+
+/**
+ * @return residual power relative to the fitted sine in dB
+ */
+static double fit_thd_n(const fit_t *f) {
+  double m[3][4] = {{f->ss, f->sc, f->s1, f->xs},
+                    {f->sc, f->cc, f->c1, f->xc},
+                    {f->s1, f->c1, f->n, f->x1}};
+  double v[3], signal, residual;
+  int i, j, k;
+
+  for (i = 0; i < 3; i++) {
+    for (j = i + 1; j < 3; j++) {
+      double r = m[j][i] / m[i][i];
+
+      for (k = i; k < 4; k++) {
+        m[j][k] -= r * m[i][k];
+      }
+    }
+  }
+  for (i = 2; i >= 0; i--) {
+    v[i] = m[i][3];
+    for (k = i + 1; k < 3; k++) {
+      v[i] -= m[i][k] * v[k];
+    }
+    v[i] /= m[i][i];
+  }
+
+  residual = f->xx - (v[0] * f->xs + v[1] * f->xc + v[2] * f->x1);
+  signal = (v[0] * v[0] + v[1] * v[1]) / 2 * f->n;
+
+  if (residual < signal * 1e-15) {
+    residual = signal * 1e-15;
+  }
+
+  return 10.0 * log10(residual / signal);
+}
+
+/**
+ * Stereo sine of freq continuing at input frame start.
+ */
+static void make_chunk(uint32_t *buf, uint64_t start, double w,
+                       uint8_t slotBits) {
+  uint32_t i;
+
+  for (i = 0; i < CHUNK_FRAMES; i++) {
+    double l = AMPLITUDE * sin(w * (start + i));
+    double r = AMPLITUDE * cos(w * (start + i));
+
+    if (slotBits == 16) {
+      buf[i] = ((uint32_t)(uint16_t)(int16_t)lrint(l * 32767.0) << 16) |
+               (uint16_t)(int16_t)lrint(r * 32767.0);
+    } else {
+      buf[2 * i] = (uint32_t)((int32_t)lrint(l * 8388607.0) << 8);
+      buf[2 * i + 1] = (uint32_t)((int32_t)lrint(r * 8388607.0) << 8);
+    }
+  }
+}
+
+/**
+ * Slip every chunk, alternately dropping and repeating. faded 0 drops or
+ * repeats a frame without the fade.
+ *
+ * @return THD+N in dB of the worse channel, click in dB in *click
+ */
+static double run(double freq, uint8_t slotBits, int faded, uint32_t seconds,
+                  double *click) {
+  const double w = 2.0 * M_PI * freq / SR;
+  const double scale = (slotBits == 16) ? 32767.0 : 2147483392.0;
+  const uint32_t chunks = seconds * 50;
+  uint32_t in[CHUNK_FRAMES * 2], out[(CHUNK_FRAMES + 1) * 2];
+  uint64_t start = 0;
+  double hist[2][3] = {{0}};
+  double maxDiff3 = 0.0;
+  uint64_t outTotal = 0;
+  fit_t fits[2];
+  sample_slip_t slip;
+  uint32_t c, n;
+  double thdN[2];
+  int s;
+
+  memset(fits, 0, sizeof(fits));
+  sample_slip_init(&slip, 2, slotBits);
+
+  for (c = 0; c < chunks; c++) {
+    int8_t delta = (c & 1) ? 1 : -1;
+    uint32_t outFrames;
+
+    make_chunk(in, start, w, slotBits);
+
+    if (faded) {
+      outFrames = sample_slip_start(&slip, in, CHUNK_FRAMES, delta);
+      sample_slip_fill(out, sizeof(out), &slip);
+    } else {
+      // plain cut at the middle of the chunk
+      uint32_t k = CHUNK_FRAMES / 2;
+
+      sample_slip_start(&slip, in, CHUNK_FRAMES, 0);
+      slip.fadeAt = k;
+      outFrames = CHUNK_FRAMES + delta;
+      for (n = 0; n < outFrames; n++) {
+        uint32_t from = (n < k) ? n : n - delta;
+
+        memcpy(&out[n * slotBits / 16], &in[from * slotBits / 16],
+               slotBits / 4);
+      }
+    }
+
+    for (n = 0; n < outFrames; n++) {
+      // input position of output frame n
+      double pos = n;
+
+      if (n >= slip.fadeAt + (faded ? SAMPLE_SLIP_FADE_FRAMES : 0)) {
+        pos = (double)n - delta;
+      } else if (faded && (n >= slip.fadeAt)) {
+        pos = n - delta * ref_ramp(n - slip.fadeAt) / 32768.0;
+      }
+
+      for (s = 0; s < 2; s++) {
+        double y = get_sample(out, n, s, 2, slotBits) / scale;
+        double diff3 = y - 3 * hist[s][0] + 3 * hist[s][1] - hist[s][2];
+
+        fit_add(&fits[s], w * (start + pos), y);
+
+        if ((outTotal >= 3) && (fabs(diff3) > maxDiff3)) {
+          maxDiff3 = fabs(diff3);
+        }
+        hist[s][2] = hist[s][1];
+        hist[s][1] = hist[s][0];
+        hist[s][0] = y;
+      }
+      outTotal++;
+    }
+
+    start += CHUNK_FRAMES;
+  }
+
+  for (s = 0; s < 2; s++) {
+    thdN[s] = fit_thd_n(&fits[s]);
+  }
+
+  // third difference of the clean sine peaks at A (2 sin(w / 2))^3
+  *click = 20.0 * log10(maxDiff3 / (AMPLITUDE * pow(2.0 * sin(w / 2), 3)));
+
+  return (thdN[0] > thdN[1]) ? thdN[0] : thdN[1];
+}
+
+/**
+ * @return ms of cpu time per second of audio, slipping every chunk or a
+ * plain copy
+ */
+static double bench(uint8_t slotBits, int slipping, uint32_t seconds) {
+  const uint32_t chunks = seconds * 50;
+  uint32_t in[CHUNK_FRAMES * 2], out[(CHUNK_FRAMES + 1) * 2];
+  volatile uint32_t sink = 0;
+  sample_slip_t slip;
+  uint64_t t0;
+  uint32_t c;
+
+  make_chunk(in, 0, 2.0 * M_PI * 1000.0 / SR, slotBits);
+  sample_slip_init(&slip, 2, slotBits);
+
+  t0 = now_ns();
+  for (c = 0; c < chunks; c++) {
+    if (slipping) {
+      sample_slip_start(&slip, in, CHUNK_FRAMES, (c & 1) ? 1 : -1);
+      sample_slip_fill(out, sizeof(out), &slip);
+    } else {
+      memcpy(out, in, CHUNK_FRAMES * slotBits / 4);
+    }
+    sink += out[c % CHUNK_FRAMES];
+  }
+  t0 = now_ns() - t0;
+
+  return (double)t0 / 1e6 / seconds;
+}
+
+int main(int argc, char **argv) {
+  static const uint8_t chs[] = {1, 2, 4, 6, 8};
+  static const uint32_t dmaBytes[] = {4096, 1500, 36};
+  static const double freqs[] = {1000.0, 10000.0};
+  uint32_t seconds = 10;
+  int errors = 0, limitErrors = 0;
+  uint32_t c, d, f;
+  uint8_t slotBits;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-s") == 0) && (i + 1 < argc)) {
+      seconds = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: %s [-s seconds]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (seconds < 1) {
+    seconds = 1;
+  }
+
+  srand(1);
+  for (slotBits = 16; slotBits <= 32; slotBits += 16) {
+    for (c = 0; c < sizeof(chs) / sizeof(chs[0]); c++) {
+      if ((slotBits == 16) && (chs[c] & 1)) {
+        continue;
+      }
+
+      for (d = 0; d < sizeof(dmaBytes) / sizeof(dmaBytes[0]); d++) {
+        errors += check(chs[c], slotBits, dmaBytes[d]);
+      }
+    }
+  }
+  printf("reference: %s\n", errors ? "FAILED" : "passed");
+
+  printf("dB slipping a frame every %dms, fade %u frames\n",
+         1000 * CHUNK_FRAMES / SR, SAMPLE_SLIP_FADE_FRAMES);
+  printf("%6s %5s %9s %9s %9s\n", "tone", "bits", "cut click", "click",
+         "THD+N");
+  for (f = 0; f < sizeof(freqs) / sizeof(freqs[0]); f++) {
+    for (slotBits = 16; slotBits <= 32; slotBits += 16) {
+      double cutClick, click, thdN;
+
+      run(freqs[f], slotBits, 0, seconds, &cutClick);
+      thdN = run(freqs[f], slotBits, 1, seconds, &click);
+
+      printf("%6.0f %5u %9.1f %9.1f %9.1f\n", freqs[f],
+             slotBits == 16 ? 16 : 24, cutClick, click, thdN);
+
+      if ((freqs[f] == 1000.0) &&
+          ((thdN > THD_N_LIMIT_DB) || (click > CLICK_LIMIT_DB))) {
+        limitErrors++;
+      }
+    }
+  }
+  printf("%s\n", limitErrors ? "FAILED" : "passed");
+
+  printf("%5s %22s %22s\n", "bits", "copy ms per s of audio",
+         "slip ms per s of audio");
+  for (slotBits = 16; slotBits <= 32; slotBits += 16) {
+    printf("%5u %22.3f %22.3f\n", slotBits == 16 ? 16 : 24,
+           bench(slotBits, 0, seconds * 10), bench(slotBits, 1, seconds * 10));
+  }
+
+  return (errors || limitErrors) ? 1 : 0;
+}
@@ -0,0 +1,1128 @@
+/* Replay of captured snapcast streams
+
+   Feeds a capture written by the stream_capture component (or snapclient_host
+   -w) through the client engine, the decoders and a model of the player's
+   sync logic using the original receive times. Reports per chunk decode
+   time and latency, queue depth over time and the hard resyncs the player
+   would do.
+
+   usage: snapcast_replay [-r] [-c] [-x factor] [-o trace.csv] capture ...
+
+     -r  replay in real time instead of as fast as possible
+     -c  model CONFIG_SNAPCLIENT_COMPRESSED_BUFFER: flac and opus chunks wait
+         encoded and are decoded once there is room in the short decoded
+         queue in front of the player
+     -x  scale host decode time before adding it to the chunk's ready time,
+         e.g. to approximate a slower target, default 1
+     -o  write one line per chunk: receive and ready time, decode time, queue
+         depth, age and player event
+
+   FLAC and Opus chunks are decoded if libFLAC and libopus were found at
+   build time, otherwise chunk durations are taken from the timestamps.
+
+   The player model follows player_task(): wait for CHNK_CTRL_CNT chunks in
+   DMA after initial sync, drop late chunks before sync (RESYNCING HARD 1),
+   resync if the queue runs empty or the short median of age exceeds 10ms
+   (RESYNCING HARD 2) and adjust playback speed by 100ppm otherwise.
+
+   Memory is reported as the target would allocate it: the pcm chunk pool
+   for the player queue plus, with -c, the peak of encoded chunks waiting
+   for the decoder. Run a capture with and without -c to compare.
+*/
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if HAVE_FLAC
+#include "FLAC/stream_decoder.h"
+#endif
+#if HAVE_OPUS
+#include "opus.h"
+#endif
+
+#include "MedianFilter.h"
+#include "snapcast.h"
+#include "snapcast_capture.h"
+#include "snapcast_client.h"
+#include "snapcast_clock.h"
+#include "test_stream.h"
+
+// see player.h and player_task()
+#define CHNK_CTRL_CNT 2
+#define SHORT_BUFFER_LEN 99
+#define MINI_BUFFER_LEN 19
+#define HARD_RESYNC_THRESHOLD 10000
+#define SHORT_OFFSET 2
+#define MINI_OFFSET 1
+#define SR_SCALER 0.0001
+
+#define MAX_DECODED_FRAMES 8192
+
+// see player.h, pcm_chunk_pool.h and main.c
+#define PLAYER_DECODE_LEAD (CHNK_CTRL_CNT + 2)
+#define PCM_CHUNK_POOL_EXTRA 3
+#define COMPRESSED_BUFFER_CHUNKS 160  // Kconfig default
+// ring buffer item header and decoderData_t on the target
+#define ENCODED_CHUNK_OVERHEAD 32
+
+// see player.h
+typedef enum codec_type_e { NONE = 0, PCM, FLAC, OGG, OPUS } codec_type_t;
+
+typedef enum player_event {
+  PLAYER_PLAY = 0,
+  PLAYER_SYNC,
+  PLAYER_DROP,
+  PLAYER_RESYNC_1,
+  PLAYER_RESYNC_2,
+} player_event_t;
+
+static const char *eventNames[] = {"play", "sync", "drop", "resync1",
+                                   "resync2"};
+
+typedef struct replay_chunk {
+  int64_t ts;      // server timestamp
+  int64_t rx;      // local receive time of last byte
+  int64_t ready;   // decoded, rx plus scaled decode time
+  int64_t dur;     // µs, 0 if not known yet
+  int64_t decode;  // host decode time in ns
+  uint32_t size;
+} replay_chunk_t;
+
+typedef struct replay {
+  // capture
+  const char *data;
+  size_t size;
+  size_t pos;
+  int64_t now;
+  bool realtime;
+  int64_t realStart;
+  int64_t captureStart;
+  double decodeScale;
+  bool compressed;
+  FILE *trace;
+
+  // stream state, set by client callbacks
+  codec_type_t codec;
+  uint32_t sr;
+  uint8_t ch, bits;
+  int64_t buf_us;
+  int64_t dacLatency_us;
+  char *chunkBuf;
+  uint32_t chunkBufSize;
+  int16_t *pcm;
+
+  replay_chunk_t *chunks;
+  size_t chunkCnt;
+  size_t chunkCap;
+
+  // time sync, see player_latency_insert()
+  snapcast_clock_t clock;
+  int64_t diffToServer;  // last one used by the player
+  int64_t lastTimeSync;
+  uint32_t timeMessages;
+
+  // player model
+  bool synced;
+  size_t next;        // next chunk the player takes from the queue
+  int64_t playerNow;  // time the player task continues
+  int64_t dmaEnd;     // time DMA runs empty
+  int64_t chkDur_us;
+  int queueEntries;
+  bool decodeAhead;     // compressed buffer and not pcm
+  size_t decoded;       // next chunk given to the decoder if decodeAhead
+  int64_t encodedSize;  // bytes waiting for the decoder
+  sMedianFilter_t shortFilter;
+  sMedianNode_t shortNodes[SHORT_BUFFER_LEN];
+  sMedianFilter_t miniFilter;
+  sMedianNode_t miniNodes[MINI_BUFFER_LEN];
+
+  // results
+  uint32_t events[PLAYER_RESYNC_2 + 1];
+  uint32_t unsynced;  // dropped before server time was known
+  uint32_t underruns;
+  uint32_t queueFull;
+  uint32_t decodeErrors;
+  int maxDepth;
+  double depthSum;
+  uint32_t depthCnt;
+  int64_t *decodeNs;
+  size_t decodeCnt;
+  int64_t encodedPeak;
+  size_t encodedPeakChunks;
+
+#if HAVE_FLAC
+  FLAC__StreamDecoder *flac;
+  const char *flacIn;
+  size_t flacInLen;
+  uint32_t flacFrames;
+#endif
+#if HAVE_OPUS
+  OpusDecoder *opus;
+#endif
+} replay_t;
+
+/**
+ *
+ */
+static int64_t host_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/**
+ *
+ */
+static int64_t host_now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// the engine takes a plain function as time base
+static replay_t *current;
+
+/**
+ *
+ */
+static int64_t replay_now(void) { return current->now; }
+
+/**
+ * Queue depth as the player sees it at time t.
+ */
+static int queue_depth(replay_t *r, int64_t t) {
+  size_t i = r->next;
+
+  while ((i < r->chunkCnt) && (r->chunks[i].ready <= t)) {
+    i++;
+  }
+
+  return i - r->next;
+}
+
+/**
+ * Duration of chunk i, decoded duration if known, else timestamp difference
+ * to the next chunk or the last known duration.
+ */
+static int64_t chunk_duration(replay_t *r, size_t i) {
+  if (r->chunks[i].dur > 0) {
+    return r->chunks[i].dur;
+  }
+
+  if (i + 1 < r->chunkCnt) {
+    int64_t d = r->chunks[i + 1].ts - r->chunks[i].ts;
+
+    if (d > 0) {
+      return d;
+    }
+  }
+
+  return r->chkDur_us;
+}
+
+/**
+ *
+ */
+static void trace_chunk(replay_t *r, size_t i, int64_t t, int depth,
+                        int64_t age, player_event_t event) {
+  const replay_chunk_t *c = &r->chunks[i];
+
+  r->events[event]++;
+
+  if ((event == PLAYER_RESYNC_1) || (event == PLAYER_RESYNC_2)) {
+    printf("  %9.3fs %s: age %lldus, diff to server %lldus, queue %d\n",
+           (t - r->captureStart) / 1e6, eventNames[event], (long long)age,
+           (long long)r->diffToServer, depth);
+  }
+
+  if (r->trace) {
+    fprintf(r->trace, "%zu,%lld,%lld,%lld,%lld,%lld,%d,%lld,%lld,%s\n", i,
+            (long long)c->ts, (long long)(c->rx - r->captureStart),
+            (long long)(c->ready - r->captureStart),
+            (long long)(t - r->captureStart), (long long)(c->decode / 1000),
+            depth, (long long)age, (long long)r->diffToServer,
+            eventNames[event]);
+  }
+}
+
+/**
+ * With a compressed buffer chunks are decoded one after the other as soon as
+ * there is room in the decoded queue at time t, see insert_pcm_chunk().
+ */
+static void decode_ahead(replay_t *r, int64_t t) {
+  while ((r->decoded < r->chunkCnt) &&
+         (r->decoded < r->next + PLAYER_DECODE_LEAD)) {
+    replay_chunk_t *c = &r->chunks[r->decoded];
+    int64_t start = (c->rx > t) ? c->rx : t;
+
+    if ((r->decoded > 0) && (r->chunks[r->decoded - 1].ready > start)) {
+      start = r->chunks[r->decoded - 1].ready;
+    }
+
+    c->ready = start + llround(c->decode * r->decodeScale / 1000.0);
+    r->encodedSize -= c->size + ENCODED_CHUNK_OVERHEAD;
+    r->decoded++;
+  }
+}
+
+/**
+ * Take chunk i from the queue at time t, returns queue depth afterwards.
+ */
+static int player_take(replay_t *r, size_t i, int64_t t) {
+  int depth = queue_depth(r, t);
+
+  r->next = i + 1;
+  depth = (depth > 0) ? depth - 1 : 0;
+
+  if (r->decodeAhead) {
+    decode_ahead(r, t);
+  }
+
+  if (depth > r->maxDepth) {
+    r->maxDepth = depth;
+  }
+
+  r->depthSum += depth;
+  r->depthCnt++;
+
+  return depth;
+}
+
+/**
+ * Run the player model until it needs a chunk that isn't ready at time t.
+ */
+static void player_advance(replay_t *r, int64_t t) {
+  const int64_t dmaTime = r->chkDur_us * CHNK_CTRL_CNT;
+
+  if (snapcast_clock_ready(&r->clock) == false) {
+    // insert_pcm_chunk() drops chunks until server time is known
+    while ((r->next < r->chunkCnt) && (r->chunks[r->next].ready <= t)) {
+      r->next++;
+      r->unsynced++;
+
+      if (r->decodeAhead) {
+        decode_ahead(r, r->chunks[r->next - 1].ready);
+      }
+    }
+
+    r->playerNow = t;
+
+    return;
+  }
+
+  if ((r->chkDur_us == 0) || (r->buf_us == 0)) {
+    // player waits for config, chunks stay queued
+    r->playerNow = t;
+
+    return;
+  }
+
+  // only what happens up to t, later chunks may still be on their way
+  while ((r->next < r->chunkCnt) && (r->chunks[r->next].ready <= t) &&
+         (r->playerNow <= t)) {
+    size_t i = r->next;
+    int64_t tp = r->playerNow;
+    int64_t age;
+    int depth;
+
+    if (r->chunks[i].ready > tp) {
+      tp = r->chunks[i].ready;
+    }
+
+    depth = player_take(r, i, tp);
+    r->diffToServer = snapcast_clock_offset(&r->clock, tp);
+    age = tp + r->diffToServer - r->chunks[i].ts - r->buf_us +
+          r->dacLatency_us;
+
+    if (r->synced == false) {
+      if (age < 0) {
+        int64_t start = tp - age;
+        int k;
+
+        MEDIANFILTER_Init(&r->shortFilter);
+        MEDIANFILTER_Init(&r->miniFilter);
+
+        trace_chunk(r, i, tp, depth, age, PLAYER_SYNC);
+
+        // first chunks go to DMA before the start timer fires
+        r->dmaEnd = start + chunk_duration(r, i);
+        for (k = 1; (k < CHNK_CTRL_CNT) && (r->next < r->chunkCnt); k++) {
+          size_t j = r->next;
+
+          if (r->chunks[j].ready > start) {
+            break;
+          }
+
+          depth = player_take(r, j, start);
+          trace_chunk(r, j, start, depth, 0, PLAYER_PLAY);
+          r->dmaEnd += chunk_duration(r, j);
+        }
+
+        r->synced = true;
+        r->playerNow = start;
+      } else {
+        int64_t c = (age + r->chkDur_us - 1) / r->chkDur_us;
+
+        trace_chunk(r, i, tp, depth, age, PLAYER_RESYNC_1);
+
+        // clear all chunks which are probably late too
+        while ((c-- > 0) && (r->next < r->chunkCnt) &&
+               (r->chunks[r->next].ready <= tp)) {
+          depth = player_take(r, r->next, tp);
+          trace_chunk(r, r->next - 1, tp, depth, age, PLAYER_DROP);
+        }
+
+        r->playerNow = tp;
+      }
+
+      continue;
+    }
+
+    age += dmaTime;
+
+    {
+      int64_t shortMedian, miniMedian, dur;
+      int dir = 0;
+
+      shortMedian = MEDIANFILTER_Insert(&r->shortFilter, age);
+      miniMedian = MEDIANFILTER_Insert(&r->miniFilter, age);
+
+      if ((depth == 0) || (MEDIANFILTER_isFull(&r->shortFilter, 0) &&
+                           (llabs(shortMedian) > HARD_RESYNC_THRESHOLD))) {
+        trace_chunk(r, i, tp, depth, age, PLAYER_RESYNC_2);
+
+        r->synced = false;
+        r->playerNow = tp;
+
+        continue;
+      }
+
+      if (MEDIANFILTER_isFull(&r->shortFilter, 0)) {
+        if ((shortMedian < -SHORT_OFFSET) && (miniMedian < -MINI_OFFSET) &&
+            (age < -MINI_OFFSET)) {
+          dir = -1;
+        } else if ((shortMedian > SHORT_OFFSET) &&
+                   (miniMedian > MINI_OFFSET) && (age > MINI_OFFSET)) {
+          dir = 1;
+        }
+      }
+
+      trace_chunk(r, i, tp, depth, age, PLAYER_PLAY);
+
+      // write blocks until the chunk fits into DMA
+      dur = llround(chunk_duration(r, i) / (1.0 + dir * SR_SCALER));
+      if (r->dmaEnd < tp) {
+        r->underruns++;
+        r->dmaEnd = tp;
+      }
+
+      if (r->dmaEnd - (dmaTime - dur) > tp) {
+        tp = r->dmaEnd - (dmaTime - dur);
+      }
+
+      r->dmaEnd += dur;
+      r->playerNow = tp;
+    }
+  }
+}
+
+#if HAVE_FLAC
+/**
+ *
+ */
+static FLAC__StreamDecoderReadStatus flac_read(
+    const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes,
+    void *client_data) {
+  replay_t *r = (replay_t *)client_data;
+
+  if (r->flacInLen == 0) {
+    *bytes = 0;
+
+    return FLAC__STREAM_DECODER_READ_STATUS_ABORT;
+  }
+
+  if (*bytes > r->flacInLen) {
+    *bytes = r->flacInLen;
+  }
+
+  memcpy(buffer, r->flacIn, *bytes);
+  r->flacIn += *bytes;
+  r->flacInLen -= *bytes;
+
+  return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+}
+
+/**
+ *
+ */
+static FLAC__StreamDecoderWriteStatus flac_write(
+    const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame,
+    const FLAC__int32 *const buffer[], void *client_data) {
+  replay_t *r = (replay_t *)client_data;
+  uint32_t i, c;
+
+  // interleave like the target does, the result isn't used
+  for (i = 0; (i < frame->header.blocksize) && (i < MAX_DECODED_FRAMES); i++) {
+    for (c = 0; (c < frame->header.channels) && (c < 2); c++) {
+      r->pcm[2 * i + c] = (int16_t)buffer[c][i];
+    }
+  }
+
+  r->flacFrames += frame->header.blocksize;
+
+  return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+/**
+ *
+ */
+static void flac_metadata(const FLAC__StreamDecoder *decoder,
+                          const FLAC__StreamMetadata *metadata,
+                          void *client_data) {
+  replay_t *r = (replay_t *)client_data;
+
+  if (metadata->type == FLAC__METADATA_TYPE_STREAMINFO) {
+    r->sr = metadata->data.stream_info.sample_rate;
+    r->ch = metadata->data.stream_info.channels;
+    r->bits = metadata->data.stream_info.bits_per_sample;
+  }
+}
+
+/**
+ *
+ */
+static void flac_error(const FLAC__StreamDecoder *decoder,
+                       FLAC__StreamDecoderErrorStatus status,
+                       void *client_data) {
+  replay_t *r = (replay_t *)client_data;
+
+  r->decodeErrors++;
+}
+#endif
+
+/**
+ *
+ */
+static void decoders_free(replay_t *r) {
+#if HAVE_FLAC
+  if (r->flac != NULL) {
+    FLAC__stream_decoder_delete(r->flac);
+    r->flac = NULL;
+  }
+#endif
+#if HAVE_OPUS
+  if (r->opus != NULL) {
+    opus_decoder_destroy(r->opus);
+    r->opus = NULL;
+  }
+#endif
+}
+
+/**
+ * Decode a complete chunk.
+ *
+ * @return decoded frames, 0 if the chunk wasn't decoded
+ */
+static uint32_t decode_chunk(replay_t *r, const char *data, uint32_t size) {
+  switch (r->codec) {
+    case PCM: {
+      const uint32_t *src = (const uint32_t *)data;
+      uint32_t *dst = (uint32_t *)r->pcm;
+      uint32_t frameSize = r->ch * r->bits / 8;
+      uint32_t i;
+
+      if (frameSize == 0) {
+        return 0;
+      }
+
+      // channel swap copy like the 16bit stereo pcm path
+      for (i = 0; (i < size / 4) && (i < MAX_DECODED_FRAMES); i++) {
+        dst[i] = (src[i] << 16) | (src[i] >> 16);
+      }
+
+      return size / frameSize;
+    }
+
+#if HAVE_FLAC
+    case FLAC: {
+      if (r->flac == NULL) {
+        return 0;
+      }
+
+      r->flacIn = data;
+      r->flacInLen = size;
+      r->flacFrames = 0;
+
+      while (r->flacInLen > 0) {
+        if (FLAC__stream_decoder_process_single(r->flac) == false) {
+          r->decodeErrors++;
+          FLAC__stream_decoder_flush(r->flac);
+
+          break;
+        }
+      }
+
+      return r->flacFrames;
+    }
+#endif
+
+#if HAVE_OPUS
+    case OPUS: {
+      int frames;
+
+      if (r->opus == NULL) {
+        return 0;
+      }
+
+      frames = opus_decode(r->opus, (const unsigned char *)data, size, r->pcm,
+                           MAX_DECODED_FRAMES, 0);
+      if (frames < 0) {
+        r->decodeErrors++;
+
+        return 0;
+      }
+
+      return frames;
+    }
+#endif
+
+    default:
+      return 0;
+  }
+}
+
+/**
+ *
+ */
+static int connected_cb(void *arg) {
+  replay_t *r = (replay_t *)arg;
+
+  decoders_free(r);
+
+  r->codec = NONE;
+  r->decodeAhead = false;
+  r->sr = 0;
+  r->ch = 0;
+  r->bits = 0;
+  r->buf_us = 0;
+
+  return 0;
+}
+
+/**
+ *
+ */
+static int codec_header_cb(void *arg, const codec_header_message_t *msg) {
+  replay_t *r = (replay_t *)arg;
+  const uint8_t *p = (const uint8_t *)msg->payload;
+
+  decoders_free(r);
+
+  if (strcmp(msg->codec, "pcm") == 0) {
+    r->codec = PCM;
+    if (msg->size >= 36) {
+      r->ch = p[22];
+      r->sr = p[24] | (p[25] << 8) | (p[26] << 16) | ((uint32_t)p[27] << 24);
+      r->bits = p[34];
+    }
+  } else if (strcmp(msg->codec, "opus") == 0) {
+    r->codec = OPUS;
+    if (msg->size >= 12) {
+      r->sr = p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32_t)p[7] << 24);
+      r->bits = p[8];
+      r->ch = p[10];
+    }
+#if HAVE_OPUS
+    int err;
+
+    r->opus = opus_decoder_create(r->sr, r->ch, &err);
+    if (err != OPUS_OK) {
+      fprintf(stderr, "couldn't create opus decoder: %d\n", err);
+      r->opus = NULL;
+    }
+#endif
+  } else if (strcmp(msg->codec, "flac") == 0) {
+    r->codec = FLAC;
+    // STREAMINFO follows "fLaC" and the metadata block header
+    if ((msg->size >= 22) && (memcmp(p, "fLaC", 4) == 0)) {
+      r->sr = (p[18] << 12) | (p[19] << 4) | (p[20] >> 4);
+      r->ch = ((p[20] >> 1) & 0x07) + 1;
+      r->bits = (((p[20] & 0x01) << 4) | (p[21] >> 4)) + 1;
+    }
+#if HAVE_FLAC
+    r->flac = FLAC__stream_decoder_new();
+    if ((r->flac == NULL) ||
+        (FLAC__stream_decoder_init_stream(
+             r->flac, flac_read, NULL, NULL, NULL, NULL, flac_write,
+             flac_metadata, flac_error,
+             r) != FLAC__STREAM_DECODER_INIT_STATUS_OK)) {
+      fprintf(stderr, "couldn't create flac decoder\n");
+      decoders_free(r);
+    } else {
+      r->flacIn = msg->payload;
+      r->flacInLen = msg->size;
+      FLAC__stream_decoder_process_until_end_of_metadata(r->flac);
+    }
+#endif
+  } else {
+    fprintf(stderr, "codec %s not supported\n", msg->codec);
+  }
+
+  // pcm is always buffered decoded
+  r->decodeAhead = r->compressed && (r->codec != PCM) && (r->codec != NONE);
+  r->decoded = r->chunkCnt;
+
+  printf("  codec %s %u:%u:%u\n", msg->codec, r->sr, r->bits, r->ch);
+
+  return 0;
+}
+
+/**
+ *
+ */
+static int server_settings_cb(void *arg,
+                              const server_settings_message_t *msg) {
+  replay_t *r = (replay_t *)arg;
+
+  r->buf_us = (int64_t)msg->buffer_ms * 1000;
+  r->dacLatency_us = (int64_t)msg->latency * 1000;
+
+  return 0;
+}
+
+/**
+ *
+ */
+static int wire_chunk_cb(void *arg, const snapcast_frame_t *frame) {
+  replay_t *r = (replay_t *)arg;
+  replay_chunk_t *c;
+  int64_t t0;
+  uint32_t frames;
+
+  if (frame->event == SNAPCAST_FRAMER_MESSAGE) {
+    if (frame->total > r->chunkBufSize) {
+      r->chunkBuf = realloc(r->chunkBuf, frame->total);
+      r->chunkBufSize = frame->total;
+    }
+
+    return (r->chunkBuf == NULL) ? -1 : 0;
+  }
+
+  memcpy(&r->chunkBuf[frame->offset], frame->data, frame->len);
+  if (frame->complete == false) {
+    return 0;
+  }
+
+  if (r->chunkCnt == r->chunkCap) {
+    r->chunkCap = r->chunkCap ? 2 * r->chunkCap : 4096;
+    r->chunks = realloc(r->chunks, r->chunkCap * sizeof(replay_chunk_t));
+    r->decodeNs = realloc(r->decodeNs, r->chunkCap * sizeof(int64_t));
+    if ((r->chunks == NULL) || (r->decodeNs == NULL)) {
+      return -1;
+    }
+  }
+
+  c = &r->chunks[r->chunkCnt];
+  c->ts = (int64_t)frame->wire_chunk.timestamp.sec * 1000000LL +
+          frame->wire_chunk.timestamp.usec;
+  c->rx = r->now;
+  c->size = frame->total;
+
+  t0 = host_now_ns();
+  frames = decode_chunk(r, r->chunkBuf, frame->total);
+  c->decode = host_now_ns() - t0;
+
+  c->dur = 0;
+  if ((frames > 0) && (r->sr > 0)) {
+    c->dur = (int64_t)frames * 1000000LL / r->sr;
+    if (r->codec != PCM) {
+      r->decodeNs[r->decodeCnt++] = c->decode;
+    }
+  }
+
+  if (r->codec == PCM) {
+    r->decodeNs[r->decodeCnt++] = c->decode;
+  }
+
+  if (r->decodeAhead) {
+    // waits encoded until decode_ahead() gets to it
+    c->ready = INT64_MAX;
+    r->chunkCnt++;
+
+    r->encodedSize += c->size + ENCODED_CHUNK_OVERHEAD;
+    decode_ahead(r, c->rx);
+    if (r->encodedSize > r->encodedPeak) {
+      r->encodedPeak = r->encodedSize;
+      r->encodedPeakChunks = r->chunkCnt - r->decoded;
+    }
+  } else {
+    // single decoder, it starts on a chunk when it is done with the last one
+    c->ready = c->rx;
+    if ((r->chunkCnt > 0) && (c->ready < r->chunks[r->chunkCnt - 1].ready)) {
+      c->ready = r->chunks[r->chunkCnt - 1].ready;
+    }
+
+    c->ready += llround(c->decode * r->decodeScale / 1000.0);
+
+    r->chunkCnt++;
+  }
+
+  if ((r->chkDur_us == 0) && (r->buf_us > 0)) {
+    int64_t dur = c->dur;
+
+    if ((dur == 0) && (r->chunkCnt > 1)) {
+      dur = chunk_duration(r, r->chunkCnt - 2);
+    }
+
+    if (dur > 0) {
+      r->chkDur_us = dur;
+      r->queueEntries =
+          (int)((r->buf_us + dur - 1) / dur) - CHNK_CTRL_CNT;
+      if (r->decodeAhead && (r->queueEntries > PLAYER_DECODE_LEAD)) {
+        r->queueEntries = PLAYER_DECODE_LEAD;
+      }
+    }
+  }
+
+  if (r->decodeAhead) {
+    // the network task blocks on a full decoder queue
+    if (r->chunkCnt - r->decoded > COMPRESSED_BUFFER_CHUNKS) {
+      r->queueFull++;
+    }
+  } else if ((r->queueEntries > 0) &&
+             (r->chunkCnt - r->next > (size_t)r->queueEntries)) {
+    r->queueFull++;
+  }
+
+  return 0;
+}
+
+/**
+ *
+ */
+static int time_cb(void *arg, int64_t diffToServer, int64_t rtt,
+                   int64_t now) {
+  replay_t *r = (replay_t *)arg;
+
+  // see time_cb() in main.c
+  if (now - r->lastTimeSync > 60000000LL) {
+    snapcast_clock_init(&r->clock);
+  }
+
+  snapcast_clock_insert(&r->clock, now, diffToServer, rtt);
+  r->lastTimeSync = now;
+  r->timeMessages++;
+
+  return 0;
+}
+
+/**
+ *
+ */
+static int replay_connect(void *ctx) { return 0; }
+
+/**
+ *
+ */
+static int replay_send(void *ctx, const char *data, size_t len) { return 0; }
+
+/**
+ * Hand out the next record of the current session, the session ends at the
+ * next session header or at the end of the capture.
+ */
+static int replay_recv(void *ctx, const char **data, size_t *len) {
+  replay_t *r = (replay_t *)ctx;
+  int64_t t;
+  uint32_t n;
+
+  if ((r->pos + SNAPCAST_CAPTURE_RECORD_HEADER_SIZE > r->size) ||
+      ((r->pos + SNAPCAST_CAPTURE_SESSION_HEADER_SIZE <= r->size) &&
+       snapcast_capture_is_session_header(&r->data[r->pos]))) {
+    return -1;
+  }
+
+  snapcast_capture_record_parse(&r->data[r->pos], &t, &n);
+  if (r->pos + SNAPCAST_CAPTURE_RECORD_HEADER_SIZE + n > r->size) {
+    fprintf(stderr, "truncated record at %zu\n", r->pos);
+    r->pos = r->size;
+
+    return -1;
+  }
+
+  if (r->captureStart == 0) {
+    r->captureStart = t;
+    r->realStart = host_now();
+  }
+
+  // let the player run up to the arrival of this record
+  player_advance(r, t);
+
+  if (r->realtime) {
+    int64_t wait = (t - r->captureStart) - (host_now() - r->realStart);
+
+    if (wait > 0) {
+      usleep(wait);
+    }
+  }
+
+  r->now = t;
+  *data = &r->data[r->pos + SNAPCAST_CAPTURE_RECORD_HEADER_SIZE];
+  *len = n;
+  r->pos += SNAPCAST_CAPTURE_RECORD_HEADER_SIZE + n;
+
+  return 1;
+}
+
+/**
+ *
+ */
+static void replay_close(void *ctx) {}
+
+/**
+ *
+ */
+static int compare_int64(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ *
+ */
+static void replay_report(replay_t *r) {
+  double seconds = (r->now - r->captureStart) / 1e6;
+
+  printf("  %.3fs, %zu chunks, %u time messages, diff to server %lldus\n",
+         seconds, r->chunkCnt, r->timeMessages, (long long)r->diffToServer);
+
+  if (r->decodeCnt > 0) {
+    int64_t decodeSum = 0;
+    size_t i;
+
+    for (i = 0; i < r->decodeCnt; i++) {
+      decodeSum += r->decodeNs[i];
+    }
+
+    qsort(r->decodeNs, r->decodeCnt, sizeof(int64_t), compare_int64);
+    printf("  decode: median %.1fus, p99 %.1fus, max %.1fus, cpu %.2f%%, "
+           "errors %u\n",
+           r->decodeNs[r->decodeCnt / 2] / 1000.0,
+           r->decodeNs[r->decodeCnt * 99 / 100] / 1000.0,
+           r->decodeNs[r->decodeCnt - 1] / 1000.0,
+           (seconds > 0) ? decodeSum / (seconds * 1e7) : 0,
+           r->decodeErrors);
+  } else {
+    printf("  decode: not decoded, durations from timestamps\n");
+  }
+
+  printf("  queue: %d entries, avg depth %.1f, max depth %d, full %u times\n",
+         r->queueEntries, r->depthCnt ? r->depthSum / r->depthCnt : 0,
+         r->maxDepth, r->queueFull);
+  if (r->chunkCnt > 0) {
+    int64_t *latency = malloc(r->chunkCnt * sizeof(int64_t));
+    size_t i, n = 0;
+
+    for (i = 0; (latency != NULL) && (i < r->chunkCnt); i++) {
+      if (r->chunks[i].ready != INT64_MAX) {
+        latency[n++] = r->chunks[i].ready - r->chunks[i].rx;
+      }
+    }
+
+    if (n > 0) {
+      qsort(latency, n, sizeof(int64_t), compare_int64);
+      printf("  received to decoded: median %lldus, p99 %lldus, max %lldus\n",
+             (long long)latency[n / 2], (long long)latency[n * 99 / 100],
+             (long long)latency[n - 1]);
+    }
+
+    free(latency);
+  }
+
+  if ((r->queueEntries > 0) && (r->sr > 0)) {
+    int64_t blockSize = (r->chkDur_us * r->sr / 1000000) * r->ch *
+                        (r->bits / 8);
+    int64_t pool = (r->queueEntries + PCM_CHUNK_POOL_EXTRA) * blockSize;
+
+    printf("  memory: pcm pool %d blocks of %lld bytes, encoded peak %lld "
+           "bytes in %zu chunks, %.1fKB %s\n",
+           r->queueEntries + PCM_CHUNK_POOL_EXTRA, (long long)blockSize,
+           (long long)r->encodedPeak, r->encodedPeakChunks,
+           (pool + r->encodedPeak) / 1024.0,
+           r->decodeAhead ? "compressed buffer" : "decoded buffer");
+  }
+
+  printf("  player: %u before time sync, %u syncs, %u played, %u dropped, "
+         "%u hard resync 1, %u hard resync 2, %u underruns\n",
+         r->unsynced, r->events[PLAYER_SYNC], r->events[PLAYER_PLAY],
+         r->events[PLAYER_DROP], r->events[PLAYER_RESYNC_1],
+         r->events[PLAYER_RESYNC_2], r->underruns);
+}
+
+/**
+ *
+ */
+static int replay_session(replay_t *r) {
+  snapcast_transport_t transport = {
+      .ctx = r,
+      .connect = replay_connect,
+      .send = replay_send,
+      .recv = replay_recv,
+      .close = replay_close,
+  };
+  snapcast_client_callbacks_t cb = {
+      .arg = r,
+      .connected = connected_cb,
+      .codec_header = codec_header_cb,
+      .server_settings = server_settings_cb,
+      .wire_chunk = wire_chunk_cb,
+      .time = time_cb,
+  };
+  hello_message_t hello = {
+      .mac = "00:00:00:00:00:00",
+      .hostname = "snapcast_replay",
+      .version = "0.0.2",
+      .client_name = "libsnapcast",
+      .os = "linux",
+      .arch = "host",
+      .instance = 1,
+      .id = "00:00:00:00:00:00",
+      .protocol_version = 2,
+  };
+  snapcast_client_t client;
+
+  current = r;
+
+  r->shortFilter.numNodes = SHORT_BUFFER_LEN;
+  r->shortFilter.medianBuffer = r->shortNodes;
+  r->miniFilter.numNodes = MINI_BUFFER_LEN;
+  r->miniFilter.medianBuffer = r->miniNodes;
+  snapcast_clock_init(&r->clock);
+  MEDIANFILTER_Init(&r->shortFilter);
+  MEDIANFILTER_Init(&r->miniFilter);
+
+  if (snapcast_client_init(&client, &transport, &cb, replay_now) != 0) {
+    return -1;
+  }
+
+  snapcast_client_run(&client, &hello);
+
+  replay_report(r);
+
+  decoders_free(r);
+
+  return 0;
+}
+
+/**
+ *
+ */
+static int replay_file(const char *path, bool realtime, bool compressed,
+                       double decodeScale, FILE *trace) {
+  stream_t capture = {0};
+  replay_t *r;
+  size_t pos = 0;
+  int session = 0;
+
+  if (stream_load(&capture, path) != 0) {
+    return -1;
+  }
+
+  while (pos + SNAPCAST_CAPTURE_SESSION_HEADER_SIZE <= capture.size) {
+    if (!snapcast_capture_is_session_header(&capture.data[pos])) {
+      fprintf(stderr, "%s: no capture session at %zu\n", path, pos);
+      stream_free(&capture);
+
+      return -1;
+    }
+
+    r = calloc(1, sizeof(replay_t));
+    if ((r == NULL) ||
+        ((r->pcm = malloc(MAX_DECODED_FRAMES * 2 * sizeof(int16_t))) ==
+         NULL)) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+
+    r->data = capture.data;
+    r->size = capture.size;
+    r->pos = pos + SNAPCAST_CAPTURE_SESSION_HEADER_SIZE;
+    r->realtime = realtime;
+    r->decodeScale = decodeScale;
+    r->compressed = compressed;
+    r->trace = trace;
+
+    printf("%s session %d:\n", path, session++);
+    replay_session(r);
+
+    pos = r->pos;
+
+    free(r->chunks);
+    free(r->decodeNs);
+    free(r->chunkBuf);
+    free(r->pcm);
+    free(r);
+  }
+
+  stream_free(&capture);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  bool realtime = false;
+  bool compressed = false;
+  double decodeScale = 1.0;
+  FILE *trace = NULL;
+  int files = 0;
+  int ret = 0;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-r") == 0) {
+      realtime = true;
+    } else if (strcmp(argv[i], "-c") == 0) {
+      compressed = true;
+    } else if ((strcmp(argv[i], "-x") == 0) && (i + 1 < argc)) {
+      decodeScale = atof(argv[++i]);
+    } else if ((strcmp(argv[i], "-o") == 0) && (i + 1 < argc)) {
+      trace = fopen(argv[++i], "w");
+      if (trace == NULL) {
+        perror(argv[i]);
+        return 1;
+      }
+
+      fprintf(trace,
+              "chunk,timestamp_us,rx_us,ready_us,player_us,decode_us,"
+              "queue,age_us,diff_us,event\n");
+    } else if (argv[i][0] == '-') {
+      break;
+    } else {
+      ret |= replay_file(argv[i], realtime, compressed, decodeScale, trace);
+      files++;
+    }
+  }
+
+  if ((files == 0) || (i < argc)) {
+    fprintf(stderr,
+            "usage: %s [-r] [-c] [-x factor] [-o trace.csv] capture ...\n",
+            argv[0]);
+    return 1;
+  }
+
+  if (trace) {
+    fclose(trace);
+  }
+
+  return ret ? 1 : 0;
+}
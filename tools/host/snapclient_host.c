@@ -0,0 +1,510 @@
+/* Snapcast client engine running on a linux host
+
+   Runs the same client engine as the ESP32 against a snapserver or against
+   a built in fake server, and reports throughput, CPU time and latency of
+   the whole receive path (socket, framing, dispatch, chunk copy).
+
+   usage: snapclient_host [-h host] [-p port] [-t seconds] [-f] [-r]
+                          [-w capture]
+
+     -h, -p  connect to a snapserver, default is to start a fake server on
+             localhost
+     -t      stream duration, default 60s
+     -f      fake server sends FLAC sized chunks instead of PCM
+     -r      fake server sends in real time instead of as fast as possible
+     -w      write received data to a capture for snapcast_replay
+*/
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "snapcast.h"
+#include "snapcast_capture.h"
+#include "snapcast_client.h"
+#include "snapcast_transport.h"
+#include "test_stream.h"
+
+#define TIME_SYNC_INTERVAL_US 100000
+#define MAX_LATENCY_SAMPLES 100000
+
+typedef struct fake_server {
+  int listenFd;
+  uint16_t port;
+  stream_t stream;
+  bool realtime;
+  pthread_t thread;
+} fake_server_t;
+
+typedef struct host_stats {
+  int64_t start;
+  int64_t end;
+  int64_t durationLimit;
+  int64_t firstChunkTs;  // server timestamp of first chunk
+  int64_t firstChunkRx;  // local receive time of first chunk
+  uint32_t chunks;
+  uint64_t payloadBytes;
+  uint32_t timeMessages;
+  int64_t lastDiffToServer;
+  char *chunkBuf;
+  uint32_t chunkBufSize;
+  uint32_t latencyCnt;
+  int64_t *latency;  // chunk arrival relative to its timestamp
+  FILE *capture;
+} host_stats_t;
+
+/**
+ *
+ */
+static int64_t host_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/**
+ *
+ */
+static int64_t cpu_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+  return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/**
+ *
+ */
+static int send_all(int fd, const char *data, size_t len) {
+  ssize_t n;
+
+  while (len > 0) {
+    n = send(fd, data, len, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return -1;
+    }
+
+    data += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+/**
+ * Answer all pending time requests of the client.
+ */
+static int fake_server_answer(int fd, snapcast_framer_t *framer) {
+  snapcast_frame_t frame;
+  char buf[1024];
+  const char *p;
+  ssize_t n;
+  size_t len, used;
+
+  while ((n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+    p = buf;
+    len = n;
+
+    while (len > 0) {
+      used = snapcast_framer_parse(framer, p, len, &frame);
+      p += used;
+      len -= used;
+
+      if (frame.event == SNAPCAST_FRAMER_ERROR) {
+        return -1;
+      }
+
+      if ((frame.event == SNAPCAST_FRAMER_MESSAGE) &&
+          (frame.base.type == SNAPCAST_MESSAGE_TIME)) {
+        stream_t reply = {0};
+        int64_t now = host_now();
+        int64_t sent = (int64_t)frame.base.sent.sec * 1000000LL +
+                       frame.base.sent.usec;
+        int64_t latency = now - sent;
+
+        stream_put_base(&reply, SNAPCAST_MESSAGE_TIME, 0, frame.base.id, now,
+                        TIME_MESSAGE_SIZE);
+        stream_put_u32(&reply, latency / 1000000);
+        stream_put_u32(&reply, latency % 1000000);
+
+        n = send_all(fd, reply.data, reply.size);
+        stream_free(&reply);
+        if (n < 0) {
+          return -1;
+        }
+      }
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Send the generated stream message by message, answering time requests in
+ * between. In real time mode wire chunks are sent when they are due.
+ */
+static void *fake_server_task(void *arg) {
+  fake_server_t *server = (fake_server_t *)arg;
+  snapcast_framer_t framer;
+  int64_t start = 0;
+  size_t pos = 0;
+  int fd;
+
+  fd = accept(server->listenFd, NULL, NULL);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  snapcast_framer_init(&framer);
+
+  while (pos + BASE_MESSAGE_SIZE <= server->stream.size) {
+    base_message_t base;
+    size_t len;
+
+    base_message_deserialize(&base, &server->stream.data[pos],
+                             BASE_MESSAGE_SIZE);
+    len = BASE_MESSAGE_SIZE + base.size;
+
+    if ((server->realtime) && (base.type == SNAPCAST_MESSAGE_WIRE_CHUNK)) {
+      wire_chunk_message_t wire_chnk;
+      int64_t due;
+
+      wire_chunk_message_deserialize(
+          &wire_chnk, &server->stream.data[pos + BASE_MESSAGE_SIZE],
+          base.size);
+      due = (int64_t)wire_chnk.timestamp.sec * 1000000LL +
+            wire_chnk.timestamp.usec;
+      if (start == 0) {
+        start = host_now() - due;
+      }
+
+      while (host_now() < start + due) {
+        if (fake_server_answer(fd, &framer) < 0) {
+          goto end;
+        }
+
+        usleep(1000);
+      }
+
+      // timestamp in server time like a real server does
+      stream_t ts = {0};
+
+      stream_put_u32(&ts, (start + due) / 1000000);
+      stream_put_u32(&ts, (start + due) % 1000000);
+      memcpy(&server->stream.data[pos + BASE_MESSAGE_SIZE], ts.data, ts.size);
+      stream_free(&ts);
+    }
+
+    if (send_all(fd, &server->stream.data[pos], len) < 0) {
+      break;
+    }
+
+    pos += len;
+
+    if (fake_server_answer(fd, &framer) < 0) {
+      break;
+    }
+  }
+
+end:
+  close(fd);
+
+  return NULL;
+}
+
+/**
+ *
+ */
+static int fake_server_start(fake_server_t *server, bool flac, bool realtime,
+                             uint32_t seconds) {
+  struct sockaddr_in addr;
+  socklen_t addrLen = sizeof(addr);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+
+  server->realtime = realtime;
+  server->listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  if ((server->listenFd < 0) ||
+      (bind(server->listenFd, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+      (listen(server->listenFd, 1) < 0) ||
+      (getsockname(server->listenFd, (struct sockaddr *)&addr, &addrLen) <
+       0)) {
+    perror("fake server");
+    return -1;
+  }
+
+  server->port = ntohs(addr.sin_port);
+
+  test_stream_generate(&server->stream, flac, seconds, 0);
+
+  return pthread_create(&server->thread, NULL, fake_server_task, server);
+}
+
+/**
+ *
+ */
+static int connected_cb(void *arg) {
+  host_stats_t *stats = (host_stats_t *)arg;
+  char hdr[SNAPCAST_CAPTURE_SESSION_HEADER_SIZE];
+
+  if (stats->capture) {
+    snapcast_capture_session_header(hdr);
+    fwrite(hdr, 1, sizeof(hdr), stats->capture);
+  }
+
+  return 0;
+}
+
+/**
+ *
+ */
+static void received_cb(void *arg, const char *data, size_t len,
+                        int64_t now) {
+  host_stats_t *stats = (host_stats_t *)arg;
+  char hdr[SNAPCAST_CAPTURE_RECORD_HEADER_SIZE];
+
+  snapcast_capture_record_header(hdr, now, len);
+  fwrite(hdr, 1, sizeof(hdr), stats->capture);
+  fwrite(data, 1, len, stats->capture);
+}
+
+/**
+ *
+ */
+static int codec_header_cb(void *arg, const codec_header_message_t *msg) {
+  printf("codec: %s, header %u bytes\n", msg->codec, msg->size);
+
+  return 0;
+}
+
+/**
+ *
+ */
+static int server_settings_cb(void *arg,
+                              const server_settings_message_t *msg) {
+  printf("server settings: buffer %dms, latency %dms, volume %u, muted %d\n",
+         msg->buffer_ms, msg->latency, msg->volume, msg->muted);
+
+  return 0;
+}
+
+/**
+ * Copy chunks like the PCM path does to include memory bandwidth.
+ */
+static int wire_chunk_cb(void *arg, const snapcast_frame_t *frame) {
+  host_stats_t *stats = (host_stats_t *)arg;
+
+  if (frame->event == SNAPCAST_FRAMER_MESSAGE) {
+    if (frame->total > stats->chunkBufSize) {
+      stats->chunkBuf = realloc(stats->chunkBuf, frame->total);
+      stats->chunkBufSize = frame->total;
+    }
+
+    return 0;
+  }
+
+  memcpy(&stats->chunkBuf[frame->offset], frame->data, frame->len);
+  stats->payloadBytes += frame->len;
+
+  if (frame->complete) {
+    int64_t now = host_now();
+    int64_t ts = (int64_t)frame->wire_chunk.timestamp.sec * 1000000LL +
+                 frame->wire_chunk.timestamp.usec;
+
+    if (stats->chunks == 0) {
+      stats->firstChunkTs = ts;
+      stats->firstChunkRx = now;
+    }
+
+    if (stats->latencyCnt < MAX_LATENCY_SAMPLES) {
+      stats->latency[stats->latencyCnt++] =
+          (now - stats->firstChunkRx) - (ts - stats->firstChunkTs);
+    }
+
+    stats->chunks++;
+
+    if ((stats->durationLimit > 0) &&
+        (ts - stats->firstChunkTs >= stats->durationLimit)) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ *
+ */
+static int time_cb(void *arg, int64_t diffToServer, int64_t rtt,
+                   int64_t now) {
+  host_stats_t *stats = (host_stats_t *)arg;
+
+  stats->timeMessages++;
+  stats->lastDiffToServer = diffToServer;
+
+  return 0;
+}
+
+/**
+ *
+ */
+static int compare_int64(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+  const char *host = NULL;
+  uint16_t port = 1704;
+  uint32_t seconds = 60;
+  bool flac = false, realtime = false;
+  fake_server_t server = {0};
+  snapcast_transport_t *transport;
+  snapcast_client_t client;
+  host_stats_t stats = {0};
+  hello_message_t hello = {
+      .mac = "00:00:00:00:00:00",
+      .hostname = "snapclient_host",
+      .version = "0.0.2",
+      .client_name = "libsnapcast",
+      .os = "linux",
+      .arch = "host",
+      .instance = 1,
+      .id = "00:00:00:00:00:00",
+      .protocol_version = 2,
+  };
+  snapcast_client_callbacks_t cb = {
+      .arg = &stats,
+      .connected = connected_cb,
+      .codec_header = codec_header_cb,
+      .server_settings = server_settings_cb,
+      .wire_chunk = wire_chunk_cb,
+      .time = time_cb,
+  };
+  int64_t cpuStart, cpuEnd, lastTimeReq = 0;
+  double seconds_run;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-h") == 0) && (i + 1 < argc)) {
+      host = argv[++i];
+    } else if ((strcmp(argv[i], "-p") == 0) && (i + 1 < argc)) {
+      port = atoi(argv[++i]);
+    } else if ((strcmp(argv[i], "-t") == 0) && (i + 1 < argc)) {
+      seconds = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-f") == 0) {
+      flac = true;
+    } else if (strcmp(argv[i], "-r") == 0) {
+      realtime = true;
+    } else if ((strcmp(argv[i], "-w") == 0) && (i + 1 < argc)) {
+      stats.capture = fopen(argv[++i], "wb");
+      if (stats.capture == NULL) {
+        perror(argv[i]);
+        return 1;
+      }
+
+      cb.received = received_cb;
+    } else {
+      fprintf(stderr,
+              "usage: %s [-h host] [-p port] [-t seconds] [-f] [-r] "
+              "[-w capture]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  if (host == NULL) {
+    if (fake_server_start(&server, flac, realtime, seconds) != 0) {
+      return 1;
+    }
+
+    host = "127.0.0.1";
+    port = server.port;
+  } else {
+    stats.durationLimit = (int64_t)seconds * 1000000LL;
+  }
+
+  stats.latency = malloc(MAX_LATENCY_SAMPLES * sizeof(int64_t));
+
+  transport = snapcast_transport_posix_create(host, port);
+  if ((transport == NULL) ||
+      (snapcast_client_init(&client, transport, &cb, host_now) != 0)) {
+    return 1;
+  }
+
+  if (snapcast_client_connect(&client, &hello) != 0) {
+    fprintf(stderr, "couldn't connect to %s:%d\n", host, port);
+    return 1;
+  }
+
+  stats.start = host_now();
+  cpuStart = cpu_now();
+
+  while (snapcast_client_process(&client) == 0) {
+    int64_t now = host_now();
+
+    if (now - lastTimeReq >= TIME_SYNC_INTERVAL_US) {
+      snapcast_client_send_time_request(&client);
+      lastTimeReq = now;
+    }
+  }
+
+  cpuEnd = cpu_now();
+  stats.end = host_now();
+
+  snapcast_client_disconnect(&client);
+
+  if (server.listenFd > 0) {
+    pthread_join(server.thread, NULL);
+    close(server.listenFd);
+    stream_free(&server.stream);
+  }
+
+  seconds_run = (stats.end - stats.start) / 1e6;
+  printf("received %llu bytes, %u messages, %u wire chunks in %.3fs\n",
+         (unsigned long long)client.rxBytes, client.messages, stats.chunks,
+         seconds_run);
+  printf("throughput %.1f MB/s, %.0f chunks/s\n",
+         client.rxBytes / (1024.0 * 1024.0) / seconds_run,
+         stats.chunks / seconds_run);
+  printf("client cpu %.3fs, %.2f us/chunk, %.2f us/MB\n",
+         (cpuEnd - cpuStart) / 1e6,
+         stats.chunks ? (double)(cpuEnd - cpuStart) / stats.chunks : 0,
+         (double)(cpuEnd - cpuStart) /
+             (client.rxBytes / (1024.0 * 1024.0)));
+  printf("time messages %u, last diff to server %lldus\n", stats.timeMessages,
+         (long long)stats.lastDiffToServer);
+
+  if ((realtime || (server.listenFd <= 0)) && (stats.latencyCnt > 0)) {
+    qsort(stats.latency, stats.latencyCnt, sizeof(int64_t), compare_int64);
+    printf("chunk arrival jitter: min %lldus, median %lldus, p99 %lldus, "
+           "max %lldus\n",
+           (long long)stats.latency[0],
+           (long long)stats.latency[stats.latencyCnt / 2],
+           (long long)stats.latency[stats.latencyCnt * 99 / 100],
+           (long long)stats.latency[stats.latencyCnt - 1]);
+  }
+
+  snapcast_transport_posix_destroy(transport);
+  free(stats.latency);
+  if (stats.capture) {
+    fclose(stats.capture);
+  }
+  free(stats.chunkBuf);
+
+  return 0;
+}
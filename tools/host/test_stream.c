@@ -0,0 +1,179 @@
+/* Generated snapcast streams for host benchmarks */
+
+#include "test_stream.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapcast.h"
+#include "snapcast_framer.h"
+
+/**
+ *
+ */
+void stream_put(stream_t *s, const void *data, size_t len) {
+  if (s->size + len > s->capacity) {
+    s->capacity = (s->size + len) * 2;
+    s->data = realloc(s->data, s->capacity);
+    if (s->data == NULL) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+  }
+
+  memcpy(&s->data[s->size], data, len);
+  s->size += len;
+}
+
+/**
+ *
+ */
+void stream_put_u16(stream_t *s, uint16_t v) {
+  uint8_t b[2] = {v & 0xFF, v >> 8};
+
+  stream_put(s, b, sizeof(b));
+}
+
+/**
+ *
+ */
+void stream_put_u32(stream_t *s, uint32_t v) {
+  uint8_t b[4] = {v & 0xFF, (v >> 8) & 0xFF, (v >> 16) & 0xFF, v >> 24};
+
+  stream_put(s, b, sizeof(b));
+}
+
+/**
+ *
+ */
+void stream_put_base(stream_t *s, uint16_t type, uint16_t id,
+                     uint16_t refersTo, uint64_t sent_us, uint32_t size) {
+  stream_put_u16(s, type);
+  stream_put_u16(s, id);
+  stream_put_u16(s, refersTo);
+  stream_put_u32(s, sent_us / 1000000);
+  stream_put_u32(s, sent_us % 1000000);
+  stream_put_u32(s, 0);
+  stream_put_u32(s, 0);
+  stream_put_u32(s, size);
+}
+
+/**
+ *
+ */
+void stream_free(stream_t *s) {
+  free(s->data);
+  s->data = NULL;
+  s->size = 0;
+  s->capacity = 0;
+}
+
+/**
+ *
+ */
+int stream_load(stream_t *s, const char *path) {
+  char buf[4096];
+  size_t n;
+  FILE *f = fopen(path, "rb");
+
+  if (f == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    stream_put(s, buf, n);
+  }
+
+  fclose(f);
+
+  return 0;
+}
+
+/**
+ *
+ */
+void test_stream_generate(stream_t *s, int flac, uint32_t seconds,
+                          int timeMessages) {
+  const char *settings =
+      "{\"bufferMs\":1000,\"latency\":0,\"muted\":false,\"volume\":100}";
+  const char *codec = flac ? "flac" : "pcm";
+  uint8_t header[44] = {0};
+  uint8_t *payload;
+  uint64_t ts = 0;
+  uint32_t chunkSize;
+  uint32_t i, k;
+  uint16_t id = 0;
+  uint16_t channels = 2, bits = 16;
+  uint32_t rate = TEST_STREAM_SAMPLE_RATE;
+
+  payload = malloc(TEST_STREAM_SAMPLE_RATE * 4);
+  if (payload == NULL) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+
+  // the fields the client reads from RIFF and fLaC headers
+  if (flac) {
+    // STREAMINFO block header, sample rate, channels and bits per sample
+    memcpy(header, "fLaC", 4);
+    header[7] = 34;
+    header[18] = rate >> 12;
+    header[19] = rate >> 4;
+    header[20] = ((rate & 0x0F) << 4) | ((channels - 1) << 1) |
+                 ((bits - 1) >> 4);
+    header[21] = ((bits - 1) & 0x0F) << 4;
+  } else {
+    memcpy(header, "RIFF", 4);
+    memcpy(&header[22], &channels, sizeof(channels));
+    memcpy(&header[24], &rate, sizeof(rate));
+    memcpy(&header[34], &bits, sizeof(bits));
+  }
+
+  stream_put_base(s, SNAPCAST_MESSAGE_CODEC_HEADER, id++, 0, 0,
+                  4 + strlen(codec) + 4 + sizeof(header));
+  stream_put_u32(s, strlen(codec));
+  stream_put(s, codec, strlen(codec));
+  stream_put_u32(s, sizeof(header));
+  stream_put(s, header, sizeof(header));
+
+  stream_put_base(s, SNAPCAST_MESSAGE_SERVER_SETTINGS, id++, 0, 0,
+                  4 + strlen(settings));
+  stream_put_u32(s, strlen(settings));
+  stream_put(s, settings, strlen(settings));
+
+  srand(flac ? 2 : 1);
+  for (i = 0; i < seconds * 1000 / TEST_STREAM_CHUNK_MS; i++) {
+    if (flac) {
+      // ~ 55% compression ratio with some variation per chunk
+      chunkSize =
+          TEST_STREAM_SAMPLE_RATE / 1000 * TEST_STREAM_CHUNK_MS * 4 * 55 / 100 +
+          (rand() % 512) - 256;
+    } else {
+      chunkSize = TEST_STREAM_SAMPLE_RATE / 1000 * TEST_STREAM_CHUNK_MS * 4;
+    }
+
+    for (k = 0; k < chunkSize; k++) {
+      payload[k] = rand();
+    }
+
+    stream_put_base(s, SNAPCAST_MESSAGE_WIRE_CHUNK, id++, 0, ts,
+                    WIRE_CHUNK_HEADER_SIZE + chunkSize);
+    stream_put_u32(s, ts / 1000000);
+    stream_put_u32(s, ts % 1000000);
+    stream_put_u32(s, chunkSize);
+    stream_put(s, payload, chunkSize);
+
+    ts += TEST_STREAM_CHUNK_MS * 1000;
+
+    if (timeMessages && ((i % (1000 / TEST_STREAM_CHUNK_MS)) == 0)) {
+      stream_put_base(s, SNAPCAST_MESSAGE_TIME, id++, 0, ts,
+                      TIME_MESSAGE_SIZE);
+      stream_put_u32(s, 0);
+      stream_put_u32(s, 1234);
+    }
+  }
+
+  free(payload);
+}
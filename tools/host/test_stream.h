@@ -0,0 +1,44 @@
+/* Generated snapcast streams for host benchmarks */
+
+#ifndef __TEST_STREAM_H__
+#define __TEST_STREAM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TEST_STREAM_SAMPLE_RATE 48000
+#define TEST_STREAM_CHUNK_MS 20
+
+typedef struct stream {
+  char *data;
+  size_t size;
+  size_t capacity;
+} stream_t;
+
+void stream_put(stream_t *s, const void *data, size_t len);
+void stream_put_u16(stream_t *s, uint16_t v);
+void stream_put_u32(stream_t *s, uint32_t v);
+void stream_put_base(stream_t *s, uint16_t type, uint16_t id,
+                     uint16_t refersTo, uint64_t sent_us, uint32_t size);
+void stream_free(stream_t *s);
+
+/**
+ * Load raw received bytes from a file.
+ *
+ * @return 0 on success, -1 on error
+ */
+int stream_load(stream_t *s, const char *path);
+
+/**
+ * Generate a stream as the server would send it: codec header, server
+ * settings, then 48kHz/16bit/2ch wire chunks.
+ *
+ * @param[in] s The stream to fill.
+ * @param[in] flac Generate variable sized chunks like FLAC does.
+ * @param[in] seconds Stream duration.
+ * @param[in] timeMessages Add a time message answer every second.
+ */
+void test_stream_generate(stream_t *s, int flac, uint32_t seconds,
+                          int timeMessages);
+
+#endif  // __TEST_STREAM_H__